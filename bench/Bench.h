@@ -0,0 +1,325 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+namespace bench {
+
+/**
+ * A minimal Google-Benchmark-like harness.
+ *
+ *  bench::add("math/dot", {{"dim", {64, 784}}}, [](bench::State &state) {
+ *      auto x = ...;                          // setup, not timed
+ *      for (auto _ : state) {                 // timed loop, iteration count picked by runner
+ *          bench::doNotOptimize(stat::dot(x, x));
+ *      }
+ *      state.setItemsProcessed(state.iterations());
+ *  });
+ *
+ * Every combination of the parameter values is a case named `name/key:value/...`. Each case is
+ * calibrated to run at least `--min_time` seconds per repetition and the median over
+ * `--repetitions` is reported. `--json=FILE` writes results in the same schema as Google
+ * Benchmark, `--compare=FILE` diffs against such a baseline. `--filter=STR` selects cases by
+ * substring. stdout of the library is muted while a case runs.
+ *
+ * A case may report the bytes its subject holds, `state.setBytesUsed(model.memoryUsage().total())`.
+ * They are written as "bytes_used" and compared like the time, a memory regression shows up next
+ * to a slowdown.
+ */
+
+template <typename T>
+inline void doNotOptimize(T const &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+inline void clobberMemory() { asm volatile("" : : : "memory"); }
+
+using Params = std::vector<std::pair<std::string, std::vector<int64_t>>>;
+
+class State {
+public:
+    State(std::map<std::string, int64_t> _args, uint64_t _iterations)
+        : args(std::move(_args)), total(_iterations), items(0), elapsed(0) {}
+
+    int64_t operator[](const std::string &key) const {
+        auto it = args.find(key);
+        return it == args.end() ? 0 : it->second;
+    }
+
+    uint64_t iterations() const { return total; }
+    void setItemsProcessed(uint64_t n) { items = n; }
+    uint64_t itemsProcessed() const { return items; }
+    void setBytesUsed(uint64_t n) { bytes = n; }
+    uint64_t bytesUsed() const { return bytes; }
+    double seconds() const { return elapsed; }
+
+    // the loop variable of `for (auto _ : state)`, never used
+    struct [[maybe_unused]] Value {};
+
+    struct Iterator {
+        State *state;
+        uint64_t left;
+        bool operator!=(const Iterator &) const {
+            if (left > 0) return true;
+            state->stop();
+            return false;
+        }
+        void operator++() { --left; }
+        Value operator*() const { return {}; }
+    };
+
+    Iterator begin() {
+        start = Clock::now();
+        return {this, total};
+    }
+    Iterator end() { return {this, 0}; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    std::map<std::string, int64_t> args;
+    uint64_t total;
+    uint64_t items;
+    uint64_t bytes = 0;
+    double elapsed;
+    Clock::time_point start;
+
+    void stop() { elapsed = std::chrono::duration<double>(Clock::now() - start).count(); }
+};
+
+struct Case {
+    std::string name;
+    std::map<std::string, int64_t> args;
+    std::function<void(State &)> fn;
+};
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double ns;           // median time per iteration
+    double stddev;       // over repetitions, ns
+    double itemsPerSec;  // 0 if the case reports no items
+    uint64_t bytesUsed;  // 0 if the case reports none
+};
+
+// time and memory of a case in a --json file
+struct Baseline {
+    double ns = 0.0;
+    double bytes = 0.0;
+};
+
+inline std::vector<Case> &registry() {
+    static std::vector<Case> cases;
+    return cases;
+}
+
+inline void add(const std::string &name, const Params &params, std::function<void(State &)> fn) {
+    // expand the cartesian product of all parameter values
+    std::vector<std::map<std::string, int64_t>> combos(1);
+    std::vector<std::string> suffixes(1);
+    for (const auto &p : params) {
+        std::vector<std::map<std::string, int64_t>> nextCombos;
+        std::vector<std::string> nextSuffixes;
+        for (std::size_t i = 0; i < combos.size(); ++i) {
+            for (auto v : p.second) {
+                auto c = combos[i];
+                c[p.first] = v;
+                nextCombos.emplace_back(std::move(c));
+                nextSuffixes.emplace_back(suffixes[i] + "/" + p.first + ":" + std::to_string(v));
+            }
+        }
+        combos.swap(nextCombos);
+        suffixes.swap(nextSuffixes);
+    }
+    for (std::size_t i = 0; i < combos.size(); ++i) {
+        registry().push_back({name + suffixes[i], combos[i], fn});
+    }
+}
+
+// silences stdout of the library code under benchmark
+class Mute {
+public:
+    Mute() {
+        fflush(stdout);
+        saved = ::dup(STDOUT_FILENO);
+        auto devnull = std::fopen("/dev/null", "w");
+        if (devnull) {
+            ::dup2(::fileno(devnull), STDOUT_FILENO);
+            std::fclose(devnull);
+        }
+    }
+    ~Mute() {
+        fflush(stdout);
+        ::dup2(saved, STDOUT_FILENO);
+        ::close(saved);
+    }
+
+private:
+    int saved;
+};
+
+inline Result runCase(const Case &c, double minTime, uint32_t repetitions) {
+    auto once = [&c](uint64_t iterations) {
+        State state(c.args, iterations);
+        {
+            Mute mute;
+            c.fn(state);
+        }
+        return state;
+    };
+    // calibrate, grow iterations until one run takes at least minTime
+    uint64_t iterations = 1;
+    auto state = once(iterations);
+    while (state.seconds() < minTime && iterations < (1ull << 40)) {
+        double scale = state.seconds() > 0 ? minTime / state.seconds() * 1.4 : 10.0;
+        iterations = std::max<uint64_t>(iterations + 1, iterations * std::min(scale, 10.0));
+        state = once(iterations);
+    }
+    std::vector<double> ns{state.seconds() * 1e9 / iterations};
+    std::vector<double> items{static_cast<double>(state.itemsProcessed()) / state.seconds()};
+    for (uint32_t r = 1; r < repetitions; ++r) {
+        state = once(iterations);
+        ns.push_back(state.seconds() * 1e9 / iterations);
+        items.push_back(static_cast<double>(state.itemsProcessed()) / state.seconds());
+    }
+    double mean = 0.0, var = 0.0;
+    for (auto v : ns) mean += v / ns.size();
+    for (auto v : ns) var += (v - mean) * (v - mean) / ns.size();
+    auto median = [](std::vector<double> v) {
+        std::sort(v.begin(), v.end());
+        return v[v.size() / 2];
+    };
+    return {c.name, iterations, median(ns), std::sqrt(var), median(items), state.bytesUsed()};
+}
+
+// reads (name, real_time, bytes_used) back from a --json output file
+inline std::map<std::string, Baseline> readBaseline(const char *filename) {
+    std::map<std::string, Baseline> baseline;
+    std::ifstream fin(filename);
+    if (!fin.is_open()) {
+        printf("ERROR: failed to load baseline from (%s)\n", filename);
+        return baseline;
+    }
+    std::stringstream ss;
+    ss << fin.rdbuf();
+    auto text = ss.str();
+    const std::string nameKey = "\"name\": \"", timeKey = "\"real_time\": ",
+                      bytesKey = "\"bytes_used\": ";
+    for (auto pos = text.find(nameKey); pos != std::string::npos; pos = text.find(nameKey, pos)) {
+        pos += nameKey.size();
+        auto name = text.substr(pos, text.find('"', pos) - pos);
+        auto t = text.find(timeKey, pos);
+        if (t == std::string::npos) break;
+        baseline[name].ns = std::atof(text.c_str() + t + timeKey.size());
+        auto b = text.find(bytesKey, pos);
+        if (b < text.find('}', pos)) baseline[name].bytes = std::atof(text.c_str() + b + bytesKey.size());
+    }
+    return baseline;
+}
+
+inline bool writeJson(const char *filename, const std::vector<Result> &results) {
+    FILE *fp = std::fopen(filename, "w");
+    if (!fp) {
+        printf("ERROR: failed to open (%s) for writing\n", filename);
+        return false;
+    }
+    char date[64];
+    auto t = std::time(nullptr);
+    std::strftime(date, sizeof date, "%Y-%m-%dT%H:%M:%S", std::localtime(&t));
+    fprintf(fp, "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"num_cpus\": %u\n  },\n", date,
+            std::thread::hardware_concurrency());
+    fprintf(fp, "  \"benchmarks\": [");
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const auto &r = results[i];
+        fprintf(fp,
+                "%s\n    {\"name\": \"%s\", \"run_name\": \"%s\", \"iterations\": %llu, "
+                "\"real_time\": %.3f, \"stddev\": %.3f, \"time_unit\": \"ns\"",
+                i ? "," : "", r.name.c_str(), r.name.c_str(),
+                static_cast<unsigned long long>(r.iterations), r.ns, r.stddev);
+        if (r.itemsPerSec > 0) fprintf(fp, ", \"items_per_second\": %.3f", r.itemsPerSec);
+        if (r.bytesUsed > 0) {
+            fprintf(fp, ", \"bytes_used\": %llu", static_cast<unsigned long long>(r.bytesUsed));
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    return std::fclose(fp) == 0;
+}
+
+inline int main(int argc, char **argv) {
+    double minTime = 0.2;
+    uint32_t repetitions = 3;
+    std::string filter, json, compare;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&arg](const char *key) -> const char * {
+            auto len = std::strlen(key);
+            return arg.compare(0, len, key) == 0 ? arg.c_str() + len : nullptr;
+        };
+        if (auto v = value("--min_time=")) {
+            minTime = std::atof(v);
+        } else if (auto v = value("--repetitions=")) {
+            repetitions = std::max(1, std::atoi(v));
+        } else if (auto v = value("--filter=")) {
+            filter = v;
+        } else if (auto v = value("--json=")) {
+            json = v;
+        } else if (auto v = value("--compare=")) {
+            compare = v;
+        } else if (arg == "--list") {
+            for (const auto &c : registry()) printf("%s\n", c.name.c_str());
+            return 0;
+        } else {
+            printf("usage: %s [--filter=STR] [--min_time=SEC] [--repetitions=N] [--json=FILE] "
+                   "[--compare=FILE] [--list]\n",
+                   argv[0]);
+            return 1;
+        }
+    }
+
+    std::map<std::string, Baseline> baseline;
+    if (!compare.empty()) baseline = readBaseline(compare.c_str());
+    printf("%-56s %14s %12s %14s %12s %9s\n", "Benchmark", "Time(ns)", "Iterations", "Items/s",
+           "Bytes", baseline.empty() ? "" : "vs base");
+    printf("%s\n", std::string(122, '-').c_str());
+    std::vector<Result> results;
+    for (const auto &c : registry()) {
+        if (!filter.empty() && c.name.find(filter) == std::string::npos) continue;
+        auto r = runCase(c, minTime, repetitions);
+        printf("%-56s %14.1f %12llu %14.4g %12s", r.name.c_str(), r.ns,
+               static_cast<unsigned long long>(r.iterations), r.itemsPerSec,
+               r.bytesUsed ? std::to_string(r.bytesUsed).c_str() : "");
+        auto base = baseline.find(r.name);
+        if (base != baseline.end() && base->second.ns > 0) {
+            printf(" %+8.1f%%", (r.ns / base->second.ns - 1.0) * 100.0);
+        }
+        if (base != baseline.end() && base->second.bytes > 0 && r.bytesUsed > 0) {
+            printf(" mem %+.1f%%", (r.bytesUsed / base->second.bytes - 1.0) * 100.0);
+        }
+        printf("\n");
+        fflush(stdout);
+        results.push_back(r);
+    }
+    if (!json.empty() && !writeJson(json.c_str(), results)) return 1;
+    return 0;
+}
+
+}  // namespace bench
+
+#endif  // __BENCH_H__
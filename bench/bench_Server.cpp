@@ -0,0 +1,212 @@
+#include "Server.h"
+#include "Stat.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Closed-loop load generator of stat::Server. `--clients` threads each keep `--inflight` requests
+ * outstanding for `--seconds`, sending the rows of the test set round robin, once calling the model
+ * directly per row and once through the micro-batching server. Reports QPS and p50/p99/max latency
+ * of both. Run from the repository root, the data sets are read from data/:
+ *
+ *  ./out/bench_Server                                   # iris and mnist, a decision tree each
+ *  ./out/bench_Server --data=mnist --model=adaboost --clients=32 --max_batch=64
+ *  ./out/bench_Server --slo_us=500                      # batching wait capped by a latency target
+ *
+ * Without the mnist images (data/mnist holds the labels only) a synthetic set of the same shape is
+ * served instead.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string data = "all";
+    std::string model = "decision_tree";
+    uint32_t clients = 16;
+    uint32_t inflight = 1;
+    double seconds = 2.0;
+    stat::ServerParam server;
+};
+
+struct Report {
+    uint64_t requests = 0;
+    double qps = 0.0;
+    double p50 = 0.0, p99 = 0.0, max = 0.0;  // us
+};
+
+double percentile(std::vector<double> &sorted, double q) {
+    if (sorted.empty()) return 0.0;
+    auto i = std::min<size_t>(sorted.size() - 1, size_t(q * sorted.size()));
+    return sorted[i];
+}
+
+/**
+ * `call(row)` returns a future of the label of a row. every client thread submits `inflight` rows,
+ * then waits for the oldest and submits the next, until time is up
+ */
+template <typename Call>
+Report drive(const stat::Data<float> &X, const Options &opt, Call &&call) {
+    std::atomic<bool> stop{false};
+    std::vector<std::vector<double>> latencies(opt.clients);
+    std::vector<std::thread> clients;
+    auto start = Clock::now();
+    for (uint32_t c = 0; c < opt.clients; ++c) {
+        clients.emplace_back([&, c] {
+            struct Pending {
+                std::future<float> label;
+                Clock::time_point sent;
+            };
+            std::vector<Pending> window(opt.inflight);
+            uint32_t row = c % X.m;
+            auto send = [&](Pending &p) {
+                p.sent = Clock::now();
+                p.label = call(X.data[row]);
+                row = (row + opt.clients) % X.m;
+            };
+            for (auto &p : window) send(p);
+            for (uint32_t slot = 0; !stop.load(std::memory_order_relaxed);
+                 slot = (slot + 1) % opt.inflight) {
+                window[slot].label.get();
+                latencies[c].push_back(
+                    std::chrono::duration<double, std::micro>(Clock::now() - window[slot].sent)
+                        .count());
+                send(window[slot]);
+            }
+            for (auto &p : window) p.label.get();
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(opt.seconds));
+    stop.store(true);
+    for (auto &client : clients) client.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<double> all;
+    for (auto &l : latencies) all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+    Report r;
+    r.requests = all.size();
+    r.qps = all.size() / elapsed;
+    r.p50 = percentile(all, 0.50);
+    r.p99 = percentile(all, 0.99);
+    r.max = all.empty() ? 0.0 : all.back();
+    return r;
+}
+
+void print(const char *name, const Report &r) {
+    printf("%-10s %12llu %12.0f %10.1f %10.1f %10.1f\n", name,
+           static_cast<unsigned long long>(r.requests), r.qps, r.p50, r.p99, r.max);
+}
+
+void serve(const char *name, const stat::Data<float> &trainX, const stat::Data<float> &trainY,
+           const stat::Data<float> &testX, const Options &opt) {
+    static const std::map<std::string, stat::ModelType> kModels = {
+        {"decision_tree", stat::MODEL_DECISION_TREE},
+        {"adaboost", stat::MODEL_ADA_BOOST},
+        {"knn", stat::MODEL_KNN},
+        {"naive_bayes", stat::MODEL_NAIVE_BAYES},
+        {"logistic_regression", stat::MODEL_LOGISTIC_REGRESSION},
+    };
+    auto type = kModels.find(opt.model);
+    auto config = type == kModels.end() ? std::nullopt : stat::ParseModelConfig(type->second);
+    if (!config) {
+        printf("ERROR: unknown model %s\n", opt.model.c_str());
+        return;
+    }
+    stat::AnyModel<float, float> model(*config);
+    model.train(trainX, trainY);
+
+    printf("\n%s: %s on %u x %u, %u clients x %u in flight, batch <= %u, wait <= %u us", name,
+           opt.model.c_str(), testX.m, testX.n, opt.clients, opt.inflight, opt.server.maxBatch,
+           opt.server.maxWaitUs);
+    if (opt.server.sloUs) printf(", slo %u us", opt.server.sloUs);
+    printf("\n%-10s %12s %12s %10s %10s %10s\n", "mode", "requests", "QPS", "p50(us)", "p99(us)",
+           "max(us)");
+
+    // the caller's own thread runs the model, the future is ready on return
+    auto direct = drive(testX, opt, [&](const stat::Vec<float> &row) {
+        std::promise<float> label;
+        label.set_value(model.predict(row));
+        return label.get_future();
+    });
+    print("direct", direct);
+
+    stat::Server<float, float> server(model, opt.server);
+    auto batched = drive(testX, opt, [&](const stat::Vec<float> &row) { return server.submit(row); });
+    print("batched", batched);
+    auto stats = server.stats();
+    printf("%llu batches, %.1f rows per batch, %.1f us per batch\n",
+           static_cast<unsigned long long>(stats.batches),
+           stats.batches ? double(stats.requests) / stats.batches : 0.0, stats.serviceUs);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&arg](const char *key) -> const char * {
+            auto len = std::strlen(key);
+            return arg.compare(0, len, key) == 0 ? arg.c_str() + len : nullptr;
+        };
+        if (auto v = value("--data=")) {
+            opt.data = v;
+        } else if (auto v = value("--model=")) {
+            opt.model = v;
+        } else if (auto v = value("--clients=")) {
+            opt.clients = std::max(1, std::atoi(v));
+        } else if (auto v = value("--inflight=")) {
+            opt.inflight = std::max(1, std::atoi(v));
+        } else if (auto v = value("--seconds=")) {
+            opt.seconds = std::atof(v);
+        } else if (auto v = value("--max_batch=")) {
+            opt.server.maxBatch = std::max(1, std::atoi(v));
+        } else if (auto v = value("--max_wait_us=")) {
+            opt.server.maxWaitUs = std::max(0, std::atoi(v));
+        } else if (auto v = value("--slo_us=")) {
+            opt.server.sloUs = std::max(0, std::atoi(v));
+        } else {
+            printf("usage: %s [--data=iris|mnist|all] [--model=decision_tree|adaboost|knn|"
+                   "naive_bayes|logistic_regression] [--clients=N] [--inflight=N] [--seconds=SEC] "
+                   "[--max_batch=N] [--max_wait_us=US] [--slo_us=US]\n",
+                   argv[0]);
+            return 1;
+        }
+    }
+
+    if (opt.data == "all" || opt.data == "iris") {
+        auto [trainX, trainY] = stat::iris::loadTrainSet<float>();
+        auto [testX, testY] = stat::iris::loadTestSet<float>();
+        if (trainX.m && testX.m) serve("iris", trainX, trainY, testX, opt);
+    }
+    if (opt.data == "all" || opt.data == "mnist") {
+        auto [trainX, trainY] = stat::mnist::loadTrainSet<float>();
+        auto [testX, testY] = stat::mnist::loadTestSet<float>();
+        if (trainX.m && testX.m) {
+            serve("mnist", trainX, trainY, testX, opt);
+        } else {
+            printf("INFO: mnist images missing, serving synthetic 28x28 blobs instead\n");
+            auto [X, Y] = stat::synthetic::makeBlobs<float>(12000, 784, 10, 1, 0.5);
+            stat::Data<float> synTrainX{stat::Mat<float>(X.data.begin(), X.data.begin() + 10000),
+                                        10000, 784};
+            stat::Data<float> synTrainY{stat::Mat<float>(Y.data.begin(), Y.data.begin() + 10000),
+                                        10000, 1};
+            stat::Data<float> synTestX{stat::Mat<float>(X.data.begin() + 10000, X.data.end()),
+                                       2000, 784};
+            serve("mnist", synTrainX, synTrainY, synTestX, opt);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,831 @@
+#include "Bench.h"
+#include "Memory.h"
+#include "ModelSelection.h"
+#include "Parallel.h"
+#include "Stat.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+
+/**
+ * Benchmark suite of the math kernels, loaders and models. All cases run on synthetic data, no
+ * dataset file is needed. Typical use:
+ *
+ *  ./out/bench_Stat --json=baseline.json          # record a baseline
+ *  ./out/bench_Stat --compare=baseline.json       # later, diff against it
+ *  ./out/bench_Stat --filter=knn/                 # a subset only
+ */
+
+namespace {
+
+constexpr const char *kBenchImages = "/tmp/stat_bench_images.idx3-ubyte";
+constexpr const char *kBenchText = "/tmp/stat_bench_data.txt";
+
+stat::Vec<double> randomVec(uint32_t n, uint32_t seed) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    stat::Vec<double> v(n);
+    for (auto &e : v) e = uniform(gen);
+    return v;
+}
+
+stat::Mat<double> randomMat(uint32_t m, uint32_t n, uint32_t seed) {
+    stat::Mat<double> mat;
+    for (uint32_t i = 0; i < m; ++i) mat.emplace_back(randomVec(n, seed + i));
+    return mat;
+}
+
+// a mnist-like idx3 file of m random 28x28 images
+void writeImages(uint32_t m) {
+    FILE *fp = std::fopen(kBenchImages, "wb");
+    if (!fp) return;
+    uint32_t header[4] = {htonl(stat::mnist::kMagicImage), htonl(m), htonl(28), htonl(28)};
+    std::fwrite(header, sizeof header, 1, fp);
+    std::mt19937 gen(0);
+    std::vector<uint8_t> image(28 * 28);
+    for (uint32_t i = 0; i < m; ++i) {
+        for (auto &p : image) p = gen() & 0xff;
+        std::fwrite(image.data(), 1, image.size(), fp);
+    }
+    std::fclose(fp);
+}
+
+// an iris-like text file of m rows and n space separated columns
+void writeText(uint32_t m, uint32_t n) {
+    FILE *fp = std::fopen(kBenchText, "w");
+    if (!fp) return;
+    auto X = randomMat(m, n, 0);
+    for (const auto &row : X) {
+        for (uint32_t j = 0; j < n; ++j) std::fprintf(fp, j ? " %.1f" : "%.1f", row[j] * 10.0);
+        std::fprintf(fp, "\n");
+    }
+    std::fclose(fp);
+}
+
+void registerMath() {
+    bench::add("math/dot", {{"dim", {4, 64, 784, 4096}}}, [](bench::State &state) {
+        auto x = randomVec(state["dim"], 1), y = randomVec(state["dim"], 2);
+        for (auto _ : state) bench::doNotOptimize(stat::dot(x, y));
+        state.setItemsProcessed(state.iterations() * state["dim"]);
+    });
+
+    bench::add("math/lp", {{"dim", {4, 64, 784, 4096}}, {"p", {1, 2}}}, [](bench::State &state) {
+        auto x = randomVec(state["dim"], 1), y = randomVec(state["dim"], 2);
+        for (auto _ : state) bench::doNotOptimize(stat::Lp(x, y, state["p"]));
+        state.setItemsProcessed(state.iterations() * state["dim"]);
+    });
+
+    bench::add("math/gram", {{"rows", {64, 256}}, {"dim", {4, 64}}}, [](bench::State &state) {
+        auto X = randomMat(state["rows"], state["dim"], 0);
+        for (auto _ : state) bench::doNotOptimize(stat::gram(X));
+        state.setItemsProcessed(state.iterations() * state["rows"] * state["rows"]);
+    });
+
+    bench::add("math/transpose",
+               {{"rows", {256, 4096}}, {"cols", {64, 784}}, {"threads", {1, 4}}},
+               [](bench::State &state) {
+                   auto X = randomMat(state["rows"], state["cols"], 0);
+                   stat::parallel::ScopedThreads pool(state["threads"]);
+                   for (auto _ : state) bench::doNotOptimize(stat::transpose(X));
+                   state.setItemsProcessed(state.iterations() * state["rows"] * state["cols"]);
+               });
+
+    bench::add("math/transpose_inplace", {{"dim", {256, 2048}}}, [](bench::State &state) {
+        auto X = randomMat(state["dim"], state["dim"], 0);
+        for (auto _ : state) {
+            stat::transposeInPlace(X);
+            bench::clobberMemory();
+        }
+        state.setItemsProcessed(state.iterations() * state["dim"] * state["dim"]);
+    });
+
+    bench::add("math/column_major", {{"rows", {10000}}, {"cols", {64, 784}}},
+               [](bench::State &state) {
+                   auto X = randomMat(state["rows"], state["cols"], 0);
+                   for (auto _ : state) bench::doNotOptimize(stat::columnMajor(X));
+                   state.setItemsProcessed(state.iterations() * state["rows"] * state["cols"]);
+               });
+
+    bench::add("math/matmul_nt", {{"rows", {256}}, {"cols", {10, 256}}, {"depth", {64, 784}}},
+               [](bench::State &state) {
+                   auto A = randomVec(state["rows"] * state["depth"], 1);
+                   auto B = randomVec(state["cols"] * state["depth"], 2);
+                   stat::Vec<double> C(state["rows"] * state["cols"]);
+                   for (auto _ : state) {
+                       stat::matmulNT(A.data(), B.data(), C.data(), state["rows"], state["cols"],
+                                      state["depth"]);
+                       bench::clobberMemory();
+                   }
+                   state.setItemsProcessed(state.iterations() * state["rows"] * state["cols"] *
+                                           state["depth"]);
+               });
+
+    // the fused single-pass summary against the former two pass mean then stdev
+    bench::add("math/summary", {{"size", {1024, 1 << 20}}}, [](bench::State &state) {
+        auto x = randomVec(state["size"], 1);
+        for (auto _ : state) bench::doNotOptimize(stat::summary(x));
+        state.setItemsProcessed(state.iterations() * state["size"]);
+    });
+
+    bench::add("math/mean_stdev_two_pass", {{"size", {1024, 1 << 20}}}, [](bench::State &state) {
+        auto x = randomVec(state["size"], 1);
+        for (auto _ : state) {
+            double mu = 0.0, var = 0.0;
+            for (auto e : x) mu += e;
+            mu /= x.size();
+            for (auto e : x) var += (e - mu) * (e - mu);
+            bench::doNotOptimize(std::sqrt(var / x.size()));
+        }
+        state.setItemsProcessed(state.iterations() * state["size"]);
+    });
+
+    bench::add("math/column_summaries", {{"rows", {10000}}, {"cols", {64, 784}}},
+               [](bench::State &state) {
+                   uint32_t m = state["rows"], n = state["cols"];
+                   stat::Data<double> X{randomMat(m, n, 0), m, n};
+                   for (auto _ : state) bench::doNotOptimize(stat::columnSummaries(X));
+                   state.setItemsProcessed(state.iterations() * m * n);
+               });
+}
+
+void registerLoaders() {
+    bench::add("load/idx", {{"rows", {1000, 10000}}}, [](bench::State &state) {
+        writeImages(state["rows"]);
+        for (auto _ : state) bench::doNotOptimize(stat::mnist::loadData<float>(kBenchImages));
+        state.setItemsProcessed(state.iterations() * state["rows"]);
+        std::remove(kBenchImages);
+    });
+
+    // standardization fused into the loader against a load then a separate pass over the rows
+    for (bool fused : {true, false}) {
+        bench::add(fused ? "load/idx_standardize_fused" : "load/idx_standardize_two_pass",
+                   {{"rows", {1000, 10000}}}, [fused](bench::State &state) {
+                       writeImages(state["rows"]);
+                       stat::transform::Pipeline pipeline;
+                       pipeline.standardize().fit(stat::mnist::loadData<float>(kBenchImages));
+                       for (auto _ : state) {
+                           if (fused) {
+                               bench::doNotOptimize(
+                                   stat::mnist::loadData<float>(kBenchImages, pipeline));
+                           } else {
+                               auto X = stat::mnist::loadData<float>(kBenchImages);
+                               pipeline.transform(X);
+                               bench::doNotOptimize(X);
+                           }
+                       }
+                       state.setItemsProcessed(state.iterations() * state["rows"]);
+                       std::remove(kBenchImages);
+                   });
+    }
+
+    bench::add("load/text", {{"rows", {1000, 10000}}, {"dim", {4, 64}}}, [](bench::State &state) {
+        writeText(state["rows"], state["dim"]);
+        for (auto _ : state) bench::doNotOptimize(stat::iris::loadData<float>(kBenchText));
+        state.setItemsProcessed(state.iterations() * state["rows"]);
+        std::remove(kBenchText);
+    });
+}
+
+void registerKnn() {
+    bench::add("knn/kdtree_build", {{"rows", {1000, 10000, 100000}}, {"dim", {2, 8, 32}}},
+               [](bench::State &state) {
+                   auto train = stat::synthetic::makeBlobs<float>(state["rows"], state["dim"], 10);
+                   for (auto _ : state) {
+                       stat::KNN<float, float> model(stat::ModelParam{{"model_type", "kdtree"}});
+                       bench::doNotOptimize(model.train(std::get<0>(train), std::get<1>(train)));
+                       state.setBytesUsed(model.memoryUsage().total());
+                   }
+                   state.setItemsProcessed(state.iterations() * state["rows"]);
+               });
+
+    // a batch of queries spread over the worker threads
+    auto query = [](const char *type) {
+        return [type](bench::State &state) {
+            constexpr uint32_t kQueries = 16;
+            auto train = stat::synthetic::makeBlobs<float>(state["rows"], state["dim"], 10, 1);
+            auto test = stat::synthetic::makeBlobs<float>(kQueries, state["dim"], 10, 2);
+            const auto &Q = std::get<0>(test);
+            stat::KNN<float, float> model(stat::ModelParam{{"k", "5"}, {"model_type", type}});
+            model.train(std::get<0>(train), std::get<1>(train));
+            stat::parallel::ScopedThreads pool(state["threads"]);
+            for (auto _ : state) {
+                stat::parallel::parallelFor(0, Q.m, 1, [&](std::size_t lo, std::size_t hi) {
+                    for (auto i = lo; i < hi; ++i) bench::doNotOptimize(model.predict(Q.data[i]));
+                });
+            }
+            state.setItemsProcessed(state.iterations() * kQueries);
+        };
+    };
+    bench::add("knn/brute_query",
+               {{"rows", {1000, 10000}}, {"dim", {16, 64, 256}}, {"threads", {1, 2, 4}}},
+               query("knn"));
+    bench::add("knn/kdtree_query",
+               {{"rows", {10000, 100000}}, {"dim", {2, 8, 32}}, {"threads", {1, 2, 4}}},
+               query("kdtree"));
+
+    // early abandoning on queries from the training blobs, the fraction of dimensions summed and
+    // of points not skipped by the norm bound go to stderr
+    bench::add("knn/brute_abandon", {{"dim", {64, 784}}}, [](bench::State &state) {
+        constexpr uint32_t kRows = 10000, kQueries = 100;
+        uint32_t dim = state["dim"];
+        auto data = stat::synthetic::makeBlobs<float>(kRows + kQueries, dim, 10, 1);
+        auto &X = std::get<0>(data);
+        stat::Data<float> Q{stat::Mat<float>(X.data.begin() + kRows, X.data.end()), kQueries, dim};
+        X.data.resize(kRows);
+        std::get<1>(data).data.resize(kRows);
+        X.m = std::get<1>(data).m = kRows;
+        stat::KNN<float, float> model(stat::ModelParam{{"k", "5"}});
+        model.train(X, std::get<1>(data));
+
+        static std::set<uint32_t> reported;
+        if (reported.insert(dim).second) {
+            bool enabled = stat::profile::enabled();
+            stat::profile::setEnabled(true);
+            stat::profile::reset();
+            for (const auto &q : Q.data) model.predict(q);
+            auto counters = stat::profile::snapshot().counters;
+            stat::profile::setEnabled(enabled);
+            fprintf(stderr, "INFO: %u dim, %f of dims touched, %f of points evaluated\n", dim,
+                    static_cast<double>(counters[stat::profile::DIMS_TOUCHED]) /
+                        counters[stat::profile::DIMS_SCANNED],
+                    static_cast<double>(counters[stat::profile::DISTANCE_EVALS]) /
+                        (uint64_t(kRows) * kQueries));
+        }
+        for (auto _ : state) {
+            for (const auto &q : Q.data) bench::doNotOptimize(model.predict(q));
+        }
+        state.setItemsProcessed(state.iterations() * kQueries);
+    });
+
+    // accuracy against latency per target dimension: 784-dim blobs close enough to overlap,
+    // queries from the same blobs. the accuracy of each case goes to stderr, stdout is muted
+    auto reduced = [](const char *reduction) {
+        return [reduction](bench::State &state) {
+            constexpr uint32_t kRows = 5000, kQueries = 100;
+            auto data = stat::synthetic::makeBlobs<float>(kRows + kQueries, 784, 10, 1, 0.5);
+            auto &X = std::get<0>(data);
+            auto &y = std::get<1>(data);
+            stat::Data<float> Q{stat::Mat<float>(X.data.begin() + kRows, X.data.end()), kQueries,
+                                784};
+            stat::Data<float> yQ{stat::Mat<float>(y.data.begin() + kRows, y.data.end()), kQueries,
+                                 1};
+            X.data.resize(kRows);
+            y.data.resize(kRows);
+            X.m = y.m = kRows;
+            stat::KNN<float, float> model(
+                stat::ModelParam{{"k", "5"},
+                                 {"model_type", state["kdtree"] ? "kdtree" : "knn"},
+                                 {"reduction", reduction},
+                                 {"reduced_dim", std::to_string(state["reduced_dim"])}});
+            model.train(X, y);
+            uint32_t hits = 0;
+            for (uint32_t i = 0; i < kQueries; ++i) hits += model.predict(Q.data[i]) == yQ.data[i][0];
+            // once per target dimension, the setup runs again for every repetition
+            static std::set<std::string> reported;
+            auto key = std::string(reduction) + std::to_string(state["reduced_dim"]);
+            if (reported.insert(key).second) {
+                fprintf(stderr, "INFO: %s to %lld dim, accuracy %f\n", reduction,
+                        static_cast<long long>(state["reduced_dim"]),
+                        static_cast<double>(hits) / kQueries);
+            }
+            for (auto _ : state) {
+                for (const auto &q : Q.data) bench::doNotOptimize(model.predict(q));
+            }
+            state.setItemsProcessed(state.iterations() * kQueries);
+        };
+    };
+    bench::add("knn/unreduced_query", {{"reduced_dim", {784}}, {"kdtree", {0, 1}}}, reduced("none"));
+    bench::add("knn/pca_query", {{"reduced_dim", {8, 16, 32, 64}}, {"kdtree", {0, 1}}},
+               reduced("pca"));
+    bench::add("knn/jl_query", {{"reduced_dim", {8, 16, 32, 64}}, {"kdtree", {0, 1}}},
+               reduced("jl"));
+
+    // compressed scan against the exact one: pq_m 0 is the brute force baseline on the floats,
+    // accuracy and bytes per point of each case go to stderr
+    auto quantized = [](bench::State &state) {
+        constexpr uint32_t kRows = 20000, kQueries = 100, kDim = 128;
+        // queries from the same blobs, the last rows
+        auto data = stat::synthetic::makeBlobs<float>(kRows + kQueries, kDim, 10, 1, 0.5);
+        auto &X = std::get<0>(data);
+        auto &y = std::get<1>(data);
+        stat::Data<float> Q{stat::Mat<float>(X.data.begin() + kRows, X.data.end()), kQueries,
+                            kDim};
+        stat::Data<float> yQ{stat::Mat<float>(y.data.begin() + kRows, y.data.end()), kQueries, 1};
+        X.data.resize(kRows);
+        y.data.resize(kRows);
+        X.m = y.m = kRows;
+        bool pq = state["pq_m"] > 0;
+        stat::KNN<float, float> model(
+            stat::ModelParam{{"k", "5"},
+                             {"model_type", pq ? "pq" : "knn"},
+                             {"pq_m", std::to_string(state["pq_m"])},
+                             {"rerank", std::to_string(state["rerank"])}});
+        model.train(X, y);
+        uint32_t hits = 0;
+        for (uint32_t i = 0; i < kQueries; ++i) hits += model.predict(Q.data[i]) == yQ.data[i][0];
+        static std::set<std::pair<long long, long long>> reported;
+        if (reported.insert({state["pq_m"], state["rerank"]}).second) {
+            fprintf(stderr, "INFO: pq_m %lld rerank %lld, %lld bytes per point, accuracy %f\n",
+                    static_cast<long long>(state["pq_m"]), static_cast<long long>(state["rerank"]),
+                    static_cast<long long>(pq ? state["pq_m"] : kDim * sizeof(float)),
+                    static_cast<double>(hits) / kQueries);
+        }
+        for (auto _ : state) {
+            for (const auto &q : Q.data) bench::doNotOptimize(model.predict(q));
+        }
+        state.setItemsProcessed(state.iterations() * kQueries);
+    };
+    bench::add("knn/pq_baseline", {{"pq_m", {0}}, {"rerank", {0}}}, quantized);
+    bench::add("knn/pq_query", {{"pq_m", {8, 16, 32}}, {"rerank", {0, 50}}}, quantized);
+
+    // brute-force scan split into shards on (NUMA-)pinned threads, 0 is the single scan
+    bench::add("knn/sharded", {{"shards", {0, 1, 2, 4}}}, [](bench::State &state) {
+        constexpr uint32_t kRows = 20000, kDim = 256, kQueries = 50;
+        auto data = stat::synthetic::makeBlobs<float>(kRows + kQueries, kDim, 10, 1);
+        auto &X = std::get<0>(data);
+        stat::Data<float> Q{stat::Mat<float>(X.data.begin() + kRows, X.data.end()), kQueries, kDim};
+        X.data.resize(kRows);
+        std::get<1>(data).data.resize(kRows);
+        X.m = std::get<1>(data).m = kRows;
+        uint32_t shards = state["shards"];
+        stat::KNN<float, float> model(stat::ModelParam{
+            {"k", "5"}, {"sharded", shards ? "true" : "false"}, {"shards", std::to_string(shards)}});
+        model.train(X, std::get<1>(data));
+        for (auto _ : state) {
+            for (const auto &q : Q.data) bench::doNotOptimize(model.predict(q));
+        }
+        state.setItemsProcessed(state.iterations() * kQueries);
+    });
+
+    bench::add("knn/pca_fit", {{"rows", {10000}}, {"reduced_dim", {16, 64}}, {"threads", {1, 4}}},
+               [](bench::State &state) {
+                   auto data = stat::synthetic::makeBlobs<float>(state["rows"], 784, 10, 1);
+                   stat::parallel::ScopedThreads pool(state["threads"]);
+                   for (auto _ : state) {
+                       stat::reduction::Projection pca;
+                       bench::doNotOptimize(pca.fitPca(std::get<0>(data), state["reduced_dim"]));
+                   }
+                   state.setItemsProcessed(state.iterations() * state["rows"]);
+               });
+
+    // updatable index: insert throughput, then query latency against the static kd-tree with
+    // part of the points removed and with a writer inserting during the queries
+    bench::add("knn/dynamic_insert", {{"rows", {10000, 100000}}, {"buffer", {16, 64, 256}}},
+               [](bench::State &state) {
+                   auto data = stat::synthetic::makeBlobs<float>(state["rows"], 8, 10, 1);
+                   const auto &X = std::get<0>(data);
+                   const auto &y = std::get<1>(data);
+                   stat::DynamicKnnParam param;
+                   param.bufferSize = state["buffer"];
+                   for (auto _ : state) {
+                       stat::DynamicKNN<float, float> index(param);
+                       for (uint32_t i = 0; i < X.m; ++i) index.insert(X.data[i], y.data[i][0]);
+                       bench::doNotOptimize(index.size());
+                       state.setBytesUsed(index.memoryUsage().total());
+                   }
+                   state.setItemsProcessed(state.iterations() * X.m);
+               });
+    auto dynamic = [](bool isStatic) {
+        return [isStatic](bench::State &state) {
+            constexpr uint32_t kRows = 50000, kQueries = 1000;
+            auto data = stat::synthetic::makeBlobs<float>(kRows + kQueries, 8, 10, 1);
+            auto &X = std::get<0>(data);
+            auto &y = std::get<1>(data);
+            stat::Data<float> Q{stat::Mat<float>(X.data.begin() + kRows, X.data.end()), kQueries, 8};
+            X.data.resize(kRows);
+            y.data.resize(kRows);
+            X.m = y.m = kRows;
+            if (isStatic) {
+                stat::KNN<float, float> model(stat::ModelParam{{"model_type", "kdtree"}});
+                model.train(X, y);
+                for (auto _ : state) {
+                    for (const auto &q : Q.data) bench::doNotOptimize(model.predict(q));
+                }
+                state.setItemsProcessed(state.iterations() * kQueries);
+                return;
+            }
+            stat::DynamicKnnParam param;
+            param.backgroundMerge = true;
+            stat::DynamicKNN<float, float> index(param);
+            for (uint32_t i = 0; i < kRows; ++i) index.insert(X.data[i], y.data[i][0]);
+            for (uint32_t i = 0; i < kRows; ++i) {
+                if (i % 100 < state["removed_pct"]) index.remove(i);
+            }
+            index.waitForMerges();
+            std::atomic<bool> done{false};
+            std::thread writer([&] {
+                for (uint32_t i = 0; state["writer"] && !done; i = (i + 1) % kRows) {
+                    index.insert(X.data[i], y.data[i][0]);
+                }
+            });
+            for (auto _ : state) {
+                for (const auto &q : Q.data) bench::doNotOptimize(index.predict(q));
+            }
+            done = true;
+            writer.join();
+            state.setItemsProcessed(state.iterations() * kQueries);
+        };
+    };
+    bench::add("knn/dynamic_baseline", {{"removed_pct", {0}}, {"writer", {0}}}, dynamic(true));
+    bench::add("knn/dynamic_query", {{"removed_pct", {0, 50}}, {"writer", {0, 1}}},
+               dynamic(false));
+}
+
+void registerNaiveBayes() {
+    bench::add("nb/train", {{"rows", {1000, 10000}}, {"dim", {16, 64, 784}}},
+               [](bench::State &state) {
+                   auto train = stat::synthetic::makeBlobs<float>(state["rows"], state["dim"], 10);
+                   for (auto _ : state) {
+                       stat::NaiveBayes<float, float> model(stat::ModelParam{});
+                       bench::doNotOptimize(model.train(std::get<0>(train), std::get<1>(train)));
+                       state.setBytesUsed(model.memoryUsage().total());
+                   }
+                   state.setItemsProcessed(state.iterations() * state["rows"]);
+               });
+
+    bench::add("nb/predict", {{"dim", {16, 64, 784}}}, [](bench::State &state) {
+        auto train = stat::synthetic::makeBlobs<float>(1000, state["dim"], 10, 1);
+        auto test = stat::synthetic::makeBlobs<float>(100, state["dim"], 10, 2);
+        const auto &Q = std::get<0>(test);
+        stat::NaiveBayes<float, float> model(stat::ModelParam{});
+        model.train(std::get<0>(train), std::get<1>(train));
+        for (auto _ : state) {
+            for (const auto &q : Q.data) bench::doNotOptimize(model.predict(q));
+        }
+        state.setItemsProcessed(state.iterations() * Q.m);
+    });
+
+    // features binarized at 0, half of the bits are set on average
+    bench::add("nb/predict_bernoulli", {{"dim", {64, 784}}}, [](bench::State &state) {
+        auto train = stat::synthetic::makeBlobs<float>(1000, state["dim"], 10, 1);
+        auto test = stat::synthetic::makeBlobs<float>(100, state["dim"], 10, 2);
+        const auto &Q = std::get<0>(test);
+        stat::NaiveBayes<float, float> model(
+            stat::ModelParam{{"model_type", "bernoulli"}, {"threshold", "0"}});
+        model.train(std::get<0>(train), std::get<1>(train));
+        for (auto _ : state) {
+            for (const auto &q : Q.data) bench::doNotOptimize(model.predict(q));
+        }
+        state.setItemsProcessed(state.iterations() * Q.m);
+    });
+}
+
+void registerDecisionTree() {
+    bench::add("dt/train", {{"rows", {1000, 10000}}, {"dim", {16, 64}}, {"threads", {1, 4}}},
+               [](bench::State &state) {
+                   auto train = stat::synthetic::makeBlobs<float>(state["rows"], state["dim"], 10);
+                   stat::parallel::ScopedThreads pool(state["threads"]);
+                   for (auto _ : state) {
+                       stat::DecisionTree<float, float> model(stat::ModelParam{});
+                       bench::doNotOptimize(model.train(std::get<0>(train), std::get<1>(train)));
+                       state.setBytesUsed(model.memoryUsage().total());
+                   }
+                   state.setItemsProcessed(state.iterations() * state["rows"]);
+               });
+
+    // row by row traversal against blocks of rows walked level by level
+    for (auto batched : {false, true}) {
+        auto predict = [batched](bench::State &state) {
+            auto train = stat::synthetic::makeBlobs<float>(10000, state["dim"], 10, 1, 0.3);
+            const auto &X = std::get<0>(train);
+            stat::DecisionTree<float, float> model(stat::ModelParam{});
+            model.train(X, std::get<1>(train));
+            stat::parallel::ScopedThreads pool(1);
+            for (auto _ : state) {
+                if (batched) {
+                    bench::doNotOptimize(model.predictBatch(X));
+                } else {
+                    for (const auto &x : X.data) bench::doNotOptimize(model.predict(x));
+                }
+            }
+            state.setItemsProcessed(state.iterations() * X.m);
+        };
+        bench::add(batched ? "dt/predict_batch" : "dt/predict", {{"dim", {16, 64}}}, predict);
+    }
+}
+
+void registerLogisticRegression() {
+    // a fixed amount of work per case, early stopping off, items are samples seen by the solver
+    bench::add("lr/train_sgd", {{"dim", {64, 784}}}, [](bench::State &state) {
+        auto train = stat::synthetic::makeBlobs<float>(10000, state["dim"], 10);
+        for (auto _ : state) {
+            stat::LogisticRegression<float, float> model(stat::ModelParam{
+                {"model_type", "sgd"}, {"epochs", "5"}, {"holdout", "0"}, {"eta", "0.01"}});
+            bench::doNotOptimize(model.train(std::get<0>(train), std::get<1>(train)));
+        }
+        state.setItemsProcessed(state.iterations() * 10000 * 5);
+    });
+
+    bench::add("lr/train_lbfgs", {{"dim", {64, 784}}, {"threads", {1, 4}}},
+               [](bench::State &state) {
+                   auto train = stat::synthetic::makeBlobs<float>(10000, state["dim"], 10);
+                   stat::parallel::ScopedThreads pool(state["threads"]);
+                   for (auto _ : state) {
+                       stat::LogisticRegression<float, float> model(stat::ModelParam{
+                           {"model_type", "lbfgs"}, {"epochs", "10"}, {"tolerance", "0"}});
+                       bench::doNotOptimize(model.train(std::get<0>(train), std::get<1>(train)));
+                   }
+                   state.setItemsProcessed(state.iterations() * 10000 * 10);
+               });
+}
+
+void registerSvm() {
+    // kernel rows cached for the whole problem against a cache of a tenth of it, shrinking on/off
+    for (auto shrinking : {"true", "false"}) {
+        auto train = [shrinking](bench::State &state) {
+            auto rows = state["rows"];
+            auto data = stat::synthetic::makeBlobs<float>(rows, 16, 4, 1, 1.0);
+            double full = rows * rows * sizeof(float) / double(1 << 20);
+            stat::parallel::ScopedThreads pool(state["threads"]);
+            for (auto _ : state) {
+                stat::SVM<float, float> model(stat::ModelParam{
+                    {"model_type", "rbf"},
+                    {"shrinking", shrinking},
+                    {"cache_size", std::to_string(state["cache"] ? full : full / 10)}});
+                bench::doNotOptimize(model.train(std::get<0>(data), std::get<1>(data)));
+            }
+            state.setItemsProcessed(state.iterations() * rows);
+        };
+        bench::add(std::string("svm/train_shrinking_") + shrinking,
+                   {{"rows", {1000, 4000}}, {"cache", {0, 1}}, {"threads", {1, 4}}}, train);
+    }
+
+    bench::add("svm/predict_batch", {{"dim", {16, 64}}}, [](bench::State &state) {
+        auto data = stat::synthetic::makeBlobs<float>(2000, state["dim"], 4, 1, 1.0);
+        const auto &X = std::get<0>(data);
+        stat::SVM<float, float> model(stat::ModelParam{{"model_type", "rbf"}});
+        model.train(X, std::get<1>(data));
+        stat::parallel::ScopedThreads pool(1);
+        for (auto _ : state) bench::doNotOptimize(model.predictBatch(X));
+        state.setItemsProcessed(state.iterations() * X.m);
+    });
+}
+
+void registerAdaBoost() {
+    // items are (row, feature) pairs scanned per round
+    bench::add("adaboost/train", {{"rows", {1000, 10000}}, {"dim", {16, 64}}, {"threads", {1, 4}}},
+               [](bench::State &state) {
+                   auto train = stat::synthetic::makeBlobs<float>(state["rows"], state["dim"], 10);
+                   stat::parallel::ScopedThreads pool(state["threads"]);
+                   for (auto _ : state) {
+                       stat::AdaBoost<float, float> model(stat::ModelParam{{"rounds", "20"}});
+                       bench::doNotOptimize(model.train(std::get<0>(train), std::get<1>(train)));
+                   }
+                   state.setItemsProcessed(state.iterations() * 20 * state["rows"] *
+                                           state["dim"]);
+               });
+
+    bench::add("adaboost/predict_batch", {{"rounds", {100, 500}}}, [](bench::State &state) {
+        auto train = stat::synthetic::makeBlobs<float>(10000, 32, 10, 1, 1.0);
+        const auto &X = std::get<0>(train);
+        stat::AdaBoost<float, float> model(
+            stat::ModelParam{{"rounds", std::to_string(state["rounds"])}});
+        model.train(X, std::get<1>(train));
+        stat::parallel::ScopedThreads pool(1);
+        for (auto _ : state) bench::doNotOptimize(model.predictBatch(X));
+        state.setItemsProcessed(state.iterations() * X.m);
+    });
+}
+
+void registerEm() {
+    // items are rows through the E-step, a fixed number of iterations per case
+    for (auto covariance : {"diagonal", "full"}) {
+        auto fit = [covariance](bench::State &state) {
+            auto data = stat::synthetic::makeBlobs<double>(20000, state["dim"], 8);
+            const auto &X = std::get<0>(data);
+            stat::Vec<double> rows;
+            for (const auto &x : X.data) rows.insert(rows.end(), x.cbegin(), x.cend());
+            stat::parallel::ScopedThreads pool(state["threads"]);
+            stat::MixtureParam param;
+            param.components = 8;
+            param.full = covariance[0] == 'f';
+            param.maxIterations = 10;
+            param.tolerance = 0.0;
+            param.batchSize = state["batch"];
+            for (auto _ : state) {
+                stat::GaussianMixture gmm(param);
+                bench::doNotOptimize(gmm.fit(rows.data(), X.m, X.n));
+            }
+            state.setItemsProcessed(state.iterations() * 10 * X.m);
+        };
+        bench::add(std::string("em/fit_") + covariance,
+                   {{"dim", {8, 32}}, {"batch", {0, 1000}}, {"threads", {1, 4}}}, fit);
+    }
+}
+
+void registerHmm() {
+    // items are tokens, 1000 sequences of 100 tokens from a random model
+    bench::add("hmm/viterbi", {{"states", {8, 64}}, {"threads", {1, 4}}},
+               [](bench::State &state) {
+                   auto hmm = stat::HMM::random(state["states"], 64);
+                   auto data = stat::synthetic::makeSequences(hmm, 1000, 100);
+                   stat::parallel::ScopedThreads pool(state["threads"]);
+                   for (auto _ : state) bench::doNotOptimize(hmm.viterbiBatch(std::get<0>(data)));
+                   state.setItemsProcessed(state.iterations() * 1000 * 100);
+               });
+
+    bench::add("hmm/forward", {{"states", {8, 64}}}, [](bench::State &state) {
+        auto hmm = stat::HMM::random(state["states"], 64);
+        auto data = stat::synthetic::makeSequences(hmm, 1000, 100);
+        for (auto _ : state) {
+            for (const auto &seq : std::get<0>(data)) {
+                bench::doNotOptimize(hmm.logLikelihood(seq));
+            }
+        }
+        state.setItemsProcessed(state.iterations() * 1000 * 100);
+    });
+
+    bench::add("hmm/baum_welch", {{"states", {8, 64}}, {"threads", {1, 4}}},
+               [](bench::State &state) {
+                   auto truth = stat::HMM::random(state["states"], 64);
+                   auto data = stat::synthetic::makeSequences(truth, 1000, 100);
+                   stat::parallel::ScopedThreads pool(state["threads"]);
+                   stat::HmmParam param;
+                   param.states = state["states"];
+                   param.maxIterations = 5;
+                   param.tolerance = 0.0;
+                   for (auto _ : state) {
+                       stat::HMM hmm(param);
+                       bench::doNotOptimize(hmm.fit(std::get<0>(data)));
+                   }
+                   state.setItemsProcessed(state.iterations() * 5 * 1000 * 100);
+               });
+}
+
+void registerCrf() {
+    // items are tokens, 1000 tagged sequences of 50 tokens, 4 features per token
+    bench::add("crf/train_lbfgs", {{"labels", {4, 16}}, {"threads", {1, 4}}},
+               [](bench::State &state) {
+                   auto data = stat::synthetic::makeTaggedSequences(1000, 50, state["labels"], 64);
+                   stat::parallel::ScopedThreads pool(state["threads"]);
+                   stat::CrfParam param;
+                   param.maxIterations = 5;
+                   for (auto _ : state) {
+                       stat::CRF crf(param);
+                       bench::doNotOptimize(crf.fit(data));
+                   }
+                   state.setItemsProcessed(state.iterations() * 5 * 1000 * 50);
+               });
+
+    bench::add("crf/train_sgd", {{"labels", {4, 16}}}, [](bench::State &state) {
+        auto data = stat::synthetic::makeTaggedSequences(1000, 50, state["labels"], 64);
+        stat::CrfParam param;
+        param.solver = stat::CrfParam::SGD;
+        param.epochs = 1;
+        for (auto _ : state) {
+            stat::CRF crf(param);
+            bench::doNotOptimize(crf.fit(data));
+        }
+        state.setItemsProcessed(state.iterations() * 1000 * 50);
+    });
+
+    bench::add("crf/viterbi", {{"labels", {4, 16}}, {"threads", {1, 4}}},
+               [](bench::State &state) {
+                   auto data = stat::synthetic::makeTaggedSequences(1000, 50, state["labels"], 64);
+                   stat::CrfParam param;
+                   param.maxIterations = 5;
+                   stat::CRF crf(param);
+                   crf.fit(data);
+                   stat::parallel::ScopedThreads pool(state["threads"]);
+                   for (auto _ : state) bench::doNotOptimize(crf.viterbiBatch(data));
+                   state.setItemsProcessed(state.iterations() * 1000 * 50);
+               });
+}
+
+void registerPerceptron() {
+    for (auto form : {"original", "dual"}) {
+        auto train = [form](bench::State &state) {
+            auto data = stat::synthetic::makeSeparable<double>(state["rows"], state["dim"]);
+            for (auto _ : state) {
+                stat::Perceptron<double, double> model(stat::ModelParam{{"model_type", form}});
+                bench::doNotOptimize(model.train(std::get<0>(data), std::get<1>(data)));
+            }
+            state.setItemsProcessed(state.iterations() * state["rows"]);
+        };
+        bench::add(std::string("perceptron/train_") + form,
+                   {{"rows", {100, 500}}, {"dim", {4, 16}}}, train);
+    }
+}
+
+// per-prediction cost on iris-sized data, where the call itself is a large part of it: a virtual
+// predict per row through CreateModel() against one static dispatch for the batch by AnyModel
+void registerDispatch() {
+    bench::add("dispatch/predict", {{"model", {3, 4, 5, 7}}, {"static", {0, 1}}},
+               [](bench::State &state) {
+                   auto data = stat::synthetic::makeBlobs<double>(150, 4, 3, 1);
+                   const auto &X = std::get<0>(data);
+                   const auto &y = std::get<1>(data);
+                   auto type = static_cast<stat::ModelType>(state["model"]);
+                   if (state["static"]) {
+                       stat::AnyModel<double, double> model(*stat::ParseModelConfig(type));
+                       model.train(X, y);
+                       for (auto _ : state) bench::doNotOptimize(model.predict(X));
+                   } else {
+                       auto model = stat::CreateModel<double, double>(type);
+                       model->train(X, y);
+                       for (auto _ : state) {
+                           for (const auto &x : X.data) bench::doNotOptimize(model->predict(x));
+                       }
+                   }
+                   state.setItemsProcessed(state.iterations() * X.m);
+               });
+}
+
+// choosing k in [1, 15] and p in {1, 2} by 5-fold cross-validation: a k-NN retrained per
+// configuration against one neighbor search per row and p
+void registerSelection() {
+    bench::add("select/knn_sweep", {{"rows", {1000, 2000}}, {"one_pass", {0, 1}}},
+               [](bench::State &state) {
+                   auto data = stat::synthetic::makeBlobs<float>(state["rows"], 32, 10, 1, 1.0);
+                   const auto &X = std::get<0>(data);
+                   const auto &y = std::get<1>(data);
+                   stat::selection::KnnSweepParam sweep;
+                   sweep.ps = {1, 2};
+                   for (auto _ : state) {
+                       if (state["one_pass"]) {
+                           bench::doNotOptimize(stat::selection::knnSweep(X, y, sweep));
+                           continue;
+                       }
+                       for (auto p : sweep.ps) {
+                           for (uint32_t k = 1; k <= sweep.kMax; ++k) {
+                               stat::KnnParam param;
+                               param.k = k;
+                               param.p = p;
+                               bench::doNotOptimize(stat::selection::crossValidate(X, y, param));
+                           }
+                       }
+                   }
+                   state.setItemsProcessed(state.iterations() * sweep.kMax * sweep.ps.size());
+               });
+}
+
+// loading into a monotonic arena against one allocation per row, and k-NN queries over points on
+// huge pages against 4 KB pages. allocation counts go to stderr
+void registerMemory() {
+    bench::add("memory/load_idx", {{"rows", {10000, 60000}}, {"arena", {0, 1}}},
+               [](bench::State &state) {
+                   writeImages(state["rows"]);
+                   bool arena = state["arena"];
+                   stat::memory::Counter counter;
+                   auto load = [&] {
+                       if (!arena) return stat::mnist::loadData<float>(kBenchImages);
+                       return stat::mnist::loadData<float>(kBenchImages, stat::NoTransform{},
+                                                           stat::memory::makeArena(1 << 20, &counter));
+                   };
+                   static std::set<std::pair<long long, bool>> reported;
+                   if (reported.insert({state["rows"], arena}).second) {
+                       auto *previous = std::pmr::set_default_resource(&counter);
+                       load();
+                       std::pmr::set_default_resource(previous);
+                       fprintf(stderr, "INFO: %lld rows, %s, %llu allocations\n",
+                               static_cast<long long>(state["rows"]), arena ? "arena" : "per row",
+                               static_cast<unsigned long long>(counter.allocations()));
+                   }
+                   for (auto _ : state) bench::doNotOptimize(load());
+                   state.setItemsProcessed(state.iterations() * state["rows"]);
+                   std::remove(kBenchImages);
+               });
+
+    bench::add("memory/knn_query", {{"rows", {20000}}, {"huge_pages", {0, 1}}},
+               [](bench::State &state) {
+                   constexpr uint32_t kDim = 784, kQueries = 20;
+                   auto data = stat::synthetic::makeBlobs<float>(state["rows"], kDim, 10, 1);
+                   stat::memory::hugePages()->setEnabled(state["huge_pages"]);
+                   stat::KNN<float, float> model(stat::ModelParam{{"k", "5"}});
+                   model.train(std::get<0>(data), std::get<1>(data));
+                   stat::memory::hugePages()->setEnabled(true);
+                   auto queries = stat::synthetic::makeBlobs<float>(kQueries, kDim, 10, 1);
+                   for (auto _ : state) {
+                       for (const auto &q : std::get<0>(queries).data) {
+                           bench::doNotOptimize(model.predict(q));
+                       }
+                   }
+                   state.setItemsProcessed(state.iterations() * kQueries);
+               });
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    registerMath();
+    registerLoaders();
+    registerKnn();
+    registerNaiveBayes();
+    registerDecisionTree();
+    registerLogisticRegression();
+    registerSvm();
+    registerAdaBoost();
+    registerEm();
+    registerHmm();
+    registerCrf();
+    registerPerceptron();
+    registerDispatch();
+    registerSelection();
+    registerMemory();
+    return bench::main(argc, argv);
+}
@@ -0,0 +1,416 @@
+#ifndef __ADA_BOOST_H__
+#define __ADA_BOOST_H__
+
+#include "Math.h"
+#include "Model.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace stat {
+
+// AdaBoost params, from ModelParam by parse() or set directly
+struct AdaBoostParam {
+    uint32_t rounds = 100;  // boosting rounds, one stump each
+    bool show = false;
+
+    // {"rounds"}, {"model_show"}
+    static AdaBoostParam parse(const ModelParam &param) {
+        AdaBoostParam p;
+        ParamReader(param, "AdaBoost").number("rounds", p.rounds, 1u).flag("model_show", p.show);
+        return p;
+    }
+};
+
+/**
+ * AdaBoost model, SAMME for K classes (K = 2 is the classic discrete AdaBoost)
+ *
+ * Model:   $f(x) = \arg\max_k \sum_{t=1}^T{\alpha_t [h_t(x) = k]}$
+ * Round t: $e_t = \sum_i{w_i [h_t(x_i) \ne y_i]}$, $\alpha_t = log\frac{1 - e_t}{e_t} + log(K - 1)$,
+ *          $w_i \leftarrow w_i exp(\alpha_t [h_t(x_i) \ne y_i])$, then normalized
+ *
+ * Weak learners are decision stumps, `x[feature] <= threshold` votes for class `left`, otherwise
+ * for class `right`. Every feature is sorted once before the first round, a round then scans the
+ * presorted rows of each feature in O(m) (two passes: a backward one for the best class on the
+ * right of every cut, a forward one for the left), in parallel over features.
+ *
+ * The ensemble is flattened into parallel arrays, `predictBatch()` transposes a block of rows and
+ * applies one stump at a time to the whole block: a contiguous compare-and-add per class.
+ */
+template <typename DataType, typename LabelType>
+class AdaBoost : public Model<DataType, LabelType> {
+public:
+    explicit AdaBoost(const AdaBoostParam &param = {});
+    explicit AdaBoost(const ModelParam &param) : AdaBoost(AdaBoostParam::parse(param)) {}
+    virtual ~AdaBoost() = default;
+
+    virtual bool train(const Data<DataType> &X_train, const Data<LabelType> &y_train) final;
+
+    virtual LabelType predict(const Vec<DataType> &X) final;
+
+    virtual double validate(const Data<DataType> &X_test, const Data<LabelType> &y_test) final;
+
+    virtual void describe() const final;
+
+    virtual memory::Usage memoryUsage() const final;
+
+    virtual uint32_t inputDim() const final;
+
+    virtual bool save(const char *filename) const final;
+
+    virtual bool load(const char *filename) final;
+
+    // labels of rows [0, X.m) of X, scored in blocks
+    Vec<LabelType> predictBatch(const Data<DataType> &X) const;
+
+private:
+    struct Stump {
+        double correct;  // weighted accuracy on the training set, larger is better
+        double threshold;
+        uint32_t feature;
+        uint32_t left;
+        uint32_t right;
+    };
+
+    // fixed size part of the saved model. sections follow: class labels, features, thresholds,
+    // left classes, right classes and alphas
+    struct FileHeader {
+        uint32_t classes;
+        uint32_t dim;
+        uint32_t stumps;
+        uint32_t reserved;
+    };
+
+    static constexpr uint32_t kBlockRows = 256;  // rows scored together by predictBatch
+
+    uint32_t rounds;
+    bool isModelShow;
+
+    uint32_t dim;
+    Vec<LabelType> classes;
+    Vec<uint32_t> features;
+    Vec<double> thresholds;
+    Vec<uint32_t> lefts;
+    Vec<uint32_t> rights;
+    Vec<double> alphas;
+
+    Stump bestStump(const ColMajor<DataType> &cols, const std::vector<uint32_t> &order,
+                    const Vec<uint32_t> &y, const Vec<double> &w, uint32_t f,
+                    std::vector<double> &scratch) const;
+    void score(const double *block, std::size_t rows, double *scores) const;
+};
+
+template <typename DataType, typename LabelType>
+AdaBoost<DataType, LabelType>::AdaBoost(const AdaBoostParam &param)
+    : rounds(param.rounds), isModelShow(param.show), dim(0) {}
+
+/**
+ * Best stump of feature f under weights w. `order` holds the rows sorted by feature f, the
+ * candidate cuts are the midpoints of consecutive distinct values. The backward pass records the
+ * best (class, weight) right of every cut, the forward pass adds the best on the left. Both sides
+ * only ever gain weight along their pass, so the running maxima are O(1) per row.
+ */
+template <typename DataType, typename LabelType>
+typename AdaBoost<DataType, LabelType>::Stump AdaBoost<DataType, LabelType>::bestStump(
+    const ColMajor<DataType> &cols, const std::vector<uint32_t> &order, const Vec<uint32_t> &y,
+    const Vec<double> &w, uint32_t f, std::vector<double> &scratch) const {
+    auto m = cols.m;
+    auto C = classes.size();
+    auto values = cols.col(f);
+    auto idx = order.data() + static_cast<std::size_t>(f) * m;
+
+    // scratch: C class sums, then per position the best right weight and class
+    scratch.assign(C + 2 * static_cast<std::size_t>(m), 0.0);
+    auto sums = scratch.data();
+    auto bestRight = sums + C, bestRightClass = bestRight + m;
+    double best = 0.0;
+    uint32_t bestClass = 0;
+    for (auto p = m; p-- > 0;) {
+        auto r = idx[p];
+        auto s = sums[y[r]] += w[r];
+        if (s > best) {
+            best = s;
+            bestClass = y[r];
+        }
+        bestRight[p] = best;
+        bestRightClass[p] = bestClass;
+    }
+
+    Stump stump{-1.0, 0.0, f, 0, 0};
+    std::fill(sums, sums + C, 0.0);
+    best = 0.0;
+    bestClass = 0;
+    for (uint32_t p = 0; p + 1 < m; ++p) {
+        auto r = idx[p];
+        auto s = sums[y[r]] += w[r];
+        if (s > best) {
+            best = s;
+            bestClass = y[r];
+        }
+        double lo = values[r], hi = values[idx[p + 1]];
+        if (lo == hi) continue;  // not a cut between distinct values
+        double correct = best + bestRight[p + 1];
+        if (correct > stump.correct) {
+            stump.correct = correct;
+            stump.threshold = lo + (hi - lo) / 2;
+            stump.left = bestClass;
+            stump.right = static_cast<uint32_t>(bestRightClass[p + 1]);
+        }
+    }
+    return stump;
+}
+
+template <typename DataType, typename LabelType>
+bool AdaBoost<DataType, LabelType>::train(const Data<DataType> &X_train,
+                                          const Data<LabelType> &y_train) {
+    STAT_PROFILE_SCOPE(__func__);
+
+    auto m = X_train.m, n = X_train.n;
+    if (m < 2 || n == 0 || y_train.m != m) {
+        printf("ERROR: invalid training set\n");
+        return false;
+    }
+    dim = n;
+    auto y = encodeLabels(y_train, classes);
+    auto C = static_cast<uint32_t>(classes.size());
+    if (C < 2) {
+        printf("ERROR: adaboost needs at least 2 classes\n");
+        return false;
+    }
+
+    // rows sorted by every feature, once for all rounds
+    auto cols = columnMajor(X_train.data);
+    std::vector<uint32_t> order(static_cast<std::size_t>(n) * m);
+    parallel::parallelFor(0, n, 1, [&](std::size_t lo, std::size_t hi) {
+        for (auto f = lo; f < hi; ++f) {
+            auto idx = order.begin() + f * m;
+            auto values = cols.col(f);
+            std::iota(idx, idx + m, 0u);
+            std::stable_sort(idx, idx + m,
+                             [values](uint32_t a, uint32_t b) { return values[a] < values[b]; });
+        }
+    });
+
+    features.clear();
+    thresholds.clear();
+    lefts.clear();
+    rights.clear();
+    alphas.clear();
+    Vec<double> w(m, 1.0 / m);
+    std::vector<Stump> candidates(n);
+    double bias = std::log(C - 1.0);
+    for (uint32_t t = 0; t < rounds; ++t) {
+        parallel::parallelFor(0, n, 1, [&](std::size_t lo, std::size_t hi) {
+            std::vector<double> scratch;
+            for (auto f = lo; f < hi; ++f) {
+                candidates[f] = bestStump(cols, order, y, w, f, scratch);
+            }
+        });
+        // reduced in feature order, ties go to the lower feature whatever the thread count
+        auto stump = candidates[0];
+        for (uint32_t f = 1; f < n; ++f) {
+            if (candidates[f].correct > stump.correct) stump = candidates[f];
+        }
+        if (stump.correct < 0.0) {
+            printf("WARNING: adaboost found no split, every feature is constant\n");
+            break;
+        }
+
+        double total = std::accumulate(w.cbegin(), w.cend(), 0.0);
+        double err = std::max(0.0, 1.0 - stump.correct / total);
+        if (err >= 1.0 - 1.0 / C) break;  // no better than chance, boosting cannot go on
+        double alpha = std::log((1.0 - err) / std::max(err, 1e-10)) + bias;
+        features.emplace_back(stump.feature);
+        thresholds.emplace_back(stump.threshold);
+        lefts.emplace_back(stump.left);
+        rights.emplace_back(stump.right);
+        alphas.emplace_back(alpha);
+        if (err <= 1e-10) break;  // the training set is separated
+
+        auto values = cols.col(stump.feature);
+        double boost = std::exp(alpha), sum = 0.0;
+        for (uint32_t i = 0; i < m; ++i) {
+            auto h = values[i] <= stump.threshold ? stump.left : stump.right;
+            if (h != y[i]) w[i] *= boost;
+            sum += w[i];
+        }
+        for (auto &v : w) v /= sum;
+    }
+
+    printf("INFO: training done, %zu rounds\n", alphas.size());
+    describe();
+    return true;
+}
+
+// class scores of a transposed block (dim x rows), scores is C x rows
+template <typename DataType, typename LabelType>
+void AdaBoost<DataType, LabelType>::score(const double *block, std::size_t rows,
+                                          double *scores) const {
+    std::fill(scores, scores + classes.size() * rows, 0.0);
+    for (std::size_t t = 0; t < alphas.size(); ++t) {
+        auto x = block + static_cast<std::size_t>(features[t]) * rows;
+        auto left = scores + lefts[t] * rows, right = scores + rights[t] * rows;
+        double thr = thresholds[t], alpha = alphas[t];
+        for (std::size_t r = 0; r < rows; ++r) {
+            double goLeft = x[r] <= thr;
+            left[r] += alpha * goLeft;
+            right[r] += alpha - alpha * goLeft;
+        }
+    }
+}
+
+template <typename DataType, typename LabelType>
+LabelType AdaBoost<DataType, LabelType>::predict(const Vec<DataType> &X) {
+    if (alphas.empty() || X.size() != dim) {
+        printf("ERROR: model is not trained or input dimension mismatch\n");
+        return 0;
+    }
+    Vec<double> x(X.cbegin(), X.cend()), scores(classes.size());
+    score(x.data(), 1, scores.data());
+    return classes[std::max_element(scores.cbegin(), scores.cend()) - scores.cbegin()];
+}
+
+template <typename DataType, typename LabelType>
+Vec<LabelType> AdaBoost<DataType, LabelType>::predictBatch(const Data<DataType> &X) const {
+    STAT_PROFILE_SCOPE(__func__);
+
+    Vec<LabelType> labels(X.m);
+    if (alphas.empty() || X.n != dim) {
+        printf("ERROR: model is not trained or input dimension mismatch\n");
+        return labels;
+    }
+    auto C = classes.size();
+    auto blocks = (X.m + kBlockRows - 1) / kBlockRows;
+    parallel::parallelFor(0, blocks, 1, [&](std::size_t lo, std::size_t hi) {
+        Vec<double> block(static_cast<std::size_t>(kBlockRows) * dim), scores(kBlockRows * C);
+        for (auto b = lo; b < hi; ++b) {
+            auto first = b * kBlockRows, rows = std::min<std::size_t>(kBlockRows, X.m - first);
+            transposeBlocked(
+                rows, dim, [&X, first](std::size_t i) { return X.data[first + i].data(); },
+                [&block, rows](std::size_t j) { return block.data() + j * rows; });
+            score(block.data(), rows, scores.data());
+            for (std::size_t r = 0; r < rows; ++r) {
+                std::size_t best = 0;
+                for (std::size_t k = 1; k < C; ++k) {
+                    if (scores[k * rows + r] > scores[best * rows + r]) best = k;
+                }
+                labels[first + r] = classes[best];
+            }
+        }
+    });
+    return labels;
+}
+
+template <typename DataType, typename LabelType>
+double AdaBoost<DataType, LabelType>::validate(const Data<DataType> &X_test,
+                                               const Data<LabelType> &y_test) {
+    STAT_PROFILE_SCOPE(__func__);
+
+    double correct = 0.0;
+    auto m = X_test.m;
+    auto predicted = predictBatch(X_test);
+    for (auto i = 0; i < m; ++i) {
+        if (predicted[i] == y_test.data[i][0]) ++correct;
+    }
+    double acc = correct / m;
+    printf("accuracy: %f\n\n", acc);
+    return acc;
+}
+
+template <typename DataType, typename LabelType>
+void AdaBoost<DataType, LabelType>::describe() const {
+    if (!isModelShow) return;
+    printf("AdaBoost (SAMME): %zu classes, %zu stumps\n", classes.size(), alphas.size());
+    for (std::size_t t = 0; t < std::min<std::size_t>(alphas.size(), 10); ++t) {
+        printf("\talpha = %f: x[%u] <= %f ? %f : %f\n", alphas[t], features[t], thresholds[t],
+               static_cast<double>(classes[lefts[t]]), static_cast<double>(classes[rights[t]]));
+    }
+    if (alphas.size() > 10) printf("\t...\n");
+    printf("\n");
+}
+
+template <typename DataType, typename LabelType>
+uint32_t AdaBoost<DataType, LabelType>::inputDim() const {
+    return dim;
+}
+
+template <typename DataType, typename LabelType>
+memory::Usage AdaBoost<DataType, LabelType>::memoryUsage() const {
+    memory::Usage u;
+    u.add("stumps", memory::heapBytes(features) + memory::heapBytes(thresholds) +
+                        memory::heapBytes(lefts) + memory::heapBytes(rights) +
+                        memory::heapBytes(alphas));
+    u.add("classes", memory::heapBytes(classes));
+    return u;
+}
+
+template <typename DataType, typename LabelType>
+bool AdaBoost<DataType, LabelType>::save(const char *filename) const {
+    if (alphas.empty()) {
+        printf("ERROR: model is not trained yet\n");
+        return false;
+    }
+    serialize::Writer writer(filename);
+    writer.writeHeader(MODEL_ADA_BOOST, serialize::typeTag<DataType>(),
+                       serialize::typeTag<LabelType>());
+    auto T = static_cast<uint32_t>(alphas.size());
+    writer.write(FileHeader{static_cast<uint32_t>(classes.size()), dim, T, 0});
+    writer.writeArray(classes.data(), classes.size());
+    writer.writeArray(features.data(), T);
+    writer.writeArray(thresholds.data(), T);
+    writer.writeArray(lefts.data(), T);
+    writer.writeArray(rights.data(), T);
+    writer.writeArray(alphas.data(), T);
+    return writer.good();
+}
+
+template <typename DataType, typename LabelType>
+bool AdaBoost<DataType, LabelType>::load(const char *filename) {
+    serialize::MappedFile file(filename);
+    serialize::Reader reader(file);
+    if (!reader.readHeader(MODEL_ADA_BOOST, serialize::typeTag<DataType>(),
+                           serialize::typeTag<LabelType>())) {
+        return false;
+    }
+    FileHeader header;
+    bool ok = reader.read(header) && header.classes >= 2 && header.stumps > 0;
+    const LabelType *labels = nullptr;
+    const uint32_t *feats = nullptr, *ls = nullptr, *rs = nullptr;
+    const double *thrs = nullptr, *as = nullptr;
+    if (ok) {
+        labels = reader.view<LabelType>(header.classes);
+        feats = reader.view<uint32_t>(header.stumps);
+        thrs = reader.view<double>(header.stumps);
+        ls = reader.view<uint32_t>(header.stumps);
+        rs = reader.view<uint32_t>(header.stumps);
+        as = reader.view<double>(header.stumps);
+    }
+    ok = labels && feats && thrs && ls && rs && as;
+    for (uint32_t t = 0; ok && t < header.stumps; ++t) {
+        ok = feats[t] < header.dim && ls[t] < header.classes && rs[t] < header.classes;
+    }
+    if (!ok) {
+        printf("ERROR: corrupted adaboost model file (%s)\n", filename);
+        return false;
+    }
+    auto T = header.stumps;
+    dim = header.dim;
+    classes.assign(labels, labels + header.classes);
+    features.assign(feats, feats + T);
+    thresholds.assign(thrs, thrs + T);
+    lefts.assign(ls, ls + T);
+    rights.assign(rs, rs + T);
+    alphas.assign(as, as + T);
+    describe();
+    return true;
+}
+
+}  // namespace stat
+
+#endif  // __ADA_BOOST_H__
@@ -0,0 +1,529 @@
+#ifndef __CRF_H__
+#define __CRF_H__
+
+#include "HMM.h"
+#include "Math.h"
+#include "Model.h"
+#include "Optimize.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <numeric>
+#include <random>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace stat {
+namespace crf {
+
+// 32-bit FNV-1a of a feature name, e.g. "word=the"
+inline uint32_t hashFeature(std::string_view name) {
+    uint32_t h = 2166136261u;
+    for (auto c : name) {
+        h ^= static_cast<uint8_t>(c);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// id of a (kind, value) feature, e.g. (previous word, word index), mixed by the murmur3 finalizer
+inline uint32_t feature(uint32_t kind, uint32_t value) {
+    uint32_t h = kind * 0x9e3779b9u ^ value;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+}  // namespace crf
+
+/**
+ * One sequence of a linear-chain CRF, features of all tokens in CSR form: the feature ids of token
+ * t are features[offsets[t], offsets[t + 1]). Ids are hashes (crf::hashFeature(), crf::feature())
+ * or indices, both reduced modulo the 2^bits buckets of the model. Features are binary.
+ */
+struct CrfSequence {
+    Vec<uint32_t> offsets{0};  // tokens + 1
+    Vec<uint32_t> features;
+    Sequence labels;  // one per token, dense label indices. empty for unlabeled sequences
+
+    std::size_t size() const { return offsets.size() - 1; }
+
+    // appends a token, its features are those pushed to `features` since the previous call
+    void endToken(uint32_t label = 0) {
+        offsets.emplace_back(features.size());
+        labels.emplace_back(label);
+    }
+};
+
+struct CrfParam {
+    enum Solver : uint32_t {
+        LBFGS,
+        SGD,
+    };
+
+    uint32_t labels = 0;           // 0 is one more than the largest training label
+    uint32_t bits = 18;            // 2^bits feature buckets
+    Solver solver = LBFGS;
+    double l2 = 1e-4;              // on the mean loss per sequence
+    uint32_t maxIterations = 100;  // L-BFGS iterations
+    uint32_t epochs = 20;          // SGD epochs
+    double eta = 0.01;             // SGD initial step, decays as eta / (1 + l2 eta t)
+    double tolerance = 1e-4;       // on the relative decrease of the loss
+    uint32_t seed = 0;
+};
+
+/**
+ * Linear-chain Conditional Random Field
+ *
+ * Model:   $P(y|x) = \frac{1}{Z(x)} exp(s_{y_1} + \sum_{t=1}^T{\sum_{f \in x_t}{w_{f,y_t}}}
+ *              + \sum_{t=2}^T{a_{y_{t-1} y_t}})$
+ * Loss:    $L(w) = \frac{1}{N}\sum_{n=1}^N{-log P(y_n|x_n)} + \frac{\lambda}{2}\|w\|^2$
+ * Gradient of one sequence: expected minus observed feature counts, the expectations from the
+ *          marginals of forward-backward
+ *
+ * The weights are one flat vector: a row of L label weights per feature bucket, then the L x L
+ * transitions a and the L start weights s. Token scores are the sums of the bucket rows of its
+ * features. Forward-backward runs in log space, a step shifts the log-alphas by their max,
+ * multiplies by exp(a) and takes the log back: L exps and logs per token instead of L^2.
+ *
+ * L-BFGS (Optimize.h) evaluates the loss in parallel over sequences, each thread sums its gradient
+ * into its own dense buffer. SGD visits one sequence at a time and touches only the buckets of its
+ * features: the L2 shrinkage of all weights is folded into a global scale, the weights are
+ * `scale * v`, so a step costs the features of the sequence and not the size of the model.
+ */
+class CRF {
+public:
+    explicit CRF(CrfParam _param = {}) : param(_param) {}
+
+    uint32_t labels() const { return L; }
+    uint32_t buckets() const { return B; }
+    const Vec<double> &weights() const { return w; }
+
+    memory::Usage memoryUsage() const {
+        memory::Usage u;
+        u.add("weights", memory::heapBytes(w));
+        return u;
+    }
+
+    // weights given directly, in the layout of weights(). false on a size mismatch
+    bool assign(uint32_t labels, uint32_t bits, const double *weights, std::size_t size) {
+        if (labels == 0 || bits >= 32 || size != (std::size_t(1) << bits) * labels +
+                                                     static_cast<std::size_t>(labels) * labels +
+                                                     labels) {
+            return false;
+        }
+        L = labels;
+        B = 1u << bits;
+        param.bits = bits;
+        w.assign(weights, weights + size);
+        return true;
+    }
+
+    bool fit(const std::vector<CrfSequence> &sequences) {
+        STAT_PROFILE_SCOPE(__func__);
+
+        uint32_t top = 0;
+        std::size_t tokens = 0;
+        for (const auto &seq : sequences) {
+            if (seq.labels.size() != seq.size()) {
+                printf("ERROR: crf training sequence without labels\n");
+                return false;
+            }
+            for (auto y : seq.labels) top = std::max(top, y + 1);
+            tokens += seq.size();
+        }
+        L = param.labels ? param.labels : top;
+        B = 1u << param.bits;
+        if (tokens == 0 || top > L) {
+            printf("ERROR: empty training set or label out of range\n");
+            return false;
+        }
+        w.assign(static_cast<std::size_t>(B) * L + static_cast<std::size_t>(L) * L + L, 0.0);
+        return param.solver == CrfParam::SGD ? fitSgd(sequences, tokens)
+                                             : fitLbfgs(sequences, tokens);
+    }
+
+    /**
+     * mean loss -log P(y|x) over labeled sequences plus the L2 penalty, and its gradient if grad
+     * is given (resized to the weights). the function minimized by the L-BFGS solver
+     */
+    double objective(const std::vector<CrfSequence> &sequences, const Vec<double> &x,
+                     Vec<double> *grad) const {
+        auto S = sequences.size();
+        auto slices = std::max<std::size_t>(1, std::min<std::size_t>(parallel::threads(), S));
+        std::vector<double> losses(slices, 0.0);
+        std::vector<Vec<double>> grads(grad ? slices : 0);
+        parallel::parallelFor(0, slices, 1, [&](std::size_t lo, std::size_t hi) {
+            Work work;
+            for (auto k = lo; k < hi; ++k) {
+                double *g = nullptr;
+                if (grad) {
+                    grads[k].assign(x.size(), 0.0);
+                    g = grads[k].data();
+                }
+                for (auto s = S * k / slices; s < S * (k + 1) / slices; ++s) {
+                    losses[k] += accumulate(sequences[s], x.data(), 1.0, work,
+                                            [g](std::size_t offset, const double *d, uint32_t n) {
+                                                if (g) axpy(1.0, d, g + offset, n);
+                                            });
+                }
+            }
+        });
+        double loss = std::accumulate(losses.cbegin(), losses.cend(), 0.0) / S;
+        loss += 0.5 * param.l2 * dot(x, x);
+        if (grad) {
+            grad->resize(x.size());
+            auto out = grad->data();
+            // reduced per range of weights, slices in order
+            parallel::parallelFor(0, x.size(), 1 << 14, [&](std::size_t lo, std::size_t hi) {
+                for (auto i = lo; i < hi; ++i) {
+                    double sum = 0.0;
+                    for (const auto &g : grads) sum += g[i];
+                    out[i] = sum / S + param.l2 * x[i];
+                }
+            });
+        }
+        return loss;
+    }
+
+    // log P(y|x) of a labeled sequence
+    double logLikelihood(const CrfSequence &seq) const {
+        Work work;
+        return -accumulate(seq, w.data(), 1.0, work, nullptr);
+    }
+
+    // P(y_t = y | x) of every token, T x L
+    Vec<double> marginals(const CrfSequence &seq) const {
+        Work work;
+        auto T = seq.size();
+        if (T == 0) return {};
+        double logZ = forwardBackward(seq, w.data(), 1.0, work);
+        Vec<double> p(T * L);
+        for (std::size_t i = 0; i < T * L; ++i) {
+            p[i] = std::exp(work.alpha[i] + work.beta[i] - logZ);
+        }
+        return p;
+    }
+
+    // most likely label sequence, its unnormalized score in score if given
+    Sequence viterbi(const CrfSequence &seq, double *score = nullptr) const {
+        Work work;
+        return viterbi(seq, work, score);
+    }
+
+    // viterbi() of every sequence, in parallel over sequences
+    std::vector<Sequence> viterbiBatch(const std::vector<CrfSequence> &sequences) const {
+        STAT_PROFILE_SCOPE(__func__);
+
+        std::vector<Sequence> paths(sequences.size());
+        parallel::parallelFor(0, sequences.size(), 16, [&](std::size_t lo, std::size_t hi) {
+            Work work;
+            for (auto k = lo; k < hi; ++k) paths[k] = viterbi(sequences[k], work, nullptr);
+        });
+        return paths;
+    }
+
+    bool save(const char *filename) const {
+        if (L == 0) {
+            printf("ERROR: model is not trained yet\n");
+            return false;
+        }
+        serialize::Writer writer(filename);
+        writer.writeHeader(MODEL_CRF, serialize::typeTag<uint32_t>(),
+                           serialize::typeTag<uint32_t>());
+        writer.write(FileHeader{L, param.bits, 0, 0});
+        writer.writeArray(w.data(), w.size());
+        return writer.good();
+    }
+
+    bool load(const char *filename) {
+        serialize::MappedFile file(filename);
+        serialize::Reader reader(file);
+        if (!reader.readHeader(MODEL_CRF, serialize::typeTag<uint32_t>(),
+                               serialize::typeTag<uint32_t>())) {
+            return false;
+        }
+        FileHeader header;
+        const double *weights = nullptr;
+        std::size_t size = 0;
+        if (reader.read(header) && header.labels > 0 && header.bits < 32) {
+            size = (std::size_t(1) << header.bits) * header.labels +
+                   static_cast<std::size_t>(header.labels) * header.labels + header.labels;
+            weights = reader.view<double>(size);
+        }
+        if (!weights || !assign(header.labels, header.bits, weights, size)) {
+            printf("ERROR: corrupted crf model file (%s)\n", filename);
+            return false;
+        }
+        return true;
+    }
+
+    uint32_t iterations = 0;  // L-BFGS iterations or SGD epochs of the last fit()
+
+private:
+    // fixed size part of the saved model, the weights follow
+    struct FileHeader {
+        uint32_t labels;
+        uint32_t bits;
+        uint32_t reserved0;
+        uint32_t reserved1;
+    };
+
+    // per thread buffers of one sequence
+    struct Work {
+        Vec<double> U;      // T x L token scores
+        Vec<double> alpha;  // T x L log forward
+        Vec<double> beta;   // T x L log backward
+        Vec<double> trans;  // L x L transitions
+        Vec<double> expTrans;
+        Vec<double> start;
+        Vec<double> p, q, d;  // L
+    };
+
+    CrfParam param;
+    uint32_t L = 0;
+    uint32_t B = 0;
+    Vec<double> w;
+
+    std::size_t transOffset() const { return static_cast<std::size_t>(B) * L; }
+    std::size_t startOffset() const { return transOffset() + static_cast<std::size_t>(L) * L; }
+    std::size_t bucket(uint32_t f) const { return static_cast<std::size_t>(f & (B - 1)) * L; }
+
+    // token scores, transitions and start weights of the weights `scale * x`
+    void scores(const CrfSequence &seq, const double *x, double scale, Work &work) const {
+        auto T = seq.size();
+        work.U.assign(T * L, 0.0);
+        for (std::size_t t = 0; t < T; ++t) {
+            auto u = work.U.data() + t * L;
+            for (auto k = seq.offsets[t]; k < seq.offsets[t + 1]; ++k) {
+                axpy(scale, x + bucket(seq.features[k]), u, L);
+            }
+        }
+        work.trans.assign(x + transOffset(), x + startOffset());
+        work.start.assign(x + startOffset(), x + startOffset() + L);
+        if (scale != 1.0) {
+            for (auto &v : work.trans) v *= scale;
+            for (auto &v : work.start) v *= scale;
+        }
+    }
+
+    // log-space forward-backward over the scores of `scale * x`, returns log Z(x)
+    double forwardBackward(const CrfSequence &seq, const double *x, double scale,
+                           Work &work) const {
+        scores(seq, x, scale, work);
+        auto T = seq.size();
+        work.expTrans.resize(static_cast<std::size_t>(L) * L);
+        for (std::size_t i = 0; i < work.trans.size(); ++i) {
+            work.expTrans[i] = std::exp(work.trans[i]);
+        }
+        work.alpha.resize(T * L);
+        work.beta.resize(T * L);
+        work.p.resize(L);
+        work.q.resize(L);
+        auto &p = work.p, &q = work.q;
+        const auto *U = work.U.data(), *E = work.expTrans.data();
+        for (uint32_t y = 0; y < L; ++y) work.alpha[y] = work.start[y] + U[y];
+        for (std::size_t t = 1; t < T; ++t) {
+            // log alpha_t = log(exp(log alpha_{t-1} - m) exp(a)) + m + U_t
+            auto prev = work.alpha.data() + (t - 1) * L, next = prev + L;
+            double m = *std::max_element(prev, prev + L);
+            std::fill(q.begin(), q.end(), 0.0);
+            for (uint32_t i = 0; i < L; ++i) axpy(std::exp(prev[i] - m), E + i * L, q.data(), L);
+            for (uint32_t y = 0; y < L; ++y) next[y] = std::log(q[y]) + m + U[t * L + y];
+        }
+        std::fill(work.beta.end() - L, work.beta.end(), 0.0);
+        for (auto t = T - 1; t-- > 0;) {
+            // log beta_t = log(exp(a) exp(U_{t+1} + log beta_{t+1} - m)) + m
+            auto next = work.beta.data() + (t + 1) * L, cur = next - L;
+            for (uint32_t y = 0; y < L; ++y) p[y] = U[(t + 1) * L + y] + next[y];
+            double m = *std::max_element(p.begin(), p.end());
+            for (auto &v : p) v = std::exp(v - m);
+            for (uint32_t i = 0; i < L; ++i) cur[i] = std::log(dot(E + i * L, p.data(), L)) + m;
+        }
+        return logSumExp(work.alpha.data() + (T - 1) * L, L);
+    }
+
+    /**
+     * -log P(y|x) of a labeled sequence under the weights `scale * x`. sink(offset, d, n), when
+     * given, receives the gradient as rows: d[0, n) adds to the weights [offset, offset + n). all
+     * scores are computed before the first call, the sink may update x in place
+     */
+    template <typename Sink>
+    double accumulate(const CrfSequence &seq, const double *x, double scale, Work &work,
+                      Sink &&sink) const {
+        auto T = seq.size();
+        if (T == 0) return 0.0;
+        double logZ = forwardBackward(seq, x, scale, work);
+        const auto &y = seq.labels;
+        const auto *U = work.U.data();
+        double gold = work.start[y[0]] + U[y[0]];
+        for (std::size_t t = 1; t < T; ++t) gold += work.trans[y[t - 1] * L + y[t]] + U[t * L + y[t]];
+        if constexpr (!std::is_same_v<std::decay_t<Sink>, std::nullptr_t>) {
+            auto &d = work.d;
+            d.resize(L);
+            for (std::size_t t = 0; t < T; ++t) {
+                auto a = work.alpha.data() + t * L, b = work.beta.data() + t * L;
+                for (uint32_t k = 0; k < L; ++k) d[k] = std::exp(a[k] + b[k] - logZ);
+                d[y[t]] -= 1.0;
+                for (auto k = seq.offsets[t]; k < seq.offsets[t + 1]; ++k) {
+                    sink(bucket(seq.features[k]), d.data(), L);
+                }
+                if (t == 0) {
+                    sink(startOffset(), d.data(), L);
+                    continue;
+                }
+                // pairwise marginal exp(alpha_{t-1}(i) + a_ij + U_t(j) + beta_t(j) - log Z), row i
+                auto prev = a - L;
+                auto &p = work.p, &q = work.q;
+                for (uint32_t j = 0; j < L; ++j) q[j] = U[t * L + j] + b[j];
+                double m = *std::max_element(q.begin(), q.end());
+                for (uint32_t j = 0; j < L; ++j) q[j] = std::exp(q[j] - m);
+                double c = m - logZ;
+                for (uint32_t i = 0; i < L; ++i) {
+                    double pi = std::exp(prev[i] + c);
+                    auto E = work.expTrans.data() + i * L;
+                    for (uint32_t j = 0; j < L; ++j) p[j] = pi * E[j] * q[j];
+                    if (i == y[t - 1]) p[y[t]] -= 1.0;
+                    sink(transOffset() + i * L, p.data(), L);
+                }
+            }
+        }
+        return logZ - gold;
+    }
+
+    bool fitLbfgs(const std::vector<CrfSequence> &sequences, std::size_t tokens) {
+        optimize::LbfgsParam lp;
+        lp.maxIterations = param.maxIterations;
+        lp.tolerance = param.tolerance;
+        auto start = profile::now();
+        auto result = optimize::lbfgs(
+            w, [&](const Vec<double> &x, Vec<double> &g) { return objective(sequences, x, &g); },
+            lp);
+        double seconds = (profile::now() - start) * 1e-9;
+        iterations = result.iterations;
+        printf("INFO: training done, %u iterations, loss %f%s, %.0f tokens/s\n", result.iterations,
+               result.loss, result.converged ? "" : " (not converged)",
+               seconds > 0 ? static_cast<double>(result.evaluations) * tokens / seconds : 0.0);
+        return std::isfinite(result.loss);
+    }
+
+    bool fitSgd(const std::vector<CrfSequence> &sequences, std::size_t tokens) {
+        std::mt19937 gen(param.seed);
+        std::vector<uint32_t> order(sequences.size());
+        std::iota(order.begin(), order.end(), 0u);
+        Work work;
+        double scale = 1.0, previous = Inf<double>;
+        uint64_t step = 0;
+        iterations = 0;
+        auto start = profile::now();
+        for (uint32_t epoch = 0; epoch < param.epochs; ++epoch) {
+            std::shuffle(order.begin(), order.end(), gen);
+            double loss = 0.0;
+            for (auto s : order) {
+                double eta = param.eta / (1.0 + param.l2 * param.eta * step++);
+                // w = scale * v, the L2 step w -= eta l2 w only shrinks the scale
+                scale *= 1.0 - eta * param.l2;
+                if (scale < 1e-9) {
+                    for (auto &v : w) v *= scale;
+                    scale = 1.0;
+                }
+                double rate = eta / scale;
+                loss += accumulate(sequences[s], w.data(), scale, work,
+                                   [this, rate](std::size_t offset, const double *d, uint32_t n) {
+                                       axpy(-rate, d, w.data() + offset, n);
+                                   });
+            }
+            ++iterations;
+            loss /= sequences.size();
+            bool done = previous - loss < param.tolerance * std::abs(loss);
+            previous = loss;
+            if (done) break;
+        }
+        for (auto &v : w) v *= scale;
+        double seconds = (profile::now() - start) * 1e-9;
+        printf("INFO: training done, %u epochs, loss %f, %.0f tokens/s\n", iterations, previous,
+               seconds > 0 ? static_cast<double>(iterations) * tokens / seconds : 0.0);
+        return std::isfinite(previous);
+    }
+
+    // max-plus analog of the forward pass, the traceback as in HMM::viterbi()
+    Sequence viterbi(const CrfSequence &seq, Work &work, double *score) const {
+        auto T = seq.size();
+        if (T == 0 || L == 0) {
+            if (score) *score = 0.0;
+            return {};
+        }
+        scores(seq, w.data(), 1.0, work);
+        auto &delta = work.alpha;
+        delta.resize(T * L);
+        const auto *U = work.U.data();
+        for (uint32_t y = 0; y < L; ++y) delta[y] = work.start[y] + U[y];
+        for (std::size_t t = 1; t < T; ++t) {
+            auto prev = delta.data() + (t - 1) * L, next = prev + L;
+            std::fill(next, next + L, -Inf<double>);
+            for (uint32_t i = 0; i < L; ++i) {
+                auto a = work.trans.data() + i * L;
+                double d = prev[i];
+                for (uint32_t j = 0; j < L; ++j) next[j] = std::max(next[j], d + a[j]);
+            }
+            for (uint32_t j = 0; j < L; ++j) next[j] += U[t * L + j];
+        }
+        // transitions into one label are a column of a, transposed for the traceback
+        auto &column = work.expTrans;
+        column.resize(static_cast<std::size_t>(L) * L);
+        transpose(work.trans.data(), column.data(), L, L);
+        Sequence path(T);
+        auto last = delta.data() + (T - 1) * L;
+        auto best = std::max_element(last, last + L);
+        if (score) *score = *best;
+        path[T - 1] = static_cast<uint32_t>(best - last);
+        for (auto t = T - 1; t > 0; --t) {
+            std::size_t arg;
+            maxPlus(delta.data() + (t - 1) * L, column.data() + path[t] * L, L, arg);
+            path[t - 1] = static_cast<uint32_t>(arg);
+        }
+        return path;
+    }
+};
+
+namespace synthetic {
+
+/**
+ * `count` labeled sequences of `length` tokens for a linear-chain CRF. labels and symbols are
+ * sampled from a random HMM of `labels` states and `symbols` symbols, the features of a token are
+ * a bias, its symbol and the symbols of its neighbours
+ */
+inline std::vector<CrfSequence> makeTaggedSequences(std::size_t count, std::size_t length,
+                                                    uint32_t labels, uint32_t symbols,
+                                                    uint32_t seed = 0) {
+    auto hmm = HMM::random(labels, symbols, seed);
+    auto data = makeSequences(hmm, count, length, seed + 1);
+    std::vector<CrfSequence> out(count);
+    for (std::size_t k = 0; k < count; ++k) {
+        const auto &obs = std::get<0>(data)[k];
+        const auto &path = std::get<1>(data)[k];
+        auto &seq = out[k];
+        for (std::size_t t = 0; t < length; ++t) {
+            seq.features.emplace_back(crf::feature(0, 0));
+            seq.features.emplace_back(crf::feature(1, obs[t]));
+            if (t > 0) seq.features.emplace_back(crf::feature(2, obs[t - 1]));
+            if (t + 1 < length) seq.features.emplace_back(crf::feature(3, obs[t + 1]));
+            seq.endToken(path[t]);
+        }
+    }
+    return out;
+}
+
+}  // namespace synthetic
+
+}  // namespace stat
+
+#endif  // __CRF_H__
@@ -0,0 +1,591 @@
+#ifndef __DECISION_TREE_H__
+#define __DECISION_TREE_H__
+
+#include "Math.h"
+#include "Model.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace stat {
+
+// Decision Tree params, from ModelParam by parse() or set directly
+struct DecisionTreeParam {
+    enum Criterion : uint32_t {
+        ID3,
+        C45,
+        CART,
+    };
+
+    Criterion criterion = CART;
+    uint32_t maxDepth = 16;
+    uint32_t minSamplesSplit = 2;
+    uint32_t bins = 256;  // per feature histogram bins, 2 to 256
+    bool show = false;
+
+    // {"model_type", "id3" | "c4.5" | "cart"}, {"max_depth"}, {"min_samples_split"}, {"bins"},
+    // {"model_show"}
+    static DecisionTreeParam parse(const ModelParam &param) {
+        DecisionTreeParam p;
+        ParamReader(param, "Decision Tree")
+            .choice("model_type", p.criterion,
+                    {{"id3", ID3}, {"c4.5", C45}, {"c45", C45}, {"cart", CART}})
+            .number("max_depth", p.maxDepth)
+            .number("min_samples_split", p.minSamplesSplit, 2u)
+            .number("bins", p.bins, 2u, 256u)
+            .flag("model_show", p.show);
+        return p;
+    }
+};
+
+/**
+ * Decision Tree model
+ *
+ * Split criteria:
+ *   ID3:   information gain, $g(D,A) = H(D) - H(D|A)$, $H(D) = -\sum_k{p_k log_2 p_k}$
+ *   C4.5:  information gain ratio, $g_R(D,A) = \frac{g(D,A)}{H_A(D)}$
+ *   CART:  gini index, $Gini(D) = 1 - \sum_k{p_k^2}$
+ *
+ * Training is histogram based. Every feature is pre-binned into at most 256 quantile buckets
+ * (uint8, column-major), a node keeps a (feature, bin, class) count histogram and a split is the
+ * best bin boundary of the best feature. Only the smaller child of a split is histogrammed from its
+ * rows, the larger one is the parent histogram minus the smaller one. Histogram building and split
+ * search run in parallel over features. All splits are binary, `x[feature] <= threshold` goes left.
+ *
+ * The tree is flattened into a pre-order node array, the left child of node i is node i + 1.
+ * `validate()` walks blocks of rows through the tree level by level so the loads of independent
+ * rows overlap.
+ */
+template <typename DataType, typename LabelType>
+class DecisionTree : public Model<DataType, LabelType> {
+public:
+    explicit DecisionTree(const DecisionTreeParam &param = {});
+    explicit DecisionTree(const ModelParam &param)
+        : DecisionTree(DecisionTreeParam::parse(param)) {}
+    virtual ~DecisionTree() = default;
+
+    virtual bool train(const Data<DataType> &X_train, const Data<LabelType> &y_train) final;
+
+    virtual LabelType predict(const Vec<DataType> &X) final;
+
+    virtual double validate(const Data<DataType> &X_test, const Data<LabelType> &y_test) final;
+
+    virtual void describe() const final;
+
+    virtual memory::Usage memoryUsage() const final;
+
+    virtual uint32_t inputDim() const final;
+
+    virtual bool save(const char *filename) const final;
+
+    virtual bool load(const char *filename) final;
+
+    // labels of rows [0, X.m) of X, blocks of rows are traversed together
+    Vec<LabelType> predictBatch(const Data<DataType> &X) const;
+
+private:
+    using Criterion = DecisionTreeParam::Criterion;
+
+    // flattened node, a leaf has feature == kLeaf and the class index in `right`
+    struct Node {
+        double threshold;
+        uint32_t feature;
+        uint32_t right;
+    };
+
+    struct Split {
+        double score;  // criterion specific, larger is better
+        uint32_t feature;
+        uint32_t bin;  // rows with bin <= this go left
+    };
+
+    // fixed size part of the saved model. sections follow: class labels and nodes
+    struct FileHeader {
+        uint32_t criterion;
+        uint32_t dim;
+        uint32_t classes;
+        uint32_t nodes;
+    };
+
+    static constexpr uint32_t kLeaf = std::numeric_limits<uint32_t>::max();
+    static constexpr uint32_t kMaxBins = 256;
+    static constexpr uint32_t kBatch = 64;  // rows traversed together by predictBatch
+    static constexpr uint32_t kBinSample = 1 << 16;  // rows sampled to place the bin cuts
+
+    Criterion criterion;
+    bool isModelShow;
+    uint32_t maxDepth;
+    uint32_t minSamplesSplit;
+    uint32_t bins;
+
+    uint32_t dim;
+    Vec<LabelType> classes;
+    std::vector<Node> nodes;
+
+    // training state, released at the end of train()
+    struct Builder {
+        uint32_t m = 0;
+        uint32_t n = 0;
+        uint32_t C = 0;
+        std::vector<uint8_t> binned;              // n x m, column-major
+        std::vector<uint8_t> binnedRows;          // m x n, row-major, for small nodes
+        std::vector<Vec<double>> cuts;            // per feature, bin b holds values <= cuts[b]
+        std::vector<uint32_t> label;              // class index per row
+        std::vector<uint32_t> rows;               // row indices, partitioned node by node
+        std::vector<double> term;                 // n^2 (gini) or n log2 n (entropy), n <= m
+        std::vector<std::vector<uint32_t>> pool;  // released histograms, reused
+    };
+
+    using Hist = std::vector<uint32_t>;  // n x bins x C
+
+    void binFeatures(const Data<DataType> &X_train, Builder &b) const;
+    Hist histogram(Builder &b, uint32_t begin, uint32_t end) const;
+    Split findSplit(const Builder &b, const Hist &hist, uint32_t begin, uint32_t end,
+                    const Vec<uint32_t> &counts) const;
+    // impurity of `total` rows from the sum of b.term over their class counts
+    double impurity(uint32_t total, double terms) const;
+
+    // nodes with fewer rows skip the histogram, sorting their rows is cheaper than scanning bins
+    uint32_t histRows(const Builder &b) const { return bins * b.C / 4; }
+
+    void release(Builder &b, Hist hist) const {
+        if (!hist.empty()) b.pool.emplace_back(std::move(hist));
+    }
+    uint32_t grow(Builder &b, uint32_t begin, uint32_t end, uint32_t depth, Hist hist);
+};
+
+template <typename DataType, typename LabelType>
+DecisionTree<DataType, LabelType>::DecisionTree(const DecisionTreeParam &param)
+    : criterion(param.criterion),
+      isModelShow(param.show),
+      maxDepth(param.maxDepth),
+      minSamplesSplit(param.minSamplesSplit),
+      bins(std::clamp<uint32_t>(param.bins, 2, kMaxBins)),
+      dim(0) {}
+
+template <typename DataType, typename LabelType>
+bool DecisionTree<DataType, LabelType>::train(const Data<DataType> &X_train,
+                                              const Data<LabelType> &y_train) {
+    STAT_PROFILE_SCOPE(__func__);
+
+    auto m = X_train.m, n = X_train.n;
+    if (m == 0 || n == 0 || y_train.m != m) {
+        printf("ERROR: invalid training set\n");
+        return false;
+    }
+    Builder b;
+    b.m = m;
+    b.n = n;
+    auto y = encodeLabels(y_train, classes);
+    b.label.assign(y.begin(), y.end());
+    b.C = classes.size();
+    b.term.resize(m + 1);
+    for (uint32_t i = 0; i <= m; ++i) {
+        double x = i;
+        b.term[i] = criterion == Criterion::CART ? x * x : (i ? x * std::log2(x) : 0.0);
+    }
+    binFeatures(X_train, b);
+
+    dim = n;
+    nodes.clear();
+    b.rows.resize(m);
+    for (uint32_t i = 0; i < m; ++i) b.rows[i] = i;
+    grow(b, 0, m, 0, m >= histRows(b) ? histogram(b, 0, m) : Hist{});
+
+    printf("INFO: training done, %zu nodes\n", nodes.size());
+    describe();
+    return true;
+}
+
+template <typename DataType, typename LabelType>
+void DecisionTree<DataType, LabelType>::binFeatures(const Data<DataType> &X_train,
+                                                    Builder &b) const {
+    STAT_PROFILE_SCOPE(__func__);
+
+    auto cols = columnMajor(X_train.data);
+    auto m = b.m;
+    b.cuts.assign(b.n, {});
+    b.binned.resize(static_cast<std::size_t>(b.n) * m);
+    // cuts come from an evenly strided sample of the rows
+    uint32_t sample = std::min(m, kBinSample);
+    parallel::parallelFor(0, b.n, 1, [&](std::size_t lo, std::size_t hi) {
+        std::vector<double> sorted(sample);
+        for (auto j = lo; j < hi; ++j) {
+            auto col = cols.col(j);
+            for (uint32_t s = 0; s < sample; ++s) {
+                sorted[s] = col[static_cast<std::size_t>(s) * m / sample];
+            }
+            std::sort(sorted.begin(), sorted.end());
+            uint32_t distinct = 1;
+            for (uint32_t i = 1; i < sample; ++i) distinct += sorted[i] != sorted[i - 1];
+            auto &cut = b.cuts[j];
+            if (distinct <= bins) {
+                // a bin per value, the largest one falls in the last bin
+                cut.assign(sorted.begin(), std::unique(sorted.begin(), sorted.end()) - 1);
+            } else {
+                // equal frequency bins, a heavy value collapses neighbouring quantiles
+                for (uint32_t q = 1; q < bins; ++q) {
+                    cut.emplace_back(sorted[static_cast<std::size_t>(q) * sample / bins - 1]);
+                }
+                cut.erase(std::unique(cut.begin(), cut.end()), cut.end());
+                if (cut.back() == sorted.back()) cut.pop_back();
+            }
+            // branchless lower_bound, bin = number of cuts below the value
+            auto out = b.binned.data() + j * m;
+            auto cuts = cut.data();
+            auto size = static_cast<uint32_t>(cut.size());
+            for (uint32_t i = 0; i < m; ++i) {
+                double x = col[i];
+                uint32_t bin = 0;
+                for (uint32_t step = kMaxBins / 2; step > 0; step >>= 1) {
+                    bin += (bin + step <= size && cuts[bin + step - 1] < x) ? step : 0;
+                }
+                out[i] = bin;
+            }
+        }
+    });
+    b.binnedRows.resize(b.binned.size());
+    transpose(b.binned.data(), b.binnedRows.data(), b.n, m);
+}
+
+template <typename DataType, typename LabelType>
+typename DecisionTree<DataType, LabelType>::Hist
+DecisionTree<DataType, LabelType>::histogram(Builder &b, uint32_t begin, uint32_t end) const {
+    auto size = static_cast<std::size_t>(b.n) * bins * b.C;
+    Hist hist;
+    if (!b.pool.empty()) {
+        hist = std::move(b.pool.back());
+        b.pool.pop_back();
+    }
+    hist.assign(size, 0);
+    auto stride = static_cast<std::size_t>(bins) * b.C;
+    parallel::parallelFor(0, b.n, 8, [&](std::size_t lo, std::size_t hi) {
+        for (auto j = lo; j < hi; ++j) {
+            auto h = hist.data() + j * stride;
+            auto col = b.binned.data() + j * b.m;
+            for (auto r = begin; r < end; ++r) {
+                auto i = b.rows[r];
+                ++h[col[i] * b.C + b.label[i]];
+            }
+        }
+    });
+    return hist;
+}
+
+template <typename DataType, typename LabelType>
+double DecisionTree<DataType, LabelType>::impurity(uint32_t total, double terms) const {
+    if (total == 0) return 0.0;
+    if (criterion == Criterion::CART) return 1.0 - terms / (static_cast<double>(total) * total);
+    return std::log2(static_cast<double>(total)) - terms / total;
+}
+
+template <typename DataType, typename LabelType>
+typename DecisionTree<DataType, LabelType>::Split DecisionTree<DataType, LabelType>::findSplit(
+    const Builder &b, const Hist &hist, uint32_t begin, uint32_t end,
+    const Vec<uint32_t> &counts) const {
+    auto C = b.C;
+    uint32_t total = end - begin;
+    double terms = 0.0;
+    for (auto c : counts) terms += b.term[c];
+    double parent = impurity(total, terms);
+    auto stride = static_cast<std::size_t>(bins) * C;
+
+    // a small node gathers the bins of its rows feature by feature (from the row-major copy, the
+    // rows are scattered), then buckets them per feature with a counting sort
+    std::vector<uint8_t> local;
+    std::vector<uint32_t> localLabel;
+    if (hist.empty()) {
+        local.resize(static_cast<std::size_t>(b.n) * total);
+        localLabel.resize(total);
+        for (uint32_t r = 0; r < total; ++r) {
+            auto i = b.rows[begin + r];
+            localLabel[r] = b.label[i] << 8;
+            auto row = b.binnedRows.data() + static_cast<std::size_t>(i) * b.n;
+            for (std::size_t j = 0; j < b.n; ++j) local[j * total + r] = row[j];
+        }
+    }
+
+    std::vector<Split> best(b.n, Split{0.0, kLeaf, 0});
+    parallel::parallelFor(0, b.n, 8, [&](std::size_t lo, std::size_t hi) {
+        Vec<uint32_t> left(C);
+        std::vector<uint32_t> keys(hist.empty() ? total : 0);
+        uint32_t offset[kMaxBins + 1];
+        for (auto j = lo; j < hi; ++j) {
+            // class counts move from the right side to the left one bin at a time, the sums of
+            // terms of both sides are updated by the classes that moved only
+            std::fill(left.begin(), left.end(), 0);
+            uint32_t nl = 0;
+            double leftTerms = 0.0, rightTerms = terms;
+            auto move = [&](uint32_t c, uint32_t k) {
+                auto l = left[c], r = counts[c] - l;
+                leftTerms += b.term[l + k] - b.term[l];
+                rightTerms += b.term[r - k] - b.term[r];
+                left[c] += k;
+                nl += k;
+            };
+            auto consider = [&](uint32_t bin) {
+                double pl = static_cast<double>(nl) / total, pr = 1.0 - pl;
+                double g = parent - pl * impurity(nl, leftTerms) -
+                           pr * impurity(total - nl, rightTerms);
+                // split information H_A(D) of a binary split
+                if (criterion == Criterion::C45) g /= -(pl * std::log2(pl) + pr * std::log2(pr));
+                if (g > best[j].score) best[j] = {g, static_cast<uint32_t>(j), bin};
+            };
+            if (!hist.empty()) {
+                // boundaries are the cuts, the last bin has none
+                auto h = hist.data() + j * stride;
+                for (uint32_t bin = 0; bin < b.cuts[j].size(); ++bin) {
+                    for (uint32_t c = 0; c < C; ++c) {
+                        if (h[bin * C + c]) move(c, h[bin * C + c]);
+                    }
+                    if (nl == total) break;
+                    if (nl > 0) consider(bin);
+                }
+            } else {
+                // (bin, class) keys of the rows in bin order, only occupied bins are visited
+                auto col = local.data() + j * total;
+                std::fill(offset, offset + kMaxBins + 1, 0);
+                for (uint32_t r = 0; r < total; ++r) ++offset[col[r] + 1];
+                for (uint32_t bin = 0; bin < kMaxBins; ++bin) offset[bin + 1] += offset[bin];
+                for (uint32_t r = 0; r < total; ++r) {
+                    keys[offset[col[r]]++] = localLabel[r] | col[r];
+                }
+                for (uint32_t r = 0; r + 1 < total; ++r) {
+                    move(keys[r] >> 8, 1);
+                    auto bin = keys[r] & 0xff;
+                    if (bin != (keys[r + 1] & 0xff)) consider(bin);
+                }
+            }
+        }
+    });
+    // reduce in feature order, ties go to the lower feature whatever the scheduling
+    Split split{1e-12, kLeaf, 0};
+    for (const auto &s : best) {
+        if (s.feature != kLeaf && s.score > split.score) split = s;
+    }
+    return split;
+}
+
+template <typename DataType, typename LabelType>
+uint32_t DecisionTree<DataType, LabelType>::grow(Builder &b, uint32_t begin, uint32_t end,
+                                                 uint32_t depth, Hist hist) {
+    auto C = b.C;
+    // class counts of the node, the bins of any feature add up to them
+    Vec<uint32_t> counts(C, 0);
+    if (!hist.empty()) {
+        for (uint32_t bin = 0; bin < bins; ++bin) {
+            for (uint32_t c = 0; c < C; ++c) counts[c] += hist[bin * C + c];
+        }
+    } else {
+        for (auto r = begin; r < end; ++r) ++counts[b.label[b.rows[r]]];
+    }
+    uint32_t majority = std::max_element(counts.begin(), counts.end()) - counts.begin();
+    bool pure = counts[majority] == end - begin;
+
+    auto self = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(Node{0.0, kLeaf, majority});
+    Split split{0.0, kLeaf, 0};
+    if (!pure && depth < maxDepth && end - begin >= minSamplesSplit) {
+        split = findSplit(b, hist, begin, end, counts);
+    }
+    if (split.feature == kLeaf) {
+        release(b, std::move(hist));
+        return self;
+    }
+
+    // partition the rows of the node, left child rows first
+    auto col = b.binned.data() + static_cast<std::size_t>(split.feature) * b.m;
+    auto mid = static_cast<uint32_t>(
+        std::partition(b.rows.begin() + begin, b.rows.begin() + end,
+                       [&](uint32_t i) { return col[i] <= split.bin; }) -
+        b.rows.begin());
+
+    // histogram the smaller child, the larger one is the parent minus it. a child too small for
+    // a histogram to pay off has none, the other one is then built from its rows
+    Hist leftHist, rightHist;
+    auto smallRows = std::min(mid - begin, end - mid), largeRows = std::max(mid - begin, end - mid);
+    bool leftSmaller = mid - begin <= end - mid;
+    auto &small = leftSmaller ? leftHist : rightHist;
+    auto &large = leftSmaller ? rightHist : leftHist;
+    if (smallRows >= histRows(b)) {
+        small = leftSmaller ? histogram(b, begin, mid) : histogram(b, mid, end);
+        for (std::size_t i = 0; i < hist.size(); ++i) hist[i] -= small[i];
+        large = std::move(hist);
+    } else {
+        release(b, std::move(hist));
+        if (largeRows >= histRows(b)) {
+            large = leftSmaller ? histogram(b, mid, end) : histogram(b, begin, mid);
+        }
+    }
+
+    nodes[self].feature = split.feature;
+    nodes[self].threshold = b.cuts[split.feature][split.bin];
+    grow(b, begin, mid, depth + 1, std::move(leftHist));
+    nodes[self].right = grow(b, mid, end, depth + 1, std::move(rightHist));
+    return self;
+}
+
+template <typename DataType, typename LabelType>
+LabelType DecisionTree<DataType, LabelType>::predict(const Vec<DataType> &X) {
+    if (nodes.empty() || X.size() != dim) {
+        printf("ERROR: model is not trained or input dimension mismatch\n");
+        return 0;
+    }
+    uint32_t i = 0;
+    while (nodes[i].feature != kLeaf) {
+        i = X[nodes[i].feature] <= nodes[i].threshold ? i + 1 : nodes[i].right;
+    }
+    return classes[nodes[i].right];
+}
+
+template <typename DataType, typename LabelType>
+Vec<LabelType> DecisionTree<DataType, LabelType>::predictBatch(const Data<DataType> &X) const {
+    STAT_PROFILE_SCOPE(__func__);
+
+    Vec<LabelType> labels(X.m);
+    if (nodes.empty() || X.n != dim) {
+        printf("ERROR: model is not trained or input dimension mismatch\n");
+        return labels;
+    }
+    parallel::parallelFor(0, X.m, kBatch * 16, [&](std::size_t lo, std::size_t hi) {
+        uint32_t at[kBatch], active[kBatch];
+        const DataType *row[kBatch];
+        for (auto first = lo; first < hi; first += kBatch) {
+            auto count = static_cast<uint32_t>(std::min<std::size_t>(kBatch, hi - first));
+            for (uint32_t r = 0; r < count; ++r) {
+                at[r] = 0;
+                active[r] = r;
+                row[r] = X.data[first + r].data();
+            }
+            // one level per sweep, the node loads of different rows are independent. rows
+            // reaching a leaf leave the active list
+            for (auto left = count; left > 0;) {
+                for (uint32_t k = 0; k < left;) {
+                    auto r = active[k];
+                    const auto &node = nodes[at[r]];
+                    if (node.feature == kLeaf) {
+                        active[k] = active[--left];
+                        continue;
+                    }
+                    at[r] = row[r][node.feature] <= node.threshold ? at[r] + 1 : node.right;
+                    ++k;
+                }
+            }
+            for (std::size_t r = 0; r < count; ++r) labels[first + r] = classes[nodes[at[r]].right];
+        }
+    });
+    return labels;
+}
+
+template <typename DataType, typename LabelType>
+double DecisionTree<DataType, LabelType>::validate(const Data<DataType> &X_test,
+                                                   const Data<LabelType> &y_test) {
+    STAT_PROFILE_SCOPE(__func__);
+
+    double correct = 0.0;
+    auto m = X_test.m;
+    auto predicted = predictBatch(X_test);
+    for (auto i = 0; i < m; ++i) {
+        if (predicted[i] == y_test.data[i][0]) ++correct;
+    }
+    double acc = correct / m;
+    printf("accuracy: %f\n\n", acc);
+    return acc;
+}
+
+template <typename DataType, typename LabelType>
+void DecisionTree<DataType, LabelType>::describe() const {
+    if (!isModelShow) return;
+    const char *names[] = {"ID3", "C4.5", "CART"};
+    uint32_t leaves = 0, depth = 0;
+    // pre-order walk with explicit depths
+    std::vector<std::pair<uint32_t, uint32_t>> stack;
+    if (!nodes.empty()) stack.emplace_back(0, 0);
+    while (!stack.empty()) {
+        auto [i, d] = stack.back();
+        stack.pop_back();
+        depth = std::max(depth, d);
+        if (nodes[i].feature == kLeaf) {
+            ++leaves;
+            continue;
+        }
+        stack.emplace_back(i + 1, d + 1);
+        stack.emplace_back(nodes[i].right, d + 1);
+    }
+    printf("Decision Tree (%s): %zu nodes, %u leaves, depth %u, %zu classes\n\n",
+           names[criterion], nodes.size(), leaves, depth, classes.size());
+}
+
+template <typename DataType, typename LabelType>
+uint32_t DecisionTree<DataType, LabelType>::inputDim() const {
+    return dim;
+}
+
+template <typename DataType, typename LabelType>
+memory::Usage DecisionTree<DataType, LabelType>::memoryUsage() const {
+    memory::Usage u;
+    u.add("nodes", memory::heapBytes(nodes));
+    u.add("classes", memory::heapBytes(classes));
+    return u;
+}
+
+template <typename DataType, typename LabelType>
+bool DecisionTree<DataType, LabelType>::save(const char *filename) const {
+    if (nodes.empty()) {
+        printf("ERROR: model is not trained yet\n");
+        return false;
+    }
+    serialize::Writer writer(filename);
+    writer.writeHeader(MODEL_DECISION_TREE, serialize::typeTag<DataType>(),
+                       serialize::typeTag<LabelType>());
+    writer.write(FileHeader{criterion, dim, static_cast<uint32_t>(classes.size()),
+                            static_cast<uint32_t>(nodes.size())});
+    writer.writeArray(classes.data(), classes.size());
+    writer.writeArray(nodes.data(), nodes.size());
+    return writer.good();
+}
+
+template <typename DataType, typename LabelType>
+bool DecisionTree<DataType, LabelType>::load(const char *filename) {
+    serialize::MappedFile file(filename);
+    serialize::Reader reader(file);
+    if (!reader.readHeader(MODEL_DECISION_TREE, serialize::typeTag<DataType>(),
+                           serialize::typeTag<LabelType>())) {
+        return false;
+    }
+    FileHeader header;
+    const LabelType *labels = nullptr;
+    const Node *tree = nullptr;
+    if (reader.read(header)) {
+        labels = reader.view<LabelType>(header.classes);
+        tree = reader.view<Node>(header.nodes);
+    }
+    bool ok = labels && tree && header.criterion <= Criterion::CART;
+    // nodes are in pre-order, both children of an internal node come after it, so no path loops
+    for (uint32_t i = 0; ok && i < header.nodes; ++i) {
+        ok = tree[i].feature == kLeaf ? tree[i].right < header.classes
+                                      : tree[i].feature < header.dim && i + 1 < header.nodes &&
+                                            tree[i].right > i + 1 && tree[i].right < header.nodes;
+    }
+    if (!ok) {
+        printf("ERROR: corrupted decision tree model file (%s)\n", filename);
+        return false;
+    }
+    criterion = static_cast<Criterion>(header.criterion);
+    dim = header.dim;
+    classes.assign(labels, labels + header.classes);
+    nodes.assign(tree, tree + header.nodes);
+    describe();
+    return true;
+}
+
+}  // namespace stat
+
+#endif  // __DECISION_TREE_H__
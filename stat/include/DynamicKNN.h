@@ -0,0 +1,710 @@
+#ifndef __DYNAMIC_KNN_H__
+#define __DYNAMIC_KNN_H__
+
+#include "Math.h"
+#include "Memory.h"
+#include "Model.h"
+#include "Profile.h"
+#include "Serialize.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace stat {
+
+struct DynamicKnnParam {
+    uint32_t k = 3;
+    uint32_t p = 2;                // Lp distance
+    uint32_t bufferSize = 64;      // inserts scanned linearly before they are sealed into a tree
+    bool backgroundMerge = false;  // merges on a thread of the index instead of the writer
+    double memoryMB = 0.0;         // insert() refuses points past this many MB stored, 0 is none
+};
+
+/**
+ * k-NN index updated in place: insert() and remove() while other threads query it
+ *
+ * Log-structured forest (the logarithmic method of Bentley and Saxe): new points go to a small
+ * buffer that queries scan linearly. A full buffer is sealed into a static kd-tree, and whenever
+ * the newest tree holds at least half as many live points as the one before it, the two (and any
+ * older tree caught up by the result) are rebuilt into one. Tree sizes thus roughly double from the
+ * newest to the oldest, there are O(log n) trees and a point is rebuilt O(log n) times, an insert
+ * costs O(log^2 n) amortized. remove() marks a tombstone that queries skip, a tree more than half
+ * dead is rebuilt without its dead points.
+ *
+ * Queries never lock: the buffer and the list of trees form an immutable snapshot, a writer copies
+ * it (the buffer is small, trees are shared) and publishes the new one atomically, a query keeps
+ * the snapshot it started with alive. Tombstones are atomic flags of the trees, the only state a
+ * writer changes in place. Writers are serialized by a mutex, a merge builds its tree outside of
+ * it so inserts and removes go on meanwhile, then swaps the tree in and carries over the removes
+ * that happened during the build.
+ *
+ * Every tree is a flattened kd-tree like KNN's (pre-order nodes, node i splits on point i), the
+ * search of a query goes through the buffer and every tree with a single k-nearest heap, so the
+ * bound found in one tree prunes the next ones. Distances are ranked by their p-th power.
+ */
+template <typename DataType, typename LabelType>
+class DynamicKNN {
+public:
+    using Id = uint64_t;
+
+    explicit DynamicKNN(const DynamicKnnParam &_param = {})
+        : param(_param), current(std::make_shared<const Snapshot>()) {
+        param.k = std::max<uint32_t>(param.k, 1);
+        param.p = std::max<uint32_t>(param.p, 1);
+        param.bufferSize = std::max<uint32_t>(param.bufferSize, 1);
+        if (param.backgroundMerge) merger = std::thread([this] { mergeLoop(); });
+    }
+
+    DynamicKNN(const DynamicKNN &) = delete;
+    DynamicKNN &operator=(const DynamicKNN &) = delete;
+
+    ~DynamicKNN() {
+        if (merger.joinable()) {
+            {
+                std::lock_guard<std::mutex> guard(mergeSignal);
+                stopping = true;
+            }
+            mergeWake.notify_one();
+            merger.join();
+        }
+    }
+
+    uint32_t dim() const { return n; }
+    std::size_t size() const { return snapshot()->live; }
+    std::size_t trees() const { return snapshot()->trees.size(); }
+
+    // the current snapshot and the id map. older snapshots a query still holds and the copy a
+    // merge is building are not counted, the budget of `memoryMB` leaves room for them
+    memory::Usage memoryUsage() const {
+        std::lock_guard<std::mutex> guard(writeLock);
+        return resident(*snapshot());
+    }
+
+    // replaces the content with a single tree of X, ids are the row indices
+    bool train(const Data<DataType> &X_train, const Data<LabelType> &y_train) {
+        STAT_PROFILE_SCOPE(__func__);
+
+        if (X_train.m == 0 || X_train.n == 0 || X_train.m != y_train.m) {
+            printf("ERROR: invalid training set\n");
+            return false;
+        }
+        std::lock_guard<std::mutex> merging(mergeLock);
+        std::lock_guard<std::mutex> guard(writeLock);
+        n = X_train.n;
+        Rows rows;
+        for (uint32_t i = 0; i < X_train.m; ++i) {
+            rows.add(X_train.data[i].data(), n, y_train.data[i][0], i);
+        }
+        nextId = X_train.m;
+        auto next = std::make_shared<Snapshot>();
+        next->buffer = std::make_shared<const Rows>();
+        where.clear();
+        auto tree = buildTree(rows);
+        locate(tree);
+        next->trees.emplace_back(std::move(tree));
+        next->live = X_train.m;
+        publish(std::move(next));
+        return true;
+    }
+
+    // adds a point of dim() values, its id is returned. dim() is set by train(), load() or the
+    // first insert of a Vec
+    Id insert(const DataType *point, LabelType label) {
+        bool merge = false;
+        Id id;
+        {
+            std::lock_guard<std::mutex> guard(writeLock);
+            auto snap = snapshot();
+            if (memory::overBudget(param.memoryMB, resident(*snap).total() + insertBytes())) {
+                printf("ERROR: dynamic k-NN over its memory budget of %.1f MB\n", param.memoryMB);
+                return kNoId;
+            }
+            id = nextId++;
+            auto buffer = std::make_shared<Rows>(*snap->buffer, &pool);
+            buffer->reserve(buffer->size() + 1, n);
+            buffer->add(point, n, label, id);
+            where[id] = {nullptr, static_cast<uint32_t>(buffer->size() - 1)};
+            auto next = std::make_shared<Snapshot>(*snap);
+            next->live = snap->live + 1;
+            if (buffer->size() >= param.bufferSize) {
+                auto tree = buildTree(*buffer);
+                locate(tree);
+                next->trees.emplace_back(std::move(tree));
+                buffer = std::make_shared<Rows>(&pool);
+                merge = mergeNeeded(next->trees);
+            }
+            next->buffer = std::move(buffer);
+            publish(std::move(next));
+        }
+        if (merge) scheduleMerge();
+        return id;
+    }
+
+    Id insert(const Vec<DataType> &point, LabelType label) {
+        {
+            std::lock_guard<std::mutex> guard(writeLock);
+            if (n == 0) n = static_cast<uint32_t>(point.size());
+        }
+        if (point.size() != n) {
+            printf("ERROR: point of %zu values in an index of dim %u\n", point.size(), n);
+            return kNoId;
+        }
+        return insert(point.data(), label);
+    }
+
+    // false if the id is unknown or already removed
+    bool remove(Id id) {
+        bool merge = false;
+        {
+            std::lock_guard<std::mutex> guard(writeLock);
+            auto it = where.find(id);
+            if (it == where.end()) return false;
+            auto loc = it->second;
+            where.erase(it);
+            auto snap = snapshot();
+            auto next = std::make_shared<Snapshot>(*snap);
+            next->live = snap->live - 1;
+            if (!loc.tree) {
+                auto buffer = std::make_shared<Rows>(&pool);
+                const auto &old = *snap->buffer;
+                for (uint32_t i = 0; i < old.size(); ++i) {
+                    if (i == loc.index) continue;
+                    buffer->add(old.point(i, n), n, old.labels[i], old.ids[i]);
+                    where[old.ids[i]].index = static_cast<uint32_t>(buffer->size() - 1);
+                }
+                next->buffer = std::move(buffer);
+            } else {
+                loc.tree->dead[loc.index].store(1, std::memory_order_release);
+                ++loc.tree->deadCount;
+                merge = mergeNeeded(next->trees);
+            }
+            publish(std::move(next));
+        }
+        if (merge) scheduleMerge();
+        return true;
+    }
+
+    // ids and distances of the k nearest live points, nearest first
+    std::vector<std::pair<Id, double>> nearest(const Vec<DataType> &X, uint32_t k) const {
+        std::vector<std::pair<Id, double>> out;
+        if (X.size() != n || k == 0) return out;
+        auto heap = search(*snapshot(), X.data(), k);
+        for (const auto &c : heap) out.emplace_back(c.id, rootPow(c.dist, param.p));
+        return out;
+    }
+
+    LabelType predict(const Vec<DataType> &X) const {
+        if (X.size() != n || n == 0) {
+            printf("ERROR: query of %zu values in an index of dim %u\n", X.size(), n);
+            return 0;
+        }
+        return vote(search(*snapshot(), X.data(), param.k));
+    }
+
+    double validate(const Data<DataType> &X_test, const Data<LabelType> &y_test) const {
+        if (X_test.m == 0 || X_test.m != y_test.m) {
+            printf("ERROR: invalid test set\n");
+            return 0.0;
+        }
+        uint32_t hits = 0;
+        for (uint32_t i = 0; i < X_test.m; ++i) hits += predict(X_test.data[i]) == y_test.data[i][0];
+        return static_cast<double>(hits) / X_test.m;
+    }
+
+    // rebuilds the buffer and every tree into a single tree without dead points
+    void compact() {
+        std::lock_guard<std::mutex> merging(mergeLock);
+        std::vector<std::shared_ptr<Tree>> victims;
+        std::shared_ptr<const Rows> buffer;
+        {
+            std::lock_guard<std::mutex> guard(writeLock);
+            auto snap = snapshot();
+            victims = snap->trees;
+            buffer = snap->buffer;
+        }
+        rebuild(victims, buffer);
+    }
+
+    // blocks until no merge is due, the background thread included
+    void waitForMerges() {
+        std::lock_guard<std::mutex> merging(mergeLock);
+        while (mergeStep()) {}
+    }
+
+    // the live points, compacted, as a KNN-like model file
+    bool save(const char *filename) const {
+        Rows rows;
+        Id next;
+        {
+            std::lock_guard<std::mutex> guard(writeLock);
+            collect(*snapshot(), rows);
+            next = nextId;
+        }
+        serialize::Writer writer(filename);
+        writer.writeHeader(MODEL_DYNAMIC_KNN, serialize::typeTag<DataType>(),
+                           serialize::typeTag<LabelType>());
+        writer.write(FileHeader{param.k, param.p, n, 0, static_cast<uint64_t>(rows.size()), next});
+        writer.writeVec(rows.points);
+        writer.writeVec(rows.labels);
+        writer.writeVec(rows.ids);
+        return writer.good();
+    }
+
+    bool load(const char *filename) {
+        serialize::MappedFile file(filename);
+        serialize::Reader reader(file);
+        if (!reader.readHeader(MODEL_DYNAMIC_KNN, serialize::typeTag<DataType>(),
+                               serialize::typeTag<LabelType>())) {
+            return false;
+        }
+        FileHeader header;
+        Rows rows;
+        if (!reader.read(header) || !reader.readVec(rows.points) || !reader.readVec(rows.labels) ||
+            !reader.readVec(rows.ids) || rows.labels.size() != header.count ||
+            rows.ids.size() != header.count ||
+            rows.points.size() != static_cast<std::size_t>(header.count) * header.dim) {
+            printf("ERROR: corrupted model file (%s)\n", filename);
+            return false;
+        }
+        std::lock_guard<std::mutex> merging(mergeLock);
+        std::lock_guard<std::mutex> guard(writeLock);
+        param.k = std::max<uint32_t>(header.k, 1);
+        param.p = std::max<uint32_t>(header.p, 1);
+        n = header.dim;
+        nextId = header.nextId;
+        where.clear();
+        auto next = std::make_shared<Snapshot>();
+        next->buffer = std::make_shared<const Rows>();
+        if (header.count > 0) {
+            auto tree = buildTree(rows);
+            locate(tree);
+            next->trees.emplace_back(std::move(tree));
+        }
+        next->live = header.count;
+        publish(std::move(next));
+        return true;
+    }
+
+    static constexpr Id kNoId = std::numeric_limits<Id>::max();
+
+private:
+    static constexpr uint32_t kNullNode = std::numeric_limits<uint32_t>::max();
+
+    // fixed size part of the saved index, points, labels and ids follow
+    struct FileHeader {
+        uint32_t k;
+        uint32_t p;
+        uint32_t dim;
+        uint32_t reserved;
+        uint64_t count;
+        uint64_t nextId;
+    };
+
+    // points in row-major order with their labels and ids
+    struct Rows {
+        Vec<DataType> points;
+        Vec<LabelType> labels;
+        Vec<Id> ids;
+
+        explicit Rows(std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+            : points(memory), labels(memory), ids(memory) {}
+        Rows(const Rows &o, std::pmr::memory_resource *memory)
+            : points(o.points, memory), labels(o.labels, memory), ids(o.ids, memory) {}
+
+        std::size_t size() const { return ids.size(); }
+        void reserve(std::size_t count, uint32_t dim) {
+            points.reserve(count * dim);
+            labels.reserve(count);
+            ids.reserve(count);
+        }
+        const DataType *point(std::size_t i, uint32_t dim) const {
+            return points.data() + i * dim;
+        }
+        void add(const DataType *x, uint32_t dim, LabelType label, Id id) {
+            points.insert(points.end(), x, x + dim);
+            labels.emplace_back(label);
+            ids.emplace_back(id);
+        }
+    };
+
+    struct KdNode {
+        uint32_t axis;
+        uint32_t left;
+        uint32_t right;
+        uint32_t reserved;
+    };
+
+    // immutable kd-tree but for its tombstones, node i splits on point i of rows
+    struct Tree {
+        Rows rows{memory::hugePages()};
+        std::vector<KdNode> nodes;
+        std::unique_ptr<std::atomic<uint8_t>[]> dead;
+        uint32_t deadCount = 0;  // guarded by writeLock
+
+        std::size_t live() const { return rows.size() - deadCount; }
+    };
+
+    // what a query sees, never changed once published
+    struct Snapshot {
+        std::vector<std::shared_ptr<Tree>> trees;  // oldest (largest) first
+        std::shared_ptr<const Rows> buffer = std::make_shared<const Rows>();
+        std::size_t live = 0;
+    };
+
+    // where a live id is, a null tree is the buffer
+    struct Location {
+        Tree *tree;
+        uint32_t index;
+    };
+
+    static std::size_t rowBytes(const Rows &rows) {
+        return memory::heapBytes(rows.points) + memory::heapBytes(rows.labels) +
+               memory::heapBytes(rows.ids);
+    }
+
+    // memoryUsage() of a snapshot, writeLock held
+    memory::Usage resident(const Snapshot &snap) const {
+        std::size_t points = 0, nodes = 0, tombstones = 0;
+        for (const auto &tree : snap.trees) {
+            points += rowBytes(tree->rows);
+            nodes += memory::heapBytes(tree->nodes);
+            tombstones += tree->rows.size();
+        }
+        memory::Usage u;
+        u.add("tree points", points);
+        u.add("kd-tree nodes", nodes);
+        u.add("tombstones", tombstones);
+        u.add("buffer", rowBytes(*snap.buffer));
+        u.add("id map", memory::heapBytes(where));
+        return u;
+    }
+
+    // bytes the next insert adds: its values, label, id, the node and tombstone it gets once
+    // sealed, its id map entry and the bucket array of a rehash it triggers. writeLock held
+    std::size_t insertBytes() const {
+        std::size_t bytes = std::size_t(n) * sizeof(DataType) + sizeof(LabelType) + sizeof(Id) +
+                            sizeof(KdNode) + 1 + sizeof(std::pair<const Id, Location>) +
+                            2 * sizeof(void *);
+        if (where.size() + 1 > where.bucket_count() * where.max_load_factor()) {
+            bytes += where.bucket_count() * sizeof(void *);
+        }
+        return bytes;
+    }
+
+    // a candidate of the k-nearest heap, ranked by (distance^p, label) like KNN's pairs
+    struct Candidate {
+        double dist;
+        LabelType label;
+        Id id;
+
+        bool operator<(const Candidate &o) const {
+            return dist < o.dist || (dist == o.dist && label < o.label);
+        }
+    };
+
+    struct SearchStats {
+        uint64_t evals = 0;
+        uint64_t visited = 0;
+        uint64_t pruned = 0;
+    };
+
+    DynamicKnnParam param;
+    uint32_t n = 0;
+
+    memory::Pool pool;  // insert buffers, a copy per insert. declared before `current`, outlives it
+    std::shared_ptr<const Snapshot> current;  // std::atomic_load / std::atomic_store only
+    mutable std::mutex writeLock;             // writers, where and nextId
+    std::unordered_map<Id, Location> where;
+    Id nextId = 0;
+
+    std::mutex mergeLock;  // one merge at a time
+    std::thread merger;
+    std::mutex mergeSignal;
+    std::condition_variable mergeWake;
+    bool mergePending = false;
+    bool stopping = false;
+
+    std::shared_ptr<const Snapshot> snapshot() const { return std::atomic_load(&current); }
+
+    void publish(std::shared_ptr<const Snapshot> next) { std::atomic_store(&current, std::move(next)); }
+
+    void locate(const std::shared_ptr<Tree> &tree) {
+        for (uint32_t i = 0; i < tree->rows.size(); ++i) where[tree->rows.ids[i]] = {tree.get(), i};
+    }
+
+    // a tree over every row of `rows`
+    std::shared_ptr<Tree> buildTree(const Rows &rows) const {
+        auto tree = std::make_shared<Tree>();
+        auto count = rows.size();
+        std::vector<uint32_t> index(count);
+        std::iota(index.begin(), index.end(), 0u);
+        tree->rows.points.reserve(count * n);
+        tree->rows.labels.reserve(count);
+        tree->rows.ids.reserve(count);
+        tree->nodes.reserve(count);
+        build(*tree, rows, index.begin(), index.end(), 0);
+        tree->dead.reset(new std::atomic<uint8_t>[count]);
+        for (std::size_t i = 0; i < count; ++i) tree->dead[i].store(0, std::memory_order_relaxed);
+        return tree;
+    }
+
+    uint32_t build(Tree &tree, const Rows &rows, std::vector<uint32_t>::iterator start,
+                   std::vector<uint32_t>::iterator end, uint32_t depth) const {
+        if (start >= end) return kNullNode;
+        uint32_t axis = depth % n;
+        auto value = [&](uint32_t i) { return rows.point(i, n)[axis]; };
+        auto mid = start + (end - start) / 2;
+        std::nth_element(start, mid, end, [&](uint32_t a, uint32_t b) { return value(a) < value(b); });
+        // left_val < mid_val <= right_val
+        auto split = value(*mid);
+        mid = std::partition(start, mid, [&](uint32_t i) { return value(i) != split; });
+
+        auto node = static_cast<uint32_t>(tree.nodes.size());
+        tree.nodes.push_back({axis, kNullNode, kNullNode, 0});
+        tree.rows.add(rows.point(*mid, n), n, rows.labels[*mid], rows.ids[*mid]);
+        auto left = build(tree, rows, start, mid, depth + 1);
+        auto right = build(tree, rows, mid + 1, end, depth + 1);
+        tree.nodes[node].left = left;
+        tree.nodes[node].right = right;
+        return node;
+    }
+
+    std::vector<Candidate> search(const Snapshot &snap, const DataType *X, uint32_t k) const {
+        std::vector<Candidate> heap;
+        heap.reserve(k + 1);
+        SearchStats stats;
+        const auto &buffer = *snap.buffer;
+        for (std::size_t i = 0; i < buffer.size(); ++i) {
+            push(heap, k, powDistance(X, buffer.point(i, n), heap, k, stats), buffer.labels[i],
+                 buffer.ids[i]);
+        }
+        for (const auto &tree : snap.trees) {
+            if (!tree->nodes.empty()) findNearest(*tree, 0, X, heap, k, stats);
+        }
+        std::sort_heap(heap.begin(), heap.end());
+        STAT_PROFILE_COUNT(DISTANCE_EVALS, stats.evals);
+        STAT_PROFILE_COUNT(NODES_VISITED, stats.visited);
+        STAT_PROFILE_COUNT(PRUNED_SUBTREES, stats.pruned);
+        return heap;
+    }
+
+    double powDistance(const DataType *X, const DataType *point, const std::vector<Candidate> &heap,
+                       uint32_t k, SearchStats &stats) const {
+        ++stats.evals;
+        std::size_t touched = 0;
+        double bound = heap.size() < k ? Inf<double> : heap.front().dist;
+        return LpPowBounded(X, point, n, param.p, bound, touched);
+    }
+
+    static void push(std::vector<Candidate> &heap, uint32_t k, double dist, LabelType label, Id id) {
+        Candidate c{dist, label, id};
+        if (heap.size() < k) {
+            heap.emplace_back(c);
+            std::push_heap(heap.begin(), heap.end());
+        } else if (c < heap.front()) {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = c;
+            std::push_heap(heap.begin(), heap.end());
+        }
+    }
+
+    void findNearest(const Tree &tree, uint32_t node, const DataType *X,
+                     std::vector<Candidate> &heap, uint32_t k, SearchStats &stats) const {
+        if (node == kNullNode) return;
+        ++stats.visited;
+        const auto &kd = tree.nodes[node];
+        const DataType *point = tree.rows.point(node, n);
+        double diff = static_cast<double>(X[kd.axis]) - static_cast<double>(point[kd.axis]);
+        auto nearSide = diff < 0 ? kd.left : kd.right;
+        auto farSide = diff < 0 ? kd.right : kd.left;
+        findNearest(tree, nearSide, X, heap, k, stats);
+
+        if (!tree.dead[node].load(std::memory_order_acquire)) {
+            push(heap, k, powDistance(X, point, heap, k, stats), tree.rows.labels[node],
+                 tree.rows.ids[node]);
+        }
+        // the split plane is closer than the k-th nearest one, the far side may hold nearer ones
+        if (heap.size() < k || absPow(diff, param.p) < heap.front().dist) {
+            findNearest(tree, farSide, X, heap, k, stats);
+        } else if (farSide != kNullNode) {
+            ++stats.pruned;
+        }
+    }
+
+    // KNN's rule: the most frequent label, a tie goes to the label of the nearer neighbor
+    static LabelType vote(const std::vector<Candidate> &neighbors) {
+        std::size_t maxCount = 0;
+        LabelType predictedLabel = 0;
+        for (const auto &c : neighbors) {
+            auto count = std::count_if(neighbors.cbegin(), neighbors.cend(),
+                                       [&c](const Candidate &o) { return o.label == c.label; });
+            if (count > maxCount) {
+                maxCount = count;
+                predictedLabel = c.label;
+            }
+        }
+        return predictedLabel;
+    }
+
+    // every live point of a snapshot
+    void collect(const Snapshot &snap, Rows &rows) const {
+        const auto &buffer = *snap.buffer;
+        for (std::size_t i = 0; i < buffer.size(); ++i) {
+            rows.add(buffer.point(i, n), n, buffer.labels[i], buffer.ids[i]);
+        }
+        for (const auto &tree : snap.trees) {
+            for (std::size_t i = 0; i < tree->rows.size(); ++i) {
+                if (tree->dead[i].load(std::memory_order_acquire)) continue;
+                rows.add(tree->rows.point(i, n), n, tree->rows.labels[i], tree->rows.ids[i]);
+            }
+        }
+    }
+
+    // newest tree at least half the live size of the one before it, or a tree mostly dead
+    static bool mergeNeeded(const std::vector<std::shared_ptr<Tree>> &trees) {
+        auto count = trees.size();
+        if (count >= 2 && trees[count - 1]->live() * 2 >= trees[count - 2]->live()) return true;
+        for (const auto &t : trees) {
+            if (t->deadCount * 2 > t->rows.size()) return true;
+        }
+        return false;
+    }
+
+    void scheduleMerge() {
+        if (!param.backgroundMerge) {
+            waitForMerges();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> guard(mergeSignal);
+            mergePending = true;
+        }
+        mergeWake.notify_one();
+    }
+
+    void mergeLoop() {
+        std::unique_lock<std::mutex> signal(mergeSignal);
+        while (true) {
+            mergeWake.wait(signal, [this] { return mergePending || stopping; });
+            if (stopping) return;
+            mergePending = false;
+            signal.unlock();
+            waitForMerges();
+            signal.lock();
+        }
+    }
+
+    // one merge if one is due, mergeLock held. false if none was
+    bool mergeStep() {
+        std::vector<std::shared_ptr<Tree>> victims;
+        {
+            std::lock_guard<std::mutex> guard(writeLock);
+            auto trees = snapshot()->trees;
+            for (const auto &t : trees) {
+                if (t->deadCount * 2 > t->rows.size()) {
+                    victims.emplace_back(t);
+                    break;
+                }
+            }
+            if (victims.empty()) {
+                auto count = trees.size();
+                if (count < 2 || trees[count - 1]->live() * 2 < trees[count - 2]->live()) {
+                    return false;
+                }
+                // the newest two, then every older tree the merged one catches up with
+                std::size_t first = count - 2, live = trees[count - 1]->live() + trees[count - 2]->live();
+                while (first > 0 && live * 2 >= trees[first - 1]->live()) live += trees[--first]->live();
+                victims.assign(trees.begin() + first, trees.end());
+            }
+        }
+        rebuild(victims, nullptr);
+        return true;
+    }
+
+    /**
+     * replaces the victim trees (and the buffer if given) with one tree of their live points. the
+     * tree is built without writeLock, the removes done meanwhile are carried over when it is
+     * swapped in. mergeLock held, no other merge changes the trees, but an insert may seal the
+     * buffer meanwhile: a point is only claimed if `where` still has it in a victim or the buffer,
+     * otherwise it is dead in the new tree and stays live where it is now
+     */
+    void rebuild(const std::vector<std::shared_ptr<Tree>> &victims,
+                 std::shared_ptr<const Rows> buffer) {
+        STAT_PROFILE_SCOPE(__func__);
+
+        Rows rows;
+        for (const auto &t : victims) {
+            for (uint32_t i = 0; i < t->rows.size(); ++i) {
+                if (t->dead[i].load(std::memory_order_acquire)) continue;
+                rows.add(t->rows.point(i, n), n, t->rows.labels[i], t->rows.ids[i]);
+            }
+        }
+        if (buffer) {
+            for (std::size_t i = 0; i < buffer->size(); ++i) {
+                rows.add(buffer->point(i, n), n, buffer->labels[i], buffer->ids[i]);
+            }
+        }
+        auto tree = rows.size() > 0 ? buildTree(rows) : nullptr;
+        // still in the buffer (only points of the copied buffer can be) or in a victim
+        auto claimed = [&](const Location &loc) {
+            return !loc.tree ||
+                   std::any_of(victims.begin(), victims.end(),
+                               [&](const std::shared_ptr<Tree> &t) { return t.get() == loc.tree; });
+        };
+
+        std::lock_guard<std::mutex> guard(writeLock);
+        auto snap = snapshot();
+        auto next = std::make_shared<Snapshot>(*snap);
+        if (tree) {
+            for (uint32_t i = 0; i < tree->rows.size(); ++i) {
+                auto it = where.find(tree->rows.ids[i]);
+                if (it == where.end() || !claimed(it->second)) {
+                    // removed while the tree was built, or sealed into a newer tree
+                    tree->dead[i].store(1, std::memory_order_relaxed);
+                    ++tree->deadCount;
+                } else {
+                    it->second = {tree.get(), i};
+                }
+            }
+        }
+        if (buffer) {
+            // inserts after the buffer was taken stay in the buffer
+            auto rest = std::make_shared<Rows>(&pool);
+            const auto &now = *snap->buffer;
+            for (std::size_t i = 0; i < now.size(); ++i) {
+                bool taken = std::find(buffer->ids.begin(), buffer->ids.end(), now.ids[i]) !=
+                             buffer->ids.end();
+                if (taken) continue;
+                rest->add(now.point(i, n), n, now.labels[i], now.ids[i]);
+                where[now.ids[i]].index = static_cast<uint32_t>(rest->size() - 1);
+            }
+            next->buffer = std::move(rest);
+        }
+        auto &trees = next->trees;
+        auto pos = std::find(trees.begin(), trees.end(), victims.empty() ? nullptr : victims.front());
+        auto at = pos - trees.begin();
+        trees.erase(std::remove_if(trees.begin(), trees.end(),
+                                   [&](const std::shared_ptr<Tree> &t) {
+                                       return std::find(victims.begin(), victims.end(), t) !=
+                                              victims.end();
+                                   }),
+                    trees.end());
+        if (tree) trees.insert(trees.begin() + std::min<std::ptrdiff_t>(at, trees.size()), tree);
+        publish(std::move(next));
+    }
+};
+
+}  // namespace stat
+
+#endif  // __DYNAMIC_KNN_H__
@@ -0,0 +1,760 @@
+#ifndef __EM_H__
+#define __EM_H__
+
+#include "Math.h"
+#include "Model.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace stat {
+
+struct MixtureParam {
+    uint32_t components = 3;
+    bool full = false;             // full covariance matrices, otherwise diagonal
+    uint32_t maxIterations = 100;  // EM iterations, epochs over the mini-batches for stepwise EM
+    double tolerance = 1e-4;       // on the change of the mean log-likelihood
+    double regularization = 1e-6;  // added to the variances, keeps them positive
+    uint32_t batchSize = 0;        // 0 is batch EM, otherwise stepwise EM over mini-batches
+    double decay = 0.7;            // stepwise EM step size (t + 2)^-decay, in (0.5, 1]
+    uint32_t seed = 0;
+};
+
+/**
+ * Gaussian mixture $p(x) = \sum_{k=1}^K{w_k N(x; \mu_k, \Sigma_k)}$ fitted by EM
+ *
+ * E-step:  $r_{ik} = \frac{w_k N(x_i; \mu_k, \Sigma_k)}{\sum_j{w_j N(x_i; \mu_j, \Sigma_j)}}$, in log
+ *          space, one log-sum-exp (softmax) over the components per row
+ * M-step:  $w_k = \frac{N_k}{N}$, $\mu_k = \frac{1}{N_k}\sum_i{r_{ik} x_i}$,
+ *          $\Sigma_k = \frac{1}{N_k}\sum_i{r_{ik} (x_i - \mu_k)(x_i - \mu_k)^T}$, $N_k = \sum_i{r_{ik}}$
+ *
+ * The E-step splits the rows into one contiguous slice per thread, each slice accumulates its own
+ * sufficient statistics and the slices are reduced in order. Statistics are taken around the
+ * current means, the variance is then a small correction instead of the difference of two large
+ * raw moments. Full covariances are kept as their Cholesky factors, a log density is a triangular
+ * solve.
+ *
+ * Means are seeded by greedy k-means++ and a few k-means iterations. With `batchSize` set,
+ * stepwise EM (Cappe & Moulines 2009) blends the moments of every mini-batch into running ones
+ * with a decaying step; `partialFit()` takes one such step and suits data streamed from disk.
+ */
+class GaussianMixture {
+public:
+    explicit GaussianMixture(MixtureParam _param = {}) : param(_param) {}
+
+    uint32_t components() const { return K; }
+    uint32_t dimension() const { return dim; }
+    bool full() const { return param.full; }
+    const Vec<double> &weights() const { return weight; }
+    const Vec<double> &means() const { return mean; }
+    // K x dim variances, or K x dim x dim covariance matrices
+    const Vec<double> &covariances() const { return covar; }
+
+    memory::Usage memoryUsage() const {
+        memory::Usage u;
+        u.add("weights", memory::heapBytes(weight));
+        u.add("means", memory::heapBytes(mean));
+        u.add("covariances", memory::heapBytes(covar) + memory::heapBytes(factor));
+        u.add("normalizers", memory::heapBytes(logNorm));
+        u.add("running moments", memory::heapBytes(running.w) + memory::heapBytes(running.mu) +
+                                     memory::heapBytes(running.cov));
+        return u;
+    }
+
+    // parameters of a fitted mixture, e.g. loaded from a file. false if a covariance is not
+    // positive definite: a non-positive variance, or a full matrix without a Cholesky factor
+    bool assign(uint32_t components, uint32_t _dim, const double *w, const double *mu,
+                const double *cov) {
+        K = components;
+        dim = _dim;
+        weight.assign(w, w + K);
+        mean.assign(mu, mu + static_cast<std::size_t>(K) * dim);
+        covar.assign(cov, cov + static_cast<std::size_t>(K) * covarSize());
+        if (!param.full &&
+            !std::all_of(covar.cbegin(), covar.cend(), [](double v) { return v > 0.0; })) {
+            return false;
+        }
+        return prepare();
+    }
+
+    // EM over the rows of X (rows x dim, row-major), returns the final mean log-likelihood
+    double fit(const double *X, std::size_t rows, uint32_t _dim) {
+        STAT_PROFILE_SCOPE(__func__);
+
+        if (rows == 0 || _dim == 0) {
+            printf("ERROR: empty training set\n");
+            return NaN<double>;
+        }
+        K = 0;
+        step = 0;
+        iterations = 0;
+        converged = false;
+        double loglik = -Inf<double>;
+        if (param.batchSize > 0 && param.batchSize < rows) {
+            // epochs of stepwise EM over shuffled mini-batches
+            std::mt19937 gen(param.seed);
+            std::vector<uint32_t> order(rows);
+            std::iota(order.begin(), order.end(), 0u);
+            Vec<double> batch(static_cast<std::size_t>(param.batchSize) * _dim);
+            for (; iterations < param.maxIterations && !converged; ++iterations) {
+                std::shuffle(order.begin(), order.end(), gen);
+                double sum = 0.0;
+                for (std::size_t first = 0; first < rows; first += param.batchSize) {
+                    auto count = std::min<std::size_t>(param.batchSize, rows - first);
+                    for (std::size_t r = 0; r < count; ++r) {
+                        auto x = X + static_cast<std::size_t>(order[first + r]) * _dim;
+                        std::copy(x, x + _dim, batch.begin() + r * _dim);
+                    }
+                    double ll = partialFit(batch.data(), count, _dim);
+                    if (std::isnan(ll)) return ll;
+                    sum += ll * count;
+                }
+                converged = std::abs(sum / rows - loglik) < param.tolerance;
+                loglik = sum / rows;
+            }
+        } else {
+            if (!seed(X, rows, _dim)) return NaN<double>;
+            for (; iterations < param.maxIterations && !converged; ++iterations) {
+                auto stats = estep(X, rows, false);
+                if (!mstep(moments(stats))) return NaN<double>;
+                double next = stats.loglik / rows;
+                converged = std::abs(next - loglik) < param.tolerance;
+                loglik = next;
+            }
+        }
+        return loglik;
+    }
+
+    /**
+     * One stepwise EM update from a mini-batch, returns the batch mean log-likelihood under the
+     * parameters before the update. The first call on an unfitted mixture seeds it from its batch.
+     */
+    double partialFit(const double *X, std::size_t rows, uint32_t _dim) {
+        if (step == 0) {
+            // continues from the current parameters, e.g. of a batch fit, if any
+            if ((K == 0 || dim != _dim) && !seed(X, rows, _dim)) return NaN<double>;
+            running = Moments{weight, mean, covar};
+            step = 1;
+        }
+        auto stats = estep(X, rows, false);
+        double eta = std::pow(step + 1.0, -param.decay);
+        running = blend(running, moments(stats), eta);
+        if (!mstep(running)) return NaN<double>;
+        ++step;
+        return stats.loglik / rows;
+    }
+
+    // log p(x) of every row of X into out
+    void logDensity(const double *X, std::size_t rows, double *out) const {
+        parallel::parallelFor(0, rows, kGrainRows, [&](std::size_t lo, std::size_t hi) {
+            Vec<double> lp(K), scratch(dim);
+            for (auto i = lo; i < hi; ++i) {
+                componentLogProb(X + i * dim, lp.data(), scratch.data());
+                out[i] = logSumExp(lp.data(), K);
+            }
+        });
+    }
+
+    // posterior of the components given every row of X into out (rows x K)
+    void responsibilities(const double *X, std::size_t rows, double *out) const {
+        parallel::parallelFor(0, rows, kGrainRows, [&](std::size_t lo, std::size_t hi) {
+            Vec<double> scratch(dim);
+            for (auto i = lo; i < hi; ++i) {
+                componentLogProb(X + i * dim, out + i * K, scratch.data());
+                softmax(out + i * K, K);
+            }
+        });
+    }
+
+    uint32_t iterations = 0;
+    bool converged = false;
+
+private:
+    static constexpr std::size_t kGrainRows = 256;
+    static constexpr uint32_t kLloydIterations = 10;  // hard assignment rounds after seeding
+    // rows adding less to a component are left out of its statistics, far away rows would
+    // otherwise cost a dim^2 update for nothing with full covariances
+    static constexpr double kMinResponsibility = 1e-12;
+
+    // sufficient statistics of a set of rows around the current means
+    struct Stats {
+        Vec<double> n;   // K, sum of responsibilities
+        Vec<double> s;   // K x dim, sum of r (x - mu)
+        Vec<double> ss;  // K x covarSize, sum of r (x - mu)^2, or lower triangle of r dd^T
+        double loglik = 0.0;
+    };
+
+    // weights, means and covariances (without regularization) of the components
+    struct Moments {
+        Vec<double> w;
+        Vec<double> mu;
+        Vec<double> cov;
+    };
+
+    MixtureParam param;
+    uint32_t K = 0;
+    uint32_t dim = 0;
+    uint64_t step = 0;  // stepwise EM updates so far
+    Moments running;    // stepwise EM running moments
+
+    Vec<double> weight;
+    Vec<double> mean;
+    Vec<double> covar;
+    // derived by prepare(): log w_k - 1/2 (d log(2 pi) + log|Sigma_k|), and 1 / variances or the
+    // Cholesky factors
+    Vec<double> logNorm;
+    Vec<double> factor;
+
+    double sqdist(const double *x, const double *y) const {
+        double sum = 0.0;
+        for (uint32_t j = 0; j < dim; ++j) sum += (x[j] - y[j]) * (x[j] - y[j]);
+        return sum;
+    }
+
+    std::size_t covarSize() const {
+        return param.full ? static_cast<std::size_t>(dim) * dim : dim;
+    }
+
+    bool prepare() {
+        logNorm.resize(K);
+        factor = covar;
+        bool ok = true;
+        for (uint32_t k = 0; k < K; ++k) {
+            auto f = factor.data() + k * covarSize();
+            double logdet = 0.0;
+            if (param.full) {
+                ok = cholesky(f, dim) && ok;
+                for (uint32_t j = 0; j < dim; ++j) logdet += 2.0 * std::log(f[j * dim + j]);
+            } else {
+                for (uint32_t j = 0; j < dim; ++j) {
+                    logdet += std::log(f[j]);
+                    f[j] = 1.0 / f[j];
+                }
+            }
+            logNorm[k] = std::log(weight[k]) - 0.5 * (dim * std::log(2 * pi) + logdet);
+        }
+        return ok;
+    }
+
+    // log w_k + log N(x; mu_k, Sigma_k) of every component into lp, scratch holds dim values
+    void componentLogProb(const double *x, double *lp, double *scratch) const {
+        for (uint32_t k = 0; k < K; ++k) {
+            auto mu = mean.data() + static_cast<std::size_t>(k) * dim;
+            auto f = factor.data() + k * covarSize();
+            double q = 0.0;
+            if (param.full) {
+                for (uint32_t j = 0; j < dim; ++j) scratch[j] = x[j] - mu[j];
+                solveLower(f, scratch, dim);
+                q = dot(scratch, scratch, dim);
+            } else {
+                for (uint32_t j = 0; j < dim; ++j) {
+                    double d = x[j] - mu[j];
+                    q += d * d * f[j];
+                }
+            }
+            lp[k] = logNorm[k] - 0.5 * q;
+        }
+    }
+
+    // responsibilities of the rows, or a one-hot nearest mean when `hard`, summed up per slice
+    Stats estep(const double *X, std::size_t rows, bool hard) const {
+        auto slices = std::max<std::size_t>(
+            1, std::min<std::size_t>(parallel::threads(), rows / kGrainRows));
+        std::vector<Stats> partial(slices);
+        auto cs = covarSize();
+        parallel::parallelFor(0, slices, 1, [&](std::size_t lo, std::size_t hi) {
+            Vec<double> r(K), d(dim), scratch(dim);
+            for (auto t = lo; t < hi; ++t) {
+                auto &st = partial[t];
+                st.n.assign(K, 0.0);
+                st.s.assign(static_cast<std::size_t>(K) * dim, 0.0);
+                st.ss.assign(K * cs, 0.0);
+                for (auto i = rows * t / slices; i < rows * (t + 1) / slices; ++i) {
+                    auto x = X + i * dim;
+                    if (hard) {
+                        std::size_t best = 0;
+                        double bestDist = Inf<double>;
+                        for (uint32_t k = 0; k < K; ++k) {
+                            double dist = sqdist(x, mean.data() + static_cast<std::size_t>(k) * dim);
+                            if (dist < bestDist) {
+                                bestDist = dist;
+                                best = k;
+                            }
+                        }
+                        std::fill(r.begin(), r.end(), 0.0);
+                        r[best] = 1.0;
+                    } else {
+                        componentLogProb(x, r.data(), scratch.data());
+                        st.loglik += softmax(r.data(), K);
+                    }
+                    for (uint32_t k = 0; k < K; ++k) {
+                        if (r[k] < kMinResponsibility) continue;
+                        auto mu = mean.data() + static_cast<std::size_t>(k) * dim;
+                        for (uint32_t j = 0; j < dim; ++j) d[j] = x[j] - mu[j];
+                        st.n[k] += r[k];
+                        axpy(r[k], d.data(), st.s.data() + static_cast<std::size_t>(k) * dim, dim);
+                        auto ss = st.ss.data() + k * cs;
+                        if (param.full) {
+                            for (uint32_t a = 0; a < dim; ++a) {
+                                axpy(r[k] * d[a], d.data(), ss + static_cast<std::size_t>(a) * dim,
+                                     a + 1);
+                            }
+                        } else {
+                            for (uint32_t j = 0; j < dim; ++j) ss[j] += r[k] * d[j] * d[j];
+                        }
+                    }
+                }
+            }
+        });
+        auto total = std::move(partial[0]);
+        for (std::size_t t = 1; t < slices; ++t) {
+            const auto &st = partial[t];
+            for (std::size_t i = 0; i < total.n.size(); ++i) total.n[i] += st.n[i];
+            for (std::size_t i = 0; i < total.s.size(); ++i) total.s[i] += st.s[i];
+            for (std::size_t i = 0; i < total.ss.size(); ++i) total.ss[i] += st.ss[i];
+            total.loglik += st.loglik;
+        }
+        return total;
+    }
+
+    Moments moments(const Stats &st) const {
+        auto cs = covarSize();
+        Moments out{Vec<double>(K), mean, Vec<double>(K * cs)};
+        double N = std::accumulate(st.n.cbegin(), st.n.cend(), 0.0);
+        for (uint32_t k = 0; k < K; ++k) {
+            // an empty component keeps its mean and falls back on unit variances
+            double nk = st.n[k] + 1e-10;
+            out.w[k] = nk / (N + K * 1e-10);
+            auto delta = st.s.data() + static_cast<std::size_t>(k) * dim;
+            auto mu = out.mu.data() + static_cast<std::size_t>(k) * dim;
+            auto ss = st.ss.data() + k * cs;
+            auto cov = out.cov.data() + k * cs;
+            bool empty = st.n[k] < 1e-10;
+            for (uint32_t a = 0; a < dim; ++a) {
+                double da = delta[a] / nk;
+                mu[a] += da;
+                if (!param.full) {
+                    cov[a] = empty ? 1.0 : std::max(0.0, ss[a] / nk - da * da);
+                    continue;
+                }
+                for (uint32_t b = 0; b <= a; ++b) {
+                    double v = empty ? (a == b) : ss[a * dim + b] / nk - da * delta[b] / nk;
+                    cov[a * dim + b] = cov[b * dim + a] = v;
+                }
+            }
+        }
+        return out;
+    }
+
+    // (1 - eta) a + eta b as mixtures of moments, the spread of the two means adds to the
+    // covariance of the blend
+    Moments blend(const Moments &a, const Moments &b, double eta) const {
+        auto cs = covarSize();
+        Moments out{Vec<double>(K), Vec<double>(a.mu.size()), Vec<double>(a.cov.size())};
+        Vec<double> d(dim);
+        for (uint32_t k = 0; k < K; ++k) {
+            double wa = (1.0 - eta) * a.w[k], wb = eta * b.w[k], W = wa + wb;
+            out.w[k] = W;
+            auto off = static_cast<std::size_t>(k) * dim;
+            for (uint32_t j = 0; j < dim; ++j) {
+                d[j] = b.mu[off + j] - a.mu[off + j];
+                out.mu[off + j] = a.mu[off + j] + wb / W * d[j];
+            }
+            double spread = wa * wb / (W * W);
+            auto ca = a.cov.data() + k * cs, cb = b.cov.data() + k * cs;
+            auto co = out.cov.data() + k * cs;
+            for (std::size_t i = 0; i < cs; ++i) {
+                double dd = param.full ? d[i / dim] * d[i % dim] : d[i] * d[i];
+                co[i] = (wa * ca[i] + wb * cb[i]) / W + spread * dd;
+            }
+        }
+        return out;
+    }
+
+    // a covariance (covarSize() values) is positive definite, as prepare() needs it
+    bool factorizes(const double *cov) const {
+        if (!param.full) return std::all_of(cov, cov + dim, [](double v) { return v > 0.0; });
+        Vec<double> f(cov, cov + covarSize());
+        return cholesky(f.data(), dim);
+    }
+
+    /**
+     * parameters from moments plus regularization, raised per component until its covariance
+     * factorizes. a component that still does not past the cap keeps its previous covariance,
+     * false (and an ERROR) if there is none yet, in the M-step of the seeding
+     */
+    bool mstep(const Moments &m) {
+        weight = m.w;
+        mean = m.mu;
+        auto previous = std::move(covar);
+        covar = m.cov;
+        auto cs = covarSize();
+        Vec<double> trial(cs);
+        for (uint32_t k = 0; k < K; ++k) {
+            auto cov = covar.data() + k * cs;
+            bool ok = false;
+            for (double reg = param.regularization;; reg *= 10) {
+                std::copy(cov, cov + cs, trial.begin());
+                for (uint32_t j = 0; j < dim; ++j) trial[param.full ? j * dim + j : j] += reg;
+                ok = factorizes(trial.data());
+                if (ok || reg > 1.0) break;
+            }
+            if (ok) {
+                std::copy(trial.begin(), trial.end(), cov);
+            } else if (previous.size() == covar.size()) {
+                std::copy(previous.begin() + k * cs, previous.begin() + (k + 1) * cs, cov);
+            } else {
+                printf("ERROR: covariance of component %u is not positive definite\n", k);
+                return false;
+            }
+        }
+        return prepare();
+    }
+
+    /**
+     * Greedy k-means++ seeding of the means: every next center is the best, by the resulting sum
+     * of squared distances, of 2 + log K candidates drawn with probability proportional to the
+     * squared distance to the closest center so far. A few Lloyd iterations follow, then one M-step
+     * of the hard assignment to the means.
+     */
+    bool seed(const double *X, std::size_t rows, uint32_t _dim) {
+        dim = _dim;
+        covar.clear();  // no previous covariance to fall back on
+        K = std::max<uint32_t>(1, std::min<std::size_t>(param.components, rows));
+        step = 0;
+        std::mt19937 gen(param.seed);
+        mean.assign(static_cast<std::size_t>(K) * dim, 0.0);
+        auto trials = 2 + static_cast<uint32_t>(std::log(K));
+        Vec<double> dist(rows, Inf<double>), next(rows), best(rows);
+        std::size_t pick = std::uniform_int_distribution<std::size_t>(0, rows - 1)(gen);
+        auto closest = [&](const double *center, Vec<double> &out) {
+            double total = 0.0;
+            parallel::parallelFor(0, rows, kGrainRows, [&](std::size_t lo, std::size_t hi) {
+                for (auto i = lo; i < hi; ++i) {
+                    out[i] = std::min(dist[i], sqdist(X + i * dim, center));
+                }
+            });
+            for (auto v : out) total += v;
+            return total;
+        };
+        double potential = closest(X + pick * dim, dist);
+        std::copy(X + pick * dim, X + (pick + 1) * dim, mean.begin());
+        for (uint32_t k = 1; k < K; ++k) {
+            double bestPotential = Inf<double>;
+            for (uint32_t t = 0; t < trials; ++t) {
+                double u = std::uniform_real_distribution<double>(0.0, potential)(gen);
+                std::size_t candidate = 0;
+                for (; candidate + 1 < rows && (u -= dist[candidate]) > 0; ++candidate) {}
+                double p = closest(X + candidate * dim, next);
+                if (p < bestPotential) {
+                    bestPotential = p;
+                    pick = candidate;
+                    best.swap(next);
+                }
+            }
+            dist.swap(best);
+            potential = bestPotential;
+            std::copy(X + pick * dim, X + (pick + 1) * dim,
+                      mean.begin() + static_cast<std::size_t>(k) * dim);
+        }
+        auto m = moments(estep(X, rows, true));
+        for (uint32_t it = 1; it < kLloydIterations; ++it) {
+            mean = m.mu;
+            m = moments(estep(X, rows, true));
+        }
+        return mstep(m);
+    }
+};
+
+// EM classifier params, from ModelParam by parse() or set directly
+struct EmParam {
+    MixtureParam mixture;  // of every class
+    bool show = false;
+
+    // {"model_type", "diagonal" | "full"}, {"components"}, {"max_iter"}, {"tolerance"},
+    // {"regularization"}, {"batch_size"}, {"decay"}, {"seed"}, {"model_show"}
+    static EmParam parse(const ModelParam &param) {
+        EmParam p;
+        auto &m = p.mixture;
+        ParamReader(param, "EM")
+            .choice("model_type", m.full, {{"diagonal", false}, {"diag", false}, {"full", true}})
+            .number("components", m.components, 1u)
+            .number("max_iter", m.maxIterations)
+            .number("tolerance", m.tolerance, 0.0)
+            .number("regularization", m.regularization, 0.0)
+            .number("batch_size", m.batchSize)
+            .number("decay", m.decay, 0.5, 1.0)
+            .number("seed", m.seed)
+            .flag("model_show", p.show);
+        return p;
+    }
+};
+
+/**
+ * Gaussian mixture classifier, trained by EM
+ *
+ * Model:   $P(Y=c|x) \propto P(Y=c) p(x|Y=c)$, $p(x|Y=c) = \sum_{k=1}^K{w_{ck} N(x; \mu_{ck},
+ *          \Sigma_{ck})}$
+ *
+ * One GaussianMixture per class, fitted on the rows of that class. A class with fewer rows than
+ * components gets one component per row.
+ */
+template <typename DataType, typename LabelType>
+class EM : public Model<DataType, LabelType> {
+public:
+    explicit EM(const EmParam &param = {});
+    explicit EM(const ModelParam &param) : EM(EmParam::parse(param)) {}
+    virtual ~EM() = default;
+
+    virtual bool train(const Data<DataType> &X_train, const Data<LabelType> &y_train) final;
+
+    virtual LabelType predict(const Vec<DataType> &X) final;
+
+    virtual double validate(const Data<DataType> &X_test, const Data<LabelType> &y_test) final;
+
+    virtual void describe() const final;
+
+    virtual memory::Usage memoryUsage() const final;
+
+    virtual uint32_t inputDim() const final;
+
+    virtual bool save(const char *filename) const final;
+
+    virtual bool load(const char *filename) final;
+
+    // labels of rows [0, X.m) of X
+    Vec<LabelType> predictBatch(const Data<DataType> &X) const;
+
+private:
+    // fixed size part of the saved model. sections follow: class labels, log priors, components
+    // per class, then weights, means and covariances of each class in turn
+    struct FileHeader {
+        uint32_t full;
+        uint32_t classes;
+        uint32_t dim;
+        uint32_t reserved;
+    };
+
+    MixtureParam mixture;
+    bool isModelShow;
+
+    uint32_t dim;
+    Vec<LabelType> classes;
+    Vec<double> logPrior;
+    std::vector<GaussianMixture> gmm;
+};
+
+template <typename DataType, typename LabelType>
+EM<DataType, LabelType>::EM(const EmParam &param)
+    : mixture(param.mixture), isModelShow(param.show), dim(0) {}
+
+template <typename DataType, typename LabelType>
+bool EM<DataType, LabelType>::train(const Data<DataType> &X_train,
+                                    const Data<LabelType> &y_train) {
+    STAT_PROFILE_SCOPE(__func__);
+
+    auto m = X_train.m, n = X_train.n;
+    if (m == 0 || n == 0 || y_train.m != m) {
+        printf("ERROR: invalid training set\n");
+        return false;
+    }
+    dim = n;
+    auto y = encodeLabels(y_train, classes);
+    std::vector<Vec<double>> rows(classes.size());  // contiguous rows of every class
+    for (uint32_t i = 0; i < m; ++i) {
+        const auto &x = X_train.data[i];
+        rows[y[i]].insert(rows[y[i]].end(), x.cbegin(), x.cend());
+    }
+
+    // the mixtures run one after the other, each one parallel inside
+    gmm.assign(classes.size(), GaussianMixture(mixture));
+    logPrior.resize(classes.size());
+    uint32_t iterations = 0;
+    for (std::size_t c = 0; c < classes.size(); ++c) {
+        auto count = rows[c].size() / n;
+        logPrior[c] = std::log(static_cast<double>(count) / m);
+        if (std::isnan(gmm[c].fit(rows[c].data(), count, n))) {
+            printf("ERROR: mixture of class %f failed\n", static_cast<double>(classes[c]));
+            gmm.clear();
+            return false;
+        }
+        iterations += gmm[c].iterations;
+    }
+    printf("INFO: training done, %zu mixtures, %u EM iterations\n", classes.size(), iterations);
+    describe();
+    return true;
+}
+
+template <typename DataType, typename LabelType>
+LabelType EM<DataType, LabelType>::predict(const Vec<DataType> &X) {
+    if (gmm.empty() || X.size() != dim) {
+        printf("ERROR: model is not trained or input dimension mismatch\n");
+        return 0;
+    }
+    Vec<double> x(X.cbegin(), X.cend());
+    std::size_t best = 0;
+    double bestScore = -Inf<double>;
+    for (std::size_t c = 0; c < classes.size(); ++c) {
+        double lp;
+        gmm[c].logDensity(x.data(), 1, &lp);
+        if (lp + logPrior[c] > bestScore) {
+            bestScore = lp + logPrior[c];
+            best = c;
+        }
+    }
+    return classes[best];
+}
+
+template <typename DataType, typename LabelType>
+Vec<LabelType> EM<DataType, LabelType>::predictBatch(const Data<DataType> &X) const {
+    STAT_PROFILE_SCOPE(__func__);
+
+    Vec<LabelType> labels(X.m);
+    if (gmm.empty() || X.n != dim) {
+        printf("ERROR: model is not trained or input dimension mismatch\n");
+        return labels;
+    }
+    Vec<double> rows;
+    rows.reserve(static_cast<std::size_t>(X.m) * dim);
+    for (const auto &x : X.data) rows.insert(rows.end(), x.cbegin(), x.cend());
+    Vec<double> best(X.m, -Inf<double>), lp(X.m);
+    for (std::size_t c = 0; c < classes.size(); ++c) {
+        gmm[c].logDensity(rows.data(), X.m, lp.data());
+        for (uint32_t i = 0; i < X.m; ++i) {
+            if (lp[i] + logPrior[c] > best[i]) {
+                best[i] = lp[i] + logPrior[c];
+                labels[i] = classes[c];
+            }
+        }
+    }
+    return labels;
+}
+
+template <typename DataType, typename LabelType>
+double EM<DataType, LabelType>::validate(const Data<DataType> &X_test,
+                                         const Data<LabelType> &y_test) {
+    STAT_PROFILE_SCOPE(__func__);
+
+    double correct = 0.0;
+    auto m = X_test.m;
+    auto predicted = predictBatch(X_test);
+    for (auto i = 0; i < m; ++i) {
+        if (predicted[i] == y_test.data[i][0]) ++correct;
+    }
+    double acc = correct / m;
+    printf("accuracy: %f\n\n", acc);
+    return acc;
+}
+
+template <typename DataType, typename LabelType>
+void EM<DataType, LabelType>::describe() const {
+    if (!isModelShow) return;
+    printf("EM (gaussian mixtures, %s covariance): %zu classes\n",
+           mixture.full ? "full" : "diagonal", classes.size());
+    for (std::size_t c = 0; c < classes.size(); ++c) {
+        const auto &g = gmm[c];
+        printf("\tclass %f, prior %f:\n", static_cast<double>(classes[c]), std::exp(logPrior[c]));
+        for (uint32_t k = 0; k < g.components(); ++k) {
+            printf("\t\tw = %f, mu = [", g.weights()[k]);
+            for (uint32_t j = 0; j < dim; ++j) {
+                printf(j ? ", %f" : "%f", g.means()[static_cast<std::size_t>(k) * dim + j]);
+            }
+            printf("]\n");
+        }
+    }
+    printf("\n");
+}
+
+template <typename DataType, typename LabelType>
+uint32_t EM<DataType, LabelType>::inputDim() const {
+    return dim;
+}
+
+template <typename DataType, typename LabelType>
+memory::Usage EM<DataType, LabelType>::memoryUsage() const {
+    memory::Usage u;
+    std::size_t mixtures = gmm.capacity() * sizeof(GaussianMixture);
+    for (const auto &g : gmm) mixtures += g.memoryUsage().total();
+    u.add("mixtures", mixtures);
+    u.add("priors", memory::heapBytes(logPrior));
+    u.add("classes", memory::heapBytes(classes));
+    return u;
+}
+
+template <typename DataType, typename LabelType>
+bool EM<DataType, LabelType>::save(const char *filename) const {
+    if (gmm.empty()) {
+        printf("ERROR: model is not trained yet\n");
+        return false;
+    }
+    serialize::Writer writer(filename);
+    writer.writeHeader(MODEL_EM, serialize::typeTag<DataType>(), serialize::typeTag<LabelType>());
+    writer.write(FileHeader{mixture.full, static_cast<uint32_t>(classes.size()), dim, 0});
+    writer.writeArray(classes.data(), classes.size());
+    writer.writeArray(logPrior.data(), logPrior.size());
+    Vec<uint32_t> components;
+    for (const auto &g : gmm) components.emplace_back(g.components());
+    writer.writeArray(components.data(), components.size());
+    for (const auto &g : gmm) {
+        writer.writeArray(g.weights().data(), g.weights().size());
+        writer.writeArray(g.means().data(), g.means().size());
+        writer.writeArray(g.covariances().data(), g.covariances().size());
+    }
+    return writer.good();
+}
+
+template <typename DataType, typename LabelType>
+bool EM<DataType, LabelType>::load(const char *filename) {
+    serialize::MappedFile file(filename);
+    serialize::Reader reader(file);
+    if (!reader.readHeader(MODEL_EM, serialize::typeTag<DataType>(),
+                           serialize::typeTag<LabelType>())) {
+        return false;
+    }
+    FileHeader header;
+    bool ok = reader.read(header) && header.classes > 0 && header.dim > 0;
+    const LabelType *labels = nullptr;
+    const double *priors = nullptr;
+    const uint32_t *components = nullptr;
+    if (ok) {
+        labels = reader.view<LabelType>(header.classes);
+        priors = reader.view<double>(header.classes);
+        components = reader.view<uint32_t>(header.classes);
+    }
+    ok = labels && priors && components;
+    // the covariance kind of the file, the model's own is replaced only once the file is valid
+    auto param = mixture;
+    param.full = header.full != 0;
+    std::vector<GaussianMixture> loaded(ok ? header.classes : 0, GaussianMixture(param));
+    for (uint32_t c = 0; ok && c < header.classes; ++c) {
+        auto K = components[c];
+        std::size_t cs = param.full ? static_cast<std::size_t>(header.dim) * header.dim
+                                    : header.dim;
+        auto w = reader.view<double>(K);
+        auto mu = reader.view<double>(static_cast<std::size_t>(K) * header.dim);
+        auto cov = reader.view<double>(K * cs);
+        ok = K > 0 && w && mu && cov && loaded[c].assign(K, header.dim, w, mu, cov);
+    }
+    if (!ok) {
+        printf("ERROR: corrupted em model file (%s)\n", filename);
+        return false;
+    }
+    mixture.full = param.full;
+    dim = header.dim;
+    classes.assign(labels, labels + header.classes);
+    logPrior.assign(priors, priors + header.classes);
+    gmm = std::move(loaded);
+    describe();
+    return true;
+}
+
+}  // namespace stat
+
+#endif  // __EM_H__
@@ -0,0 +1,479 @@
+#ifndef __HMM_H__
+#define __HMM_H__
+
+#include "Math.h"
+#include "Model.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <tuple>
+#include <vector>
+
+namespace stat {
+
+// observation (or state) indices of one sequence
+using Sequence = Vec<uint32_t>;
+
+struct HmmParam {
+    uint32_t states = 4;
+    uint32_t symbols = 0;          // 0 is one more than the largest symbol of the training set
+    uint32_t maxIterations = 100;  // Baum-Welch iterations
+    double tolerance = 1e-4;       // on the change of the log-likelihood per token
+    double smoothing = 1e-3;       // pseudo-count added to every expected count
+    uint32_t seed = 0;
+};
+
+/**
+ * Hidden Markov Model with discrete emissions
+ *
+ * Model:   $P(o, s) = \pi_{s_1} b_{s_1}(o_1) \prod_{t=2}^T{a_{s_{t-1} s_t} b_{s_t}(o_t)}$
+ *
+ * HMMs label whole sequences, they do not fit Model::predict() of a single row and are used
+ * directly: fit() (Baum-Welch), logLikelihood() and posteriors() (forward-backward), viterbi().
+ *
+ * The transition matrix A (N x N) and the emission matrix, stored transposed as E (M x N) so the
+ * emission column of a symbol is contiguous, are flat row-major arrays. Forward-backward is the
+ * scaled recursion of Rabiner: alpha is normalized at every step and the log-likelihood is the sum
+ * of the logs of the scales, so long sequences do not underflow. One step is a vector-matrix
+ * product (axpy over the rows of A) or a matrix-vector product (dot with the rows of A). Viterbi
+ * runs in log space, a step is a max-plus vector-matrix product.
+ *
+ * Baum-Welch splits the sequences into one slice per thread, each slice sums its expected counts
+ * into its own accumulators, the slices are reduced in order.
+ */
+class HMM {
+public:
+    explicit HMM(HmmParam _param = {}) : param(_param) {}
+
+    uint32_t states() const { return N; }
+    uint32_t symbols() const { return M; }
+    const Vec<double> &initial() const { return pi; }
+    const Vec<double> &transition() const { return A; }  // N x N, row i is P(. | i)
+    const Vec<double> &emission() const { return E; }    // M x N, row o is P(o | .)
+
+    memory::Usage memoryUsage() const {
+        memory::Usage u;
+        u.add("initial", memory::heapBytes(pi));
+        u.add("transition", memory::heapBytes(A));
+        u.add("emission", memory::heapBytes(E));
+        return u;
+    }
+
+    // parameters given directly, rows are normalized. false on a dimension mismatch
+    bool assign(uint32_t states, uint32_t symbols, const double *_pi, const double *_A,
+                const double *_E) {
+        if (states == 0 || symbols == 0) return false;
+        N = states;
+        M = symbols;
+        pi.assign(_pi, _pi + N);
+        A.assign(_A, _A + static_cast<std::size_t>(N) * N);
+        E.assign(_E, _E + static_cast<std::size_t>(M) * N);
+        normalize();
+        return true;
+    }
+
+    // random parameters, every row drawn from a peaked distribution (u^4 normalized)
+    static HMM random(uint32_t states, uint32_t symbols, uint32_t seed = 0) {
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        auto draw = [&](std::size_t n) {
+            Vec<double> v(n);
+            for (auto &e : v) e = std::pow(uniform(gen), 4) + 1e-3;
+            return v;
+        };
+        HmmParam param;
+        param.states = states;
+        param.symbols = symbols;
+        HMM hmm(param);
+        auto pi = draw(states), A = draw(static_cast<std::size_t>(states) * states);
+        auto E = draw(static_cast<std::size_t>(symbols) * states);
+        hmm.assign(states, symbols, pi.data(), A.data(), E.data());
+        return hmm;
+    }
+
+    // a state path and its observations of the given length
+    std::tuple<Sequence, Sequence> sample(std::size_t length, std::mt19937 &gen) const {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        auto draw = [&](auto weight, uint32_t n) {
+            double u = uniform(gen);
+            uint32_t k = 0;
+            for (; k + 1 < n && (u -= weight(k)) > 0; ++k) {}
+            return k;
+        };
+        Sequence path(length), obs(length);
+        uint32_t s = 0;
+        for (std::size_t t = 0; t < length; ++t) {
+            s = t == 0 ? draw([this](uint32_t k) { return pi[k]; }, N)
+                       : draw([this, s](uint32_t k) { return A[s * N + k]; }, N);
+            path[t] = s;
+            obs[t] = draw([this, s](uint32_t o) { return E[o * N + s]; }, M);
+        }
+        return std::make_tuple(path, obs);
+    }
+
+    /**
+     * Baum-Welch (EM) over the sequences from random initial parameters, returns the final
+     * log-likelihood per token. Sequences with a symbol out of range are an error.
+     */
+    double fit(const std::vector<Sequence> &sequences) {
+        STAT_PROFILE_SCOPE(__func__);
+
+        uint32_t top = 0;
+        std::size_t tokens = 0;
+        for (const auto &seq : sequences) {
+            for (auto o : seq) top = std::max(top, o + 1);
+            tokens += seq.size();
+        }
+        M = param.symbols ? param.symbols : top;
+        N = param.states;
+        if (tokens == 0 || N == 0 || top > M) {
+            printf("ERROR: empty training set or symbol out of range\n");
+            return NaN<double>;
+        }
+        auto init = random(N, M, param.seed);
+        pi = init.pi;
+        A = init.A;
+        E = init.E;
+
+        iterations = 0;
+        converged = false;
+        double loglik = -Inf<double>;
+        for (; iterations < param.maxIterations && !converged; ++iterations) {
+            auto counts = expectedCounts(sequences);
+            double next = counts.loglik / tokens;
+            maximize(counts);
+            converged = std::abs(next - loglik) < param.tolerance;
+            loglik = next;
+        }
+        return loglik;
+    }
+
+    // log P(obs), -inf for an impossible sequence or a symbol out of range
+    double logLikelihood(const Sequence &obs) const {
+        if (obs.empty()) return 0.0;
+        if (!inRange(obs)) return -Inf<double>;
+        Vec<double> alpha(obs.size() * N), scale(obs.size());
+        return forward(obs, alpha.data(), scale.data());
+    }
+
+    // P(s_t = i | obs) of every step, T x N. empty if obs is impossible
+    Vec<double> posteriors(const Sequence &obs) const {
+        auto T = obs.size();
+        if (!inRange(obs)) return {};
+        Vec<double> alpha(T * N), beta(T * N), scale(T);
+        if (T == 0 || std::isinf(forward(obs, alpha.data(), scale.data()))) return {};
+        backward(obs, scale.data(), beta.data());
+        for (std::size_t i = 0; i < T * N; ++i) alpha[i] *= beta[i];
+        return alpha;
+    }
+
+    // most likely state path, its log probability in logProb if given. empty with a symbol out of
+    // range
+    Sequence viterbi(const Sequence &obs, double *logProb = nullptr) const {
+        return viterbi(obs, logTables(), logProb);
+    }
+
+    // viterbi() of every sequence, in parallel over sequences
+    std::vector<Sequence> viterbiBatch(const std::vector<Sequence> &sequences) const {
+        STAT_PROFILE_SCOPE(__func__);
+
+        auto lt = logTables();
+        std::vector<Sequence> paths(sequences.size());
+        parallel::parallelFor(0, sequences.size(), 1, [&](std::size_t lo, std::size_t hi) {
+            for (auto k = lo; k < hi; ++k) paths[k] = viterbi(sequences[k], lt, nullptr);
+        });
+        return paths;
+    }
+
+    bool save(const char *filename) const {
+        if (N == 0) {
+            printf("ERROR: model is not trained yet\n");
+            return false;
+        }
+        serialize::Writer writer(filename);
+        writer.writeHeader(MODEL_HMM, serialize::typeTag<uint32_t>(),
+                           serialize::typeTag<uint32_t>());
+        writer.write(FileHeader{N, M, 0, 0});
+        writer.writeArray(pi.data(), pi.size());
+        writer.writeArray(A.data(), A.size());
+        writer.writeArray(E.data(), E.size());
+        return writer.good();
+    }
+
+    bool load(const char *filename) {
+        serialize::MappedFile file(filename);
+        serialize::Reader reader(file);
+        if (!reader.readHeader(MODEL_HMM, serialize::typeTag<uint32_t>(),
+                               serialize::typeTag<uint32_t>())) {
+            return false;
+        }
+        FileHeader header;
+        const double *p = nullptr, *a = nullptr, *e = nullptr;
+        if (reader.read(header) && header.states > 0 && header.symbols > 0) {
+            p = reader.view<double>(header.states);
+            a = reader.view<double>(static_cast<std::size_t>(header.states) * header.states);
+            e = reader.view<double>(static_cast<std::size_t>(header.symbols) * header.states);
+        }
+        if (!p || !a || !e) {
+            printf("ERROR: corrupted hmm model file (%s)\n", filename);
+            return false;
+        }
+        return assign(header.states, header.symbols, p, a, e);
+    }
+
+    uint32_t iterations = 0;
+    bool converged = false;
+
+private:
+    // fixed size part of the saved model. sections follow: pi, A and E
+    struct FileHeader {
+        uint32_t states;
+        uint32_t symbols;
+        uint32_t reserved0;
+        uint32_t reserved1;
+    };
+
+    // expected counts of a set of sequences
+    struct Counts {
+        Vec<double> pi;     // N
+        Vec<double> trans;  // N x N
+        Vec<double> emit;   // M x N
+        double loglik = 0.0;
+    };
+
+    HmmParam param;
+    uint32_t N = 0;
+    uint32_t M = 0;
+    Vec<double> pi;
+    Vec<double> A;
+    Vec<double> E;
+
+    // rows of pi, A and the columns of E (one per state) sum to 1
+    void normalize() {
+        auto rowNormalize = [](double *v, std::size_t n) {
+            double sum = 0.0;
+            for (std::size_t i = 0; i < n; ++i) sum += v[i];
+            for (std::size_t i = 0; i < n; ++i) v[i] = sum > 0 ? v[i] / sum : 1.0 / n;
+        };
+        rowNormalize(pi.data(), N);
+        for (uint32_t i = 0; i < N; ++i) rowNormalize(A.data() + static_cast<std::size_t>(i) * N, N);
+        for (uint32_t j = 0; j < N; ++j) {
+            double sum = 0.0;
+            for (uint32_t o = 0; o < M; ++o) sum += E[o * N + j];
+            for (uint32_t o = 0; o < M; ++o) E[o * N + j] = sum > 0 ? E[o * N + j] / sum : 1.0 / M;
+        }
+    }
+
+    // every symbol of obs has an emission row
+    bool inRange(const Sequence &obs) const {
+        for (auto o : obs) {
+            if (o >= M) {
+                printf("ERROR: symbol %u out of range, the model has %u symbols\n", o, M);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * scaled forward pass, alpha_t (T x N) sums to 1 and scale_t is the sum before normalization.
+     * returns log P(obs) = sum_t log scale_t, -inf if a scale is 0 (the rest is then not filled)
+     */
+    double forward(const Sequence &obs, double *alpha, double *scale) const {
+        auto T = obs.size();
+        double loglik = 0.0;
+        for (std::size_t t = 0; t < T; ++t) {
+            auto a = alpha + t * N;
+            auto e = E.data() + static_cast<std::size_t>(obs[t]) * N;
+            if (t == 0) {
+                for (uint32_t j = 0; j < N; ++j) a[j] = pi[j] * e[j];
+            } else {
+                // alpha_t = (alpha_{t-1} A) .* e
+                auto prev = a - N;
+                std::fill(a, a + N, 0.0);
+                for (uint32_t i = 0; i < N; ++i) {
+                    axpy(prev[i], A.data() + static_cast<std::size_t>(i) * N, a, N);
+                }
+                for (uint32_t j = 0; j < N; ++j) a[j] *= e[j];
+            }
+            double s = 0.0;
+            for (uint32_t j = 0; j < N; ++j) s += a[j];
+            if (!(s > 0.0)) return -Inf<double>;
+            scale[t] = s;
+            double inv = 1.0 / s;
+            for (uint32_t j = 0; j < N; ++j) a[j] *= inv;
+            loglik += std::log(s);
+        }
+        return loglik;
+    }
+
+    // scaled backward pass with the scales of forward(), alpha_t .* beta_t is then P(s_t | obs)
+    void backward(const Sequence &obs, const double *scale, double *beta) const {
+        auto T = obs.size();
+        std::fill(beta + (T - 1) * N, beta + T * N, 1.0);
+        Vec<double> v(N);
+        for (auto t = T - 1; t-- > 0;) {
+            // beta_t = A (e_{t+1} .* beta_{t+1}) / scale_{t+1}
+            auto e = E.data() + static_cast<std::size_t>(obs[t + 1]) * N;
+            auto next = beta + (t + 1) * N, b = beta + t * N;
+            double inv = 1.0 / scale[t + 1];
+            for (uint32_t j = 0; j < N; ++j) v[j] = e[j] * next[j] * inv;
+            for (uint32_t i = 0; i < N; ++i) {
+                b[i] = dot(A.data() + static_cast<std::size_t>(i) * N, v.data(), N);
+            }
+        }
+    }
+
+    Counts expectedCounts(const std::vector<Sequence> &sequences) const {
+        auto slices = std::max<std::size_t>(
+            1, std::min<std::size_t>(parallel::threads(), sequences.size()));
+        std::vector<Counts> partial(slices);
+        parallel::parallelFor(0, slices, 1, [&](std::size_t lo, std::size_t hi) {
+            Vec<double> alpha, beta, scale, v(N);
+            for (auto k = lo; k < hi; ++k) {
+                auto &c = partial[k];
+                c.pi.assign(N, 0.0);
+                c.trans.assign(static_cast<std::size_t>(N) * N, 0.0);
+                c.emit.assign(static_cast<std::size_t>(M) * N, 0.0);
+                auto first = sequences.size() * k / slices;
+                auto last = sequences.size() * (k + 1) / slices;
+                for (auto s = first; s < last; ++s) {
+                    const auto &obs = sequences[s];
+                    auto T = obs.size();
+                    if (T == 0) continue;
+                    alpha.resize(T * N);
+                    beta.resize(T * N);
+                    scale.resize(T);
+                    double ll = forward(obs, alpha.data(), scale.data());
+                    if (std::isinf(ll)) continue;  // impossible under the current parameters
+                    c.loglik += ll;
+                    backward(obs, scale.data(), beta.data());
+                    for (std::size_t t = 0; t < T; ++t) {
+                        auto a = alpha.data() + t * N, b = beta.data() + t * N;
+                        auto emit = c.emit.data() + static_cast<std::size_t>(obs[t]) * N;
+                        for (uint32_t j = 0; j < N; ++j) emit[j] += a[j] * b[j];
+                        if (t == 0) {
+                            for (uint32_t j = 0; j < N; ++j) c.pi[j] += a[j] * b[j];
+                        }
+                        if (t + 1 == T) continue;
+                        // xi_t(i, j) = alpha_t(i) a_ij e_j(o_{t+1}) beta_{t+1}(j) / scale_{t+1}
+                        auto e = E.data() + static_cast<std::size_t>(obs[t + 1]) * N;
+                        auto next = b + N;
+                        double inv = 1.0 / scale[t + 1];
+                        for (uint32_t j = 0; j < N; ++j) v[j] = e[j] * next[j] * inv;
+                        for (uint32_t i = 0; i < N; ++i) {
+                            auto Ai = A.data() + static_cast<std::size_t>(i) * N;
+                            auto Ti = c.trans.data() + static_cast<std::size_t>(i) * N;
+                            for (uint32_t j = 0; j < N; ++j) Ti[j] += a[i] * Ai[j] * v[j];
+                        }
+                    }
+                }
+            }
+        });
+        auto total = std::move(partial[0]);
+        for (std::size_t k = 1; k < slices; ++k) {
+            const auto &c = partial[k];
+            for (std::size_t i = 0; i < total.pi.size(); ++i) total.pi[i] += c.pi[i];
+            for (std::size_t i = 0; i < total.trans.size(); ++i) total.trans[i] += c.trans[i];
+            for (std::size_t i = 0; i < total.emit.size(); ++i) total.emit[i] += c.emit[i];
+            total.loglik += c.loglik;
+        }
+        return total;
+    }
+
+    void maximize(const Counts &c) {
+        auto smooth = [this](const Vec<double> &counts) {
+            Vec<double> v(counts);
+            for (auto &e : v) e += param.smoothing;
+            return v;
+        };
+        pi = smooth(c.pi);
+        A = smooth(c.trans);
+        E = smooth(c.emit);
+        normalize();
+    }
+
+    // log parameters of viterbi, log A both row-major and transposed
+    struct LogTables {
+        Vec<double> pi, A, AT, E;
+    };
+
+    LogTables logTables() const {
+        LogTables lt;
+        auto log = [](const Vec<double> &v) {
+            Vec<double> out(v.size());
+            for (std::size_t i = 0; i < v.size(); ++i) out[i] = std::log(v[i]);
+            return out;
+        };
+        lt.pi = log(pi);
+        lt.A = log(A);
+        lt.E = log(E);
+        lt.AT.resize(A.size());
+        transpose(lt.A.data(), lt.AT.data(), N, N);
+        return lt;
+    }
+
+    /**
+     * delta_t(j) = log e_j(o_t) + max_i (delta_{t-1}(i) + log a_ij). The max runs over source
+     * states in the outer loop, the inner loop is a vertical max over all target states at once.
+     * No backpointers are kept, the deltas of every step are: the traceback recovers the best
+     * predecessor of one state per step, a max-plus reduction with a column of log A.
+     */
+    Sequence viterbi(const Sequence &obs, const LogTables &lt, double *logProb) const {
+        auto T = obs.size();
+        if (T == 0 || !inRange(obs)) {
+            if (logProb) *logProb = T == 0 ? 0.0 : -Inf<double>;
+            return {};
+        }
+        Vec<double> delta(T * N);
+        for (uint32_t j = 0; j < N; ++j) delta[j] = lt.pi[j] + lt.E[obs[0] * N + j];
+        for (std::size_t t = 1; t < T; ++t) {
+            auto prev = delta.data() + (t - 1) * N, next = prev + N;
+            std::fill(next, next + N, -Inf<double>);
+            for (uint32_t i = 0; i < N; ++i) {
+                auto a = lt.A.data() + static_cast<std::size_t>(i) * N;
+                double d = prev[i];
+                for (uint32_t j = 0; j < N; ++j) next[j] = std::max(next[j], d + a[j]);
+            }
+            auto e = lt.E.data() + static_cast<std::size_t>(obs[t]) * N;
+            for (uint32_t j = 0; j < N; ++j) next[j] += e[j];
+        }
+        Sequence path(T);
+        auto last = delta.data() + (T - 1) * N;
+        auto best = std::max_element(last, last + N);
+        if (logProb) *logProb = *best;
+        path[T - 1] = static_cast<uint32_t>(best - last);
+        for (auto t = T - 1; t > 0; --t) {
+            std::size_t arg;
+            maxPlus(delta.data() + (t - 1) * N, lt.AT.data() + path[t] * N, N, arg);
+            path[t - 1] = static_cast<uint32_t>(arg);
+        }
+        return path;
+    }
+};
+
+namespace synthetic {
+
+/**
+ * `count` sequences of `length` tokens sampled from hmm, as (observations, state paths). sequence
+ * k has its own generator seeded from (seed, k)
+ */
+inline std::tuple<std::vector<Sequence>, std::vector<Sequence>> makeSequences(
+    const HMM &hmm, std::size_t count, std::size_t length, uint32_t seed = 0) {
+    std::vector<Sequence> obs(count), paths(count);
+    for (std::size_t k = 0; k < count; ++k) {
+        std::mt19937 gen(seed * 1000003u + static_cast<uint32_t>(k));
+        std::tie(paths[k], obs[k]) = hmm.sample(length, gen);
+    }
+    return std::make_tuple(obs, paths);
+}
+
+}  // namespace synthetic
+
+}  // namespace stat
+
+#endif  // __HMM_H__
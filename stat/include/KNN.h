@@ -2,24 +2,110 @@
 #define __KNN_H__
 
 #include "Math.h"
+#include "Memory.h"
 #include "Model.h"
+#include "Numa.h"
+#include "Parallel.h"
+#include "Quantization.h"
+#include "Reduction.h"
 
 #include <algorithm>
-#include <functional>
-#include <map>
+#include <cstdint>
+#include <limits>
 #include <memory>
-#include <set>
-#include <unordered_set>
+#include <numeric>
 #include <utility>
+#include <vector>
 
 namespace stat {
 
+struct KnnParam {
+    enum Index : uint32_t {
+        SIMPLE_KNN,
+        KDTREE,
+        PQ,
+    };
+
+    uint32_t k = 3;
+    uint32_t p = 2;  // of the Lp distance
+    Index type = SIMPLE_KNN;
+    bool show = false;
+    reduction::Kind reductionKind = reduction::NONE;
+    uint32_t reducedDim = 32;
+    uint32_t pqSubspaces = 0;  // 0 is the quantizer default
+    uint32_t rerank = 0;       // PQ candidates re-ranked by their exact distance, 0 is none
+    bool sharded = false;      // simple k-NN scan split into shards on pinned threads
+    uint32_t shards = 0;       // 0 is one per NUMA node, or one per pool thread on a single node
+    double memoryMB = 0.0;     // train() refuses an index larger than this, 0 is no budget
+
+    // {"k"}, {"p"}, {"model_type", "knn" | "kdtree" | "pq"}, {"model_show"}, {"reduction", "pca" |
+    // "jl"}, {"reduced_dim"}, {"pq_m"}, {"rerank"}, {"sharded"}, {"shards"}, {"memory_budget"} MB
+    static KnnParam parse(const ModelParam &param) {
+        KnnParam p;
+        ParamReader(param, "k-NN")
+            .number("k", p.k, 1u)
+            .number("p", p.p, 1u)
+            .choice("model_type", p.type, {{"knn", SIMPLE_KNN}, {"kdtree", KDTREE}, {"pq", PQ}})
+            .flag("model_show", p.show)
+            .choice("reduction", p.reductionKind,
+                    {{"pca", reduction::PCA}, {"jl", reduction::SPARSE_JL}})
+            .number("reduced_dim", p.reducedDim, 1u)
+            .number("pq_m", p.pqSubspaces)
+            .number("rerank", p.rerank)
+            .flag("sharded", p.sharded)
+            .number("shards", p.shards)
+            .number("memory_budget", p.memoryMB, 0.0);
+        return p;
+    }
+};
+
+/**
+ * k-Nearest Neighbor model
+ *
+ * Training points are kept in one contiguous row-major buffer, the kd-tree is flattened into an
+ * array of nodes indexing that buffer. Both buffers are saved as is by `save()`, and `load()`
+ * mmaps them back and queries them in place, a large index is ready without any rebuild.
+ *
+ * With {"reduction", "pca"} or {"reduction", "jl"} the points are first projected to
+ * {"reduced_dim", "32"} dimensions (Reduction.h), both buffers and every query live in the reduced
+ * space. Distances get cheaper by n / reduced_dim, and a kd-tree becomes useful again.
+ *
+ * The simple k-NN stores its points with the dimensions reordered by decreasing variance, and
+ * keeps the Lp norm of each point. A query skips a point when |norm(q) - norm(x)|, a lower bound
+ * of the distance by the reverse triangle inequality, is beyond the current k-th distance, and
+ * abandons the sum of a distance once it is; high variance dimensions first bring it there early.
+ * Profile counters DIMS_TOUCHED / DIMS_SCANNED give the fraction of dimensions actually read.
+ *
+ * {"model_type", "pq"} keeps product quantization codes (Quantization.h) instead of the points,
+ * {"pq_m", "M"} bytes per point (default one per 8 dimensions), and a query is a scan of the codes
+ * with its asymmetric distance table. With {"rerank", "R"} the points are kept as well and the R
+ * best candidates of the scan are re-ranked by their exact distance; a loaded model leaves the
+ * points in the mapped file, only the pages of candidates are read. The tables hold squared L2
+ * distances, so PQ without rerank takes p = 2 only; with rerank the candidates are still chosen by
+ * L2 and only their final order is Lp.
+ *
+ * {"sharded", "true"} splits the rows of the simple k-NN into shards, one per NUMA node (Numa.h),
+ * each owned by a thread pinned to the cpus of its node. That thread copies its rows, so they are
+ * placed on its node by first touch, and scans them for every query: each shard keeps its own top
+ * k, the shard results are merged into the k nearest ones. The training copy of the points is
+ * released once sharded. On a single node the shards are plain (one per pool thread or
+ * {"shards", "N"}), with unpinned threads.
+ *
+ * memoryUsage() reports the buffers above by component. With {"memory_budget", "MB"} train() sizes
+ * the index it would build from the training set and fails, before allocating it, if that is over
+ * the budget.
+ */
 template <typename DataType, typename LabelType>
 class KNN : public Model<DataType, LabelType> {
 public:
-    explicit KNN(ModelParam param);
+    explicit KNN(const KnnParam &param = {});
+    explicit KNN(const ModelParam &param) : KNN(KnnParam::parse(param)) {}
     virtual ~KNN() = default;
 
+    // queries work on raw views of the owned buffers (or of the mapped file)
+    KNN(const KNN &) = delete;
+    KNN &operator=(const KNN &) = delete;
+
     virtual bool train(const Data<DataType> &X_train, const Data<LabelType> &y_train) final;
 
     virtual LabelType predict(const Vec<DataType> &X) final;
@@ -28,30 +114,56 @@ public:
 
     virtual void describe() const final;
 
+    virtual memory::Usage memoryUsage() const final;
+
+    virtual uint32_t inputDim() const final;
+
+    virtual bool save(const char *filename) const final;
+
+    virtual bool load(const char *filename) final;
+
 private:
-    enum KnnType : uint32_t {
-        SIMPLE_KNN,
-        KDTREE,
+    using KnnType = KnnParam::Index;
+
+    // flattened kd-tree node. nodes are stored in pre-order and node i splits on point i (points
+    // are reordered while building the tree), children are indices into the node array.
+    struct KdNode {
+        uint32_t axis;
+        uint32_t left;
+        uint32_t right;
+        uint32_t reserved;
     };
 
-    // combine X (sample data) and y (sample lable) together. X will be sorted during building
-    // kd-tree, this is to make sure that y and X are in the same order
-    using Point = std::pair<Vec<DataType>, LabelType>;
+    static constexpr uint32_t kNullNode = std::numeric_limits<uint32_t>::max();
 
-    struct KdNode {
-        Vec<DataType> data;  // a point from kd space
-        LabelType label;
-        uint32_t level;
-        std::shared_ptr<KdNode> left;
-        std::shared_ptr<KdNode> right;
-        double nearest_dist;
-        KdNode(const Vec<DataType> &_data, LabelType _label, uint32_t _level)
-            : data(_data),
-              label(_label),
-              level(_level),
-              left(nullptr),
-              right(nullptr),
-              nearest_dist(0.0) {}
+    // (distance, label) of a candidate, the k nearest ones are kept in a max-heap
+    using Neighbor = std::pair<double, LabelType>;
+
+    // per query search statistics, reported to the profiler once per query
+    struct SearchStats {
+        uint64_t visited = 0;
+        uint64_t pruned = 0;
+    };
+
+    // fixed size part of the saved model, followed by a PqHeader for PQ. sections follow: points
+    // (none for PQ without rerank), labels, kd-tree nodes, the projection if reduction is not NONE,
+    // for the simple k-NN the dimension order and the point norms, for PQ the quantizer and codes
+    struct FileHeader {
+        uint32_t k;
+        uint32_t p;
+        uint32_t type;
+        uint32_t rows;
+        uint32_t dim;
+        uint32_t nodes;
+        uint32_t root;
+        uint32_t reduction;
+    };
+
+    struct PqHeader {
+        uint32_t subspaces;
+        uint32_t rerank;
+        uint32_t reserved0;
+        uint32_t reserved1;
     };
 
     uint32_t k;
@@ -59,81 +171,186 @@ private:
     KnnType type;
     bool isModelShow;
 
-    Data<DataType> xdata;
-    Data<LabelType> ydata;
-    std::size_t feature_dim;
-
-    std::shared_ptr<KdNode> root;
-    std::shared_ptr<KdNode> nearest;
-
-    // compare kNearestNodes, compare each node's nearest_dist
-    using NodeCmp = std::function<bool(std::shared_ptr<KdNode>, std::shared_ptr<KdNode>)>;
+    uint32_t rows;
+    uint32_t feature_dim;  // of the stored points, reduced_dim with a reduction
+    uint32_t input_dim;    // of the queries
+
+    reduction::Kind reductionKind;
+    uint32_t reducedDim;
+    reduction::Projection projection;
+
+    uint32_t pqSubspaces;  // 0 is the quantizer default
+    uint32_t rerank;
+    quantization::ProductQuantizer quantizer;
+
+    // rows [first, first + count) of a sharded simple k-NN, allocated and written by the thread
+    // of the shard
+    struct Shard {
+        uint32_t first = 0;
+        uint32_t count = 0;
+        Vec<DataType> points{memory::hugePages()};
+        Vec<double> norms;
+        Vec<LabelType> labels;
+    };
 
-    std::set<std::shared_ptr<KdNode>, NodeCmp> kNearestNodes;
+    bool sharded;
+    uint32_t shardCount;  // 0 is automatic
+    double memoryMB;
+    std::vector<Shard> shards;
+    std::unique_ptr<numa::ShardWorkers> workers;
+
+    // owned storage filled by train(), left empty when the model is mmapped by load(). the points,
+    // the one large buffer of a query, are on huge pages
+    Vec<DataType> pointBuf{memory::hugePages()};  // rows x feature_dim, row-major
+    Vec<LabelType> labelBuf;
+    std::vector<KdNode> nodeBuf;
+    Vec<uint8_t> codeBuf;   // rows x subspaces product quantization codes
+    Vec<uint32_t> orderBuf;  // simple k-NN: stored dimension j is input dimension order[j]
+    Vec<double> normBuf;     // simple k-NN: Lp norm of each point
+    serialize::MappedFile mapped;
+
+    // views used by queries, pointing either to the owned buffers or into `mapped`
+    const DataType *points;
+    const LabelType *labels;
+    const KdNode *nodes;
+    const uint8_t *codes;
+    const uint32_t *order;
+    const double *norms;
+    uint32_t nodeCount;
+    uint32_t root;
 
     bool train_simple(const Data<DataType> &X_train, const Data<LabelType> &y_train);
     bool train_kdtree(const Data<DataType> &X_train, const Data<LabelType> &y_train);
-    LabelType predict_simple(const Vec<DataType> &X);
-    LabelType predict_kdtree(const Vec<DataType> &X);
-
-    std::shared_ptr<KdNode> createKdTree(typename std::vector<Point>::iterator start,
-                                         typename std::vector<Point>::iterator end,
-                                         uint32_t depth = 0);
-    void findNearest(std::shared_ptr<KdNode> currentNode, Vec<DataType> X);
+    bool train_pq(const Data<DataType> &X_train, const Data<LabelType> &y_train);
+    LabelType predict_simple(const Vec<DataType> &X) const;
+    LabelType predict_kdtree(const Vec<DataType> &X) const;
+    LabelType predict_pq(const Vec<DataType> &X) const;
+    LabelType predict_sharded(const Vec<DataType> &X) const;
+
+    std::size_t indexBytes(uint32_t m, uint32_t n) const;
+    void reset(uint32_t m, uint32_t n, bool keepPoints = true);
+    void bindOwned();
+    void buildShards();
+    double permuteQuery(const Vec<DataType> &X, Vec<double> &query) const;
+    void scan(const double *query, double queryNorm, const DataType *pts, const double *nrm,
+              const LabelType *lbs, std::size_t count, std::vector<Neighbor> &heap,
+              uint64_t &evals, uint64_t &touched) const;
+    uint32_t createKdTree(const Data<DataType> &X_train, const Data<LabelType> &y_train,
+                          std::vector<uint32_t>::iterator start,
+                          std::vector<uint32_t>::iterator end, uint32_t depth = 0);
+    void findNearest(uint32_t node, const DataType *X, std::vector<Neighbor> &heap,
+                     SearchStats &stats) const;
+    static bool validTree(const KdNode *nds, uint32_t count, uint32_t root, uint32_t dim);
+    void pushNeighbor(std::vector<Neighbor> &heap, double dist, LabelType label) const;
+    LabelType vote(const std::vector<Neighbor> &neighbors) const;
 };
 
 template <typename DataType, typename LabelType>
-KNN<DataType, LabelType>::KNN(ModelParam param)
-    : k(3),
-      p(2),
-      type(KnnType::SIMPLE_KNN),
-      isModelShow(false),
-      xdata({{}}),
-      ydata({{}}),
+KNN<DataType, LabelType>::KNN(const KnnParam &param)
+    : k(param.k),
+      p(param.p),
+      type(param.type),
+      isModelShow(param.show),
+      rows(0),
       feature_dim(0),
-      root(nullptr),
-      nearest(nullptr),
-      kNearestNodes([](std::shared_ptr<KdNode> n1, std::shared_ptr<KdNode> n2) {
-          return n1->nearest_dist < n2->nearest_dist;
-      }) {
-    const auto &model_k = param.find("k");
-    if (model_k != param.cend()) {
-        // trust user input, user code must ensure values are correct
-        k = std::stol(model_k->second);
-    }
-
-    const auto &model_p = param.find("p");
-    if (model_p != param.cend()) { p = std::stol(model_p->second); }
-
-    const auto &model_type = param.find("model_type");
-    if (model_type != param.cend()) {
-        if (model_type->second == "knn") {
-            type = KnnType::SIMPLE_KNN;
-        } else if (model_type->second == "kdtree") {
-            type = KnnType::KDTREE;
-        }
-    }
+      input_dim(0),
+      reductionKind(param.reductionKind),
+      reducedDim(param.reducedDim),
+      pqSubspaces(param.pqSubspaces),
+      rerank(param.rerank),
+      sharded(param.sharded),
+      shardCount(param.shards),
+      memoryMB(param.memoryMB),
+      points(nullptr),
+      labels(nullptr),
+      nodes(nullptr),
+      codes(nullptr),
+      order(nullptr),
+      norms(nullptr),
+      nodeCount(0),
+      root(kNullNode) {}
 
-    const auto &model_show = param.find("model_show");
-    if (model_show != param.cend()) {
-        if (model_show->second == "true") { isModelShow = true; }
+template <typename DataType, typename LabelType>
+bool KNN<DataType, LabelType>::train(const Data<DataType> &X_train,
+                                     const Data<LabelType> &y_train) {
+    const Data<DataType> *X = &X_train;
+    Data<DataType> reduced;
+    projection = reduction::Projection();
+    if (reductionKind != reduction::NONE && X_train.m > 0 && X_train.n > 0) {
+        bool ok = reductionKind == reduction::PCA ? projection.fitPca(X_train, reducedDim)
+                                                  : projection.fitSparse(X_train.n, reducedDim);
+        if (!ok) return false;
+        reduced = projection.transformData(X_train);
+        X = &reduced;
     }
+    auto bytes = indexBytes(X->m, X->n);
+    if (memory::overBudget(memoryMB, bytes)) {
+        printf("ERROR: k-NN index of %zu bytes over the memory budget of %.1f MB\n", bytes,
+               memoryMB);
+        return false;
+    }
+    bool ok = type == KnnType::SIMPLE_KNN ? train_simple(*X, y_train)
+              : type == KnnType::KDTREE   ? train_kdtree(*X, y_train)
+                                          : train_pq(*X, y_train);
+    input_dim = X_train.n;
+    return ok;
 }
 
+// bytes train() keeps for m points of n stored dimensions, as memoryUsage() would report them
 template <typename DataType, typename LabelType>
-bool KNN<DataType, LabelType>::train(const Data<DataType> &X_train,
-                                     const Data<LabelType> &y_train) {
+std::size_t KNN<DataType, LabelType>::indexBytes(uint32_t m, uint32_t n) const {
+    std::size_t rowsBytes = static_cast<std::size_t>(m) * n * sizeof(DataType);
+    std::size_t bytes = static_cast<std::size_t>(m) * sizeof(LabelType);
     if (type == KnnType::SIMPLE_KNN) {
-        return train_simple(X_train, y_train);
+        bytes += rowsBytes + n * sizeof(uint32_t) + static_cast<std::size_t>(m) * sizeof(double);
+    } else if (type == KnnType::KDTREE) {
+        bytes += rowsBytes + static_cast<std::size_t>(m) * sizeof(KdNode);
     } else {
-        return train_kdtree(X_train, y_train);
+        std::size_t M = std::min(n, pqSubspaces ? pqSubspaces : (n + 7) / 8);
+        bytes += static_cast<std::size_t>(m) * M +
+                 std::size_t(quantization::ProductQuantizer::kCodes) * n * sizeof(float);
+        if (rerank > 0) bytes += rowsBytes;
     }
+    return bytes;
+}
+
+template <typename DataType, typename LabelType>
+void KNN<DataType, LabelType>::reset(uint32_t m, uint32_t n, bool keepPoints) {
+    workers.reset();
+    shards.clear();
+    mapped = serialize::MappedFile();
+    pointBuf.clear();
+    labelBuf.clear();
+    nodeBuf.clear();
+    codeBuf.clear();
+    orderBuf.clear();
+    normBuf.clear();
+    if (keepPoints) pointBuf.reserve(static_cast<std::size_t>(m) * n);
+    labelBuf.reserve(m);
+    rows = m;
+    feature_dim = n;
+    root = kNullNode;
+    if (k > m) {
+        printf("WARNING: improper k, set to k = m = %u\n", m);
+        k = m;
+    }
+}
+
+template <typename DataType, typename LabelType>
+void KNN<DataType, LabelType>::bindOwned() {
+    points = pointBuf.empty() ? nullptr : pointBuf.data();
+    labels = labelBuf.data();
+    nodes = nodeBuf.data();
+    codes = codeBuf.empty() ? nullptr : codeBuf.data();
+    order = orderBuf.empty() ? nullptr : orderBuf.data();
+    norms = normBuf.empty() ? nullptr : normBuf.data();
+    nodeCount = nodeBuf.size();
 }
 
 template <typename DataType, typename LabelType>
 bool KNN<DataType, LabelType>::train_simple(const Data<DataType> &X_train,
                                             const Data<LabelType> &y_train) {
-    Clock clk(__func__);
+    STAT_PROFILE_SCOPE(__func__);
 
     printf("INFO: simple k-NN has no training progress\n");
     auto m = X_train.m, n = X_train.n;
@@ -141,8 +358,32 @@ bool KNN<DataType, LabelType>::train_simple(const Data<DataType> &X_train,
         printf("ERROR: invalid training set\n");
         return false;
     }
-    xdata = X_train;
-    ydata = y_train;
+    reset(m, n);
+    // decreasing variance, the dimensions most likely to grow a distance are summed first
+    auto stats = columnSummaries(X_train);
+    orderBuf.resize(n);
+    std::iota(orderBuf.begin(), orderBuf.end(), 0u);
+    std::stable_sort(orderBuf.begin(), orderBuf.end(),
+                     [&](uint32_t a, uint32_t b) { return stats[a].m2 > stats[b].m2; });
+    normBuf.reserve(m);
+    for (uint32_t i = 0; i < m; ++i) {
+        const auto &x = X_train.data[i];
+        double norm = 0.0;
+        for (uint32_t j = 0; j < n; ++j) {
+            pointBuf.emplace_back(x[orderBuf[j]]);
+            norm += absPow(static_cast<double>(x[j]), p);
+        }
+        normBuf.emplace_back(rootPow(norm, p));
+        labelBuf.emplace_back(y_train.data[i][0]);
+    }
+    bindOwned();
+    if (sharded) {
+        buildShards();
+        // every query reads the shards, the training copy would only be kept for save()
+        pointBuf.clear();
+        pointBuf.shrink_to_fit();
+        points = nullptr;
+    }
 
     describe();
     return true;
@@ -151,7 +392,7 @@ bool KNN<DataType, LabelType>::train_simple(const Data<DataType> &X_train,
 template <typename DataType, typename LabelType>
 bool KNN<DataType, LabelType>::train_kdtree(const Data<DataType> &X_train,
                                             const Data<LabelType> &y_train) {
-    Clock clk(__func__);
+    STAT_PROFILE_SCOPE(__func__);
 
     printf("INFO: creating KD-Tree\n");
     auto m = X_train.m, n = X_train.n;
@@ -159,14 +400,16 @@ bool KNN<DataType, LabelType>::train_kdtree(const Data<DataType> &X_train,
         printf("ERROR: invalid training set\n");
         return false;
     }
-    feature_dim = m;
-    std::vector<Point> Points;
-    for (auto i = 0; i < m; ++i) {
-        Points.emplace_back(std::make_pair(X_train.data[i], y_train.data[i][0]));
-    }
-    root = createKdTree(Points.begin(), Points.end(), 0);
-    if (root) {
+    reset(m, n);
+    nodeBuf.reserve(m);
+    // build over row indices, points are copied into the buffer in tree (pre-)order
+    std::vector<uint32_t> index(m);
+    for (uint32_t i = 0; i < m; ++i) index[i] = i;
+    root = createKdTree(X_train, y_train, index.begin(), index.end(), 0);
+    bindOwned();
+    if (root != kNullNode) {
         printf("INFO: KD-Tree created.\n");
+        describe();
         return true;
     } else {
         printf("ERROR: KD-Tree create failed.\n");
@@ -174,93 +417,268 @@ bool KNN<DataType, LabelType>::train_kdtree(const Data<DataType> &X_train,
     }
 }
 
+template <typename DataType, typename LabelType>
+bool KNN<DataType, LabelType>::train_pq(const Data<DataType> &X_train,
+                                        const Data<LabelType> &y_train) {
+    STAT_PROFILE_SCOPE(__func__);
+
+    printf("INFO: training product quantizer\n");
+    auto m = X_train.m, n = X_train.n;
+    if (m == 0 || n == 0) {
+        printf("ERROR: invalid training set\n");
+        return false;
+    }
+    if (p != 2 && rerank == 0) {
+        printf("ERROR: product quantization ranks by L2, p = %u needs {\"rerank\"}\n", p);
+        return false;
+    }
+    reset(m, n, rerank > 0);
+    quantization::PqParam param;
+    param.subspaces = pqSubspaces;
+    if (!quantizer.train(X_train, param)) return false;
+    codeBuf = quantizer.encode(X_train);
+    for (uint32_t i = 0; i < m; ++i) {
+        if (rerank > 0) {
+            pointBuf.insert(pointBuf.end(), X_train.data[i].cbegin(), X_train.data[i].cend());
+        }
+        labelBuf.emplace_back(y_train.data[i][0]);
+    }
+    bindOwned();
+    printf("INFO: %u points encoded to %u bytes each (%zu as %s)\n", m, quantizer.subspaces(),
+           n * sizeof(DataType), rerank > 0 ? "kept for rerank" : "dropped");
+
+    describe();
+    return true;
+}
+
 template <typename DataType, typename LabelType>
 LabelType KNN<DataType, LabelType>::predict(const Vec<DataType> &X) {
+    if (X.size() != input_dim) {
+        printf("ERROR: dimension mismatch, expect %u but got %zu\n", input_dim, X.size());
+        return 0;
+    }
+    const Vec<DataType> *query = &X;
+    thread_local Vec<DataType> reduced;
+    if (projection.kind() != reduction::NONE) {
+        reduced.resize(feature_dim);
+        projection.apply(X.data(), reduced.data());
+        query = &reduced;
+    }
     if (type == KnnType::SIMPLE_KNN) {
-        return predict_simple(X);
+        return shards.empty() ? predict_simple(*query) : predict_sharded(*query);
+    } else if (type == KnnType::KDTREE) {
+        return predict_kdtree(*query);
     } else {
-        return predict_kdtree(X);
+        return predict_pq(*query);
     }
 }
 
 template <typename DataType, typename LabelType>
-LabelType KNN<DataType, LabelType>::predict_simple(const Vec<DataType> &X) {
-    auto m = xdata.m;
-    if (k > m) {
-        printf("WARNING: improper k, set to k = m = %d\n", m);
-        k = m;
-    }
-    std::multimap<double, LabelType> knnMap;
-    for (auto i = 0; i < k; ++i) {
-        auto dist = Lp(X, xdata.data[i], p);
-        knnMap.emplace(std::make_pair(dist, ydata.data[i][0]));
-    }
-    for (auto i = k; i < m; ++i) {
-        // update knn distance map. std::multimap is in lexicographical order by default.
-        auto dist = Lp(X, xdata.data[i], p);
-        auto last = knnMap.end();
-        --last;
-        if (last->first > dist) {
-            knnMap.erase(last);
-            knnMap.emplace(std::make_pair(dist, ydata.data[i][0]));
-        }
-    }
-    std::unordered_set<LabelType> keys;
-    std::multiset<LabelType> multiKeys;
-    for (const auto &p : knnMap) {
-        keys.emplace(p.second);
-        multiKeys.emplace(p.second);
+void KNN<DataType, LabelType>::pushNeighbor(std::vector<Neighbor> &heap, double dist,
+                                            LabelType label) const {
+    if (heap.size() < k) {
+        heap.emplace_back(dist, label);
+        std::push_heap(heap.begin(), heap.end());
+    } else if (dist < heap.front().first) {
+        // replace current k-th nearest one
+        std::pop_heap(heap.begin(), heap.end());
+        heap.back() = std::make_pair(dist, label);
+        std::push_heap(heap.begin(), heap.end());
     }
+}
+
+template <typename DataType, typename LabelType>
+LabelType KNN<DataType, LabelType>::vote(const std::vector<Neighbor> &neighbors) const {
+    // k is small, counting in place is cheaper than any associative container. neighbors are
+    // sorted by distance, so a tie is broken in favor of the label of the nearer neighbor
     std::size_t maxCount = 0;
     LabelType predictedLabel = 0;
-    for (auto label : keys) {
-        auto count = multiKeys.count(label);
+    for (const auto &n : neighbors) {
+        auto count = std::count_if(neighbors.cbegin(), neighbors.cend(),
+                                   [&n](const Neighbor &o) { return o.second == n.second; });
         if (count > maxCount) {
             maxCount = count;
-            predictedLabel = label;
+            predictedLabel = n.second;
         }
     }
     return predictedLabel;
 }
 
 template <typename DataType, typename LabelType>
-LabelType KNN<DataType, LabelType>::predict_kdtree(const Vec<DataType> &X) {
-    if (!root) {
-        printf("ERROR: KD-Tree doesn't exist, please creat KD-Tree first\n");
+double KNN<DataType, LabelType>::permuteQuery(const Vec<DataType> &X, Vec<double> &query) const {
+    query.resize(feature_dim);
+    double queryNorm = 0.0;
+    for (uint32_t j = 0; j < feature_dim; ++j) {
+        query[j] = static_cast<double>(X[order[j]]);
+        queryNorm += absPow(query[j], p);
+    }
+    return rootPow(queryNorm, p);
+}
+
+// k nearest of `count` contiguous points into `heap`, ranked by the p-th power of the distance,
+// same order without any root
+template <typename DataType, typename LabelType>
+void KNN<DataType, LabelType>::scan(const double *query, double queryNorm, const DataType *pts,
+                                    const double *nrm, const LabelType *lbs, std::size_t count,
+                                    std::vector<Neighbor> &heap, uint64_t &evals,
+                                    uint64_t &touched) const {
+    for (std::size_t i = 0; i < count; ++i) {
+        double bound = heap.size() < k ? Inf<double> : heap.front().first;
+        if (absPow(queryNorm - nrm[i], p) >= bound) continue;
+        std::size_t dims = 0;
+        double dist = LpPowBounded(query, pts + i * feature_dim, feature_dim, p, bound, dims);
+        pushNeighbor(heap, dist, lbs[i]);
+        ++evals;
+        touched += dims;
+    }
+}
+
+template <typename DataType, typename LabelType>
+LabelType KNN<DataType, LabelType>::predict_simple(const Vec<DataType> &X) const {
+    if (!points || !order || !norms) {
+        printf("ERROR: model is not trained yet\n");
         return 0;
     }
+    thread_local Vec<double> query;
+    double queryNorm = permuteQuery(X, query);
+    std::vector<Neighbor> heap;
+    heap.reserve(k);
+    uint64_t evals = 0, touched = 0;
+    scan(query.data(), queryNorm, points, norms, labels, rows, heap, evals, touched);
+    STAT_PROFILE_COUNT(DISTANCE_EVALS, evals);
+    STAT_PROFILE_COUNT(DIMS_TOUCHED, touched);
+    STAT_PROFILE_COUNT(DIMS_SCANNED, static_cast<uint64_t>(rows) * feature_dim);
+    std::sort_heap(heap.begin(), heap.end());
+    return vote(heap);
+}
 
-    // clear previous nearest info.
-    nearest = nullptr;
-    kNearestNodes.clear();
+// every shard scans its rows on its own thread into its own top k, then the k nearest of those
+template <typename DataType, typename LabelType>
+LabelType KNN<DataType, LabelType>::predict_sharded(const Vec<DataType> &X) const {
+    thread_local Vec<double> query;
+    double queryNorm = permuteQuery(X, query);
+    // the shard threads have their own thread_local query, hand them this one
+    const double *q = query.data();
+    auto count = shards.size();
+    std::vector<std::vector<Neighbor>> local(count);
+    std::vector<uint64_t> evals(count, 0), touched(count, 0);
+    workers->run([&](uint32_t s) {
+        const auto &shard = shards[s];
+        local[s].reserve(k);
+        scan(q, queryNorm, shard.points.data(), shard.norms.data(),
+             shard.labels.data(), shard.count, local[s], evals[s], touched[s]);
+    });
+    std::vector<Neighbor> heap;
+    heap.reserve(k);
+    for (std::size_t s = 0; s < count; ++s) {
+        for (const auto &n : local[s]) pushNeighbor(heap, n.first, n.second);
+    }
+    STAT_PROFILE_COUNT(DISTANCE_EVALS, std::accumulate(evals.begin(), evals.end(), uint64_t(0)));
+    STAT_PROFILE_COUNT(DIMS_TOUCHED, std::accumulate(touched.begin(), touched.end(), uint64_t(0)));
+    STAT_PROFILE_COUNT(DIMS_SCANNED, static_cast<uint64_t>(rows) * feature_dim);
+    std::sort_heap(heap.begin(), heap.end());
+    return vote(heap);
+}
 
-    findNearest(root, X);
-    if (!nearest) {
+/**
+ * one shard per NUMA node, or shardCount of them spread over the nodes round robin, on a single
+ * node plain shards with unpinned threads. the thread of a shard copies the rows of the shard, its
+ * pages are first touched, hence placed, on the node the thread runs on
+ */
+template <typename DataType, typename LabelType>
+void KNN<DataType, LabelType>::buildShards() {
+    STAT_PROFILE_SCOPE(__func__);
+
+    const auto &topology = numa::nodes();
+    uint32_t count = shardCount ? shardCount
+                     : topology.size() > 1 ? static_cast<uint32_t>(topology.size())
+                                           : parallel::threads();
+    count = std::max<uint32_t>(std::min(count, rows), 1);
+    std::vector<std::vector<uint32_t>> cpus(count);
+    if (topology.size() > 1) {
+        for (uint32_t s = 0; s < count; ++s) cpus[s] = topology[s % topology.size()].cpus;
+    }
+    shards.clear();
+    shards.resize(count);
+    workers = std::make_unique<numa::ShardWorkers>(cpus);
+    workers->run([&](uint32_t s) {
+        auto &shard = shards[s];
+        shard.first = static_cast<uint32_t>(uint64_t(rows) * s / count);
+        shard.count = static_cast<uint32_t>(uint64_t(rows) * (s + 1) / count) - shard.first;
+        auto begin = points + static_cast<std::size_t>(shard.first) * feature_dim;
+        shard.points.assign(begin, begin + static_cast<std::size_t>(shard.count) * feature_dim);
+        shard.norms.assign(norms + shard.first, norms + shard.first + shard.count);
+        shard.labels.assign(labels + shard.first, labels + shard.first + shard.count);
+    });
+    if (isModelShow) {
+        printf("INFO: %u shards on %zu NUMA node(s)\n", count, topology.size());
+    }
+}
+
+template <typename DataType, typename LabelType>
+LabelType KNN<DataType, LabelType>::predict_kdtree(const Vec<DataType> &X) const {
+    if (root == kNullNode || !nodes) {
+        printf("ERROR: KD-Tree doesn't exist, please creat KD-Tree first\n");
+        return 0;
+    }
+    std::vector<Neighbor> heap;
+    heap.reserve(k);
+    SearchStats stats;
+    findNearest(root, X.data(), heap, stats);
+    STAT_PROFILE_COUNT(DISTANCE_EVALS, stats.visited);
+    STAT_PROFILE_COUNT(NODES_VISITED, stats.visited);
+    STAT_PROFILE_COUNT(PRUNED_SUBTREES, stats.pruned);
+    if (heap.empty()) {
         printf("ERROR: find nearst failed\n");
         return 0;
     }
-    std::unordered_set<LabelType> label_set;
-    std::multiset<LabelType> label_all;
-    for (const auto &n : kNearestNodes) {
-        label_set.emplace(n->label);
-        label_all.emplace(n->label);
+    std::sort_heap(heap.begin(), heap.end());
+    return vote(heap);
+}
+
+template <typename DataType, typename LabelType>
+LabelType KNN<DataType, LabelType>::predict_pq(const Vec<DataType> &X) const {
+    if (!codes || !labels) {
+        printf("ERROR: model is not trained yet\n");
+        return 0;
     }
-    std::size_t maxCount = 0;
-    LabelType predictedLabel = 0;
-    for (auto label : label_set) {
-        auto count = label_all.count(label);
-        if (count > maxCount) {
-            maxCount = count;
-            predictedLabel = label;
+    thread_local Vec<float> table;
+    auto M = quantizer.subspaces();
+    table.resize(static_cast<std::size_t>(M) * quantization::ProductQuantizer::kCodes);
+    quantizer.lookupTable(X.data(), table.data());
+
+    // the scan keeps the best `candidates` (approximate distance, row) in a max-heap
+    bool exact = rerank > 0 && points;
+    std::size_t candidates = exact ? std::max(k, rerank) : k;
+    std::vector<std::pair<float, uint32_t>> best;
+    best.reserve(candidates);
+    for (uint32_t i = 0; i < rows; ++i) {
+        float d = quantizer.distance(table.data(), codes + static_cast<std::size_t>(i) * M);
+        if (best.size() < candidates) {
+            best.emplace_back(d, i);
+            std::push_heap(best.begin(), best.end());
+        } else if (d < best.front().first) {
+            std::pop_heap(best.begin(), best.end());
+            best.back() = {d, i};
+            std::push_heap(best.begin(), best.end());
         }
     }
-    return predictedLabel;
+    std::vector<Neighbor> heap;
+    heap.reserve(k);
+    for (const auto &c : best) {
+        auto point = points + static_cast<std::size_t>(c.second) * feature_dim;
+        double dist = exact ? Lp(X.data(), point, feature_dim, p) : c.first;
+        pushNeighbor(heap, dist, labels[c.second]);
+    }
+    STAT_PROFILE_COUNT(DISTANCE_EVALS, exact ? best.size() : 0);
+    std::sort_heap(heap.begin(), heap.end());
+    return vote(heap);
 }
 
 template <typename DataType, typename LabelType>
 double KNN<DataType, LabelType>::validate(const Data<DataType> &X_test,
                                           const Data<LabelType> &y_test) {
-    Clock clk(__func__);
+    STAT_PROFILE_SCOPE(__func__);
 
     double correct = 0.0;
     auto m = X_test.m;
@@ -276,75 +694,241 @@ template <typename DataType, typename LabelType>
 void KNN<DataType, LabelType>::describe() const {
     if (!isModelShow) return;
     printf("\nKNN:\n\n");
-    printf("with k = %u\n\n", k);
+    printf("with k = %u, p = %u, %u points of %u dim%s\n\n", k, p, rows, feature_dim,
+           mapped.valid() ? " (mmapped)" : "");
+    if (!shards.empty()) printf("scan in %zu shards\n\n", shards.size());
+    if (type == KnnType::PQ) {
+        printf("product quantization: %u bytes per point, rerank %u\n\n", quantizer.subspaces(),
+               points ? rerank : 0);
+    }
+    if (projection.kind() != reduction::NONE) {
+        printf("reduced from %u dim by %s\n\n", input_dim,
+               projection.kind() == reduction::PCA ? "pca" : "sparse random projection");
+    }
+}
+
+template <typename DataType, typename LabelType>
+uint32_t KNN<DataType, LabelType>::inputDim() const {
+    return input_dim;
+}
+
+template <typename DataType, typename LabelType>
+memory::Usage KNN<DataType, LabelType>::memoryUsage() const {
+    memory::Usage u;
+    u.add("points", memory::heapBytes(pointBuf));
+    u.add("labels", memory::heapBytes(labelBuf));
+    u.add("kd-tree nodes", memory::heapBytes(nodeBuf));
+    u.add("pq codes", memory::heapBytes(codeBuf));
+    u.add("dimension order", memory::heapBytes(orderBuf));
+    u.add("norms", memory::heapBytes(normBuf));
+    std::size_t shardBytes = 0;
+    for (const auto &s : shards) {
+        shardBytes += memory::heapBytes(s.points) + memory::heapBytes(s.norms) +
+                      memory::heapBytes(s.labels);
+    }
+    u.add("shards", shardBytes);
+    u.add("projection", projection.memoryUsage());
+    u.add("quantizer", quantizer.memoryUsage());
+    // file backed, paged in on demand and dropped by the kernel under pressure
+    u.add("mapped file", mapped.size());
+    return u;
 }
 
 // Ref: https://github.com/junjiedong/KDTree
 // KD-Tree is actually a BST(Binary Search Tree), but it's order relation is compared between each
 // node's value on current split axis (index)
 template <typename DataType, typename LabelType>
-std::shared_ptr<typename KNN<DataType, LabelType>::KdNode> KNN<DataType, LabelType>::createKdTree(
-    typename std::vector<Point>::iterator start, typename std::vector<Point>::iterator end,
-    uint32_t depth) {
-    if (start >= end) return nullptr;
-    auto axis = depth % feature_dim;
-    auto cmp = [axis](const Point &p1, const Point &p2) { return p1.first[axis] < p2.first[axis]; };
+uint32_t KNN<DataType, LabelType>::createKdTree(const Data<DataType> &X_train,
+                                                const Data<LabelType> &y_train,
+                                                std::vector<uint32_t>::iterator start,
+                                                std::vector<uint32_t>::iterator end,
+                                                uint32_t depth) {
+    if (start >= end) return kNullNode;
+    uint32_t axis = depth % feature_dim;
+    const auto &X = X_train.data;
+    auto cmp = [&X, axis](uint32_t i1, uint32_t i2) { return X[i1][axis] < X[i2][axis]; };
     std::size_t len = end - start;
     auto mid = start + len / 2;
     std::nth_element(start, mid, end, cmp);
     // move to make left_val < mid_val, right_val >= mid_val
-    mid = std::partition(start, mid,
-                         [=](const auto &p) { return p.first[axis] != mid->first[axis]; });
-    auto node =
-        std::make_shared<typename KNN<DataType, LabelType>::KdNode>(mid->first, mid->second, depth);
-    node->left = createKdTree(start, mid, depth + 1);
-    node->right = createKdTree(mid + 1, end, depth + 1);
+    auto split = X[*mid][axis];
+    mid = std::partition(start, mid, [&X, axis, split](uint32_t i) { return X[i][axis] != split; });
+
+    uint32_t node = nodeBuf.size();
+    nodeBuf.push_back({axis, kNullNode, kNullNode, 0});
+    pointBuf.insert(pointBuf.end(), X[*mid].cbegin(), X[*mid].cend());
+    labelBuf.emplace_back(y_train.data[*mid][0]);
+    auto left = createKdTree(X_train, y_train, start, mid, depth + 1);
+    auto right = createKdTree(X_train, y_train, mid + 1, end, depth + 1);
+    nodeBuf[node].left = left;
+    nodeBuf[node].right = right;
     return node;
 }
 
+/**
+ * a loaded kd-tree is safe to search: every axis is below dim, every child is kNullNode or a node
+ * (whose point has the same index, count == rows), and no node is reached twice. every node has at
+ * most one parent and the root none, so the search from the root terminates
+ */
 template <typename DataType, typename LabelType>
-void KNN<DataType, LabelType>::findNearest(
-    std::shared_ptr<typename KNN<DataType, LabelType>::KdNode> currentNode, Vec<DataType> X) {
-    if (!currentNode) return;
-    auto axis = currentNode->level % feature_dim;
-    // find the leaf node which may be the nearest one to X (check the vertical distance from the
-    // split axis).
-    if (currentNode->left || currentNode->right) {
-        if (X[axis] < currentNode->data[axis] && currentNode->left) {
-            findNearest(currentNode->left, X);
-        } else if (currentNode->right) {
-            findNearest(currentNode->right, X);
+bool KNN<DataType, LabelType>::validTree(const KdNode *nds, uint32_t count, uint32_t root,
+                                         uint32_t dim) {
+    if (root >= count) return false;
+    std::vector<uint8_t> parent(count, 0);
+    parent[root] = 1;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (nds[i].axis >= dim) return false;
+        for (auto child : {nds[i].left, nds[i].right}) {
+            if (child == kNullNode) continue;
+            if (child >= count || parent[child]) return false;
+            parent[child] = 1;
         }
     }
+    return true;
+}
 
-    // save k nearest nodes. update the nearest_dist to the lp distance of two points
-    auto dist = Lp(X, currentNode->data, p);
-    if (!nearest || dist < nearest->nearest_dist) {
-        nearest = currentNode;
-        nearest->nearest_dist = dist;
-        if (kNearestNodes.size() < k) {
-            kNearestNodes.insert(nearest);
-        } else {
-            auto last = kNearestNodes.end();
-            --last;
-            if ((*last)->nearest_dist > dist) {
-                kNearestNodes.erase(last);
-                kNearestNodes.insert(nearest);
-            }
-        }
+template <typename DataType, typename LabelType>
+void KNN<DataType, LabelType>::findNearest(uint32_t node, const DataType *X,
+                                           std::vector<Neighbor> &heap, SearchStats &stats) const {
+    if (node == kNullNode) return;
+    ++stats.visited;
+    const auto &current = nodes[node];
+    const DataType *point = points + static_cast<std::size_t>(node) * feature_dim;
+    auto axis = current.axis;
+    // visit the half space containing X first, left subtree holds values < split value
+    double diff = static_cast<double>(X[axis]) - static_cast<double>(point[axis]);
+    auto nearSide = diff < 0 ? current.left : current.right;
+    auto farSide = diff < 0 ? current.right : current.left;
+    findNearest(nearSide, X, heap, stats);
+
+    pushNeighbor(heap, Lp(X, point, feature_dim, p), labels[node]);
+
+    // the vertical distance from split axis < k-th nearest distance means that a circle with X as
+    // center and that distance as radius intersects the split axis. check the other side.
+    if (heap.size() < k || std::abs(diff) < heap.front().first) {
+        findNearest(farSide, X, heap, stats);
+    } else if (farSide != kNullNode) {
+        ++stats.pruned;
     }
+}
 
-    // the vertical distance from split axis < lp distance means that a circle with X as point and
-    // lp distance as radius may intersect with other nodes' split axes. check them.
-    if (std::abs(static_cast<double>(X[axis] - currentNode->data[axis])) < nearest->nearest_dist) {
-        if (currentNode->left && X[axis] >= currentNode->data[axis]) {
-            findNearest(currentNode->left, X);
-        } else if (currentNode->right && X[axis] < currentNode->data[axis]) {
-            findNearest(currentNode->right, X);
+template <typename DataType, typename LabelType>
+bool KNN<DataType, LabelType>::save(const char *filename) const {
+    if (!labels || (!points && !codes && shards.empty())) {
+        printf("ERROR: model is not trained yet\n");
+        return false;
+    }
+    // a sharded model keeps its points in the shards only
+    const DataType *pts = points;
+    Vec<DataType> gathered;
+    if (!pts && !shards.empty()) {
+        gathered.reserve(static_cast<std::size_t>(rows) * feature_dim);
+        for (const auto &shard : shards) {
+            gathered.insert(gathered.end(), shard.points.cbegin(), shard.points.cend());
         }
+        pts = gathered.data();
+    }
+    serialize::Writer writer(filename);
+    writer.writeHeader(MODEL_KNN, serialize::typeTag<DataType>(), serialize::typeTag<LabelType>());
+    writer.write(FileHeader{k, p, type, rows, feature_dim, nodeCount, root, projection.kind()});
+    bool isPq = type == KnnType::PQ;
+    if (isPq) writer.write(PqHeader{quantizer.subspaces(), points ? rerank : 0, 0, 0});
+    writer.writeArray(pts, pts ? static_cast<std::size_t>(rows) * feature_dim : 0);
+    writer.writeArray(labels, rows);
+    writer.writeArray(nodes, nodeCount);
+    if (projection.kind() != reduction::NONE) projection.write(writer);
+    if (type == KnnType::SIMPLE_KNN) {
+        writer.writeArray(order, feature_dim);
+        writer.writeArray(norms, rows);
+    }
+    if (isPq) {
+        quantizer.write(writer);
+        writer.writeArray(codes, static_cast<std::size_t>(rows) * quantizer.subspaces());
     }
+    return writer.good();
+}
+
+template <typename DataType, typename LabelType>
+bool KNN<DataType, LabelType>::load(const char *filename) {
+    serialize::MappedFile file(filename);
+    serialize::Reader reader(file);
+    if (!reader.readHeader(MODEL_KNN, serialize::typeTag<DataType>(),
+                           serialize::typeTag<LabelType>())) {
+        return false;
+    }
+    FileHeader header;
+    if (!reader.read(header)) return false;
+    bool isSimple = header.type == KnnType::SIMPLE_KNN, isTree = header.type == KnnType::KDTREE,
+         isPq = header.type == KnnType::PQ;
+    PqHeader pqHeader{0, 0, 0, 0};
+    if (isPq && !reader.read(pqHeader)) return false;
+    // a PQ model without rerank has no points section
+    bool hasPoints = !isPq || pqHeader.rerank > 0;
+    auto pts =
+        reader.view<DataType>(hasPoints ? static_cast<std::size_t>(header.rows) * header.dim : 0);
+    auto lbs = reader.view<LabelType>(header.rows);
+    auto nds = reader.view<KdNode>(header.nodes);
+    reduction::Projection proj;
+    bool projected = header.reduction != reduction::NONE;
+    quantization::ProductQuantizer pq;
+    const uint8_t *cds = nullptr;
+    bool ok = (pts || !hasPoints) && lbs && header.k >= 1 && header.p >= 1 &&
+              header.type <= KnnType::PQ &&
+              (!isTree || (header.nodes == header.rows && nds &&
+                           validTree(nds, header.nodes, header.root, header.dim))) &&
+              (!projected || (proj.read(reader) && proj.outputDim() == header.dim));
+    const uint32_t *ord = nullptr;
+    const double *nrm = nullptr;
+    if (ok && isSimple) {
+        ord = reader.view<uint32_t>(header.dim);
+        nrm = reader.view<double>(header.rows);
+        ok = ord && nrm &&
+             std::all_of(ord, ord + header.dim, [&](uint32_t j) { return j < header.dim; });
+    }
+    if (ok && isPq) {
+        ok = pq.read(reader) && pq.dim() == header.dim && pq.subspaces() == pqHeader.subspaces &&
+             (header.p == 2 || pqHeader.rerank > 0);
+        cds = ok ? reader.view<uint8_t>(static_cast<std::size_t>(header.rows) * pq.subspaces())
+                 : nullptr;
+        ok = ok && cds;
+    }
+    if (!ok) {
+        printf("ERROR: corrupted k-NN model file (%s)\n", filename);
+        return false;
+    }
+
+    // no deserialization, queries run directly on the mapped sections
+    workers.reset();
+    shards.clear();
+    pointBuf.clear();
+    labelBuf.clear();
+    nodeBuf.clear();
+    codeBuf.clear();
+    orderBuf.clear();
+    normBuf.clear();
+    mapped = std::move(file);
+    k = header.k;
+    p = header.p;
+    type = static_cast<KnnType>(header.type);
+    rows = header.rows;
+    feature_dim = header.dim;
+    projection = std::move(proj);
+    input_dim = projected ? projection.inputDim() : header.dim;
+    quantizer = std::move(pq);
+    rerank = pqHeader.rerank;
+    codes = cds;
+    order = ord;
+    norms = nrm;
+    points = pts;
+    labels = lbs;
+    nodes = nds;
+    nodeCount = header.nodes;
+    root = isTree ? header.root : kNullNode;
+    if (sharded && isSimple) buildShards();
+    describe();
+    return true;
 }
 
 }  // namespace stat
 
-#endif  // __KNN_H__
\ No newline at end of file
+#endif  // __KNN_H__
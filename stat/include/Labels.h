@@ -0,0 +1,114 @@
+#ifndef __LABELS_H__
+#define __LABELS_H__
+
+#include "Types.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace stat {
+
+/**
+ * Class index of every row of a label column, classes numbered in order of first appearance (the
+ * order the classifiers save their classes in). `classes` receives the label of each class. The
+ * only hashing is here, once per training set: the models count, average and vote over dense
+ * per-class arrays indexed by the result.
+ */
+template <typename LabelType>
+Vec<uint32_t> encodeLabels(const Data<LabelType> &y, Vec<LabelType> &classes) {
+    classes.clear();
+    std::unordered_map<LabelType, uint32_t> index;
+    Vec<uint32_t> rows(y.m);
+    for (uint32_t i = 0; i < y.m; ++i) {
+        auto it = index.emplace(y.data[i][0], static_cast<uint32_t>(classes.size()));
+        if (it.second) classes.emplace_back(y.data[i][0]);
+        rows[i] = it.first->second;
+    }
+    return rows;
+}
+
+/**
+ * Reversible label dictionary
+ *
+ * A label column is a Data<LabelType> of one-value rows, a heap block per label. fit() turns it
+ * into one contiguous array of class indices (4 bytes a row) and keeps the label of each class,
+ * decode() maps an index back. encode() of a single label is a binary search over the sorted
+ * labels, no hashing. A label fit() did not see encodes to kUnknown, and kUnknown (or any index
+ * past size()) decodes to unknownLabel(): NaN for a floating point label, its max otherwise, so
+ * inverse(transform(y)) is defined for any y.
+ *
+ *  stat::LabelEncoder<float> encoder;
+ *  auto y = encoder.fit(y_train);        // y[i] in [0, encoder.size())
+ *  auto label = encoder.decode(y[0]);    // == y_train.data[0][0]
+ */
+template <typename LabelType>
+class LabelEncoder {
+public:
+    static constexpr uint32_t kUnknown = std::numeric_limits<uint32_t>::max();
+
+    // class indices of the rows of y, the dictionary is replaced by the classes of y
+    Vec<uint32_t> fit(const Data<LabelType> &y) {
+        auto rows = encodeLabels(y, classes);
+        index();
+        return rows;
+    }
+
+    // classes given directly, e.g. read back from a model file
+    void assign(const LabelType *labels, uint32_t count) {
+        classes.assign(labels, labels + count);
+        index();
+    }
+
+    uint32_t size() const { return static_cast<uint32_t>(classes.size()); }
+    const Vec<LabelType> &labels() const { return classes; }
+
+    static LabelType unknownLabel() {
+        if constexpr (std::numeric_limits<LabelType>::has_quiet_NaN) {
+            return std::numeric_limits<LabelType>::quiet_NaN();
+        } else {
+            return std::numeric_limits<LabelType>::max();
+        }
+    }
+
+    LabelType decode(uint32_t c) const { return c < classes.size() ? classes[c] : unknownLabel(); }
+
+    // class of a label, kUnknown if it was not seen by fit()
+    uint32_t encode(LabelType label) const {
+        auto it = std::lower_bound(sorted.begin(), sorted.end(), std::make_pair(label, 0u),
+                                   [](const auto &a, const auto &b) { return a.first < b.first; });
+        return it != sorted.end() && it->first == label ? it->second : kUnknown;
+    }
+
+    // class indices of the rows of y, kUnknown for labels not seen by fit()
+    Vec<uint32_t> transform(const Data<LabelType> &y) const {
+        Vec<uint32_t> rows(y.m);
+        for (uint32_t i = 0; i < y.m; ++i) rows[i] = encode(y.data[i][0]);
+        return rows;
+    }
+
+    // a label column again, one row per index, unknownLabel() for kUnknown
+    Data<LabelType> inverse(const Vec<uint32_t> &rows) const {
+        Data<LabelType> y{Mat<LabelType>(), static_cast<uint32_t>(rows.size()), 1};
+        y.data.reserve(rows.size());
+        for (auto c : rows) y.data.emplace_back(1, decode(c));
+        return y;
+    }
+
+private:
+    Vec<LabelType> classes;                            // class -> label
+    std::vector<std::pair<LabelType, uint32_t>> sorted;  // (label, class) by label
+
+    void index() {
+        sorted.clear();
+        for (uint32_t c = 0; c < classes.size(); ++c) sorted.emplace_back(classes[c], c);
+        std::sort(sorted.begin(), sorted.end());
+    }
+};
+
+}  // namespace stat
+
+#endif  // __LABELS_H__
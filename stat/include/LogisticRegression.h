@@ -0,0 +1,466 @@
+#ifndef __LOGISTIC_REGRESSION_H__
+#define __LOGISTIC_REGRESSION_H__
+
+#include "Math.h"
+#include "Model.h"
+#include "Optimize.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace stat {
+
+// Logistic Regression params, from ModelParam by parse() or set directly
+struct LogisticRegressionParam {
+    enum Solver : uint32_t {
+        SGD,
+        LBFGS,
+    };
+
+    Solver solver = SGD;
+    double eta = 0.1;
+    double l2 = 1e-4;
+    double tolerance = 1e-4;
+    uint32_t epochs = 100;  // sgd epochs, lbfgs iterations
+    uint32_t batchSize = 32;
+    uint32_t patience = 5;
+    double holdout = 0.1;
+    uint32_t seed = 0;
+    bool show = false;
+
+    // {"model_type", "sgd" | "lbfgs"}, {"eta"}, {"l2"}, {"tolerance"}, {"epochs"}, {"batch_size"},
+    // {"patience"}, {"holdout"}, {"seed"}, {"model_show"}
+    static LogisticRegressionParam parse(const ModelParam &param) {
+        LogisticRegressionParam p;
+        ParamReader(param, "Logistic Regression")
+            .choice("model_type", p.solver, {{"sgd", SGD}, {"lbfgs", LBFGS}})
+            .number("eta", p.eta, 0.0)
+            .number("l2", p.l2, 0.0)
+            .number("tolerance", p.tolerance, 0.0)
+            .number("epochs", p.epochs)
+            .number("batch_size", p.batchSize, 1u)
+            .number("patience", p.patience)
+            .number("holdout", p.holdout, 0.0, 1.0)
+            .number("seed", p.seed)
+            .flag("model_show", p.show);
+        return p;
+    }
+};
+
+/**
+ * Multinomial Logistic Regression model
+ *
+ * Model:   $P(Y=k|x) = \frac{exp(w_k \cdot x + b_k)}{\sum_{j=1}^K{exp(w_j \cdot x + b_j)}}$
+ * Loss:    $L(w,b) = \frac{1}{N}\sum_{i=1}^N{-log P(y_i|x_i)} + \frac{\lambda}{2}\|w\|^2$
+ * Gradient:
+ *          $\frac{\partial L}{\partial w_k} = \frac{1}{N}\sum_i{(P(k|x_i) - [y_i=k]) x_i}
+ *              + \lambda w_k$
+ *
+ * Logits of a block of rows are one matrix product (matmulNT), softmax and log-sum-exp are
+ * fused and shifted by the row max. Solvers:
+ *   sgd:   mini-batch SGD over shuffled rows, early stopped on a held out fraction of the
+ *          training set once its loss stops improving for `patience` epochs
+ *   lbfgs: full batch L-BFGS (Optimize.h), loss and gradient are accumulated over row chunks in
+ *          parallel and reduced in chunk order
+ */
+template <typename DataType, typename LabelType>
+class LogisticRegression : public Model<DataType, LabelType> {
+public:
+    explicit LogisticRegression(const LogisticRegressionParam &param = {});
+    explicit LogisticRegression(const ModelParam &param)
+        : LogisticRegression(LogisticRegressionParam::parse(param)) {}
+    virtual ~LogisticRegression() = default;
+
+    virtual bool train(const Data<DataType> &X_train, const Data<LabelType> &y_train) final;
+
+    virtual LabelType predict(const Vec<DataType> &X) final;
+
+    virtual double validate(const Data<DataType> &X_test, const Data<LabelType> &y_test) final;
+
+    virtual void describe() const final;
+
+    virtual memory::Usage memoryUsage() const final;
+
+    virtual uint32_t inputDim() const final;
+
+    virtual bool save(const char *filename) const final;
+
+    virtual bool load(const char *filename) final;
+
+private:
+    using Solver = LogisticRegressionParam::Solver;
+
+    // fixed size part of the saved model. sections follow: class labels and parameters
+    struct FileHeader {
+        uint32_t solver;
+        uint32_t classes;
+        uint32_t dim;
+        uint32_t reserved;
+    };
+
+    // rows per chunk of the full batch gradient and of batched prediction
+    static constexpr uint32_t kChunkRows = 256;
+
+    Solver solver;
+    bool isModelShow;
+    double eta;
+    double l2;
+    double tolerance;
+    uint32_t epochs;  // sgd epochs, lbfgs iterations
+    uint32_t batchSize;
+    uint32_t patience;
+    double holdout;
+    uint32_t seed;
+
+    uint32_t dim;
+    Vec<LabelType> classes;
+    Vec<double> theta;  // C x dim weights, row by row, then C biases
+
+    bool train_sgd(const Vec<double> &X, const Vec<uint32_t> &y, uint32_t m);
+    bool train_lbfgs(const Vec<double> &X, const Vec<uint32_t> &y, uint32_t m);
+
+    // sum over `rows` contiguous rows of the cross entropy, grad (if not null) is added the
+    // unnormalized gradient. logits is scratch of rows x C
+    double lossGrad(const double *X, const uint32_t *y, std::size_t rows, const double *params,
+                    double *grad, double *logits) const;
+    // loss and gradient of the objective over all m rows, in parallel over row chunks
+    double objective(const Vec<double> &X, const Vec<uint32_t> &y, uint32_t m,
+                     const Vec<double> &params, Vec<double> *grad) const;
+    void logits(const double *X, std::size_t rows, double *out) const;
+};
+
+template <typename DataType, typename LabelType>
+LogisticRegression<DataType, LabelType>::LogisticRegression(const LogisticRegressionParam &param)
+    : solver(param.solver),
+      isModelShow(param.show),
+      eta(param.eta),
+      l2(param.l2),
+      tolerance(param.tolerance),
+      epochs(param.epochs),
+      batchSize(std::max<uint32_t>(param.batchSize, 1)),
+      patience(param.patience),
+      holdout(param.holdout),
+      seed(param.seed),
+      dim(0) {}
+
+template <typename DataType, typename LabelType>
+bool LogisticRegression<DataType, LabelType>::train(const Data<DataType> &X_train,
+                                                    const Data<LabelType> &y_train) {
+    STAT_PROFILE_SCOPE(__func__);
+
+    auto m = X_train.m, n = X_train.n;
+    if (m == 0 || n == 0 || y_train.m != m) {
+        printf("ERROR: invalid training set\n");
+        return false;
+    }
+    dim = n;
+    auto y = encodeLabels(y_train, classes);
+    // one contiguous row-major copy, the solvers read rows as blocks of a matrix
+    Vec<double> X;
+    X.reserve(static_cast<std::size_t>(m) * n);
+    for (const auto &row : X_train.data) X.insert(X.end(), row.cbegin(), row.cend());
+    theta.assign(classes.size() * (static_cast<std::size_t>(n) + 1), 0.0);
+
+    bool ok = solver == Solver::SGD ? train_sgd(X, y, m) : train_lbfgs(X, y, m);
+    if (ok) describe();
+    return ok;
+}
+
+template <typename DataType, typename LabelType>
+void LogisticRegression<DataType, LabelType>::logits(const double *X, std::size_t rows,
+                                                     double *out) const {
+    auto C = classes.size();
+    auto bias = theta.data() + C * dim;
+    matmulNT(X, theta.data(), out, rows, C, dim);
+    for (std::size_t i = 0; i < rows; ++i) {
+        for (std::size_t c = 0; c < C; ++c) out[i * C + c] += bias[c];
+    }
+}
+
+template <typename DataType, typename LabelType>
+double LogisticRegression<DataType, LabelType>::lossGrad(const double *X, const uint32_t *y,
+                                                         std::size_t rows, const double *params,
+                                                         double *grad, double *logits) const {
+    auto C = classes.size();
+    auto bias = params + C * dim;
+    matmulNT(X, params, logits, rows, C, dim);
+    double loss = 0.0;
+    for (std::size_t i = 0; i < rows; ++i) {
+        auto z = logits + i * C;
+        for (std::size_t c = 0; c < C; ++c) z[c] += bias[c];
+        double target = z[y[i]];
+        // -log P(y|x) = lse(z) - z_y, z turns into the probabilities
+        loss += softmax(z, C) - target;
+        if (!grad) continue;
+        z[y[i]] -= 1.0;
+        auto x = X + i * dim;
+        for (std::size_t c = 0; c < C; ++c) {
+            axpy(z[c], x, grad + c * dim, dim);
+            grad[C * dim + c] += z[c];
+        }
+    }
+    return loss;
+}
+
+template <typename DataType, typename LabelType>
+double LogisticRegression<DataType, LabelType>::objective(const Vec<double> &X,
+                                                          const Vec<uint32_t> &y, uint32_t m,
+                                                          const Vec<double> &params,
+                                                          Vec<double> *grad) const {
+    auto C = classes.size();
+    auto size = params.size();
+    auto chunks = (m + kChunkRows - 1) / kChunkRows;
+    // per chunk partial sums, reduced in chunk order so the result does not depend on threads
+    std::vector<double> losses(chunks, 0.0);
+    std::vector<Vec<double>> grads(grad ? chunks : 0);
+    parallel::parallelFor(0, chunks, 1, [&](std::size_t lo, std::size_t hi) {
+        Vec<double> scratch(kChunkRows * C);
+        for (auto k = lo; k < hi; ++k) {
+            auto first = k * kChunkRows, rows = std::min<std::size_t>(kChunkRows, m - first);
+            double *g = nullptr;
+            if (grad) {
+                grads[k].assign(size, 0.0);
+                g = grads[k].data();
+            }
+            losses[k] = lossGrad(X.data() + first * dim, y.data() + first, rows, params.data(), g,
+                                 scratch.data());
+        }
+    });
+    double loss = 0.0, penalty = 0.0;
+    for (auto l : losses) loss += l;
+    for (std::size_t i = 0; i < C * dim; ++i) penalty += params[i] * params[i];
+    if (grad) {
+        grad->assign(size, 0.0);
+        for (const auto &g : grads) {
+            for (std::size_t i = 0; i < size; ++i) (*grad)[i] += g[i];
+        }
+        for (std::size_t i = 0; i < size; ++i) {
+            (*grad)[i] = (*grad)[i] / m + (i < C * dim ? l2 * params[i] : 0.0);
+        }
+    }
+    return loss / m + 0.5 * l2 * penalty;
+}
+
+template <typename DataType, typename LabelType>
+bool LogisticRegression<DataType, LabelType>::train_sgd(const Vec<double> &X,
+                                                        const Vec<uint32_t> &y, uint32_t m) {
+    STAT_PROFILE_SCOPE(__func__);
+
+    auto C = classes.size();
+    std::mt19937 gen(seed);
+    std::vector<uint32_t> order(m);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), gen);
+
+    // the tail of the shuffled rows is held out for early stopping
+    uint32_t held = m >= 20 ? static_cast<uint32_t>(m * std::clamp(holdout, 0.0, 0.5)) : 0;
+    uint32_t fit = m - held;
+    Vec<double> heldX;
+    Vec<uint32_t> heldY;
+    for (uint32_t r = fit; r < m; ++r) {
+        auto x = X.data() + static_cast<std::size_t>(order[r]) * dim;
+        heldX.insert(heldX.end(), x, x + dim);
+        heldY.emplace_back(y[order[r]]);
+    }
+    order.resize(fit);
+
+    Vec<double> batchX(static_cast<std::size_t>(batchSize) * dim), grad(theta.size());
+    Vec<uint32_t> batchY(batchSize);
+    Vec<double> scratch(static_cast<std::size_t>(batchSize) * C);
+    Vec<double> best = theta;
+    double bestLoss = Inf<double>;
+    uint32_t epoch = 0, stale = 0;
+    auto start = profile::now();
+    for (; epoch < epochs; ++epoch) {
+        std::shuffle(order.begin(), order.end(), gen);
+        for (uint32_t first = 0; first < fit; first += batchSize) {
+            auto rows = std::min(batchSize, fit - first);
+            for (uint32_t r = 0; r < rows; ++r) {
+                auto x = X.data() + static_cast<std::size_t>(order[first + r]) * dim;
+                std::copy(x, x + dim, batchX.data() + static_cast<std::size_t>(r) * dim);
+                batchY[r] = y[order[first + r]];
+            }
+            std::fill(grad.begin(), grad.end(), 0.0);
+            lossGrad(batchX.data(), batchY.data(), rows, theta.data(), grad.data(),
+                     scratch.data());
+            double step = eta / rows;
+            for (std::size_t i = 0; i < theta.size(); ++i) {
+                double decay = i < C * dim ? eta * l2 * theta[i] : 0.0;
+                theta[i] -= step * grad[i] + decay;
+            }
+        }
+        if (held == 0) continue;
+        double loss = objective(heldX, heldY, held, theta, nullptr);
+        if (loss < bestLoss - tolerance) {
+            bestLoss = loss;
+            best = theta;
+            stale = 0;
+        } else if (++stale >= patience) {
+            ++epoch;
+            printf("INFO: early stopping, held out loss %f\n", bestLoss);
+            break;
+        }
+    }
+    if (held > 0) theta = best;
+    double seconds = (profile::now() - start) * 1e-9;
+    printf("INFO: training done, %u epochs, %.0f samples/s\n", epoch,
+           seconds > 0 ? static_cast<double>(epoch) * fit / seconds : 0.0);
+    return true;
+}
+
+template <typename DataType, typename LabelType>
+bool LogisticRegression<DataType, LabelType>::train_lbfgs(const Vec<double> &X,
+                                                          const Vec<uint32_t> &y, uint32_t m) {
+    STAT_PROFILE_SCOPE(__func__);
+
+    optimize::LbfgsParam param;
+    param.maxIterations = epochs;
+    param.tolerance = tolerance;
+    auto start = profile::now();
+    auto result = optimize::lbfgs(
+        theta, [&](const Vec<double> &x, Vec<double> &g) { return objective(X, y, m, x, &g); },
+        param);
+    double seconds = (profile::now() - start) * 1e-9;
+    printf("INFO: training done, %u iterations, loss %f%s, %.0f samples/s\n", result.iterations,
+           result.loss, result.converged ? "" : " (not converged)",
+           seconds > 0 ? static_cast<double>(result.evaluations) * m / seconds : 0.0);
+    return true;
+}
+
+template <typename DataType, typename LabelType>
+LabelType LogisticRegression<DataType, LabelType>::predict(const Vec<DataType> &X) {
+    if (classes.empty() || X.size() != dim) {
+        printf("ERROR: model is not trained or input dimension mismatch\n");
+        return 0;
+    }
+    auto C = classes.size();
+    auto bias = theta.data() + C * dim;
+    std::size_t best = 0;
+    double bestLogit = -Inf<double>;
+    for (std::size_t c = 0; c < C; ++c) {
+        double z = dot(X.data(), theta.data() + c * dim, dim) + bias[c];
+        if (z > bestLogit) {
+            bestLogit = z;
+            best = c;
+        }
+    }
+    return classes[best];
+}
+
+template <typename DataType, typename LabelType>
+double LogisticRegression<DataType, LabelType>::validate(const Data<DataType> &X_test,
+                                                         const Data<LabelType> &y_test) {
+    STAT_PROFILE_SCOPE(__func__);
+
+    auto m = X_test.m, C = static_cast<uint32_t>(classes.size());
+    if (C == 0 || X_test.n != dim) {
+        printf("ERROR: model is not trained or input dimension mismatch\n");
+        return 0.0;
+    }
+    // logits of row chunks as matrix products
+    auto chunks = (m + kChunkRows - 1) / kChunkRows;
+    std::vector<uint32_t> correct(chunks, 0);
+    parallel::parallelFor(0, chunks, 1, [&](std::size_t lo, std::size_t hi) {
+        Vec<double> block(static_cast<std::size_t>(kChunkRows) * dim), z(kChunkRows * C);
+        for (auto k = lo; k < hi; ++k) {
+            auto first = k * kChunkRows, rows = std::min<std::size_t>(kChunkRows, m - first);
+            for (std::size_t r = 0; r < rows; ++r) {
+                const auto &x = X_test.data[first + r];
+                std::copy(x.cbegin(), x.cend(), block.begin() + r * dim);
+            }
+            logits(block.data(), rows, z.data());
+            for (std::size_t r = 0; r < rows; ++r) {
+                auto row = z.data() + r * C;
+                auto c = std::max_element(row, row + C) - row;
+                correct[k] += classes[c] == y_test.data[first + r][0];
+            }
+        }
+    });
+    double acc = static_cast<double>(std::accumulate(correct.begin(), correct.end(), 0u)) / m;
+    printf("accuracy: %f\n\n", acc);
+    return acc;
+}
+
+template <typename DataType, typename LabelType>
+void LogisticRegression<DataType, LabelType>::describe() const {
+    if (!isModelShow) return;
+    auto C = classes.size();
+    printf("Logistic Regression (%s): %zu classes, %u features\n",
+           solver == Solver::SGD ? "sgd" : "lbfgs", C, dim);
+    for (std::size_t c = 0; c < C; ++c) {
+        printf("Label: %f\n\tw = [ ", static_cast<double>(classes[c]));
+        for (std::size_t j = 0; j < std::min<std::size_t>(dim, 8); ++j) {
+            printf("%f, ", theta[c * dim + j]);
+        }
+        printf("%s]\n\tb = %f\n", dim > 8 ? "... " : "", theta[C * dim + c]);
+    }
+    printf("\n");
+}
+
+template <typename DataType, typename LabelType>
+uint32_t LogisticRegression<DataType, LabelType>::inputDim() const {
+    return dim;
+}
+
+template <typename DataType, typename LabelType>
+memory::Usage LogisticRegression<DataType, LabelType>::memoryUsage() const {
+    memory::Usage u;
+    u.add("weights", memory::heapBytes(theta));
+    u.add("classes", memory::heapBytes(classes));
+    return u;
+}
+
+template <typename DataType, typename LabelType>
+bool LogisticRegression<DataType, LabelType>::save(const char *filename) const {
+    if (classes.empty()) {
+        printf("ERROR: model is not trained yet\n");
+        return false;
+    }
+    serialize::Writer writer(filename);
+    writer.writeHeader(MODEL_LOGISTIC_REGRESSION, serialize::typeTag<DataType>(),
+                       serialize::typeTag<LabelType>());
+    writer.write(FileHeader{solver, static_cast<uint32_t>(classes.size()), dim, 0});
+    writer.writeArray(classes.data(), classes.size());
+    writer.writeArray(theta.data(), theta.size());
+    return writer.good();
+}
+
+template <typename DataType, typename LabelType>
+bool LogisticRegression<DataType, LabelType>::load(const char *filename) {
+    serialize::MappedFile file(filename);
+    serialize::Reader reader(file);
+    if (!reader.readHeader(MODEL_LOGISTIC_REGRESSION, serialize::typeTag<DataType>(),
+                           serialize::typeTag<LabelType>())) {
+        return false;
+    }
+    FileHeader header;
+    const LabelType *labels = nullptr;
+    const double *params = nullptr;
+    std::size_t size = 0;
+    if (reader.read(header)) {
+        size = static_cast<std::size_t>(header.classes) * (header.dim + 1ul);
+        labels = reader.view<LabelType>(header.classes);
+        params = reader.view<double>(size);
+    }
+    if (!labels || !params || header.solver > Solver::LBFGS) {
+        printf("ERROR: corrupted logistic regression model file (%s)\n", filename);
+        return false;
+    }
+    solver = static_cast<Solver>(header.solver);
+    dim = header.dim;
+    classes.assign(labels, labels + header.classes);
+    theta.assign(params, params + size);
+    describe();
+    return true;
+}
+
+}  // namespace stat
+
+#endif  // __LOGISTIC_REGRESSION_H__
@@ -1,12 +1,17 @@
 #ifndef __MATH_H__
 #define __MATH_H__
 
+#include "Parallel.h"
+#include "Profile.h"
 #include "Types.h"
 
 #include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace stat {
 
@@ -20,12 +25,14 @@ constexpr double pi = 3.141592653589793238463;
 
 template <typename T>
 Vec<T> allocVec(uint32_t N, T v = 0) {
+    STAT_PROFILE_COUNT(ALLOCATIONS, 1);
     Vec<T> vec(N, v);
     return vec;
 }
 
 template <typename T>
 Mat<T> allocMat(uint32_t M, uint32_t N, T v = 0) {
+    STAT_PROFILE_COUNT(ALLOCATIONS, M);
     Mat<T> mat(M, allocVec<T>(N, v));
     return mat;
 }
@@ -35,16 +42,106 @@ double sign(T v) {
     return std::signbit(v) ? -1.0 : 1.0;
 }
 
+// independent accumulator lanes, break the dependency chain so the compiler can vectorize
+constexpr std::size_t kLanes = 4;
+
+// dot product of two n-dim vectors stored in contiguous memory
+template <typename T1, typename T2>
+double dot(const T1 *x1, const T2 *x2, std::size_t n) {
+    double lane[kLanes] = {0};
+    std::size_t i = 0;
+    for (; i + kLanes <= n; i += kLanes) {
+        for (std::size_t l = 0; l < kLanes; ++l) {
+            lane[l] += static_cast<double>(x1[i + l]) * static_cast<double>(x2[i + l]);
+        }
+    }
+    double sum = (lane[0] + lane[1]) + (lane[2] + lane[3]);
+    for (; i < n; ++i) sum += static_cast<double>(x1[i]) * static_cast<double>(x2[i]);
+    return sum;
+}
+
 template <typename T1, typename T2>
 double dot(const Vec<T1> &x1, const Vec<T2> &x2) {
-    double sum = 0.0;
     auto m1 = x1.size(), m2 = x2.size();
     if (m1 != m2) {
         printf("ERROR: dot, dimensions are not aligned of two input vectors [%zu, %zu]\n", m1, m2);
-        return sum;
+        return 0.0;
     }
-    for (auto i = 0; i < m1; ++i) { sum += (x1[i] * x2[i]); }
-    return sum;
+    return dot(x1.data(), x2.data(), m1);
+}
+
+// max_i (x1[i] + x2[i]) of n > 0 values and the first i reaching it (a max-plus dot product). the
+// max runs in lanes like dot(), the index is found by a second scan for the first sum equal to
+// it, a compare-and-select of indices in the lanes would not vectorize
+inline double maxPlus(const double *x1, const double *x2, std::size_t n, std::size_t &arg) {
+    double lane[kLanes];
+    std::fill(lane, lane + kLanes, -std::numeric_limits<double>::infinity());
+    std::size_t i = 0;
+    for (; i + kLanes <= n; i += kLanes) {
+        for (std::size_t l = 0; l < kLanes; ++l) lane[l] = std::max(lane[l], x1[i + l] + x2[i + l]);
+    }
+    double best = lane[0];
+    for (std::size_t l = 1; l < kLanes; ++l) best = std::max(best, lane[l]);
+    for (; i < n; ++i) best = std::max(best, x1[i] + x2[i]);
+    for (arg = 0; arg + 1 < n && x1[arg] + x2[arg] != best; ++arg) {}
+    return best;
+}
+
+// y += a * x of n-dim vectors
+template <typename T>
+void axpy(double a, const T *x, double *y, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) y[i] += a * static_cast<double>(x[i]);
+}
+
+// tiles of matmulNT, a tile of B (kMatmulRows x kMatmulDepth doubles) is 32KB
+constexpr std::size_t kMatmulRows = 16;
+constexpr std::size_t kMatmulDepth = 256;
+
+/**
+ * C = A B^T of row-major A (m x k) and B (n x k), C is row-major (m x n).
+ *
+ * Both operands are read along their rows. B is walked in tiles of kMatmulRows rows by
+ * kMatmulDepth columns, a tile stays in cache while every row of A is multiplied by it.
+ */
+template <typename T1, typename T2>
+void matmulNT(const T1 *A, const T2 *B, double *C, std::size_t m, std::size_t n, std::size_t k) {
+    std::fill(C, C + m * n, 0.0);
+    for (std::size_t jb = 0; jb < n; jb += kMatmulRows) {
+        auto je = std::min(n, jb + kMatmulRows);
+        for (std::size_t kb = 0; kb < k; kb += kMatmulDepth) {
+            auto len = std::min(k, kb + kMatmulDepth) - kb;
+            for (std::size_t i = 0; i < m; ++i) {
+                auto a = A + i * k + kb;
+                auto c = C + i * n;
+                for (auto j = jb; j < je; ++j) c[j] += dot(a, B + j * k + kb, len);
+            }
+        }
+    }
+}
+
+// log(\sum{exp(x_i)}) of n values, shifted by the max so no exp overflows
+inline double logSumExp(const double *x, std::size_t n) {
+    if (n == 0) return -std::numeric_limits<double>::infinity();
+    double hi = *std::max_element(x, x + n);
+    if (std::isinf(hi)) return hi;
+    double sum = 0.0;
+    for (std::size_t i = 0; i < n; ++i) sum += std::exp(x[i] - hi);
+    return hi + std::log(sum);
+}
+
+// x = softmax(x) in place, returns log(\sum{exp(x_i)}) of the input (the log partition). one
+// exp per element, the shifted exponentials are normalized in place
+inline double softmax(double *x, std::size_t n) {
+    if (n == 0) return -std::numeric_limits<double>::infinity();
+    double hi = *std::max_element(x, x + n);
+    double sum = 0.0;
+    for (std::size_t i = 0; i < n; ++i) {
+        x[i] = std::exp(x[i] - hi);
+        sum += x[i];
+    }
+    double inv = 1.0 / sum;
+    for (std::size_t i = 0; i < n; ++i) x[i] *= inv;
+    return hi + std::log(sum);
 }
 
 template <typename T1, typename T2>
@@ -92,19 +189,126 @@ Mat<T> gram(const Mat<T> &X) {
     return g;
 }
 
+// tile edge of blocked transposition, a 32x32 tile of doubles is 8KB and stays in L1
+constexpr std::size_t kTransposeBlock = 32;
+
+// matrices with fewer elements are transposed on the calling thread
+constexpr std::size_t kParallelTransposeSize = 1 << 16;
+
+/**
+ * dst = src^T of a (rows x cols) matrix, rows are reached through srcRow(i) / dstRow(j).
+ *
+ * The naive loop writes with a stride of a full row per element. Here the matrix is walked in
+ * kTransposeBlock^2 tiles, the source lines of a tile are reused for kTransposeBlock consecutive
+ * columns and each destination row is written contiguously. Bands of destination rows are
+ * independent and processed in parallel for large matrices.
+ */
+template <typename SrcRow, typename DstRow>
+void transposeBlocked(std::size_t rows, std::size_t cols, SrcRow srcRow, DstRow dstRow) {
+    auto band = [&](std::size_t jlo, std::size_t jhi) {
+        for (std::size_t i0 = 0; i0 < rows; i0 += kTransposeBlock) {
+            auto ihi = std::min(rows, i0 + kTransposeBlock);
+            for (auto j = jlo; j < jhi; ++j) {
+                auto dst = dstRow(j);
+                for (auto i = i0; i < ihi; ++i) dst[i] = srcRow(i)[j];
+            }
+        }
+    };
+    if (rows * cols < kParallelTransposeSize) {
+        band(0, cols);
+    } else {
+        parallel::parallelFor(0, cols, kTransposeBlock, band);
+    }
+}
+
+// contiguous row-major src (rows x cols) into contiguous row-major dst (cols x rows)
+template <typename T1, typename T2>
+void transpose(const T1 *src, T2 *dst, std::size_t rows, std::size_t cols) {
+    transposeBlocked(
+        rows, cols, [src, cols](std::size_t i) { return src + i * cols; },
+        [dst, rows](std::size_t j) { return dst + j * rows; });
+}
+
 template <typename T>
 Mat<T> transpose(const Mat<T> &mat) {
     auto m = mat.size();
-    if (m == 0) { printf("ERROR: transpose on empty matrix (rows = 0)\n"); }
+    if (m == 0) {
+        printf("ERROR: transpose on empty matrix (rows = 0)\n");
+        return {};
+    }
     auto n = mat[0].size();
-    if (n == 0) { printf("ERROR: transpose on empty matrix (cols = 0)\n"); }
-    auto transMat = allocMat<T>(n, m, 0);
-    for (auto i = 0; i < m; ++i) {
-        for (auto j = 0; j < n; ++j) { transMat[j][i] = mat[i][j]; }
+    if (n == 0) {
+        printf("ERROR: transpose on empty matrix (cols = 0)\n");
+        return {};
     }
+    auto transMat = allocMat<T>(n, m, 0);
+    transposeBlocked(
+        m, n, [&mat](std::size_t i) { return mat[i].data(); },
+        [&transMat](std::size_t j) { return transMat[j].data(); });
     return transMat;
 }
 
+// in-place transposition of a square n x n matrix, tile (I, J) is swapped with tile (J, I)
+template <typename RowFn>
+void transposeSquareInPlace(std::size_t n, RowFn row) {
+    auto blocks = (n + kTransposeBlock - 1) / kTransposeBlock;
+    auto band = [&](std::size_t blo, std::size_t bhi) {
+        for (auto bi = blo; bi < bhi; ++bi) {
+            auto i0 = bi * kTransposeBlock, ihi = std::min(n, i0 + kTransposeBlock);
+            for (auto bj = bi; bj < blocks; ++bj) {
+                auto j0 = bj * kTransposeBlock, jhi = std::min(n, j0 + kTransposeBlock);
+                for (auto i = i0; i < ihi; ++i) {
+                    auto ri = row(i);
+                    // only the upper triangle of a diagonal tile
+                    for (auto j = bi == bj ? i + 1 : j0; j < jhi; ++j) std::swap(ri[j], row(j)[i]);
+                }
+            }
+        }
+    };
+    if (n * n < kParallelTransposeSize) {
+        band(0, blocks);
+    } else {
+        parallel::parallelFor(0, blocks, 1, band);
+    }
+}
+
+template <typename T>
+void transposeInPlace(T *data, std::size_t n) {
+    transposeSquareInPlace(n, [data, n](std::size_t i) { return data + i * n; });
+}
+
+// square matrices are transposed in place, others fall back to a transposed copy
+template <typename T>
+void transposeInPlace(Mat<T> &mat) {
+    auto m = mat.size();
+    if (m == 0) return;
+    if (mat[0].size() != m) {
+        mat = transpose(mat);
+        return;
+    }
+    transposeSquareInPlace(m, [&mat](std::size_t i) { return mat[i].data(); });
+}
+
+/**
+ * Column-major materialization of the rows `order` of a row-major matrix (all rows by default).
+ * column j of the selected rows is the contiguous range [col(j), col(j) + m), per feature
+ * statistics then read contiguous memory instead of gathering one element per row allocation.
+ */
+template <typename T>
+ColMajor<T> columnMajor(const Mat<T> &mat, const std::vector<uint32_t> &order = {}) {
+    ColMajor<T> cols;
+    cols.m = order.empty() ? mat.size() : order.size();
+    cols.n = mat.empty() ? 0 : mat[0].size();
+    cols.data.resize(static_cast<std::size_t>(cols.m) * cols.n);
+    auto srcRow = [&mat, &order](std::size_t i) {
+        return mat[order.empty() ? i : order[i]].data();
+    };
+    auto buf = cols.data.data();
+    auto m = cols.m;
+    transposeBlocked(cols.m, cols.n, srcRow, [buf, m](std::size_t j) { return buf + j * m; });
+    return cols;
+}
+
 template <typename T>
 Vec<T> getRow(const Mat<T> &mat, uint32_t r) {
     if (r >= mat.size()) {
@@ -123,52 +327,324 @@ Vec<T> getCol(const Mat<T> &mat, uint32_t c) {
         return {};
     }
     Vec<T> col;
+    col.reserve(m);
     for (auto i = 0; i < m; ++i) { col.emplace_back(mat[i][c]); }
     return col;
 }
 
+// |v|^p for an integer p, by multiplication, std::pow costs an order of magnitude more
+inline double absPow(double v, uint32_t p) {
+    v = std::abs(v);
+    if (p == 1) return v;
+    if (p == 2) return v * v;
+    double r = 1.0;
+    for (uint32_t i = 0; i < p; ++i) r *= v;
+    return r;
+}
+
+// p-th root of a sum of |v|^p
+inline double rootPow(double sum, uint32_t p) {
+    if (p == 1) return sum;
+    if (p == 2) return std::sqrt(sum);
+    return std::pow(sum, 1.0 / static_cast<double>(p));
+}
+
+// Lp distance of two n-dim points stored in contiguous memory
+template <typename T1, typename T2>
+double Lp(const T1 *x, const T2 *y, std::size_t n, uint32_t p = 2) {
+    double sum = 0.0;
+    for (std::size_t i = 0; i < n; ++i) sum += absPow(static_cast<double>(x[i] - y[i]), p);
+    return rootPow(sum, p);
+}
+
+/**
+ * sum of |x_i - y_i|^p (the p-th power of the Lp distance) abandoned once it exceeds `bound`,
+ * checked after every block of 16 dims so the inner loop stays branch free. a caller ranking by
+ * distance only needs to know the candidate is beyond its bound, the partial sum already is.
+ * `touched` gets the number of dims summed
+ */
+template <typename T1, typename T2>
+double LpPowBounded(const T1 *x, const T2 *y, std::size_t n, uint32_t p, double bound,
+                    std::size_t &touched) {
+    constexpr std::size_t kBlock = 16;
+    double sum = 0.0;
+    std::size_t i = 0;
+    while (i < n) {
+        auto end = std::min(n, i + kBlock);
+        if (p == 2) {
+            for (; i < end; ++i) {
+                double d = static_cast<double>(x[i]) - static_cast<double>(y[i]);
+                sum += d * d;
+            }
+        } else {
+            for (; i < end; ++i) {
+                sum += absPow(static_cast<double>(x[i]) - static_cast<double>(y[i]), p);
+            }
+        }
+        if (sum > bound) break;
+    }
+    touched = i;
+    return sum;
+}
+
 template <typename T1, typename T2>
 double Lp(const Vec<T1> &x, const Vec<T2> &y, uint32_t p = 2) {
     auto mx = x.size(), my = y.size();
+    if (mx == my && mx > 0) { return Lp(x.data(), y.data(), mx, p); }
+    return 0.0;
+}
+
+inline uint32_t popcount(uint64_t x) { return __builtin_popcountll(x); }
+
+// 64-bit words needed to hold n bits
+inline std::size_t bitWords(std::size_t n) { return (n + 63) / 64; }
+
+// binarize x at threshold (x > threshold is 1) into bitWords(n) words, bit j%64 of word j/64
+template <typename T>
+void packBits(const T *x, std::size_t n, double threshold, uint64_t *bits) {
+    for (std::size_t w = 0; w < bitWords(n); ++w) {
+        uint64_t word = 0;
+        auto first = w * 64, last = std::min(n, first + 64);
+        for (auto j = first; j < last; ++j) {
+            word |= static_cast<uint64_t>(x[j] > threshold) << (j - first);
+        }
+        bits[w] = word;
+    }
+}
+
+// accumulator of a sum over T, integers widen to 64 bits and floating point to double
+template <typename T>
+using Accumulator = std::conditional_t<
+    std::is_integral_v<T>, std::conditional_t<std::is_signed_v<T>, int64_t, uint64_t>, double>;
+
+// elements per block of the fused kernels, a block stays in L1 between the two passes over it
+constexpr std::size_t kSummaryBlock = 1024;
+
+// samples with more elements are summarized in parallel chunks
+constexpr std::size_t kParallelSummarySize = 1 << 18;
+
+template <typename T>
+Accumulator<T> sum(const T *X, std::size_t n) {
+    if constexpr (std::is_integral_v<T>) {
+        Accumulator<T> sum = 0;
+        for (std::size_t i = 0; i < n; ++i) sum += X[i];
+        return sum;
+    } else {
+        // Kahan compensated, per lane
+        double s[kLanes] = {0}, c[kLanes] = {0};
+        std::size_t i = 0;
+        for (; i + kLanes <= n; i += kLanes) {
+            for (std::size_t l = 0; l < kLanes; ++l) {
+                double y = X[i + l] - c[l];
+                double t = s[l] + y;
+                c[l] = (t - s[l]) - y;
+                s[l] = t;
+            }
+        }
+        double sum = 0.0;
+        for (std::size_t l = 0; l < kLanes; ++l) sum += s[l] - c[l];
+        for (; i < n; ++i) sum += X[i];
+        return sum;
+    }
+}
+
+template <typename T>
+Accumulator<T> sum(const Vec<T> &X) {
+    return sum(X.data(), X.size());
+}
+
+/**
+ * Descriptive statistics of a sample: count, mean, M2 (sum of squared deviations from the mean),
+ * min and max. Summaries of disjoint samples are combined exactly by `merge` (Chan et al.):
+ *
+ *      n = n_a + n_b,  \delta = \mu_b - \mu_a
+ *      \mu = \mu_a + \delta n_b / n
+ *      M2 = M2_a + M2_b + \delta^2 n_a n_b / n
+ *
+ * so a sample can be reduced block by block, or chunk by chunk on different threads.
+ */
+struct Summary {
+    uint64_t count = 0;
+    double mean = 0.0;
+    double m2 = 0.0;
+    double min = Inf<double>;
+    double max = -Inf<double>;
+
+    // population variance, \sigma^2 = \frac{\sum{(X-\mu)^2}}{N}
+    double variance() const { return count > 0 ? m2 / count : NaN<double>; }
+    double stdev() const { return std::sqrt(variance()); }
+
+    void merge(const Summary &other) {
+        if (other.count == 0) return;
+        if (count == 0) {
+            *this = other;
+            return;
+        }
+        double n = static_cast<double>(count + other.count);
+        double delta = other.mean - mean;
+        mean += delta * (other.count / n);
+        m2 += other.m2 + delta * delta * (static_cast<double>(count) * other.count / n);
+        count += other.count;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+};
+
+// summary of one block, the second pass (deviations from the block mean) re-reads L1 only. A
+// block is short enough for a plain lane-wise sum, precision over blocks comes from the merge
+template <typename T>
+Summary summarizeBlock(const T *X, std::size_t n) {
+    Summary s;
+    if (n == 0) return s;
+    double total[kLanes] = {0}, lo[kLanes], hi[kLanes];
+    for (std::size_t l = 0; l < kLanes; ++l) {
+        lo[l] = Inf<double>;
+        hi[l] = -Inf<double>;
+    }
+    std::size_t i = 0;
+    for (; i + kLanes <= n; i += kLanes) {
+        for (std::size_t l = 0; l < kLanes; ++l) {
+            double x = X[i + l];
+            total[l] += x;
+            lo[l] = x < lo[l] ? x : lo[l];
+            hi[l] = x > hi[l] ? x : hi[l];
+        }
+    }
     double sum = 0.0;
-    if (mx == my && mx > 0) {
-        for (auto i = 0; i < mx; ++i) {
-            sum += std::pow(std::abs(static_cast<double>(x[i] - y[i])), static_cast<double>(p));
+    for (std::size_t l = 0; l < kLanes; ++l) {
+        sum += total[l];
+        s.min = std::min(s.min, lo[l]);
+        s.max = std::max(s.max, hi[l]);
+    }
+    for (; i < n; ++i) {
+        sum += X[i];
+        s.min = std::min<double>(s.min, X[i]);
+        s.max = std::max<double>(s.max, X[i]);
+    }
+    s.count = n;
+    s.mean = sum / n;
+    double m2[kLanes] = {0};
+    for (i = 0; i + kLanes <= n; i += kLanes) {
+        for (std::size_t l = 0; l < kLanes; ++l) {
+            double d = X[i + l] - s.mean;
+            m2[l] += d * d;
         }
-        return std::pow(sum, 1.0 / static_cast<double>(p));
     }
-    return sum;
+    for (std::size_t l = 0; l < kLanes; ++l) s.m2 += m2[l];
+    for (; i < n; ++i) {
+        double d = X[i] - s.mean;
+        s.m2 += d * d;
+    }
+    return s;
 }
 
+// count, mean, variance, min and max of X in a single read of memory
 template <typename T>
-T sum(const Vec<T> &X) {
-    T sum = 0;
-    // overflow risk
-    for (const auto &x : X) sum += x;
-    return sum;
+Summary summary(const T *X, std::size_t n) {
+    auto reduce = [X](std::size_t lo, std::size_t hi) {
+        Summary s;
+        for (auto i = lo; i < hi; i += kSummaryBlock) {
+            s.merge(summarizeBlock(X + i, std::min(kSummaryBlock, hi - i)));
+        }
+        return s;
+    };
+    auto threads = parallel::threads();
+    if (n < kParallelSummarySize || threads == 1) return reduce(0, n);
+    // one chunk per thread, merged in chunk order so the result does not depend on scheduling
+    auto chunk = (n / threads + kSummaryBlock - 1) / kSummaryBlock * kSummaryBlock;
+    std::vector<Summary> partial((n + chunk - 1) / chunk);
+    parallel::parallelFor(0, n, chunk, [&](std::size_t lo, std::size_t hi) {
+        partial[lo / chunk] = reduce(lo, hi);
+    });
+    Summary s;
+    for (const auto &p : partial) s.merge(p);
+    return s;
 }
 
 template <typename T>
-double mean(const Vec<T> &X) {
-    if (X.size() == 0) {
+Summary summary(const Vec<T> &X) {
+    return summary(X.data(), X.size());
+}
+
+/**
+ * Per feature (column) summaries of a row-major dataset in a single pass over its rows. Rows are
+ * taken in chunks small enough to stay in cache for the deviation pass, chunks are reduced in
+ * parallel with per-thread accumulators and merged at the end.
+ */
+template <typename T>
+std::vector<Summary> columnSummaries(const Data<T> &X) {
+    auto m = X.m, n = X.n;
+    if (m == 0 || n == 0) return {};
+    // ~256KB of rows per chunk
+    std::size_t chunkRows = std::max<std::size_t>(1, (256 << 10) / (sizeof(T) * n));
+    auto chunks = (m + chunkRows - 1) / chunkRows;
+    std::vector<std::vector<Summary>> partial(chunks);
+    parallel::parallelFor(0, chunks, 1, [&](std::size_t clo, std::size_t chi) {
+        Vec<double> total(n), mu(n), m2(n), lo(n, Inf<double>), hi(n, -Inf<double>);
+        for (auto c = clo; c < chi; ++c) {
+            auto first = c * chunkRows, last = std::min<std::size_t>(m, first + chunkRows);
+            std::fill(total.begin(), total.end(), 0.0);
+            std::fill(m2.begin(), m2.end(), 0.0);
+            std::fill(lo.begin(), lo.end(), Inf<double>);
+            std::fill(hi.begin(), hi.end(), -Inf<double>);
+            for (auto i = first; i < last; ++i) {
+                const T *row = X.data[i].data();
+                for (uint32_t j = 0; j < n; ++j) {
+                    double x = row[j];
+                    total[j] += x;
+                    lo[j] = std::min(lo[j], x);
+                    hi[j] = std::max(hi[j], x);
+                }
+            }
+            double len = static_cast<double>(last - first);
+            for (uint32_t j = 0; j < n; ++j) mu[j] = total[j] / len;
+            for (auto i = first; i < last; ++i) {
+                const T *row = X.data[i].data();
+                for (uint32_t j = 0; j < n; ++j) {
+                    double d = row[j] - mu[j];
+                    m2[j] += d * d;
+                }
+            }
+            auto &result = partial[c];
+            result.resize(n);
+            uint64_t count = last - first;
+            for (uint32_t j = 0; j < n; ++j) result[j] = {count, mu[j], m2[j], lo[j], hi[j]};
+        }
+    });
+    std::vector<Summary> summaries(n);
+    for (const auto &p : partial) {
+        for (uint32_t j = 0; j < n; ++j) summaries[j].merge(p[j]);
+    }
+    return summaries;
+}
+
+template <typename T>
+double mean(const T *X, std::size_t n) {
+    if (n == 0) {
         printf("ERROR: invalid input vector\n");
         return NaN<double>;
     }
-    double sum = stat::sum(X);
-    return sum / X.size();
+    return static_cast<double>(sum(X, n)) / n;
+}
+
+template <typename T>
+double mean(const Vec<T> &X) {
+    return mean(X.data(), X.size());
 }
 
 // \sigma^2 = \frac{\sum{(X-\mu)^2}}{N}
 template <typename T>
-double stdev(const Vec<T> &X) {
-    if (X.size() == 0) {
+double stdev(const T *X, std::size_t n) {
+    if (n == 0) {
         printf("ERROR: invalid input vector\n");
         return NaN<double>;
     }
-    auto mu = mean(X);
-    double sum = 0.0;
-    for (const auto &x : X) { sum += std::pow(x - mu, 2); }
-    return std::sqrt(sum / X.size());
+    return summary(X, n).stdev();
+}
+
+template <typename T>
+double stdev(const Vec<T> &X) {
+    return stdev(X.data(), X.size());
 }
 
 // gaussian probability, aka. normal distribution
@@ -179,10 +655,115 @@ double gaussian_prob(T x, double mu, double sigma) {
         printf("ERROR: sigma = 0\n");
         return NaN<double>;
     }
-    double exp = std::exp(-(std::pow(x - mu, 2) / 2.0 / std::pow(sigma, 2)));
+    double d = x - mu;
+    double exp = std::exp(-(d * d / 2.0 / (sigma * sigma)));
     return exp / std::sqrt(2 * pi) / sigma;
 }
 
+// A = L L^T in place for a symmetric positive definite (n x n, row-major) A, L lands in the lower
+// triangle (the upper one is zeroed). false if A is not positive definite
+inline bool cholesky(double *A, std::size_t n) {
+    for (std::size_t j = 0; j < n; ++j) {
+        auto Lj = A + j * n;
+        double d = Lj[j] - dot(Lj, Lj, j);
+        if (!(d > 0.0)) return false;
+        Lj[j] = std::sqrt(d);
+        for (std::size_t i = j + 1; i < n; ++i) {
+            auto Li = A + i * n;
+            Li[j] = (Li[j] - dot(Li, Lj, j)) / Lj[j];
+        }
+        std::fill(Lj + j + 1, Lj + n, 0.0);
+    }
+    return true;
+}
+
+// x = L^{-1} x in place, L lower triangular (n x n, row-major)
+inline void solveLower(const double *L, double *x, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        auto Li = L + i * n;
+        x[i] = (x[i] - dot(Li, x, i)) / Li[i];
+    }
+}
+
+/**
+ * Modified Gram-Schmidt over `count` rows of length n (row-major), in place. Rows that are
+ * (numerically) in the span of the previous ones are zeroed. returns the rank
+ */
+inline std::size_t orthonormalize(double *rows, std::size_t count, std::size_t n) {
+    std::size_t rank = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        auto r = rows + i * n;
+        double before = std::sqrt(dot(r, r, n));
+        // twice is enough (Giraud et al.), the second pass removes the rounding of the first
+        for (int pass = 0; pass < 2; ++pass) {
+            for (std::size_t j = 0; j < i; ++j) axpy(-dot(rows + j * n, r, n), rows + j * n, r, n);
+        }
+        double norm = std::sqrt(dot(r, r, n));
+        if (norm <= 1e-10 * before || norm == 0.0) {
+            std::fill(r, r + n, 0.0);
+            continue;
+        }
+        for (std::size_t k = 0; k < n; ++k) r[k] /= norm;
+        ++rank;
+    }
+    return rank;
+}
+
+/**
+ * Eigen decomposition of a symmetric (n x n, row-major) A by cyclic Jacobi rotations, A is
+ * destroyed. eigenvalues land in values in decreasing order, the matching unit eigenvectors in the
+ * rows of vectors (n x n). For the small matrices of the randomized SVD, n is tens.
+ */
+inline void symmetricEigen(double *A, std::size_t n, double *values, double *vectors) {
+    Vec<double> V(n * n, 0.0);
+    for (std::size_t i = 0; i < n; ++i) V[i * n + i] = 1.0;
+    for (int sweep = 0; sweep < 64; ++sweep) {
+        double off = 0.0, total = 0.0;
+        for (std::size_t i = 0; i < n; ++i) {
+            for (std::size_t j = 0; j < n; ++j) {
+                total += A[i * n + j] * A[i * n + j];
+                if (i != j) off += A[i * n + j] * A[i * n + j];
+            }
+        }
+        if (off <= 1e-30 * total || off == 0.0) break;
+        for (std::size_t p = 0; p + 1 < n; ++p) {
+            for (std::size_t q = p + 1; q < n; ++q) {
+                double apq = A[p * n + q];
+                if (std::abs(apq) < 1e-300) continue;
+                double theta = (A[q * n + q] - A[p * n + p]) / (2.0 * apq);
+                double t = (theta >= 0 ? 1.0 : -1.0) /
+                           (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+                double c = 1.0 / std::sqrt(t * t + 1.0), s = t * c;
+                // A = J^T A J on rows and columns p, q; V = V J, eigenvectors in the columns
+                for (std::size_t k = 0; k < n; ++k) {
+                    double akp = A[k * n + p], akq = A[k * n + q];
+                    A[k * n + p] = c * akp - s * akq;
+                    A[k * n + q] = s * akp + c * akq;
+                }
+                for (std::size_t k = 0; k < n; ++k) {
+                    double apk = A[p * n + k], aqk = A[q * n + k];
+                    A[p * n + k] = c * apk - s * aqk;
+                    A[q * n + k] = s * apk + c * aqk;
+                }
+                for (std::size_t k = 0; k < n; ++k) {
+                    double vkp = V[k * n + p], vkq = V[k * n + q];
+                    V[k * n + p] = c * vkp - s * vkq;
+                    V[k * n + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+    std::vector<std::size_t> order(n);
+    for (std::size_t i = 0; i < n; ++i) order[i] = i;
+    std::sort(order.begin(), order.end(),
+              [A, n](std::size_t a, std::size_t b) { return A[a * n + a] > A[b * n + b]; });
+    for (std::size_t r = 0; r < n; ++r) {
+        auto i = order[r];
+        values[r] = A[i * n + i];
+        for (std::size_t k = 0; k < n; ++k) vectors[r * n + k] = V[k * n + i];
+    }
+}
+
 }  // namespace stat
 
 #endif  // __MATH_H__
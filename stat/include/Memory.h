@@ -0,0 +1,328 @@
+#ifndef __MEMORY_H__
+#define __MEMORY_H__
+
+#include "Types.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+namespace stat {
+namespace memory {
+
+constexpr std::size_t kHugePageSize = std::size_t(2) << 20;
+
+/**
+ * Allocations of at least `threshold` bytes are mapped directly, aligned and padded to 2 MB huge
+ * pages and advised as such (MADV_HUGEPAGE), so a large buffer (the points of a k-NN, a model file
+ * sized array) is covered by a few TLB entries instead of thousands of 4 KB ones. With transparent
+ * huge pages set to "never" the mapping stays on 4 KB pages and only the alignment is gained.
+ * Smaller allocations go to `upstream`. Thread-safe when upstream is.
+ */
+class HugePageResource : public std::pmr::memory_resource {
+public:
+    explicit HugePageResource(std::size_t _threshold = kHugePageSize,
+                              std::pmr::memory_resource *_upstream = std::pmr::new_delete_resource())
+        : threshold(_threshold), upstream(_upstream) {}
+
+    // off: every allocation goes upstream, buffers mapped before are still released right
+    void setEnabled(bool on) { enabled.store(on, std::memory_order_relaxed); }
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    // bytes currently mapped on huge pages
+    std::size_t mapped() const { return mappedBytes.load(std::memory_order_relaxed); }
+
+private:
+    std::size_t threshold;
+    std::pmr::memory_resource *upstream;
+    std::atomic<bool> enabled{true};
+    std::atomic<std::size_t> mappedBytes{0};
+    std::mutex lock;
+    std::set<void *> blocks;  // mapped ones, large blocks are few, a lookup costs nothing next to mmap
+
+    static std::size_t roundUp(std::size_t bytes) {
+        return (bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    }
+
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (!isEnabled() || bytes < threshold || alignment > kHugePageSize) {
+            return upstream->allocate(bytes, alignment);
+        }
+        // over-map by one huge page, then unmap the unaligned head and the tail
+        auto size = roundUp(bytes);
+        void *base = ::mmap(nullptr, size + kHugePageSize, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) throw std::bad_alloc();
+        auto addr = reinterpret_cast<uintptr_t>(base);
+        auto aligned = (addr + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+        if (aligned > addr) ::munmap(base, aligned - addr);
+        auto tail = addr + size + kHugePageSize - (aligned + size);
+        if (tail > 0) ::munmap(reinterpret_cast<void *>(aligned + size), tail);
+#ifdef MADV_HUGEPAGE
+        ::madvise(reinterpret_cast<void *>(aligned), size, MADV_HUGEPAGE);
+#endif
+        mappedBytes.fetch_add(size, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> guard(lock);
+        blocks.insert(reinterpret_cast<void *>(aligned));
+        return reinterpret_cast<void *>(aligned);
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override {
+        bool mapped = false;
+        if (bytes >= threshold) {
+            std::lock_guard<std::mutex> guard(lock);
+            mapped = blocks.erase(p) > 0;
+        }
+        if (!mapped) {
+            upstream->deallocate(p, bytes, alignment);
+            return;
+        }
+        auto size = roundUp(bytes);
+        ::munmap(p, size);
+        mappedBytes.fetch_sub(size, std::memory_order_relaxed);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// the process wide huge page resource, model buffers of the library are allocated from it. never
+// destroyed, a static model may release its buffers after the end of main()
+inline HugePageResource *hugePages() {
+    static auto *resource = new HugePageResource();
+    return resource;
+}
+
+/**
+ * Monotonic arena: allocations are bumped out of chunks that grow geometrically and are taken
+ * from `upstream` (huge pages by default), nothing is freed before the arena goes away. A loaded
+ * data set is one such lifetime, its tens of thousands of rows cost a few dozen upstream
+ * allocations. Unlike std::pmr::monotonic_buffer_resource it is safe to use from several threads
+ * (a transform run by a loader resizes rows in parallel).
+ */
+class Arena : public std::pmr::memory_resource {
+public:
+    explicit Arena(std::size_t initialBytes = 1 << 20,
+                   std::pmr::memory_resource *upstream = hugePages())
+        : arena(initialBytes, upstream) {}
+
+private:
+    std::mutex lock;
+    std::pmr::monotonic_buffer_resource arena;
+
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        std::lock_guard<std::mutex> guard(lock);
+        return arena.allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// pool of fixed size blocks per size class, for many small buffers allocated and freed repeatedly
+using Pool = std::pmr::synchronized_pool_resource;
+
+inline std::shared_ptr<Arena> makeArena(std::size_t initialBytes = 1 << 20,
+                                        std::pmr::memory_resource *upstream = hugePages()) {
+    return std::make_shared<Arena>(initialBytes, upstream);
+}
+
+inline std::shared_ptr<Pool> makePool(std::pmr::memory_resource *upstream = hugePages()) {
+    return std::make_shared<Pool>(upstream);
+}
+
+/**
+ * Counts the allocations passed on to `upstream`, e.g. installed as the default resource around a
+ * load to see how many buffers it allocates.
+ */
+class Counter : public std::pmr::memory_resource {
+public:
+    explicit Counter(std::pmr::memory_resource *_upstream = std::pmr::new_delete_resource())
+        : upstream(_upstream) {}
+
+    uint64_t allocations() const { return count.load(std::memory_order_relaxed); }
+    uint64_t bytes() const { return total.load(std::memory_order_relaxed); }
+
+private:
+    std::pmr::memory_resource *upstream;
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> total{0};
+
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        count.fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(bytes, std::memory_order_relaxed);
+        return upstream->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override {
+        upstream->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+
+/**
+ * Heap bytes owned by a container beyond its own object: capacity, not size, and the elements'
+ * own buffers, recursively. Node containers count a node per element with the two pointers and
+ * hash of libstdc++'s nodes, an estimate. A buffer on huge pages counts its capacity, the mapping
+ * itself is rounded up to 2 MB.
+ */
+template <typename T>
+std::size_t heapBytes(const T &) {
+    return 0;
+}
+template <typename T, typename A>
+std::size_t heapBytes(const std::vector<T, A> &v);
+template <typename C, typename Tr, typename A>
+std::size_t heapBytes(const std::basic_string<C, Tr, A> &s);
+template <typename K, typename V, typename H, typename E, typename A>
+std::size_t heapBytes(const std::unordered_map<K, V, H, E, A> &m);
+template <typename K, typename H, typename E, typename A>
+std::size_t heapBytes(const std::unordered_set<K, H, E, A> &m);
+template <typename K, typename V, typename C, typename A>
+std::size_t heapBytes(const std::map<K, V, C, A> &m);
+template <typename A, typename B>
+std::size_t heapBytes(const std::pair<A, B> &p);
+
+// elements without buffers of their own are not visited, a large buffer costs O(1)
+template <typename T>
+constexpr bool kFlat = std::is_trivially_copyable_v<T>;
+template <typename A, typename B>
+constexpr bool kFlat<std::pair<A, B>> = kFlat<A> && kFlat<B>;
+
+template <typename T, typename A>
+std::size_t heapBytes(const std::vector<T, A> &v) {
+    std::size_t bytes = v.capacity() * sizeof(T);
+    if constexpr (!kFlat<T>) {
+        for (const auto &e : v) bytes += heapBytes(e);
+    }
+    return bytes;
+}
+
+template <typename C, typename Tr, typename A>
+std::size_t heapBytes(const std::basic_string<C, Tr, A> &s) {
+    // short strings live in the object
+    return s.capacity() >= 16 / sizeof(C) ? (s.capacity() + 1) * sizeof(C) : 0;
+}
+
+template <typename Container>
+std::size_t hashNodeBytes(const Container &c) {
+    using Value = typename Container::value_type;
+    std::size_t bytes = c.bucket_count() * sizeof(void *) +
+                        c.size() * (sizeof(Value) + 2 * sizeof(void *));
+    if constexpr (!kFlat<std::remove_const_t<Value>>) {
+        for (const auto &e : c) bytes += heapBytes(e);
+    }
+    return bytes;
+}
+
+template <typename K, typename V, typename H, typename E, typename A>
+std::size_t heapBytes(const std::unordered_map<K, V, H, E, A> &m) {
+    return hashNodeBytes(m);
+}
+
+template <typename K, typename H, typename E, typename A>
+std::size_t heapBytes(const std::unordered_set<K, H, E, A> &m) {
+    return hashNodeBytes(m);
+}
+
+template <typename K, typename V, typename C, typename A>
+std::size_t heapBytes(const std::map<K, V, C, A> &m) {
+    // color, parent, left, right
+    std::size_t bytes = m.size() * (sizeof(std::pair<const K, V>) + 4 * sizeof(void *));
+    if constexpr (!kFlat<K> || !kFlat<V>) {
+        for (const auto &e : m) bytes += heapBytes(e);
+    }
+    return bytes;
+}
+
+template <typename A, typename B>
+std::size_t heapBytes(const std::pair<A, B> &p) {
+    return heapBytes(p.first) + heapBytes(p.second);
+}
+
+/**
+ * Resident bytes of a model or a data set by component, from memoryUsage() of the models and
+ * usage() below. Components are named by what they hold ("points", "kd-tree nodes"), a nested
+ * object is added under a prefix ("projection/components"). Zero sized components are left out.
+ */
+class Usage {
+public:
+    Usage &add(const std::string &component, std::size_t bytes) {
+        if (bytes > 0) parts.emplace_back(component, bytes);
+        return *this;
+    }
+
+    Usage &add(const std::string &prefix, const Usage &nested) {
+        for (const auto &part : nested.parts) add(prefix + "/" + part.first, part.second);
+        return *this;
+    }
+
+    std::size_t total() const {
+        std::size_t bytes = 0;
+        for (const auto &part : parts) bytes += part.second;
+        return bytes;
+    }
+
+    // bytes of one component, 0 if there is none
+    std::size_t operator[](const std::string &component) const {
+        for (const auto &part : parts) {
+            if (part.first == component) return part.second;
+        }
+        return 0;
+    }
+
+    const std::vector<std::pair<std::string, std::size_t>> &components() const { return parts; }
+
+    void print(const char *name) const {
+        printf("INFO: %s uses %.3f MB\n", name, total() / double(1 << 20));
+        for (const auto &part : parts) {
+            printf("    %-32s %12zu bytes\n", part.first.c_str(), part.second);
+        }
+    }
+
+private:
+    std::vector<std::pair<std::string, std::size_t>> parts;
+};
+
+// a data set: the values of its rows and the row objects themselves
+template <typename T>
+Usage usage(const Data<T> &X) {
+    std::size_t values = 0;
+    for (const auto &row : X.data) values += row.capacity() * sizeof(T);
+    Usage u;
+    u.add("rows", values);
+    u.add("row headers", X.data.capacity() * sizeof(Vec<T>));
+    return u;
+}
+
+// a byte budget in MB as the models take it, 0 is none
+inline bool overBudget(double budgetMB, std::size_t bytes) {
+    return budgetMB > 0.0 && bytes > budgetMB * (1 << 20);
+}
+
+}  // namespace memory
+}  // namespace stat
+
+#endif  // __MEMORY_H__
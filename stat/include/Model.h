@@ -1,17 +1,144 @@
 #ifndef __MODEL_H__
 #define __MODEL_H__
 
+#include "Labels.h"
+#include "Memory.h"
+#include "Profile.h"
+#include "Serialize.h"
 #include "Types.h"
 #include "Utils.h"
 
+#include <algorithm>
+#include <charconv>
+#include <cmath>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+#include <limits>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace stat {
 
 using ModelParam = std::unordered_map<std::string, std::string>;
 
+enum ModelType : uint32_t {
+    MODEL_UNKNOWN,
+    MODEL_PERCEPTRON,           // Perceptron model
+    MODEL_KNN,                  // k-Nearest Neighbor model
+    MODEL_NAIVE_BAYES,          // Naive Bayes model
+    MODEL_DECISION_TREE,        // Decision tree model
+    MODEL_LOGISTIC_REGRESSION,  // Logistic regression model
+    MODEL_SVM,                  // Support Vector Machine model
+    MODEL_ADA_BOOST,            // AdaBoost model
+    MODEL_EM,                   // Expectation-Maximization
+    MODEL_HMM,                  // Hidden Markov Model
+    MODEL_CRF,                  // Condition Random Field
+    MODEL_TRANSFORM,            // Preprocessing pipeline (Transform.h), saved like a model
+    MODEL_DYNAMIC_KNN,          // k-NN index updated in place (DynamicKNN.h)
+    MODEL_END,
+};
+
+/**
+ * Typed reads of a ModelParam, the adapter from string params to the typed XxxParam struct of a
+ * model. A value must parse whole and fall in its range, otherwise it is reported and the default
+ * is kept. Keys that no read asked for are reported when the reader goes out of scope, so a
+ * misspelled key does not silently leave a default.
+ */
+class ParamReader {
+public:
+    ParamReader(const ModelParam &_param, const char *_model) : param(_param), model(_model) {}
+
+    ~ParamReader() {
+        for (const auto &kv : param) {
+            if (std::find(used.cbegin(), used.cend(), kv.first) == used.cend()) {
+                printf("WARNING: unknown %s param \"%s\"\n", model, kv.first.c_str());
+            }
+        }
+    }
+
+    ParamReader(const ParamReader &) = delete;
+    ParamReader &operator=(const ParamReader &) = delete;
+
+    template <typename T>
+    ParamReader &number(const char *key, T &value, T lo = std::numeric_limits<T>::lowest(),
+                        T hi = std::numeric_limits<T>::max()) {
+        static_assert(std::is_arithmetic_v<T>, "numbers only");
+        auto text = find(key);
+        if (!text) return *this;
+        T parsed{};
+        if (parse(*text, parsed) && parsed >= lo && parsed <= hi) {
+            value = parsed;
+        } else {
+            invalid(key, *text);
+        }
+        return *this;
+    }
+
+    // "true" / "false", or 1 / 0
+    ParamReader &flag(const char *key, bool &value) {
+        auto text = find(key);
+        if (!text) return *this;
+        if (*text == "true" || *text == "1") {
+            value = true;
+        } else if (*text == "false" || *text == "0") {
+            value = false;
+        } else {
+            invalid(key, *text);
+        }
+        return *this;
+    }
+
+    // one of the named values of an enum
+    template <typename E>
+    ParamReader &choice(const char *key, E &value,
+                        std::initializer_list<std::pair<const char *, E>> names) {
+        auto text = find(key);
+        if (!text) return *this;
+        for (const auto &name : names) {
+            if (*text == name.first) {
+                value = name.second;
+                return *this;
+            }
+        }
+        invalid(key, *text);
+        return *this;
+    }
+
+private:
+    const ModelParam &param;
+    const char *model;
+    std::vector<std::string> used;
+
+    const std::string *find(const char *key) {
+        used.emplace_back(key);
+        auto it = param.find(key);
+        return it == param.cend() ? nullptr : &it->second;
+    }
+
+    void invalid(const char *key, const std::string &text) const {
+        printf("ERROR: invalid %s param %s = \"%s\", default kept\n", model, key, text.c_str());
+    }
+
+    template <typename T>
+    static bool parse(const std::string &text, T &value) {
+        auto first = text.data(), last = text.data() + text.size();
+        if constexpr (std::is_integral_v<T>) {
+            auto [ptr, ec] = std::from_chars(first, last, value);
+            return ec == std::errc() && ptr == last;
+        } else {
+            char *end = nullptr;
+            double v = std::strtod(first, &end);
+            value = static_cast<T>(v);
+            return !text.empty() && end == last && std::isfinite(v);
+        }
+    }
+};
+
 /**
  * Base model class
  */
@@ -27,6 +154,17 @@ public:
     virtual double validate(const Data<DataType> &X_test, const Data<LabelType> &y_test) = 0;
 
     virtual void describe() const = 0;
+
+    // heap bytes held by the trained model, by component (memory::Usage in Memory.h)
+    virtual memory::Usage memoryUsage() const = 0;
+
+    // values in a row the trained model takes, 0 before train() or load()
+    virtual uint32_t inputDim() const = 0;
+
+    // persist a trained model to / restore it from a versioned binary file (see Serialize.h)
+    virtual bool save(const char *filename) const = 0;
+
+    virtual bool load(const char *filename) = 0;
 };
 
 }  // namespace stat
@@ -0,0 +1,246 @@
+#ifndef __MODEL_SELECTION_H__
+#define __MODEL_SELECTION_H__
+
+#include "Math.h"
+#include "Parallel.h"
+#include "Profile.h"
+#include "Stat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace stat {
+namespace selection {
+
+struct CvParam {
+    uint32_t folds = 5;
+    uint32_t seed = 0;  // of the row shuffle, equal seeds give equal folds
+};
+
+// cross-validated accuracy of one configuration
+struct CvScore {
+    std::string name;
+    double accuracy = 0.0;  // mean over the non-empty folds, 0 if the model failed to train
+    double stdev = 0.0;     // over the non-empty folds
+    double seconds = 0.0;   // wall time spent on the configuration
+};
+
+// fold of every row: rows are shuffled and dealt round robin, fold sizes differ by one at most
+inline std::vector<uint32_t> assignFolds(uint32_t m, uint32_t folds, uint32_t seed = 0) {
+    std::vector<uint32_t> order(m), foldOf(m);
+    std::iota(order.begin(), order.end(), 0u);
+    std::shuffle(order.begin(), order.end(), std::mt19937(seed));
+    for (uint32_t i = 0; i < m; ++i) foldOf[order[i]] = i % folds;
+    return foldOf;
+}
+
+// rows of X in fold `fold`, or in every other fold, in their original order
+template <typename T>
+Data<T> selectRows(const Data<T> &X, const std::vector<uint32_t> &foldOf, uint32_t fold,
+                   bool inFold) {
+    Data<T> out{Mat<T>(), 0, X.n};
+    for (uint32_t i = 0; i < X.m; ++i) {
+        if ((foldOf[i] == fold) == inFold) out.data.emplace_back(X.data[i]);
+    }
+    out.m = out.data.size();
+    return out;
+}
+
+// mean and standard deviation of the per-fold accuracies
+inline void summarize(const Vec<double> &accuracies, CvScore &score) {
+    if (accuracies.empty()) return;
+    score.accuracy = mean(accuracies);
+    score.stdev = stdev(accuracies);
+}
+
+inline void report(const std::vector<CvScore> &scores) {
+    for (const auto &s : scores) {
+        printf("INFO: %-28s accuracy %f +- %f, %.3f s\n", s.name.c_str(), s.accuracy, s.stdev,
+               s.seconds);
+    }
+}
+
+// the highest mean accuracy, the first one of a tie
+inline const CvScore &best(const std::vector<CvScore> &scores) {
+    return *std::max_element(scores.cbegin(), scores.cend(),
+                             [](const CvScore &a, const CvScore &b) {
+                                 return a.accuracy < b.accuracy;
+                             });
+}
+
+/**
+ * k-fold cross-validation of one model configuration
+ *
+ * The folds are independent and run in parallel, each trains an AnyModel on the other folds and
+ * predicts its own rows in one batch. Nested parallel loops of the model run serially inside a
+ * fold, hence a model does not compete with its siblings for the pool. Empty folds (fewer rows
+ * than folds) are left out of the mean, like knnSweep(). A fold that fails to train fails the
+ * configuration, reported with an accuracy of 0.
+ */
+template <typename DataType, typename LabelType>
+CvScore crossValidate(const Data<DataType> &X, const Data<LabelType> &y, const ModelConfig &config,
+                      CvParam param = {}, std::string name = "") {
+    STAT_PROFILE_SCOPE(__func__);
+
+    CvScore score{std::move(name)};
+    auto start = profile::now();
+    auto folds = std::max<uint32_t>(param.folds, 2);
+    auto foldOf = assignFolds(X.m, folds, param.seed);
+    enum Outcome : uint8_t { EMPTY, SCORED, FAILED };
+    Vec<double> accuracy(folds, 0.0);
+    std::vector<Outcome> outcome(folds, EMPTY);
+    parallel::parallelFor(0, folds, 1, [&](std::size_t lo, std::size_t hi) {
+        for (auto f = lo; f < hi; ++f) {
+            auto trainX = selectRows(X, foldOf, f, false), trainY = selectRows(y, foldOf, f, false);
+            auto testX = selectRows(X, foldOf, f, true), testY = selectRows(y, foldOf, f, true);
+            if (testX.m == 0) continue;
+            AnyModel<DataType, LabelType> model(config);
+            if (!model.train(trainX, trainY)) {
+                outcome[f] = FAILED;
+                continue;
+            }
+            auto labels = model.predict(testX);
+            uint32_t hits = 0;
+            for (uint32_t i = 0; i < testX.m; ++i) hits += labels[i] == testY.data[i][0];
+            accuracy[f] = static_cast<double>(hits) / testX.m;
+            outcome[f] = SCORED;
+        }
+    });
+    score.seconds = (profile::now() - start) * 1e-9;
+    Vec<double> scored;
+    for (uint32_t f = 0; f < folds; ++f) {
+        if (outcome[f] == FAILED) {
+            printf("ERROR: %s failed to train on fold %u\n",
+                   score.name.empty() ? "model" : score.name.c_str(), f);
+            return score;
+        }
+        if (outcome[f] == SCORED) scored.emplace_back(accuracy[f]);
+    }
+    summarize(scored, score);
+    return score;
+}
+
+// cross-validation of every (name, config), on the same folds
+template <typename DataType, typename LabelType>
+std::vector<CvScore> sweep(const Data<DataType> &X, const Data<LabelType> &y,
+                           const std::vector<std::pair<std::string, ModelConfig>> &configs,
+                           CvParam param = {}) {
+    std::vector<CvScore> scores;
+    for (const auto &c : configs) scores.emplace_back(crossValidate(X, y, c.second, param, c.first));
+    return scores;
+}
+
+struct KnnSweepParam {
+    uint32_t kMax = 15;          // every k in [1, kMax] is scored
+    std::vector<uint32_t> ps{2};  // Lp distances
+    CvParam cv;
+};
+
+/**
+ * Cross-validated accuracy of k-NN for every k <= kMax and every p, one neighbor search per row
+ *
+ * Sweeping k by retraining runs the whole distance computation once per (k, p, fold). Here every
+ * row is a query of the fold it belongs to, against the rows of the other folds, which are exactly
+ * the training set of that fold: a single scan per row and p serves all folds at once. The scan
+ * keeps the kMax nearest neighbors (early abandoning like the simple k-NN), then the votes of the
+ * first k neighbors are counted incrementally for k = 1..kMax, with the tie rule of KNN (the label
+ * seen first among the most frequent). Rows are scanned in parallel.
+ *
+ * The scores of one p share one scan, their `seconds` is the time of that scan. Neighbors at
+ * exactly the k-th distance may resolve differently from a KNN trained with that k.
+ */
+template <typename DataType, typename LabelType>
+std::vector<CvScore> knnSweep(const Data<DataType> &X, const Data<LabelType> &y,
+                              const KnnSweepParam &param = {}) {
+    STAT_PROFILE_SCOPE(__func__);
+
+    auto m = X.m, n = X.n;
+    auto folds = std::max<uint32_t>(param.cv.folds, 2);
+    auto kMax = std::max<uint32_t>(param.kMax, 1);
+    auto foldOf = assignFolds(m, folds, param.cv.seed);
+    std::vector<uint32_t> foldRows(folds, 0);
+    for (auto f : foldOf) ++foldRows[f];
+
+    std::vector<CvScore> scores;
+    for (auto p : param.ps) {
+        auto start = profile::now();
+        std::vector<uint64_t> hits(std::size_t(folds) * kMax, 0);  // fold x k
+        std::mutex merge;
+        parallel::parallelFor(0, m, 16, [&](std::size_t lo, std::size_t hi) {
+            using Neighbor = std::pair<double, LabelType>;
+            std::vector<uint64_t> local(hits.size(), 0);
+            std::vector<Neighbor> heap;
+            std::vector<std::pair<LabelType, uint32_t>> votes;  // (label, count), first seen first
+            uint64_t evals = 0;
+            for (auto i = lo; i < hi; ++i) {
+                const auto *q = X.data[i].data();
+                heap.clear();
+                for (uint32_t j = 0; j < m; ++j) {
+                    if (foldOf[j] == foldOf[i]) continue;
+                    double bound = heap.size() < kMax ? Inf<double> : heap.front().first;
+                    std::size_t touched = 0;
+                    double dist = LpPowBounded(q, X.data[j].data(), n, p, bound, touched);
+                    ++evals;
+                    if (heap.size() < kMax) {
+                        heap.emplace_back(dist, y.data[j][0]);
+                        std::push_heap(heap.begin(), heap.end());
+                    } else if (dist < bound) {
+                        std::pop_heap(heap.begin(), heap.end());
+                        heap.back() = {dist, y.data[j][0]};
+                        std::push_heap(heap.begin(), heap.end());
+                    }
+                }
+                std::sort_heap(heap.begin(), heap.end());
+
+                votes.clear();
+                std::size_t top = 0;  // index in votes of the current prediction
+                auto *row = local.data() + std::size_t(foldOf[i]) * kMax;
+                for (std::size_t k = 0; k < kMax; ++k) {
+                    if (k < heap.size()) {
+                        auto label = heap[k].second;
+                        auto it = std::find_if(votes.begin(), votes.end(),
+                                               [&](const auto &v) { return v.first == label; });
+                        if (it == votes.end()) it = votes.insert(it, {label, 0u});
+                        ++it->second;
+                        auto idx = static_cast<std::size_t>(it - votes.begin());
+                        // a strictly larger count wins, a tie keeps the label seen first
+                        if (it->second > votes[top].second ||
+                            (it->second == votes[top].second && idx < top)) {
+                            top = idx;
+                        }
+                    }
+                    row[k] += !votes.empty() && votes[top].first == y.data[i][0];
+                }
+            }
+            STAT_PROFILE_COUNT(DISTANCE_EVALS, evals);
+            std::lock_guard<std::mutex> guard(merge);
+            for (std::size_t t = 0; t < hits.size(); ++t) hits[t] += local[t];
+        });
+        double seconds = (profile::now() - start) * 1e-9;
+        for (uint32_t k = 1; k <= kMax; ++k) {
+            CvScore score{"k-NN k=" + std::to_string(k) + " p=" + std::to_string(p)};
+            Vec<double> accuracy;
+            for (uint32_t f = 0; f < folds; ++f) {
+                if (foldRows[f] == 0) continue;
+                accuracy.emplace_back(static_cast<double>(hits[f * kMax + k - 1]) / foldRows[f]);
+            }
+            summarize(accuracy, score);
+            score.seconds = seconds;
+            scores.emplace_back(std::move(score));
+        }
+    }
+    return scores;
+}
+
+}  // namespace selection
+}  // namespace stat
+
+#endif  // __MODEL_SELECTION_H__
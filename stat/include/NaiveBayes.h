@@ -5,9 +5,10 @@
 #include "Model.h"
 
 #include <algorithm>
+#include <cmath>
 #include <cstdio>
-#include <unordered_map>
-#include <unordered_set>
+#include <cstdlib>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -15,10 +16,38 @@ namespace stat {
 
 constexpr double smoothing = 0.1;
 
+// additive (Laplace) smoothing of the bernoulli feature probabilities
+constexpr double laplace = 1.0;
+
+// bit-planes of the quantized bernoulli feature weights, weights are 8-bit
+constexpr uint32_t kWeightBits = 8;
+
+struct NaiveBayesParam {
+    enum Event : uint32_t {
+        GAUSSIAN,
+        BERNOULLI,
+    };
+
+    Event type = GAUSSIAN;
+    double threshold = 0.0;  // bernoulli: x > threshold binarizes to 1
+    bool show = false;
+
+    // {"model_type", "gaussian" | "bernoulli"}, {"threshold"}, {"model_show"}
+    static NaiveBayesParam parse(const ModelParam &param) {
+        NaiveBayesParam p;
+        ParamReader(param, "Naive Bayes")
+            .choice("model_type", p.type, {{"gaussian", GAUSSIAN}, {"bernoulli", BERNOULLI}})
+            .number("threshold", p.threshold)
+            .flag("model_show", p.show);
+        return p;
+    }
+};
+
 template <typename DataType, typename LabelType>
 class NaiveBayes : public Model<DataType, LabelType> {
 public:
-    explicit NaiveBayes(ModelParam param);
+    explicit NaiveBayes(const NaiveBayesParam &param = {});
+    explicit NaiveBayes(const ModelParam &param) : NaiveBayes(NaiveBayesParam::parse(param)) {}
     virtual ~NaiveBayes() = default;
 
     virtual bool train(const Data<DataType> &X_train, const Data<LabelType> &y_train) final;
@@ -29,24 +58,72 @@ public:
 
     virtual void describe() const final;
 
+    virtual memory::Usage memoryUsage() const final;
+
+    virtual uint32_t inputDim() const final;
+
+    virtual bool save(const char *filename) const final;
+
+    virtual bool load(const char *filename) final;
+
 private:
-    enum NBType : uint32_t {
-        GAUSSIAN,
-        BERNOULLI,
-        // OTHERS
-    };
+    using NBType = NaiveBayesParam::Event;
 
     struct GaussianParam {
         double mu;     // mean
         double sigma;  // standard deviation
     };
 
+    /**
+     * Bernoulli model, scored by popcount
+     *
+     * With p_cj = P(x_j = 1 | c), the log posterior of a binary row x is
+     *
+     *      log P(c) + \sum_j{log(1 - p_cj)} + \sum_j{x_j w_cj},  w_cj = log(p_cj / (1 - p_cj))
+     *
+     * The first two terms are a per-class constant (`base`). The weights are quantized to 8 bits,
+     * w_cj ~ lo + scale * q_cj, with lo and scale shared by all classes, so lo * popcount(x) is the
+     * same for every class and drops out of the argmax. Bit b of every q_cj of a class is packed in
+     * a bit-plane, hence \sum_j{x_j q_cj} = \sum_b{2^b popcount(x & plane_cb)}. Planes are
+     * interleaved word by word, (class, word, bit), so a word of x is loaded once for all 8 planes.
+     */
+    struct BernoulliParam {
+        double threshold;  // x > threshold binarizes to 1
+        double scale;      // weight of one quantization step
+    };
+
+    // fixed size part of the saved model. sections follow: labels, priors and the per-class
+    // parameters, class by class. bernoulli models store labels, base, BernoulliParam and planes
+    struct FileHeader {
+        uint32_t type;
+        uint32_t classes;
+        uint32_t dim;
+        uint32_t reserved;
+    };
+
     bool isModelShow;
     NBType type;
-    std::unordered_map<LabelType, std::vector<GaussianParam>> model;
-    std::unordered_map<LabelType, double> priorprobabilities;
 
-    std::vector<GaussianParam> summarize(const Mat<DataType> &data);
+    // both models index their arrays by class, classes[c] is the label of class c
+    uint32_t dim;
+    Vec<LabelType> classes;
+
+    // gaussian: P(c) and the dim feature params of every class, class by class. a row is scored
+    // from the derived log-density terms, logNorm[c] = log P(c) - \sum_j{log(sigma_cj)} -
+    // dim / 2 log(2 pi) and invSigma = 1 / sigma, without a log or exp per feature
+    Vec<double> priors;
+    std::vector<GaussianParam> gaussians;
+    Vec<double> logNorm;
+    Vec<double> invSigma;
+
+    BernoulliParam bernoulli;
+    Vec<double> base;
+    std::vector<uint64_t> planes;  // classes x bitWords(dim) x kWeightBits
+
+    // gaussian params of every feature over the rows [first, last) of a column-major matrix,
+    // appended to `gaussians`
+    void summarize(const ColMajor<DataType> &cols, uint32_t first, uint32_t last);
+    void compileGaussian();
     bool train_gaussian(const Data<DataType> &X_train, const Data<LabelType> &y_train);
     bool train_bernoulli(const Data<DataType> &X_train, const Data<LabelType> &y_train);
     LabelType predict_gaussian(const Vec<DataType> &X);
@@ -54,24 +131,8 @@ private:
 };
 
 template <typename DataType, typename LabelType>
-NaiveBayes<DataType, LabelType>::NaiveBayes(ModelParam param)
-    : isModelShow(false), type(NBType::GAUSSIAN) {
-    // TODO: only support gaussian model currently
-    const auto &model_show = param.find("model_show");
-    if (model_show != param.cend()) {
-        if (model_show->second == "true") { isModelShow = true; }
-    }
-
-    const auto &model_type = param.find("model_type");
-    if (model_type != param.cend()) {
-        if (model_type->second == "gaussian") {
-            type = NBType::GAUSSIAN;
-        } else if (model_type->second == "bernoulli") {
-            printf("TODO: not supproted currently\n");
-            // type = NBType::BERNOULLI;
-        }
-    }
-}
+NaiveBayes<DataType, LabelType>::NaiveBayes(const NaiveBayesParam &param)
+    : isModelShow(param.show), type(param.type), dim(0), bernoulli{param.threshold, 1.0} {}
 
 template <typename DataType, typename LabelType>
 bool NaiveBayes<DataType, LabelType>::train(const Data<DataType> &X_train,
@@ -87,32 +148,35 @@ bool NaiveBayes<DataType, LabelType>::train(const Data<DataType> &X_train,
 template <typename DataType, typename LabelType>
 bool NaiveBayes<DataType, LabelType>::train_gaussian(const Data<DataType> &X_train,
                                                      const Data<LabelType> &y_train) {
-    Clock clk(__func__);
+    STAT_PROFILE_SCOPE(__func__);
 
     auto m = X_train.m, n = X_train.n;
     if (m == 0 || n == 0) {
         printf("ERROR: invalid training set\n");
         return false;
     }
-    std::unordered_map<LabelType, Mat<DataType>> dataByLabel;
-    for (auto i = 0; i < m; ++i) {
-        auto label = y_train.data[i][0];
-        priorprobabilities[label] += 1.0 / m;  // calculate prior probabilities, P(y)
-        // check if lable exsit in map
-        if (dataByLabel.find(label) == dataByLabel.end()) {
-            Mat<DataType> d;
-            d.emplace_back(X_train.data[i]);
-            dataByLabel.emplace(std::make_pair(label, d));
-        } else {
-            dataByLabel[label].emplace_back(X_train.data[i]);
-        }
+    dim = n;
+    auto rowClass = encodeLabels(y_train, classes);
+    uint32_t C = classes.size();
+
+    // rows ordered by class (a counting sort), then one column-major copy of the training set
+    // holds every (class, feature) sample as a contiguous range
+    std::vector<uint32_t> firstRow(C + 1, 0);
+    for (auto c : rowClass) ++firstRow[c + 1];
+    priors.assign(C, 0.0);
+    for (uint32_t c = 0; c < C; ++c) {
+        priors[c] = static_cast<double>(firstRow[c + 1]) / m;  // prior probabilities, P(y)
+        firstRow[c + 1] += firstRow[c];
     }
+    std::vector<uint32_t> order(m), next(firstRow.begin(), firstRow.end() - 1);
+    for (uint32_t i = 0; i < m; ++i) order[next[rowClass[i]]++] = i;
+    auto cols = columnMajor(X_train.data, order);
 
     // calculate gaussian params which will be used to calculate P(X|y)
-    for (const auto &label_data : dataByLabel) {
-        auto param = summarize(label_data.second);
-        model.emplace(std::make_pair(label_data.first, param));
-    }
+    gaussians.clear();
+    gaussians.reserve(static_cast<std::size_t>(C) * n);
+    for (uint32_t c = 0; c < C; ++c) summarize(cols, firstRow[c], firstRow[c + 1]);
+    compileGaussian();
 
     printf("INFO: traning done\n");
     describe();
@@ -122,9 +186,62 @@ bool NaiveBayes<DataType, LabelType>::train_gaussian(const Data<DataType> &X_tra
 template <typename DataType, typename LabelType>
 bool NaiveBayes<DataType, LabelType>::train_bernoulli(const Data<DataType> &X_train,
                                                       const Data<LabelType> &y_train) {
-    Clock clk(__func__);
-    // TODO
-    return false;
+    STAT_PROFILE_SCOPE(__func__);
+
+    auto m = X_train.m, n = X_train.n;
+    if (m == 0 || n == 0) {
+        printf("ERROR: invalid training set\n");
+        return false;
+    }
+    dim = n;
+    auto rowClass = encodeLabels(y_train, classes);
+
+    // rows and ones per (class, feature)
+    uint32_t C = classes.size();
+    Vec<uint32_t> rows(C);
+    std::vector<uint32_t> ones(static_cast<std::size_t>(C) * n);
+    for (uint32_t i = 0; i < m; ++i) {
+        auto c = rowClass[i];
+        ++rows[c];
+        auto counts = ones.data() + static_cast<std::size_t>(c) * n;
+        const auto &x = X_train.data[i];
+        for (uint32_t j = 0; j < n; ++j) counts[j] += x[j] > bernoulli.threshold;
+    }
+
+    base.assign(C, 0.0);
+    std::vector<double> weights(ones.size());
+    double lo = Inf<double>, hi = -Inf<double>;
+    for (uint32_t c = 0; c < C; ++c) {
+        base[c] = std::log(static_cast<double>(rows[c]) / m);
+        for (uint32_t j = 0; j < n; ++j) {
+            auto k = static_cast<std::size_t>(c) * n + j;
+            double p = (ones[k] + laplace) / (rows[c] + 2.0 * laplace);
+            base[c] += std::log(1.0 - p);
+            weights[k] = std::log(p) - std::log(1.0 - p);
+            lo = std::min(lo, weights[k]);
+            hi = std::max(hi, weights[k]);
+        }
+    }
+
+    // quantize and scatter the weight bits into the planes
+    constexpr double steps = (1u << kWeightBits) - 1;
+    bernoulli.scale = hi > lo ? (hi - lo) / steps : 1.0;
+    auto words = bitWords(n);
+    planes.assign(static_cast<std::size_t>(C) * words * kWeightBits, 0);
+    for (uint32_t c = 0; c < C; ++c) {
+        for (uint32_t j = 0; j < n; ++j) {
+            auto q = static_cast<uint32_t>(
+                std::lround((weights[static_cast<std::size_t>(c) * n + j] - lo) / bernoulli.scale));
+            auto plane = planes.data() + (c * words + j / 64) * kWeightBits;
+            for (uint32_t b = 0; b < kWeightBits; ++b) {
+                plane[b] |= static_cast<uint64_t>((q >> b) & 1) << (j % 64);
+            }
+        }
+    }
+
+    printf("INFO: traning done\n");
+    describe();
+    return true;
 }
 
 template <typename DataType, typename LabelType>
@@ -139,23 +256,26 @@ LabelType NaiveBayes<DataType, LabelType>::predict(const Vec<DataType> &X) {
 
 template <typename DataType, typename LabelType>
 LabelType NaiveBayes<DataType, LabelType>::predict_gaussian(const Vec<DataType> &X) {
-    std::unordered_map<LabelType, double> probabilities;
-    for (const auto &m : model) {
-        probabilities[m.first] = std::log(priorprobabilities[m.first]);
-        for (auto i = 0; i < X.size(); ++i) {
-            auto param = m.second[i];
-            // calculate P(X|y), the original form is multiplication (P(X1|y)*P(X2|y)...P(Xn|y)),
-            // but prob may be very small >> 0. valeu by be 0 after multiplication (precision
-            // issue), hence, change form to sum of log value. log(AB) = log(A) + log(B)
-            probabilities[m.first] += std::log(gaussian_prob(X[i], param.mu, param.sigma));
-        }
+    if (X.size() != dim || classes.empty()) {
+        printf("ERROR: model is not trained or input dimension mismatch\n");
+        return 0;
     }
     double maxProb = -Inf<double>;
     LabelType predicted = 0;
-    for (const auto &prob : probabilities) {
-        if (prob.second > maxProb) {
-            maxProb = prob.second;
-            predicted = prob.first;
+    for (std::size_t c = 0; c < classes.size(); ++c) {
+        // P(X|y) is the product P(X1|y)*P(X2|y)...P(Xn|y), which underflows to 0, hence the sum
+        // of the logs. log(AB) = log(A) + log(B)
+        auto param = gaussians.data() + c * dim;
+        auto inv = invSigma.data() + c * dim;
+        double sum = 0.0;
+        for (uint32_t j = 0; j < dim; ++j) {
+            double z = (X[j] - param[j].mu) * inv[j];
+            sum += z * z;
+        }
+        double prob = logNorm[c] - 0.5 * sum;
+        if (prob > maxProb) {
+            maxProb = prob;
+            predicted = classes[c];
         }
     }
     return predicted;
@@ -163,14 +283,40 @@ LabelType NaiveBayes<DataType, LabelType>::predict_gaussian(const Vec<DataType>
 
 template <typename DataType, typename LabelType>
 LabelType NaiveBayes<DataType, LabelType>::predict_bernoulli(const Vec<DataType> &X) {
-    // TODO
-    return 0;
+    if (X.size() != dim || classes.empty()) {
+        printf("ERROR: model is not trained or input dimension mismatch\n");
+        return 0;
+    }
+    auto words = bitWords(dim);
+    thread_local std::vector<uint64_t> bits;
+    bits.resize(words);
+    packBits(X.data(), dim, bernoulli.threshold, bits.data());
+
+    double maxScore = -Inf<double>;
+    LabelType predicted = 0;
+    for (std::size_t c = 0; c < classes.size(); ++c) {
+        uint32_t counts[kWeightBits] = {0};
+        auto plane = planes.data() + c * words * kWeightBits;
+        for (std::size_t w = 0; w < words; ++w, plane += kWeightBits) {
+            auto x = bits[w];
+            if (x == 0) continue;
+            for (uint32_t b = 0; b < kWeightBits; ++b) counts[b] += popcount(x & plane[b]);
+        }
+        uint64_t q = 0;
+        for (uint32_t b = 0; b < kWeightBits; ++b) q += static_cast<uint64_t>(counts[b]) << b;
+        double score = base[c] + bernoulli.scale * q;
+        if (score > maxScore) {
+            maxScore = score;
+            predicted = classes[c];
+        }
+    }
+    return predicted;
 }
 
 template <typename DataType, typename LabelType>
 double NaiveBayes<DataType, LabelType>::validate(const Data<DataType> &X_test,
                                                  const Data<LabelType> &y_test) {
-    Clock clk(__func__);
+    STAT_PROFILE_SCOPE(__func__);
 
     double correct = 0.0;
     auto m = X_test.m;
@@ -184,34 +330,149 @@ double NaiveBayes<DataType, LabelType>::validate(const Data<DataType> &X_test,
 
 template <typename DataType, typename LabelType>
 void NaiveBayes<DataType, LabelType>::describe() const {
-    return;
     if (!isModelShow) return;
     if (type == NBType::GAUSSIAN) {
         printf("Naive Bayes with Gaussian model\n");
-        for (const auto &m : model) {
-            printf("Label: %f\n\t{\n", m.first);
-            for (const auto &param : m.second) {
+        for (std::size_t c = 0; c < classes.size(); ++c) {
+            printf("Label: %f\n\t{\n", static_cast<double>(classes[c]));
+            for (uint32_t j = 0; j < dim; ++j) {
+                const auto &param = gaussians[c * dim + j];
                 printf("\t\tmean: %f, std: %f,\n", param.mu, param.sigma);
             }
             printf("\t\n");
         }
     } else if (type == NBType::BERNOULLI) {
-        // TODO
+        printf("Naive Bayes with Bernoulli model, threshold: %f, weight step: %f\n",
+               bernoulli.threshold, bernoulli.scale);
+        for (std::size_t c = 0; c < classes.size(); ++c) {
+            printf("Label: %f, base log probability: %f\n", static_cast<double>(classes[c]),
+                   base[c]);
+        }
     }
 }
 
 template <typename DataType, typename LabelType>
-std::vector<typename NaiveBayes<DataType, LabelType>::GaussianParam>
-NaiveBayes<DataType, LabelType>::summarize(const Mat<DataType> &data) {
-    std::vector<GaussianParam> param;
-    for (auto i = 0; i < data[0].size(); ++i) {
-        auto x = getCol(data, i);
+uint32_t NaiveBayes<DataType, LabelType>::inputDim() const {
+    return dim;
+}
+
+template <typename DataType, typename LabelType>
+memory::Usage NaiveBayes<DataType, LabelType>::memoryUsage() const {
+    memory::Usage u;
+    u.add("gaussian parameters", memory::heapBytes(gaussians) + memory::heapBytes(invSigma) +
+                                     memory::heapBytes(logNorm));
+    u.add("priors", memory::heapBytes(priors));
+    u.add("classes", memory::heapBytes(classes));
+    u.add("bernoulli base", memory::heapBytes(base));
+    u.add("bit planes", memory::heapBytes(planes));
+    return u;
+}
+
+template <typename DataType, typename LabelType>
+void NaiveBayes<DataType, LabelType>::summarize(const ColMajor<DataType> &cols, uint32_t first,
+                                                uint32_t last) {
+    for (uint32_t j = 0; j < cols.n; ++j) {
+        auto x = cols.col(j) + first;
         // smoothing is added to avoid sigma/variance being 0. denominator in calculating gaussian
         // probability
-        GaussianParam p{mean(x), stdev(x) + smoothing};
-        param.emplace_back(p);
+        auto s = summary(x, last - first);
+        gaussians.push_back({s.mean, s.stdev() + smoothing});
     }
-    return param;
+}
+
+template <typename DataType, typename LabelType>
+void NaiveBayes<DataType, LabelType>::compileGaussian() {
+    logNorm.assign(classes.size(), 0.0);
+    invSigma.resize(gaussians.size());
+    for (std::size_t c = 0; c < classes.size(); ++c) {
+        logNorm[c] = std::log(priors[c]) - 0.5 * dim * std::log(2 * pi);
+        for (uint32_t j = 0; j < dim; ++j) {
+            auto k = c * dim + j;
+            logNorm[c] -= std::log(gaussians[k].sigma);
+            invSigma[k] = 1.0 / gaussians[k].sigma;
+        }
+    }
+}
+
+template <typename DataType, typename LabelType>
+bool NaiveBayes<DataType, LabelType>::save(const char *filename) const {
+    if (type == NBType::BERNOULLI) {
+        if (classes.empty()) {
+            printf("ERROR: model is not trained yet\n");
+            return false;
+        }
+        serialize::Writer writer(filename);
+        writer.writeHeader(MODEL_NAIVE_BAYES, serialize::typeTag<DataType>(),
+                           serialize::typeTag<LabelType>());
+        writer.write(FileHeader{type, static_cast<uint32_t>(classes.size()), dim, 0});
+        writer.writeArray(classes.data(), classes.size());
+        writer.writeArray(base.data(), base.size());
+        writer.write(bernoulli);
+        writer.writeArray(planes.data(), planes.size());
+        return writer.good();
+    }
+    if (classes.empty()) {
+        printf("ERROR: model is not trained yet\n");
+        return false;
+    }
+    serialize::Writer writer(filename);
+    writer.writeHeader(MODEL_NAIVE_BAYES, serialize::typeTag<DataType>(),
+                       serialize::typeTag<LabelType>());
+    writer.write(FileHeader{type, static_cast<uint32_t>(classes.size()), dim, 0});
+    writer.writeArray(classes.data(), classes.size());
+    writer.writeArray(priors.data(), priors.size());
+    writer.writeArray(gaussians.data(), gaussians.size());
+    return writer.good();
+}
+
+template <typename DataType, typename LabelType>
+bool NaiveBayes<DataType, LabelType>::load(const char *filename) {
+    serialize::MappedFile file(filename);
+    serialize::Reader reader(file);
+    if (!reader.readHeader(MODEL_NAIVE_BAYES, serialize::typeTag<DataType>(),
+                           serialize::typeTag<LabelType>())) {
+        return false;
+    }
+    FileHeader header;
+    if (!reader.read(header) || header.type > NBType::BERNOULLI) {
+        printf("ERROR: corrupted naive bayes model file (%s)\n", filename);
+        return false;
+    }
+    if (header.type == NBType::BERNOULLI) {
+        auto labels = reader.view<LabelType>(header.classes);
+        auto priors = reader.view<double>(header.classes);
+        BernoulliParam param;
+        bool ok = labels && priors && reader.read(param);
+        auto count = static_cast<std::size_t>(header.classes) * bitWords(header.dim) * kWeightBits;
+        auto bits = ok ? reader.view<uint64_t>(count) : nullptr;
+        if (!bits) {
+            printf("ERROR: corrupted naive bayes model file (%s)\n", filename);
+            return false;
+        }
+        type = NBType::BERNOULLI;
+        bernoulli = param;
+        dim = header.dim;
+        classes.assign(labels, labels + header.classes);
+        base.assign(priors, priors + header.classes);
+        planes.assign(bits, bits + count);
+        describe();
+        return true;
+    }
+    auto labels = reader.view<LabelType>(header.classes);
+    auto priors = reader.view<double>(header.classes);
+    auto params = reader.view<GaussianParam>(static_cast<std::size_t>(header.classes) * header.dim);
+    if (!labels || !priors || !params) {
+        printf("ERROR: corrupted naive bayes model file (%s)\n", filename);
+        return false;
+    }
+    type = static_cast<NBType>(header.type);
+    dim = header.dim;
+    classes.assign(labels, labels + header.classes);
+    this->priors.assign(priors, priors + header.classes);
+    gaussians.assign(params, params + static_cast<std::size_t>(header.classes) * header.dim);
+    compileGaussian();
+    describe();
+    return true;
 }
 
 }  // namespace stat
@@ -0,0 +1,160 @@
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace stat {
+namespace numa {
+
+// a memory node and the cpus attached to it
+struct Node {
+    uint32_t id;
+    std::vector<uint32_t> cpus;
+};
+
+// "0-3,8,10-11" (the format of the sysfs cpulist and online files)
+inline std::vector<uint32_t> parseList(const std::string &list) {
+    std::vector<uint32_t> out;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || range == "\n") continue;
+        auto dash = range.find('-');
+        try {
+            uint32_t lo = std::stoul(range.substr(0, dash));
+            uint32_t hi = dash == std::string::npos ? lo : std::stoul(range.substr(dash + 1));
+            for (auto c = lo; c <= hi; ++c) out.emplace_back(c);
+        } catch (...) {
+            return {};
+        }
+    }
+    return out;
+}
+
+inline std::string readLine(const std::string &path) {
+    std::ifstream fin(path);
+    std::string line;
+    std::getline(fin, line);
+    return line;
+}
+
+/**
+ * nodes that have cpus, from /sys/devices/system/node. a machine without that file (not Linux, a
+ * container hiding it) is one node with no cpu list, its threads are left unpinned
+ */
+inline const std::vector<Node> &nodes() {
+    static const std::vector<Node> topology = [] {
+        std::vector<Node> found;
+        const std::string root = "/sys/devices/system/node/";
+        for (auto id : parseList(readLine(root + "online"))) {
+            auto cpus = parseList(readLine(root + "node" + std::to_string(id) + "/cpulist"));
+            if (!cpus.empty()) found.push_back({id, std::move(cpus)});
+        }
+        if (found.empty()) found.push_back({0, {}});
+        return found;
+    }();
+    return topology;
+}
+
+// binds the calling thread to `cpus`, false when it can not (an empty list does nothing)
+inline bool pinCurrentThread(const std::vector<uint32_t> &cpus) {
+    if (cpus.empty()) return false;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto c : cpus) {
+        if (c < CPU_SETSIZE) CPU_SET(c, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof set, &set) == 0;
+#else
+    return false;
+#endif
+}
+
+/**
+ * One long-lived thread per shard, each pinned to the cpus of its node. `run(fn)` calls fn(shard)
+ * on the thread of every shard and returns once all are done, so whatever a shard allocates and
+ * writes first from fn is placed on its node by the first-touch policy of the kernel, and later
+ * runs read it locally. Runs are serialized, the caller only waits.
+ */
+class ShardWorkers {
+public:
+    // cpus[s] is the cpu set of shard s, empty leaves that thread unpinned
+    explicit ShardWorkers(const std::vector<std::vector<uint32_t>> &cpus) {
+        for (uint32_t s = 0; s < cpus.size(); ++s) {
+            workers.emplace_back([this, s, set = cpus[s]] {
+                pinCurrentThread(set);
+                uint64_t seen = 0;
+                while (true) {
+                    std::unique_lock<std::mutex> lk(lock);
+                    wakeup.wait(lk, [&] { return stopping || seen != generation; });
+                    if (stopping) return;
+                    seen = generation;
+                    auto fn = job;
+                    lk.unlock();
+                    (*fn)(s);
+                    lk.lock();
+                    if (--pending == 0) finished.notify_one();
+                }
+            });
+        }
+    }
+
+    ~ShardWorkers() {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (auto &w : workers) w.join();
+    }
+
+    ShardWorkers(const ShardWorkers &) = delete;
+    ShardWorkers &operator=(const ShardWorkers &) = delete;
+
+    uint32_t size() const { return workers.size(); }
+
+    template <typename Fn>
+    void run(Fn &&fn) {
+        if (workers.empty()) return;
+        std::lock_guard<std::mutex> guard(runLock);
+        std::function<void(uint32_t)> wrapped(std::ref(fn));
+        std::unique_lock<std::mutex> lk(lock);
+        job = &wrapped;
+        pending = workers.size();
+        ++generation;
+        wakeup.notify_all();
+        finished.wait(lk, [this] { return pending == 0; });
+        job = nullptr;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex runLock;  // one run at a time
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::condition_variable finished;
+    const std::function<void(uint32_t)> *job = nullptr;
+    uint32_t pending = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
+
+}  // namespace numa
+}  // namespace stat
+
+#endif  // __NUMA_H__
@@ -0,0 +1,130 @@
+#ifndef __OPTIMIZE_H__
+#define __OPTIMIZE_H__
+
+#include "Math.h"
+#include "Types.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace stat {
+namespace optimize {
+
+struct LbfgsParam {
+    uint32_t history = 10;         // (s, y) pairs kept for the inverse hessian estimate
+    uint32_t maxIterations = 100;
+    uint32_t maxLineSearch = 20;   // function evaluations per line search
+    double tolerance = 1e-5;       // on |g| / max(1, |x|)
+    double minDecrease = 1e-10;    // relative decrease of f to go on with
+};
+
+struct LbfgsResult {
+    uint32_t iterations = 0;
+    uint32_t evaluations = 0;
+    double loss = 0.0;
+    bool converged = false;
+};
+
+/**
+ * Limited memory BFGS, minimizes a smooth f over x in place.
+ *
+ * `fg(x, grad)` returns f(x) and writes its gradient into grad. The search direction comes from
+ * the two-loop recursion over the last `history` (s, y) pairs, the step from a backtracking line
+ * search on the Armijo condition. Pairs with s.y <= 0 are skipped, they would break the positive
+ * definiteness of the estimate.
+ */
+template <typename Fn>
+LbfgsResult lbfgs(Vec<double> &x, Fn &&fg, const LbfgsParam &param = {}) {
+    constexpr double kArmijo = 1e-4;
+    auto n = x.size();
+    LbfgsResult result;
+    Vec<double> g(n), xNext(n), gNext(n), d(n);
+    std::vector<Vec<double>> S, Y;
+    std::vector<double> rho;
+    Vec<double> alpha(param.history);
+
+    double f = fg(x, g);
+    ++result.evaluations;
+    for (; result.iterations < param.maxIterations; ++result.iterations) {
+        double gnorm = std::sqrt(dot(g, g)), xnorm = std::sqrt(dot(x, x));
+        if (gnorm <= param.tolerance * std::max(1.0, xnorm)) {
+            result.converged = true;
+            break;
+        }
+
+        // d = -H g, two-loop recursion, newest pair last
+        for (std::size_t i = 0; i < n; ++i) d[i] = -g[i];
+        for (auto i = S.size(); i-- > 0;) {
+            alpha[i] = rho[i] * dot(S[i], d);
+            axpy(-alpha[i], Y[i].data(), d.data(), n);
+        }
+        if (!S.empty()) {
+            double gamma = dot(S.back(), Y.back()) / dot(Y.back(), Y.back());
+            for (auto &v : d) v *= gamma;
+        }
+        for (std::size_t i = 0; i < S.size(); ++i) {
+            double beta = rho[i] * dot(Y[i], d);
+            axpy(alpha[i] - beta, S[i].data(), d.data(), n);
+        }
+        double dg = dot(d, g);
+        if (dg >= 0.0) {
+            // not a descent direction, restart from steepest descent
+            S.clear();
+            Y.clear();
+            rho.clear();
+            for (std::size_t i = 0; i < n; ++i) d[i] = -g[i];
+            dg = -gnorm * gnorm;
+        }
+
+        // the first step has no curvature information, keep it at unit length
+        double step = S.empty() ? 1.0 / std::max(1.0, std::sqrt(dot(d, d))) : 1.0;
+        double fNext = f;
+        bool accepted = false;
+        for (uint32_t ls = 0; ls < param.maxLineSearch; ++ls, step *= 0.5) {
+            for (std::size_t i = 0; i < n; ++i) xNext[i] = x[i] + step * d[i];
+            fNext = fg(xNext, gNext);
+            ++result.evaluations;
+            if (std::isfinite(fNext) && fNext <= f + kArmijo * step * dg) {
+                accepted = true;
+                break;
+            }
+        }
+        if (!accepted) break;
+
+        if (S.size() == param.history) {
+            S.erase(S.begin());
+            Y.erase(Y.begin());
+            rho.erase(rho.begin());
+        }
+        Vec<double> s(n), y(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            s[i] = xNext[i] - x[i];
+            y[i] = gNext[i] - g[i];
+        }
+        double sy = dot(s, y);
+        if (sy > 1e-10) {
+            S.emplace_back(std::move(s));
+            Y.emplace_back(std::move(y));
+            rho.emplace_back(1.0 / sy);
+        }
+
+        double decrease = (f - fNext) / std::max({std::abs(f), std::abs(fNext), 1.0});
+        x.swap(xNext);
+        g.swap(gNext);
+        f = fNext;
+        if (decrease < param.minDecrease) {
+            result.converged = true;
+            ++result.iterations;
+            break;
+        }
+    }
+    result.loss = f;
+    return result;
+}
+
+}  // namespace optimize
+}  // namespace stat
+
+#endif  // __OPTIMIZE_H__
@@ -0,0 +1,175 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace stat {
+namespace parallel {
+
+/**
+ * Process wide pool of worker threads.
+ *
+ * `run(tasks, fn)` calls fn(task) for every task in [0, tasks), the caller thread takes part in
+ * the work and returns once all tasks are done. Nested calls (from inside a task) run serially
+ * on the calling thread. The pool size counts the caller, hence a pool of size 1 has no worker
+ * and everything runs inline. Default size is env `STAT_NUM_THREADS` or the hardware concurrency.
+ */
+class ThreadPool {
+public:
+    static ThreadPool &instance() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    ~ThreadPool() { stop(); }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    uint32_t size() const { return workers.size() + 1; }
+
+    void resize(uint32_t n) {
+        std::lock_guard<std::mutex> guard(runLock);
+        n = std::max<uint32_t>(n, 1);
+        if (n == size()) return;
+        stop();
+        start(n - 1);
+    }
+
+    template <typename Fn>
+    void run(uint32_t tasks, Fn &&fn) {
+        if (tasks == 0) return;
+        if (tasks == 1 || workers.empty() || inWorker()) {
+            for (uint32_t t = 0; t < tasks; ++t) fn(t);
+            return;
+        }
+        std::lock_guard<std::mutex> guard(runLock);
+        Job job(tasks, std::function<void(uint32_t)>(std::ref(fn)));
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            current = &job;
+            ++generation;
+        }
+        wakeup.notify_all();
+        inWorker() = true;
+        job.drain();
+        inWorker() = false;
+        // all tasks are claimed, unpublish the job and wait for workers still running one
+        std::unique_lock<std::mutex> lk(lock);
+        current = nullptr;
+        finished.wait(lk, [&job] { return job.active == 0; });
+    }
+
+private:
+    struct Job {
+        uint32_t tasks;
+        std::function<void(uint32_t)> fn;
+        std::atomic<uint32_t> next{0};
+        uint32_t active = 0;  // workers attached to this job, guarded by ThreadPool::lock
+
+        Job(uint32_t _tasks, std::function<void(uint32_t)> _fn)
+            : tasks(_tasks), fn(std::move(_fn)) {}
+
+        void drain() {
+            for (auto t = next.fetch_add(1); t < tasks; t = next.fetch_add(1)) fn(t);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex runLock;  // one job at a time
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::condition_variable finished;
+    Job *current = nullptr;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    ThreadPool() {
+        uint32_t n = std::thread::hardware_concurrency();
+        if (auto env = std::getenv("STAT_NUM_THREADS")) n = std::atoi(env);
+        start(std::max<uint32_t>(n, 1) - 1);
+    }
+
+    static bool &inWorker() {
+        thread_local bool flag = false;
+        return flag;
+    }
+
+    void start(uint32_t n) {
+        stopping = false;
+        for (uint32_t i = 0; i < n; ++i) {
+            workers.emplace_back([this] {
+                inWorker() = true;
+                uint64_t seen = 0;
+                while (true) {
+                    std::unique_lock<std::mutex> lk(lock);
+                    wakeup.wait(lk, [&] { return stopping || (current && seen != generation); });
+                    if (stopping) return;
+                    seen = generation;
+                    auto job = current;
+                    ++job->active;
+                    lk.unlock();
+                    job->drain();
+                    lk.lock();
+                    if (--job->active == 0) finished.notify_all();
+                }
+            });
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (auto &w : workers) w.join();
+        workers.clear();
+    }
+};
+
+inline uint32_t threads() { return ThreadPool::instance().size(); }
+
+inline void setThreads(uint32_t n) { ThreadPool::instance().resize(n); }
+
+// pool size of a scope, the previous size is restored when it ends
+class ScopedThreads {
+public:
+    explicit ScopedThreads(uint32_t n) : previous(threads()) { setThreads(n); }
+    ~ScopedThreads() { setThreads(previous); }
+    ScopedThreads(const ScopedThreads &) = delete;
+    ScopedThreads &operator=(const ScopedThreads &) = delete;
+
+private:
+    uint32_t previous;
+};
+
+template <typename Fn>
+void run(uint32_t tasks, Fn &&fn) {
+    ThreadPool::instance().run(tasks, std::forward<Fn>(fn));
+}
+
+// fn(lo, hi) over chunks of at most `grain` indices of [begin, end)
+template <typename Fn>
+void parallelFor(std::size_t begin, std::size_t end, std::size_t grain, Fn &&fn) {
+    if (begin >= end) return;
+    grain = std::max<std::size_t>(grain, 1);
+    auto chunks = (end - begin + grain - 1) / grain;
+    run(static_cast<uint32_t>(chunks), [&](uint32_t c) {
+        auto lo = begin + c * grain;
+        fn(lo, std::min(end, lo + grain));
+    });
+}
+
+}  // namespace parallel
+}  // namespace stat
+
+#endif  // __PARALLEL_H__
@@ -6,6 +6,25 @@
 
 namespace stat {
 
+struct PerceptronParam {
+    enum Form : uint32_t {
+        ORIGINAL,
+        DUAL,
+    };
+
+    Form form = ORIGINAL;
+    bool show = false;  // print the model after training
+
+    // {"model_type", "original" | "dual"}, {"model_show", "true"}
+    static PerceptronParam parse(const ModelParam &param) {
+        PerceptronParam p;
+        ParamReader(param, "Perceptron")
+            .choice("model_type", p.form, {{"original", ORIGINAL}, {"dual", DUAL}})
+            .flag("model_show", p.show);
+        return p;
+    }
+};
+
 /**
  * Perceptron Model
  *
@@ -30,7 +49,8 @@ namespace stat {
 template <typename DataType, typename LabelType>
 class Perceptron : public Model<DataType, LabelType> {
 public:
-    explicit Perceptron(ModelParam param);
+    explicit Perceptron(const PerceptronParam &param = {});
+    explicit Perceptron(const ModelParam &param) : Perceptron(PerceptronParam::parse(param)) {}
     virtual ~Perceptron() = default;
 
     virtual bool train(const Data<DataType> &X_train, const Data<LabelType> &y_train) final;
@@ -41,12 +61,28 @@ public:
 
     virtual void describe() const final;
 
+    virtual memory::Usage memoryUsage() const final;
+
+    virtual uint32_t inputDim() const final;
+
+    virtual bool save(const char *filename) const final;
+
+    virtual bool load(const char *filename) final;
+
 private:
     enum ModelType : uint32_t {
         ORIGNAL,
         DUAL,
     };
 
+    // fixed size part of the saved model, followed by the weight section
+    struct FileHeader {
+        uint32_t type;
+        uint32_t dim;
+        double bias;
+        double eta;
+    };
+
     uint32_t type;
     bool isModelShow;
     Vec<double> weight;
@@ -56,34 +92,21 @@ private:
     Mat<DataType> gr;
 
     double f0(Vec<DataType> X);
-    double f1(Vec<LabelType> y, Vec<DataType> g);
+    double f1(const Vec<LabelType> &y, const Vec<DataType> &g);
     virtual bool train_original(const Data<DataType> &X_train,
                                 const Data<LabelType> &y_train) final;
     virtual bool train_dual(const Data<DataType> &X_train, const Data<LabelType> &y_train) final;
 };
 
 template <typename DataType, typename LabelType>
-Perceptron<DataType, LabelType>::Perceptron(ModelParam param)
-    : type(ModelType::ORIGNAL),
-      isModelShow(false),
+Perceptron<DataType, LabelType>::Perceptron(const PerceptronParam &param)
+    : type(param.form == PerceptronParam::DUAL ? ModelType::DUAL : ModelType::ORIGNAL),
+      isModelShow(param.show),
       weight({}),
       bias(0.0),
       eta(0.0),
       alpha({}),
-      gr({{}}) {
-    const auto &model_type = param.find("model_type");
-    if (model_type != param.cend()) {
-        if (model_type->second == "original")
-            type = ModelType::ORIGNAL;
-        else if (model_type->second == "dual")
-            type = ModelType::DUAL;
-    }
-
-    const auto &model_show = param.find("model_show");
-    if (model_show != param.cend()) {
-        if (model_show->second == "true") { isModelShow = true; }
-    }
-}
+      gr({{}}) {}
 
 template <typename DataType, typename LabelType>
 LabelType Perceptron<DataType, LabelType>::predict(const Vec<DataType> &X) {
@@ -93,7 +116,7 @@ LabelType Perceptron<DataType, LabelType>::predict(const Vec<DataType> &X) {
 template <typename DataType, typename LabelType>
 double Perceptron<DataType, LabelType>::validate(const Data<DataType> &X_test,
                                                  const Data<LabelType> &y_test) {
-    Clock clk(__func__);
+    STAT_PROFILE_SCOPE(__func__);
 
     double correct = 0.0;
     auto m = X_test.m;
@@ -111,7 +134,7 @@ double Perceptron<DataType, LabelType>::f0(Vec<DataType> X) {
 }
 
 template <typename DataType, typename LabelType>
-double Perceptron<DataType, LabelType>::f1(Vec<LabelType> y, Vec<DataType> g) {
+double Perceptron<DataType, LabelType>::f1(const Vec<LabelType> &y, const Vec<DataType> &g) {
     double sum = 0.0;
     for (auto i = 0; i < y.size(); ++i) { sum += alpha[i] * y[i] * g[i]; }
     sum += bias;
@@ -131,7 +154,7 @@ bool Perceptron<DataType, LabelType>::train(const Data<DataType> &X_train,
 template <typename DataType, typename LabelType>
 bool Perceptron<DataType, LabelType>::train_original(const Data<DataType> &X_train,
                                                      const Data<LabelType> &y_train) {
-    Clock clk(__func__);
+    STAT_PROFILE_SCOPE(__func__);
 
     printf("INFO: training original form\n");
     bool hasMisclassified = true;
@@ -163,7 +186,7 @@ bool Perceptron<DataType, LabelType>::train_original(const Data<DataType> &X_tra
 template <typename DataType, typename LabelType>
 bool Perceptron<DataType, LabelType>::train_dual(const Data<DataType> &X_train,
                                                  const Data<LabelType> &y_train) {
-    Clock clk(__func__);
+    STAT_PROFILE_SCOPE(__func__);
 
     printf("INFO: training dual form\n");
     bool hasMisclassified = true;
@@ -180,7 +203,7 @@ bool Perceptron<DataType, LabelType>::train_dual(const Data<DataType> &X_train,
     while (hasMisclassified) {
         int misclassified = 0;
         for (auto i = 0; i < m; ++i) {
-            auto g = getCol(gr, i);  // m dim vector
+            const auto &g = gr[i];  // m dim vector, gram matrix is symmetric, column i == row i
             if (y[i] * f1(y, g) <= 0) {
                 alpha[i] += eta;
                 bias += y[i] * eta;
@@ -206,6 +229,56 @@ void Perceptron<DataType, LabelType>::describe() const {
     printf("       b = %f\n\n", bias);
 }
 
+template <typename DataType, typename LabelType>
+uint32_t Perceptron<DataType, LabelType>::inputDim() const {
+    return static_cast<uint32_t>(weight.size());
+}
+
+template <typename DataType, typename LabelType>
+memory::Usage Perceptron<DataType, LabelType>::memoryUsage() const {
+    memory::Usage u;
+    u.add("weights", memory::heapBytes(weight));
+    u.add("dual alphas", memory::heapBytes(alpha));
+    u.add("gram matrix", memory::heapBytes(gr));
+    return u;
+}
+
+template <typename DataType, typename LabelType>
+bool Perceptron<DataType, LabelType>::save(const char *filename) const {
+    if (weight.empty()) {
+        printf("ERROR: model is not trained yet\n");
+        return false;
+    }
+    serialize::Writer writer(filename);
+    writer.writeHeader(MODEL_PERCEPTRON, serialize::typeTag<DataType>(),
+                       serialize::typeTag<LabelType>());
+    writer.write(FileHeader{type, static_cast<uint32_t>(weight.size()), bias, eta});
+    writer.writeVec(weight);
+    return writer.good();
+}
+
+template <typename DataType, typename LabelType>
+bool Perceptron<DataType, LabelType>::load(const char *filename) {
+    serialize::MappedFile file(filename);
+    serialize::Reader reader(file);
+    if (!reader.readHeader(MODEL_PERCEPTRON, serialize::typeTag<DataType>(),
+                           serialize::typeTag<LabelType>())) {
+        return false;
+    }
+    FileHeader header;
+    Vec<double> w;
+    if (!reader.read(header) || !reader.readVec(w) || w.size() != header.dim) {
+        printf("ERROR: corrupted perceptron model file (%s)\n", filename);
+        return false;
+    }
+    type = header.type;
+    bias = header.bias;
+    eta = header.eta;
+    weight = std::move(w);
+    describe();
+    return true;
+}
+
 }  // namespace stat
 
 #endif  // __PERCEPTRON_H__
\ No newline at end of file
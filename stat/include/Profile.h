@@ -0,0 +1,284 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// build with -DSTAT_PROFILING=0 to compile every instrumentation point out
+#ifndef STAT_PROFILING
+#define STAT_PROFILING 1
+#endif
+
+namespace stat {
+namespace profile {
+
+/**
+ * Low overhead instrumentation
+ *
+ * Scoped timers record (name, start, duration) events with nanosecond resolution into a per-thread
+ * ring buffer, counters are per-thread as well, hence recording never takes a lock. Recording is
+ * off by default and switched at runtime by `setEnabled()` (or env `STAT_PROFILE=1`). Results are
+ * exported as a JSON summary or as a Chrome trace (chrome://tracing, https://ui.perfetto.dev).
+ *
+ * Export reads the buffers of all threads, call it when worker threads are idle.
+ */
+
+enum Counter : uint32_t {
+    DISTANCE_EVALS,   // distance computations between two points
+    NODES_VISITED,    // tree nodes visited during search
+    PRUNED_SUBTREES,  // subtrees skipped by a bound
+    ALLOCATIONS,      // buffers allocated by library helpers
+    DIMS_TOUCHED,     // dimensions summed by early-abandoning distances
+    DIMS_SCANNED,     // dimensions a full scan would have summed, DIMS_TOUCHED / DIMS_SCANNED
+    COUNTER_END,
+};
+
+constexpr const char *kCounterNames[COUNTER_END] = {
+    "distance_evals",
+    "nodes_visited",
+    "pruned_subtrees",
+    "allocations",
+    "dims_touched",
+    "dims_scanned",
+};
+
+// events kept per thread, the oldest ones are overwritten once the ring is full
+constexpr std::size_t kRingSize = 1 << 14;
+
+struct Event {
+    const char *name;  // must have static storage duration, e.g. __func__ or a literal
+    uint64_t start;    // ns since the profiler epoch
+    uint64_t duration;  // ns
+};
+
+struct ThreadBuffer {
+    uint32_t tid;
+    std::atomic<uint64_t> recorded{0};  // events ever recorded, ring index is recorded % kRingSize
+    std::array<Event, kRingSize> events;
+    std::array<std::atomic<uint64_t>, COUNTER_END> counters{};
+};
+
+using SteadyClock = std::chrono::steady_clock;
+
+struct Registry {
+    std::mutex lock;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;  // alive until exit, outlives threads
+    SteadyClock::time_point epoch = SteadyClock::now();
+    std::atomic<bool> enabled{false};
+    std::atomic<bool> verbose{false};
+
+    Registry() {
+        auto on = [](const char *env) {
+            auto v = std::getenv(env);
+            return v && std::strcmp(v, "0") != 0;
+        };
+        enabled = on("STAT_PROFILE");
+        verbose = on("STAT_PROFILE_VERBOSE");
+    }
+};
+
+inline Registry &registry() {
+    static Registry r;
+    return r;
+}
+
+inline ThreadBuffer &local() {
+    thread_local ThreadBuffer *buffer = [] {
+        auto &r = registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+        r.buffers.emplace_back(std::make_unique<ThreadBuffer>());
+        r.buffers.back()->tid = r.buffers.size() - 1;
+        return r.buffers.back().get();
+    }();
+    return *buffer;
+}
+
+inline bool enabled() { return registry().enabled.load(std::memory_order_relaxed); }
+
+inline void setEnabled(bool on) { registry().enabled.store(on, std::memory_order_relaxed); }
+
+// print one line per finished scope, it is the only output of the profiler
+inline void setVerbose(bool on) { registry().verbose.store(on, std::memory_order_relaxed); }
+
+inline uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(SteadyClock::now() -
+                                                                registry().epoch)
+        .count();
+}
+
+inline void record(const char *name, uint64_t start, uint64_t duration) {
+    auto &buffer = local();
+    auto n = buffer.recorded.load(std::memory_order_relaxed);
+    buffer.events[n % kRingSize] = {name, start, duration};
+    buffer.recorded.store(n + 1, std::memory_order_release);
+    if (registry().verbose.load(std::memory_order_relaxed)) {
+        printf("PROFILE: %s %" PRIu64 ".%06" PRIu64 " ms\n", name, duration / 1000000,
+               duration % 1000000);
+    }
+}
+
+inline void count(Counter counter, uint64_t n = 1) {
+    if (!enabled()) return;
+    // only the owner thread writes its counters, no need of an atomic read-modify-write
+    auto &c = local().counters[counter];
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const char *_name) : name(_name), start(enabled() ? now() : kInactive) {}
+
+    ~ScopedTimer() {
+        if (start != kInactive) record(name, start, now() - start);
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    static constexpr uint64_t kInactive = ~0ull;
+    const char *name;
+    uint64_t start;
+};
+
+struct ScopeStat {
+    uint64_t calls = 0;
+    uint64_t total = 0;
+    uint64_t min = ~0ull;
+    uint64_t max = 0;
+};
+
+struct Report {
+    std::array<uint64_t, COUNTER_END> counters{};
+    std::vector<std::pair<uint32_t, Event>> events;  // (tid, event)
+};
+
+inline Report snapshot() {
+    Report report;
+    auto &r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    for (const auto &buffer : r.buffers) {
+        for (uint32_t c = 0; c < COUNTER_END; ++c) {
+            report.counters[c] += buffer->counters[c].load(std::memory_order_relaxed);
+        }
+        auto n = buffer->recorded.load(std::memory_order_acquire);
+        auto first = n > kRingSize ? n - kRingSize : 0;
+        for (auto i = first; i < n; ++i) {
+            report.events.emplace_back(buffer->tid, buffer->events[i % kRingSize]);
+        }
+    }
+    return report;
+}
+
+inline void reset() {
+    auto &r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    for (auto &buffer : r.buffers) {
+        buffer->recorded.store(0, std::memory_order_relaxed);
+        for (auto &c : buffer->counters) c.store(0, std::memory_order_relaxed);
+    }
+}
+
+inline std::string escape(const char *s) {
+    std::string out;
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') out += '\\';
+        out += *s;
+    }
+    return out;
+}
+
+// {"counters": {...}, "scopes": {"name": {"calls", "total_ns", "min_ns", "max_ns"}, ...}}
+inline bool writeJson(const char *filename) {
+    FILE *fp = std::fopen(filename, "w");
+    if (!fp) {
+        printf("ERROR: failed to open (%s) for writing\n", filename);
+        return false;
+    }
+    auto report = snapshot();
+    std::map<std::string, ScopeStat> scopes;
+    for (const auto &e : report.events) {
+        auto &s = scopes[e.second.name];
+        ++s.calls;
+        s.total += e.second.duration;
+        s.min = std::min(s.min, e.second.duration);
+        s.max = std::max(s.max, e.second.duration);
+    }
+    fprintf(fp, "{\n  \"counters\": {");
+    for (uint32_t c = 0; c < COUNTER_END; ++c) {
+        fprintf(fp, "%s\n    \"%s\": %" PRIu64, c ? "," : "", kCounterNames[c], report.counters[c]);
+    }
+    fprintf(fp, "\n  },\n  \"scopes\": {");
+    bool first = true;
+    for (const auto &s : scopes) {
+        fprintf(fp,
+                "%s\n    \"%s\": {\"calls\": %" PRIu64 ", \"total_ns\": %" PRIu64
+                ", \"min_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64 "}",
+                first ? "" : ",", escape(s.first.c_str()).c_str(), s.second.calls, s.second.total,
+                s.second.min, s.second.max);
+        first = false;
+    }
+    fprintf(fp, "\n  }\n}\n");
+    return std::fclose(fp) == 0;
+}
+
+// Chrome trace event format: complete events ("X") per scope, counter totals as one "C" event
+inline bool writeChromeTrace(const char *filename) {
+    FILE *fp = std::fopen(filename, "w");
+    if (!fp) {
+        printf("ERROR: failed to open (%s) for writing\n", filename);
+        return false;
+    }
+    auto report = snapshot();
+    uint64_t end = 0;
+    fprintf(fp, "{\"traceEvents\": [");
+    bool first = true;
+    for (const auto &e : report.events) {
+        fprintf(fp,
+                "%s\n  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, \"ts\": "
+                "%" PRIu64 ".%03" PRIu64 ", \"dur\": %" PRIu64 ".%03" PRIu64 "}",
+                first ? "" : ",", escape(e.second.name).c_str(), e.first, e.second.start / 1000,
+                e.second.start % 1000, e.second.duration / 1000, e.second.duration % 1000);
+        end = std::max(end, e.second.start + e.second.duration);
+        first = false;
+    }
+    fprintf(fp,
+            "%s\n  {\"name\": \"counters\", \"ph\": \"C\", \"pid\": 0, \"tid\": 0, "
+            "\"ts\": %" PRIu64 ", \"args\": {",
+            first ? "" : ",", end / 1000);
+    for (uint32_t c = 0; c < COUNTER_END; ++c) {
+        fprintf(fp, "%s\"%s\": %" PRIu64, c ? ", " : "", kCounterNames[c], report.counters[c]);
+    }
+    fprintf(fp, "}}\n], \"displayTimeUnit\": \"ns\"}\n");
+    return std::fclose(fp) == 0;
+}
+
+}  // namespace profile
+}  // namespace stat
+
+#if STAT_PROFILING
+#define STAT_PROFILE_CONCAT_IMPL(a, b) a##b
+#define STAT_PROFILE_CONCAT(a, b) STAT_PROFILE_CONCAT_IMPL(a, b)
+// time the enclosing scope, `name` must have static storage duration
+#define STAT_PROFILE_SCOPE(name) \
+    ::stat::profile::ScopedTimer STAT_PROFILE_CONCAT(stat_profile_scope_, __LINE__)(name)
+// add n to one of stat::profile::Counter
+#define STAT_PROFILE_COUNT(counter, n) ::stat::profile::count(::stat::profile::counter, n)
+#else
+#define STAT_PROFILE_SCOPE(name) ((void)0)
+#define STAT_PROFILE_COUNT(counter, n) ((void)0)
+#endif
+
+#endif  // __PROFILE_H__
@@ -0,0 +1,271 @@
+#ifndef __QUANTIZATION_H__
+#define __QUANTIZATION_H__
+
+#include "Math.h"
+#include "Memory.h"
+#include "Parallel.h"
+#include "Serialize.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace stat {
+namespace quantization {
+
+struct PqParam {
+    uint32_t subspaces = 0;        // 0 is one per 8 dimensions, 32x smaller than floats
+    uint32_t iterations = 15;      // k-means (Lloyd) iterations per codebook
+    uint32_t samplesPerCode = 40;  // training rows sampled per centroid
+    uint32_t seed = 0;
+};
+
+/**
+ * Product quantizer (Jegou et al. 2011)
+ *
+ * The dimensions are split into M contiguous subspaces and each subspace gets a codebook of
+ * kCodes centroids trained by k-means, so a row is encoded as M bytes, the indices of its nearest
+ * centroid in each subspace. The squared L2 distance of a query to an encoded row is approximated
+ * by a sum of M table lookups (asymmetric distance): `lookupTable()` computes once per query the
+ * M x kCodes distances of the query sub-vectors to every centroid, then `distance()` walks the M
+ * code bytes of a row. A scan over encoded rows reads M bytes per row from one contiguous buffer
+ * and the table (M KB of floats) stays in L1/L2.
+ *
+ * The codebooks are independent: they are trained in parallel over subspaces, on a sample of
+ * samplesPerCode x kCodes rows. Assignment uses |x|^2 - 2 x.c + |c|^2 with the cross terms of a
+ * block of rows from a single matmulNT().
+ */
+class ProductQuantizer {
+public:
+    static constexpr uint32_t kCodes = 256;
+
+    uint32_t dim() const { return n; }
+    uint32_t subspaces() const { return M; }
+
+    memory::Usage memoryUsage() const {
+        memory::Usage u;
+        u.add("centroids", memory::heapBytes(centroids));
+        u.add("offsets", memory::heapBytes(offsets));
+        return u;
+    }
+
+    template <typename T>
+    bool train(const Data<T> &X, PqParam param = {}) {
+        STAT_PROFILE_SCOPE(__func__);
+
+        if (X.m == 0 || X.n == 0) {
+            printf("ERROR: invalid training set\n");
+            return false;
+        }
+        n = X.n;
+        M = std::min(n, param.subspaces ? param.subspaces : (n + 7) / 8);
+        offsets.resize(M + 1);
+        for (uint32_t s = 0; s <= M; ++s) offsets[s] = static_cast<uint32_t>(uint64_t(n) * s / M);
+        centroids.assign(static_cast<std::size_t>(kCodes) * n, 0.0f);
+
+        // one sample shared by every subspace
+        std::mt19937 gen(param.seed);
+        std::vector<uint32_t> sample(X.m);
+        std::iota(sample.begin(), sample.end(), 0u);
+        std::size_t size = std::min<std::size_t>(X.m, std::size_t(param.samplesPerCode) * kCodes);
+        for (std::size_t i = 0; i < size; ++i) {
+            std::swap(sample[i], sample[i + gen() % (X.m - i)]);
+        }
+        sample.resize(size);
+        std::vector<uint32_t> seeds(M);
+        for (auto &v : seeds) v = gen();
+
+        parallel::parallelFor(0, M, 1, [&](std::size_t lo, std::size_t hi) {
+            for (auto s = lo; s < hi; ++s) trainCodebook(X, sample, s, param, seeds[s]);
+        });
+        return true;
+    }
+
+    // M code bytes of a row of dim() values
+    template <typename T>
+    void encode(const T *x, uint8_t *code) const {
+        for (uint32_t s = 0; s < M; ++s) {
+            auto len = offsets[s + 1] - offsets[s];
+            auto book = codebook(s);
+            double best = Inf<double>;
+            uint32_t arg = 0;
+            for (uint32_t c = 0; c < kCodes; ++c) {
+                double d = squared(x + offsets[s], book + c * len, len);
+                if (d < best) {
+                    best = d;
+                    arg = c;
+                }
+            }
+            code[s] = static_cast<uint8_t>(arg);
+        }
+    }
+
+    // codes of every row of X, rows x M bytes, rows in parallel
+    template <typename T>
+    Vec<uint8_t> encode(const Data<T> &X) const {
+        STAT_PROFILE_SCOPE(__func__);
+
+        Vec<uint8_t> codes(static_cast<std::size_t>(X.m) * M);
+        parallel::parallelFor(0, X.m, 64, [&](std::size_t lo, std::size_t hi) {
+            for (auto i = lo; i < hi; ++i) encode(X.data[i].data(), codes.data() + i * M);
+        });
+        return codes;
+    }
+
+    // M x kCodes squared distances of the query sub-vectors to the centroids
+    template <typename T>
+    void lookupTable(const T *query, float *table) const {
+        for (uint32_t s = 0; s < M; ++s) {
+            auto len = offsets[s + 1] - offsets[s];
+            auto book = codebook(s);
+            auto x = query + offsets[s];
+            for (uint32_t c = 0; c < kCodes; ++c) {
+                table[s * kCodes + c] = static_cast<float>(squared(x, book + c * len, len));
+            }
+        }
+    }
+
+    // asymmetric squared distance of the query of `table` to one encoded row
+    float distance(const float *table, const uint8_t *code) const {
+        float lane[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        uint32_t s = 0;
+        for (; s + 4 <= M; s += 4) {
+            for (uint32_t l = 0; l < 4; ++l) lane[l] += table[(s + l) * kCodes + code[s + l]];
+        }
+        for (; s < M; ++s) lane[0] += table[s * kCodes + code[s]];
+        return (lane[0] + lane[1]) + (lane[2] + lane[3]);
+    }
+
+    // the row a code stands for, dim() values
+    void decode(const uint8_t *code, float *x) const {
+        for (uint32_t s = 0; s < M; ++s) {
+            auto len = offsets[s + 1] - offsets[s];
+            std::copy_n(codebook(s) + code[s] * len, len, x + offsets[s]);
+        }
+    }
+
+    // a section of a model file
+    void write(serialize::Writer &writer) const {
+        writer.write(FileHeader{n, M, kCodes, 0});
+        writer.writeArray(offsets.data(), offsets.size());
+        writer.writeArray(centroids.data(), centroids.size());
+    }
+
+    bool read(serialize::Reader &reader) {
+        FileHeader header;
+        if (!reader.read(header) || header.codes != kCodes || header.subspaces == 0 ||
+            header.subspaces > header.dim) {
+            return false;
+        }
+        auto offs = reader.view<uint32_t>(header.subspaces + 1);
+        auto cents = reader.view<float>(static_cast<std::size_t>(kCodes) * header.dim);
+        if (!offs || !cents || offs[0] != 0 || offs[header.subspaces] != header.dim) return false;
+        for (uint32_t s = 0; s < header.subspaces; ++s) {
+            if (offs[s] >= offs[s + 1]) return false;
+        }
+        n = header.dim;
+        M = header.subspaces;
+        offsets.assign(offs, offs + M + 1);
+        centroids.assign(cents, cents + static_cast<std::size_t>(kCodes) * n);
+        return true;
+    }
+
+private:
+    // section header of a saved quantizer
+    struct FileHeader {
+        uint32_t dim;
+        uint32_t subspaces;
+        uint32_t codes;
+        uint32_t reserved;
+    };
+
+    // rows per block of the k-means assignment
+    static constexpr std::size_t kBlockRows = 256;
+
+    uint32_t n = 0;
+    uint32_t M = 0;
+    Vec<uint32_t> offsets;  // M + 1 first dimension of each subspace
+    Vec<float> centroids;   // subspace s: kCodes x len centroids from offsets[s] * kCodes
+
+    const float *codebook(uint32_t s) const {
+        return centroids.data() + static_cast<std::size_t>(offsets[s]) * kCodes;
+    }
+
+    template <typename T1, typename T2>
+    static double squared(const T1 *x, const T2 *y, std::size_t len) {
+        double d = 0.0;
+        for (std::size_t j = 0; j < len; ++j) {
+            double v = static_cast<double>(x[j]) - static_cast<double>(y[j]);
+            d += v * v;
+        }
+        return d;
+    }
+
+    template <typename T>
+    void trainCodebook(const Data<T> &X, const std::vector<uint32_t> &sample, std::size_t s,
+                       const PqParam &param, uint32_t seed) {
+        auto first = offsets[s], len = offsets[s + 1] - first;
+        auto rows = sample.size();
+        Vec<double> points(rows * len);
+        for (std::size_t i = 0; i < rows; ++i) {
+            std::copy_n(X.data[sample[i]].begin() + first, len, points.begin() + i * len);
+        }
+        // initial centroids are distinct sampled rows, repeated when there are fewer rows
+        Vec<double> book(static_cast<std::size_t>(kCodes) * len), bookNorms(kCodes);
+        for (uint32_t c = 0; c < kCodes; ++c) {
+            std::copy_n(points.begin() + (c % rows) * len, len, book.begin() + c * len);
+        }
+        std::mt19937 gen(seed);
+        std::vector<uint32_t> assign(rows);
+        Vec<double> cross(kBlockRows * kCodes), sums(book.size());
+        std::vector<uint32_t> counts(kCodes);
+        for (uint32_t it = 0; it < param.iterations; ++it) {
+            for (uint32_t c = 0; c < kCodes; ++c) {
+                bookNorms[c] = dot(book.data() + c * len, book.data() + c * len, len);
+            }
+            for (std::size_t b = 0; b < rows; b += kBlockRows) {
+                auto count = std::min(kBlockRows, rows - b);
+                matmulNT(points.data() + b * len, book.data(), cross.data(), count, kCodes, len);
+                for (std::size_t i = 0; i < count; ++i) {
+                    auto x = cross.data() + i * kCodes;
+                    double best = Inf<double>;
+                    uint32_t arg = 0;
+                    for (uint32_t c = 0; c < kCodes; ++c) {
+                        double d = bookNorms[c] - 2.0 * x[c];
+                        if (d < best) {
+                            best = d;
+                            arg = c;
+                        }
+                    }
+                    assign[b + i] = arg;
+                }
+            }
+            std::fill(sums.begin(), sums.end(), 0.0);
+            std::fill(counts.begin(), counts.end(), 0u);
+            for (std::size_t i = 0; i < rows; ++i) {
+                axpy(1.0, points.data() + i * len, sums.data() + assign[i] * len, len);
+                ++counts[assign[i]];
+            }
+            for (uint32_t c = 0; c < kCodes; ++c) {
+                auto dst = book.data() + c * len;
+                if (counts[c] > 0) {
+                    for (uint32_t j = 0; j < len; ++j) dst[j] = sums[c * len + j] / counts[c];
+                } else {
+                    // empty cluster, restart from a random row
+                    std::copy_n(points.begin() + (gen() % rows) * len, len, dst);
+                }
+            }
+        }
+        std::copy(book.begin(), book.end(), centroids.begin() + std::size_t(first) * kCodes);
+    }
+};
+
+}  // namespace quantization
+}  // namespace stat
+
+#endif  // __QUANTIZATION_H__
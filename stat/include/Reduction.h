@@ -0,0 +1,344 @@
+#ifndef __REDUCTION_H__
+#define __REDUCTION_H__
+
+#include "Math.h"
+#include "Memory.h"
+#include "Parallel.h"
+#include "Serialize.h"
+#include "Transform.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace stat {
+namespace reduction {
+
+enum Kind : uint32_t {
+    NONE,
+    PCA,        // principal components by randomized SVD
+    SPARSE_JL,  // very sparse Johnson-Lindenstrauss random projection
+};
+
+struct PcaParam {
+    uint32_t oversampling = 10;    // extra random directions beyond the target dimension
+    uint32_t powerIterations = 2;  // subspace iterations, sharpen a slowly decaying spectrum
+    uint32_t seed = 0;
+};
+
+/**
+ * Linear map of n-dim rows to a few dimensions, fitted on a training set and applied to the
+ * training and the query rows alike.
+ *
+ * PCA is the randomized SVD of Halko et al. (2011) on the centered data Xc (m x n): a Gaussian
+ * test matrix of l = dim + oversampling directions gives the range Q of Xc Omega, a few subspace
+ * iterations Q <- orth(Xc orth(Xc^T Q)) refine it, then the small B = Q^T Xc (l x n) holds the top
+ * singular directions: the eigenvectors of B B^T (l x l) lift to the components. Xc is never
+ * formed: the products run over blocks of kBlockRows rows centered on the fly, as tiled matmulNT()
+ * calls, and the blocks are spread over the worker threads. Every product reads X once.
+ *
+ * SPARSE_JL draws a random matrix with entries +-sqrt(s / dim) of density 1 / s, s = sqrt(n) (Li
+ * et al. 2006), which keeps pairwise distances within 1 +- eps with high probability. It needs no
+ * pass over the data, and it is stored by input column: zero inputs, most MNIST pixels, are
+ * skipped when projecting.
+ */
+class Projection {
+public:
+    Kind kind() const { return type; }
+    uint32_t inputDim() const { return in; }
+    uint32_t outputDim() const { return out; }
+
+    // PCA: variance of the data along each component, in decreasing order
+    const Vec<double> &explainedVariance() const { return variance; }
+
+    memory::Usage memoryUsage() const {
+        memory::Usage u;
+        u.add("mean", memory::heapBytes(mean) + memory::heapBytes(bias));
+        u.add("components", memory::heapBytes(components));
+        u.add("variance", memory::heapBytes(variance));
+        u.add("sparse entries", memory::heapBytes(starts) + memory::heapBytes(entries));
+        return u;
+    }
+
+    template <typename T>
+    bool fitPca(const Data<T> &X, uint32_t dim, PcaParam param = {}) {
+        STAT_PROFILE_SCOPE(__func__);
+
+        auto m = X.m, n = X.n;
+        if (m == 0 || n == 0 || dim == 0) {
+            printf("ERROR: invalid training set or target dimension\n");
+            return false;
+        }
+        dim = std::min({dim, n, m});
+        uint32_t l = std::min({dim + param.oversampling, n, m});
+
+        auto stats = columnSummaries(X);
+        mean.resize(n);
+        for (uint32_t j = 0; j < n; ++j) mean[j] = stats[j].mean;
+
+        std::mt19937 gen(param.seed);
+        std::normal_distribution<double> normal(0.0, 1.0);
+        Vec<double> Q(static_cast<std::size_t>(l) * n), YT, B;
+        for (auto &v : Q) v = normal(gen);
+        // range of Xc, as the rows of YT (l x m)
+        rangeProduct(X, Q, l, YT);
+        orthonormalize(YT.data(), l, m);
+        for (uint32_t q = 0; q < param.powerIterations; ++q) {
+            coproduct(X, YT, l, Q);
+            orthonormalize(Q.data(), l, n);
+            rangeProduct(X, Q, l, YT);
+            orthonormalize(YT.data(), l, m);
+        }
+        coproduct(X, YT, l, B);
+
+        // B B^T = U S^2 U^T, the right singular vectors of B are B^T U S^{-1}
+        Vec<double> G(static_cast<std::size_t>(l) * l), values(l), U(static_cast<std::size_t>(l) * l);
+        matmulNT(B.data(), B.data(), G.data(), l, l, n);
+        symmetricEigen(G.data(), l, values.data(), U.data());
+        components.assign(static_cast<std::size_t>(dim) * n, 0.0);
+        variance.assign(dim, 0.0);
+        for (uint32_t i = 0; i < dim; ++i) {
+            if (!(values[i] > 0.0)) continue;
+            auto c = components.data() + static_cast<std::size_t>(i) * n;
+            for (uint32_t r = 0; r < l; ++r) axpy(U[i * l + r], B.data() + r * n, c, n);
+            double s = std::sqrt(values[i]);
+            for (uint32_t j = 0; j < n; ++j) c[j] /= s;
+            variance[i] = values[i] / m;
+        }
+        type = PCA;
+        in = n;
+        out = dim;
+        compile();
+        return true;
+    }
+
+    bool fitSparse(uint32_t inputDim, uint32_t dim, uint32_t seed = 0) {
+        if (inputDim == 0 || dim == 0) {
+            printf("ERROR: invalid input or target dimension\n");
+            return false;
+        }
+        double s = std::max(1.0, std::sqrt(static_cast<double>(inputDim)));
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        starts.assign(1, 0);
+        entries.clear();
+        for (uint32_t j = 0; j < inputDim; ++j) {
+            for (uint32_t k = 0; k < dim; ++k) {
+                double u = uniform(gen) * s;
+                if (u < 0.5) {
+                    entries.emplace_back(k);
+                } else if (u < 1.0) {
+                    entries.emplace_back(k | kNegative);
+                }
+            }
+            starts.emplace_back(static_cast<uint32_t>(entries.size()));
+        }
+        scale = std::sqrt(s / dim);
+        mean.clear();
+        components.clear();
+        variance.clear();
+        type = SPARSE_JL;
+        in = inputDim;
+        out = dim;
+        return true;
+    }
+
+    // y = projection of one inputDim() row, outputDim() values
+    template <typename T1, typename T2>
+    void apply(const T1 *x, T2 *y) const {
+        if (type == PCA) {
+            for (uint32_t k = 0; k < out; ++k) {
+                auto c = components.data() + static_cast<std::size_t>(k) * in;
+                y[k] = static_cast<T2>(dot(c, x, in) + bias[k]);
+            }
+            return;
+        }
+        thread_local Vec<double> acc;
+        acc.assign(out, 0.0);
+        for (uint32_t j = 0; j < in; ++j) {
+            double v = x[j];
+            if (v == 0.0) continue;
+            for (auto e = starts[j]; e < starts[j + 1]; ++e) {
+                auto k = entries[e];
+                acc[k & ~kNegative] += k & kNegative ? -v : v;
+            }
+        }
+        for (uint32_t k = 0; k < out; ++k) y[k] = static_cast<T2>(acc[k] * scale);
+    }
+
+    // projection of every row of X into one contiguous row-major buffer (m x outputDim())
+    template <typename T>
+    Vec<T> transform(const Data<T> &X) const {
+        STAT_PROFILE_SCOPE(__func__);
+
+        Vec<T> Y(static_cast<std::size_t>(X.m) * out);
+        parallel::parallelFor(0, X.m, 64, [&](std::size_t lo, std::size_t hi) {
+            for (auto i = lo; i < hi; ++i) apply(X.data[i].data(), Y.data() + i * out);
+        });
+        return Y;
+    }
+
+    template <typename T>
+    Data<T> transformData(const Data<T> &X) const {
+        auto Y = transform(X);
+        Mat<T> rows(X.m);
+        for (uint32_t i = 0; i < X.m; ++i) {
+            rows[i].assign(Y.begin() + static_cast<std::size_t>(i) * out,
+                           Y.begin() + static_cast<std::size_t>(i + 1) * out);
+        }
+        return {std::move(rows), X.m, out};
+    }
+
+    // appends the projection as a step of a preprocessing pipeline, the sparse matrix expanded
+    void addTo(transform::Pipeline &pipeline) const {
+        if (type == PCA) {
+            pipeline.project(mean, components, out);
+        } else if (type == SPARSE_JL) {
+            Vec<double> dense(static_cast<std::size_t>(out) * in, 0.0);
+            for (uint32_t j = 0; j < in; ++j) {
+                for (auto e = starts[j]; e < starts[j + 1]; ++e) {
+                    auto k = entries[e];
+                    dense[static_cast<std::size_t>(k & ~kNegative) * in + j] =
+                        k & kNegative ? -scale : scale;
+                }
+            }
+            pipeline.project(Vec<double>(in, 0.0), dense, out);
+        }
+    }
+
+    // a section of a model file, after the sections of the model itself
+    void write(serialize::Writer &writer) const {
+        writer.write(FileHeader{type, in, out, 0, scale});
+        writer.writeVec(mean);
+        writer.writeVec(components);
+        writer.writeVec(variance);
+        writer.writeVec(starts);
+        writer.writeVec(entries);
+    }
+
+    bool read(serialize::Reader &reader) {
+        FileHeader header;
+        if (!reader.read(header) || !reader.readVec(mean) || !reader.readVec(components) ||
+            !reader.readVec(variance) || !reader.readVec(starts) || !reader.readVec(entries)) {
+            return false;
+        }
+        type = static_cast<Kind>(header.kind);
+        in = header.in;
+        out = header.out;
+        scale = header.scale;
+        bool ok = false;
+        if (type == PCA) {
+            ok = mean.size() == in && components.size() == static_cast<std::size_t>(out) * in;
+        } else if (type == SPARSE_JL) {
+            // column j owns the entries [starts[j], starts[j + 1])
+            ok = starts.size() == in + 1u && starts.front() == 0 &&
+                 std::is_sorted(starts.cbegin(), starts.cend()) && starts.back() == entries.size();
+            for (auto e : entries) ok = ok && (e & ~kNegative) < out;
+        }
+        if (ok) compile();
+        return ok;
+    }
+
+private:
+    // section header of a saved projection
+    struct FileHeader {
+        uint32_t kind;
+        uint32_t in;
+        uint32_t out;
+        uint32_t reserved;
+        double scale;
+    };
+
+    // rows per block of the randomized SVD products, 256 MNIST rows of doubles are 1.5MB
+    static constexpr uint32_t kBlockRows = 256;
+    // sign bit of a sparse entry, the low bits are the output index
+    static constexpr uint32_t kNegative = 1u << 31;
+
+    Kind type = NONE;
+    uint32_t in = 0;
+    uint32_t out = 0;
+    Vec<double> mean;        // PCA, in
+    Vec<double> components;  // PCA, out x in
+    Vec<double> variance;    // PCA, out
+    Vec<double> bias;        // PCA, -components mean
+    Vec<uint32_t> starts;    // SPARSE_JL, in + 1 offsets of the entries of each input column
+    Vec<uint32_t> entries;   // SPARSE_JL, output index | kNegative
+    double scale = 1.0;      // SPARSE_JL
+
+    void compile() {
+        if (type != PCA) return;
+        bias.resize(out);
+        for (uint32_t k = 0; k < out; ++k) {
+            bias[k] = -dot(components.data() + static_cast<std::size_t>(k) * in, mean.data(), in);
+        }
+    }
+
+    template <typename T>
+    void centeredBlock(const Data<T> &X, std::size_t first, std::size_t count, double *block) const {
+        auto n = X.n;
+        for (std::size_t r = 0; r < count; ++r) {
+            const auto &row = X.data[first + r];
+            auto b = block + r * n;
+            for (uint32_t j = 0; j < n; ++j) b[j] = row[j] - mean[j];
+        }
+    }
+
+    // YT (l x m) = P Xc^T of a row-major P (l x n), one column block of YT per row block of X
+    template <typename T>
+    void rangeProduct(const Data<T> &X, const Vec<double> &P, uint32_t l, Vec<double> &YT) const {
+        STAT_PROFILE_SCOPE(__func__);
+
+        std::size_t m = X.m, n = X.n;
+        YT.resize(l * m);
+        auto blocks = (m + kBlockRows - 1) / kBlockRows;
+        parallel::parallelFor(0, blocks, 1, [&](std::size_t lo, std::size_t hi) {
+            Vec<double> block(kBlockRows * n), C(kBlockRows * l);
+            for (auto b = lo; b < hi; ++b) {
+                auto first = b * kBlockRows, count = std::min<std::size_t>(kBlockRows, m - first);
+                centeredBlock(X, first, count, block.data());
+                matmulNT(block.data(), P.data(), C.data(), count, l, n);
+                for (std::size_t r = 0; r < count; ++r) {
+                    for (uint32_t c = 0; c < l; ++c) YT[c * m + first + r] = C[r * l + c];
+                }
+            }
+        });
+    }
+
+    // Z (l x n) = P Xc of a row-major P (l x m). partial products of a slice of blocks per thread,
+    // summed in slice order
+    template <typename T>
+    void coproduct(const Data<T> &X, const Vec<double> &P, uint32_t l, Vec<double> &Z) const {
+        STAT_PROFILE_SCOPE(__func__);
+
+        std::size_t m = X.m, n = X.n;
+        auto blocks = (m + kBlockRows - 1) / kBlockRows;
+        auto slices = std::max<std::size_t>(1, std::min<std::size_t>(parallel::threads(), blocks));
+        std::vector<Vec<double>> partial(slices, Vec<double>(l * n, 0.0));
+        parallel::parallelFor(0, slices, 1, [&](std::size_t lo, std::size_t hi) {
+            Vec<double> block(kBlockRows * n), blockT(n * kBlockRows), Pb(l * kBlockRows),
+                C(l * n);
+            for (auto s = lo; s < hi; ++s) {
+                for (auto b = blocks * s / slices; b < blocks * (s + 1) / slices; ++b) {
+                    auto first = b * kBlockRows, count = std::min<std::size_t>(kBlockRows, m - first);
+                    centeredBlock(X, first, count, block.data());
+                    transpose(block.data(), blockT.data(), count, n);
+                    for (uint32_t c = 0; c < l; ++c) {
+                        std::copy_n(P.data() + c * m + first, count, Pb.data() + c * count);
+                    }
+                    matmulNT(Pb.data(), blockT.data(), C.data(), l, n, count);
+                    axpy(1.0, C.data(), partial[s].data(), l * n);
+                }
+            }
+        });
+        Z.assign(l * n, 0.0);
+        for (const auto &p : partial) axpy(1.0, p.data(), Z.data(), l * n);
+    }
+};
+
+}  // namespace reduction
+}  // namespace stat
+
+#endif  // __REDUCTION_H__
@@ -0,0 +1,782 @@
+#ifndef __SVM_H__
+#define __SVM_H__
+
+#include "Math.h"
+#include "Model.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <list>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace stat {
+namespace svm {
+
+enum KernelType : uint32_t {
+    LINEAR,
+    POLY,
+    RBF,
+};
+
+/**
+ * K(x, z) of the supported kernels, every one is a function of x.z (and of |x|^2, |z|^2 for rbf)
+ * hence a row of kernel values is a row of dot products:
+ *
+ *      linear: x.z
+ *      poly:   (gamma x.z + coef0)^degree
+ *      rbf:    exp(-gamma |x - z|^2) = exp(-gamma (|x|^2 + |z|^2 - 2 x.z))
+ */
+struct Kernel {
+    KernelType type = RBF;
+    uint32_t degree = 3;
+    double gamma = 0.0;  // 0 is 1 / dim
+    double coef0 = 0.0;
+
+    double operator()(double dot, double xx, double zz) const {
+        switch (type) {
+            case LINEAR: return dot;
+            case POLY: {
+                double base = gamma * dot + coef0, v = 1.0;
+                for (uint32_t d = 0; d < degree; ++d) v *= base;
+                return v;
+            }
+            default: return std::exp(-gamma * std::max(0.0, xx + zz - 2.0 * dot));
+        }
+    }
+};
+
+// rows of Q_ij = y_i y_j K(x_i, x_j) of one problem, least recently used rows are evicted once
+// the cache holds more than its byte budget
+class KernelCache {
+public:
+    KernelCache(std::size_t _rows, std::size_t budget)
+        : rows(_rows), capacity(std::max<std::size_t>(2, budget / (_rows * sizeof(float) + 64))),
+          slots(_rows, lru.end()), hits(0), misses(0) {}
+
+    struct Row {
+        uint32_t index;
+        bool complete;  // every entry computed, otherwise the entries of the active set only
+        std::vector<float> data;
+    };
+
+    // cached row of i, or nullptr. a hit moves the row to the front
+    Row *find(uint32_t i) {
+        auto it = slots[i];
+        if (it == lru.end()) {
+            ++misses;
+            return nullptr;
+        }
+        ++hits;
+        lru.splice(lru.begin(), lru, it);
+        return &*it;
+    }
+
+    // a row for i, its data is not initialized. evicts the least recently used row if full
+    Row *insert(uint32_t i) {
+        if (lru.size() >= capacity) {
+            auto &last = lru.back();
+            slots[last.index] = lru.end();
+            if (spare.empty()) spare.swap(last.data);
+            lru.pop_back();
+        }
+        lru.push_front(Row{i, false, {}});
+        auto &row = lru.front();
+        row.data.swap(spare);
+        row.data.resize(rows);
+        slots[i] = lru.begin();
+        return &row;
+    }
+
+    // drops rows not computed over all entries, called when shrunk variables come back
+    void dropIncomplete() {
+        for (auto it = lru.begin(); it != lru.end();) {
+            if (it->complete) {
+                ++it;
+                continue;
+            }
+            slots[it->index] = lru.end();
+            it = lru.erase(it);
+        }
+    }
+
+    std::size_t rows;
+    std::size_t capacity;
+    std::list<Row> lru;
+    std::vector<std::list<Row>::iterator> slots;
+    std::vector<float> spare;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+/**
+ * SMO solver of the C-SVC dual
+ *
+ *      min_a 1/2 a^T Q a - e^T a,  0 <= a_i <= C,  y^T a = 0
+ *
+ * with the second order working set selection (WSS2) and the shrinking heuristics of LIBSVM
+ * (Fan, Chen and Lin, JMLR 2005). Shrunk variables leave the active set, kernel rows are then
+ * only evaluated over the active set. Before stopping, shrunk variables are restored and their
+ * gradient is reconstructed from G_bar, the gradient part due to alphas at the upper bound.
+ */
+class Solver {
+public:
+    Solver(const double *_X, const double *_norms, uint32_t _l, uint32_t _dim,
+           const std::vector<int8_t> &_y, const Kernel &_kernel, double _C, double _eps,
+           std::size_t cacheBytes, bool _shrinking)
+        : X(_X),
+          norms(_norms),
+          l(_l),
+          dim(_dim),
+          y(_y),
+          kernel(_kernel),
+          C(_C),
+          eps(_eps),
+          shrinking(_shrinking),
+          cache(_l, cacheBytes) {}
+
+    struct Result {
+        std::vector<double> alpha;
+        double rho;
+        uint64_t iterations;
+    };
+
+    Result solve(uint64_t maxIterations) {
+        alpha.assign(l, 0.0);
+        G.assign(l, -1.0);
+        G_bar.assign(l, 0.0);
+        QD.resize(l);
+        for (uint32_t i = 0; i < l; ++i) QD[i] = kernel(norms[i], norms[i], norms[i]);
+        isActive.assign(l, 1);
+        active.resize(l);
+        for (uint32_t i = 0; i < l; ++i) active[i] = i;
+        unshrunk = false;
+
+        uint64_t iter = 0;
+        uint32_t counter = std::min<uint32_t>(l, 1000) + 1;
+        while (iter < maxIterations) {
+            if (--counter == 0) {
+                counter = std::min<uint32_t>(l, 1000);
+                if (shrinking) shrink();
+            }
+            uint32_t i, j;
+            if (!select(i, j)) {
+                // optimal over the active set, check again over all variables
+                reconstruct();
+                if (!select(i, j)) break;
+                counter = 1;  // shrink at the next iteration
+            }
+            ++iter;
+            update(i, j);
+        }
+        if (iter >= maxIterations) {
+            printf("WARNING: svm reaches max iterations %llu\n",
+                   static_cast<unsigned long long>(maxIterations));
+        }
+        reconstruct();
+        STAT_PROFILE_COUNT(DISTANCE_EVALS, kernelEvals);
+        return {alpha, rho(), iter};
+    }
+
+    uint64_t kernelEvals = 0;
+
+private:
+    static constexpr double kTau = 1e-12;
+
+    const double *X;
+    const double *norms;
+    uint32_t l;
+    uint32_t dim;
+    const std::vector<int8_t> &y;
+    Kernel kernel;
+    double C;
+    double eps;
+    bool shrinking;
+    bool unshrunk;
+    KernelCache cache;
+
+    std::vector<double> alpha, G, G_bar, QD;
+    std::vector<uint32_t> active;
+    std::vector<uint8_t> isActive;
+
+    bool upper(uint32_t i) const { return alpha[i] >= C; }
+    bool lower(uint32_t i) const { return alpha[i] <= 0.0; }
+
+    double q(uint32_t i, uint32_t j) const {
+        auto d = dot(X + static_cast<std::size_t>(i) * dim, X + static_cast<std::size_t>(j) * dim,
+                     dim);
+        return y[i] * y[j] * kernel(d, norms[i], norms[j]);
+    }
+
+    // row i of Q, valid over the active set, or over all variables when `full`
+    const float *row(uint32_t i, bool full) {
+        full = full || active.size() == l;
+        auto r = cache.find(i);
+        if (r && (r->complete || !full)) return r->data.data();
+        if (!r) {
+            r = cache.insert(i);
+            if (!full) {
+                for (auto j : active) r->data[j] = q(i, j);
+                kernelEvals += active.size();
+                return r->data.data();
+            }
+            for (uint32_t j = 0; j < l; ++j) r->data[j] = q(i, j);
+            kernelEvals += l;
+        } else {
+            // complete a row computed over an active set
+            for (uint32_t j = 0; j < l; ++j) {
+                if (!isActive[j]) r->data[j] = q(i, j);
+            }
+            kernelEvals += l - active.size();
+        }
+        r->complete = true;
+        return r->data.data();
+    }
+
+    bool select(uint32_t &outI, uint32_t &outJ) {
+        double Gmax = -Inf<double>, Gmax2 = -Inf<double>;
+        int64_t best = -1;
+        for (auto t : active) {
+            if (y[t] == 1) {
+                if (!upper(t) && -G[t] >= Gmax) {
+                    Gmax = -G[t];
+                    best = t;
+                }
+            } else if (!lower(t) && G[t] >= Gmax) {
+                Gmax = G[t];
+                best = t;
+            }
+        }
+        if (best < 0) return false;
+        auto i = static_cast<uint32_t>(best);
+        auto Qi = row(i, false);
+        int64_t bestJ = -1;
+        double objMin = Inf<double>;
+        for (auto j : active) {
+            double gradDiff, quad;
+            if (y[j] == 1) {
+                if (lower(j)) continue;
+                gradDiff = Gmax + G[j];
+                Gmax2 = std::max(Gmax2, G[j]);
+                quad = QD[i] + QD[j] - 2.0 * y[i] * Qi[j];
+            } else {
+                if (upper(j)) continue;
+                gradDiff = Gmax - G[j];
+                Gmax2 = std::max(Gmax2, -G[j]);
+                quad = QD[i] + QD[j] + 2.0 * y[i] * Qi[j];
+            }
+            if (gradDiff <= 0) continue;
+            double obj = -(gradDiff * gradDiff) / (quad > 0 ? quad : kTau);
+            if (obj <= objMin) {
+                objMin = obj;
+                bestJ = j;
+            }
+        }
+        if (Gmax + Gmax2 < eps || bestJ < 0) return false;
+        outI = i;
+        outJ = static_cast<uint32_t>(bestJ);
+        return true;
+    }
+
+    void update(uint32_t i, uint32_t j) {
+        auto Qi = row(i, false), Qj = row(j, false);
+        double ai = alpha[i], aj = alpha[j];
+        if (y[i] != y[j]) {
+            double quad = QD[i] + QD[j] + 2.0 * Qi[j];
+            double delta = (-G[i] - G[j]) / (quad > 0 ? quad : kTau);
+            double diff = alpha[i] - alpha[j];
+            alpha[i] += delta;
+            alpha[j] += delta;
+            if (diff > 0) {
+                if (alpha[j] < 0) {
+                    alpha[j] = 0;
+                    alpha[i] = diff;
+                }
+            } else if (alpha[i] < 0) {
+                alpha[i] = 0;
+                alpha[j] = -diff;
+            }
+            if (diff > 0) {
+                if (alpha[i] > C) {
+                    alpha[i] = C;
+                    alpha[j] = C - diff;
+                }
+            } else if (alpha[j] > C) {
+                alpha[j] = C;
+                alpha[i] = C + diff;
+            }
+        } else {
+            double quad = QD[i] + QD[j] - 2.0 * Qi[j];
+            double delta = (G[i] - G[j]) / (quad > 0 ? quad : kTau);
+            double sum = alpha[i] + alpha[j];
+            alpha[i] -= delta;
+            alpha[j] += delta;
+            if (sum > C) {
+                if (alpha[i] > C) {
+                    alpha[i] = C;
+                    alpha[j] = sum - C;
+                }
+            } else if (alpha[j] < 0) {
+                alpha[j] = 0;
+                alpha[i] = sum;
+            }
+            if (sum > C) {
+                if (alpha[j] > C) {
+                    alpha[j] = C;
+                    alpha[i] = sum - C;
+                }
+            } else if (alpha[i] < 0) {
+                alpha[i] = 0;
+                alpha[j] = sum;
+            }
+        }
+        double di = alpha[i] - ai, dj = alpha[j] - aj;
+        for (auto k : active) G[k] += Qi[k] * di + Qj[k] * dj;
+
+        // keep G_bar, sum of C Q_k over upper bound alphas, for the gradient reconstruction
+        auto moveBar = [&](uint32_t t, double old) {
+            bool was = old >= C, is = upper(t);
+            if (was == is) return;
+            auto Qt = row(t, true);
+            double s = is ? C : -C;
+            for (uint32_t k = 0; k < l; ++k) G_bar[k] += s * Qt[k];
+        };
+        moveBar(i, ai);
+        moveBar(j, aj);
+    }
+
+    bool shrinkable(uint32_t i, double Gmax1, double Gmax2) const {
+        if (upper(i)) return y[i] == 1 ? -G[i] > Gmax1 : -G[i] > Gmax2;
+        if (lower(i)) return y[i] == 1 ? G[i] > Gmax2 : G[i] > Gmax1;
+        return false;
+    }
+
+    void shrink() {
+        double Gmax1 = -Inf<double>, Gmax2 = -Inf<double>;  // max of -yG over I_up, yG over I_low
+        for (auto t : active) {
+            if (y[t] == 1) {
+                if (!upper(t)) Gmax1 = std::max(Gmax1, -G[t]);
+                if (!lower(t)) Gmax2 = std::max(Gmax2, G[t]);
+            } else {
+                if (!upper(t)) Gmax2 = std::max(Gmax2, -G[t]);
+                if (!lower(t)) Gmax1 = std::max(Gmax1, G[t]);
+            }
+        }
+        if (!unshrunk && Gmax1 + Gmax2 <= eps * 10) {
+            // close to the end, bring every variable back once before shrinking again
+            unshrunk = true;
+            reconstruct();
+        }
+        std::size_t kept = 0;
+        for (auto t : active) {
+            if (shrinkable(t, Gmax1, Gmax2)) {
+                isActive[t] = 0;
+            } else {
+                active[kept++] = t;
+            }
+        }
+        active.resize(kept);
+    }
+
+    void reconstruct() {
+        if (active.size() == l) return;
+        for (uint32_t k = 0; k < l; ++k) {
+            if (!isActive[k]) G[k] = G_bar[k] - 1.0;
+        }
+        for (uint32_t i = 0; i < l; ++i) {
+            if (lower(i) || upper(i)) continue;
+            auto Qi = row(i, true);
+            for (uint32_t k = 0; k < l; ++k) {
+                if (!isActive[k]) G[k] += alpha[i] * Qi[k];
+            }
+        }
+        cache.dropIncomplete();
+        active.resize(l);
+        for (uint32_t i = 0; i < l; ++i) active[i] = i;
+        std::fill(isActive.begin(), isActive.end(), 1);
+    }
+
+    double rho() const {
+        double ub = Inf<double>, lb = -Inf<double>, sum = 0.0;
+        uint32_t free = 0;
+        for (uint32_t i = 0; i < l; ++i) {
+            double yG = y[i] * G[i];
+            if (upper(i)) {
+                if (y[i] == -1) {
+                    ub = std::min(ub, yG);
+                } else {
+                    lb = std::max(lb, yG);
+                }
+            } else if (lower(i)) {
+                if (y[i] == 1) {
+                    ub = std::min(ub, yG);
+                } else {
+                    lb = std::max(lb, yG);
+                }
+            } else {
+                ++free;
+                sum += yG;
+            }
+        }
+        return free > 0 ? sum / free : (ub + lb) / 2.0;
+    }
+};
+
+}  // namespace svm
+
+// SVM params, from ModelParam by parse() or set directly
+struct SvmParam {
+    svm::Kernel kernel;
+    double C = 1.0;  // > 0
+    double tolerance = 1e-3;
+    double cacheMB = 100.0;  // kernel row cache per binary problem
+    bool shrinking = true;
+    bool show = false;
+
+    // {"model_type", "linear" | "poly" | "rbf"}, {"C"}, {"tolerance"}, {"cache_size"}, {"gamma"},
+    // {"coef0"}, {"degree"}, {"shrinking"}, {"model_show"}
+    static SvmParam parse(const ModelParam &param) {
+        SvmParam p;
+        ParamReader(param, "SVM")
+            .choice("model_type", p.kernel.type,
+                    {{"linear", svm::LINEAR}, {"poly", svm::POLY}, {"rbf", svm::RBF}})
+            .number("C", p.C, std::numeric_limits<double>::min())
+            .number("tolerance", p.tolerance, 0.0)
+            .number("cache_size", p.cacheMB, 0.0)
+            .number("gamma", p.kernel.gamma, 0.0)
+            .number("coef0", p.kernel.coef0)
+            .number("degree", p.kernel.degree, 1u)
+            .flag("shrinking", p.shrinking)
+            .flag("model_show", p.show);
+        return p;
+    }
+};
+
+/**
+ * Support Vector Machine model
+ *
+ * Model:   $f(x) = sign(\sum_{i=1}^N{\alpha_i y_i K(x_i, x)} + b)$
+ * Dual:    $\min_\alpha \frac{1}{2}\sum_i\sum_j{\alpha_i \alpha_j y_i y_j K(x_i, x_j)}
+ *              - \sum_i{\alpha_i}$,  $0 \le \alpha_i \le C$, $\sum_i{\alpha_i y_i} = 0$
+ *
+ * Trained by SMO (svm::Solver) with a per-problem LRU cache of kernel rows bounded by
+ * `cache_size` MB. More than two classes are one-vs-rest, the binary problems are solved in
+ * parallel. Support vectors of all problems are stored once, contiguously, with a dense
+ * (problem x support vector) coefficient matrix. Prediction scores blocks of rows at once, the
+ * dot products of a block with every support vector are one matrix product.
+ */
+template <typename DataType, typename LabelType>
+class SVM : public Model<DataType, LabelType> {
+public:
+    explicit SVM(const SvmParam &param = {});
+    explicit SVM(const ModelParam &param) : SVM(SvmParam::parse(param)) {}
+    virtual ~SVM() = default;
+
+    virtual bool train(const Data<DataType> &X_train, const Data<LabelType> &y_train) final;
+
+    virtual LabelType predict(const Vec<DataType> &X) final;
+
+    virtual double validate(const Data<DataType> &X_test, const Data<LabelType> &y_test) final;
+
+    virtual void describe() const final;
+
+    virtual memory::Usage memoryUsage() const final;
+
+    virtual uint32_t inputDim() const final;
+
+    virtual bool save(const char *filename) const final;
+
+    virtual bool load(const char *filename) final;
+
+    // labels of rows [0, X.m) of X, scored in blocks
+    Vec<LabelType> predictBatch(const Data<DataType> &X) const;
+
+private:
+    // fixed size part of the saved model. sections follow: labels, support vectors, their norms,
+    // coefficients and biases
+    struct FileHeader {
+        svm::Kernel kernel;
+        uint32_t classes;
+        uint32_t dim;
+        uint32_t svs;
+        uint32_t problems;
+    };
+
+    static constexpr uint32_t kBlockRows = 64;  // rows scored together
+
+    svm::Kernel kernel;  // gamma of the last training set
+    double gamma;        // as set, 0 is 1 / dim of each training set
+    double C;
+    double eps;
+    double cacheMB;
+    bool shrinking;
+    bool isModelShow;
+
+    uint32_t dim;
+    Vec<LabelType> classes;
+    uint32_t svCount;
+    Vec<double> svs;      // svCount x dim, row-major
+    Vec<double> svNorms;  // |sv|^2
+    Vec<double> coef;     // problems x svCount, alpha_i y_i
+    Vec<double> bias;     // problems, -rho
+
+    uint32_t problems() const { return classes.size() == 2 ? 1 : classes.size(); }
+    void decision(const double *X, std::size_t rows, double *out) const;
+    LabelType label(const double *scores) const;
+};
+
+template <typename DataType, typename LabelType>
+SVM<DataType, LabelType>::SVM(const SvmParam &param)
+    : kernel(param.kernel),
+      gamma(param.kernel.gamma),
+      C(param.C),
+      eps(param.tolerance),
+      cacheMB(param.cacheMB),
+      shrinking(param.shrinking),
+      isModelShow(param.show),
+      dim(0),
+      svCount(0) {}
+
+template <typename DataType, typename LabelType>
+bool SVM<DataType, LabelType>::train(const Data<DataType> &X_train,
+                                     const Data<LabelType> &y_train) {
+    STAT_PROFILE_SCOPE(__func__);
+
+    auto m = X_train.m, n = X_train.n;
+    if (m == 0 || n == 0 || y_train.m != m) {
+        printf("ERROR: invalid training set\n");
+        return false;
+    }
+    if (!(C > 0.0)) {
+        printf("ERROR: svm C must be positive, got %f\n", C);
+        return false;
+    }
+    dim = n;
+    auto y = encodeLabels(y_train, classes);
+    if (classes.size() < 2) {
+        printf("ERROR: svm needs at least 2 classes\n");
+        return false;
+    }
+    kernel.gamma = gamma > 0.0 ? gamma : 1.0 / n;
+
+    Vec<double> X, norms(m);
+    X.reserve(static_cast<std::size_t>(m) * n);
+    for (const auto &row : X_train.data) X.insert(X.end(), row.cbegin(), row.cend());
+    for (uint32_t i = 0; i < m; ++i) {
+        auto x = X.data() + static_cast<std::size_t>(i) * n;
+        norms[i] = dot(x, x, n);
+    }
+
+    // one-vs-rest, problem p separates class p (+1) from the others, a binary problem is one
+    auto P = problems();
+    auto concurrent = std::min(P, parallel::threads());
+    auto cacheBytes = static_cast<std::size_t>(cacheMB * (1 << 20) / concurrent);
+    std::vector<std::vector<double>> alphas(P);
+    Vec<double> rhos(P);
+    std::vector<uint64_t> iterations(P);
+    parallel::parallelFor(0, P, 1, [&](std::size_t lo, std::size_t hi) {
+        for (auto p = lo; p < hi; ++p) {
+            std::vector<int8_t> sign(m);
+            for (uint32_t i = 0; i < m; ++i) sign[i] = y[i] == p ? 1 : -1;
+            svm::Solver solver(X.data(), norms.data(), m, n, sign, kernel, C, eps, cacheBytes,
+                               shrinking);
+            auto result = solver.solve(std::max<uint64_t>(10000000, 100ull * m));
+            for (uint32_t i = 0; i < m; ++i) result.alpha[i] *= sign[i];
+            alphas[p] = std::move(result.alpha);
+            rhos[p] = result.rho;
+            iterations[p] = result.iterations;
+        }
+    });
+
+    // support vectors of any problem, stored once
+    std::vector<uint32_t> sv;
+    for (uint32_t i = 0; i < m; ++i) {
+        bool used = false;
+        for (uint32_t p = 0; p < P && !used; ++p) used = alphas[p][i] != 0.0;
+        if (used) sv.emplace_back(i);
+    }
+    svCount = sv.size();
+    svs.clear();
+    svNorms.clear();
+    coef.assign(static_cast<std::size_t>(P) * svCount, 0.0);
+    bias.assign(P, 0.0);
+    for (uint32_t s = 0; s < svCount; ++s) {
+        auto x = X.data() + static_cast<std::size_t>(sv[s]) * n;
+        svs.insert(svs.end(), x, x + n);
+        svNorms.emplace_back(norms[sv[s]]);
+        for (uint32_t p = 0; p < P; ++p) coef[p * svCount + s] = alphas[p][sv[s]];
+    }
+    for (uint32_t p = 0; p < P; ++p) bias[p] = -rhos[p];
+
+    uint64_t total = 0;
+    for (auto it : iterations) total += it;
+    printf("INFO: training done, %u problems, %llu iterations, %u support vectors\n", P,
+           static_cast<unsigned long long>(total), svCount);
+    describe();
+    return true;
+}
+
+template <typename DataType, typename LabelType>
+void SVM<DataType, LabelType>::decision(const double *X, std::size_t rows, double *out) const {
+    auto P = problems();
+    Vec<double> K(rows * svCount);
+    matmulNT(X, svs.data(), K.data(), rows, svCount, dim);
+    for (std::size_t r = 0; r < rows; ++r) {
+        auto x = X + r * dim;
+        double xx = kernel.type == svm::RBF ? dot(x, x, dim) : 0.0;
+        auto k = K.data() + r * svCount;
+        for (uint32_t s = 0; s < svCount; ++s) k[s] = kernel(k[s], xx, svNorms[s]);
+        for (uint32_t p = 0; p < P; ++p) {
+            out[r * P + p] = dot(k, coef.data() + static_cast<std::size_t>(p) * svCount, svCount) +
+                             bias[p];
+        }
+    }
+}
+
+template <typename DataType, typename LabelType>
+LabelType SVM<DataType, LabelType>::label(const double *scores) const {
+    if (classes.size() == 2) return scores[0] > 0 ? classes[0] : classes[1];
+    return classes[std::max_element(scores, scores + classes.size()) - scores];
+}
+
+template <typename DataType, typename LabelType>
+LabelType SVM<DataType, LabelType>::predict(const Vec<DataType> &X) {
+    if (classes.empty() || X.size() != dim) {
+        printf("ERROR: model is not trained or input dimension mismatch\n");
+        return 0;
+    }
+    Vec<double> x(X.cbegin(), X.cend()), scores(problems());
+    decision(x.data(), 1, scores.data());
+    return label(scores.data());
+}
+
+template <typename DataType, typename LabelType>
+Vec<LabelType> SVM<DataType, LabelType>::predictBatch(const Data<DataType> &X) const {
+    STAT_PROFILE_SCOPE(__func__);
+
+    Vec<LabelType> labels(X.m);
+    if (classes.empty() || X.n != dim) {
+        printf("ERROR: model is not trained or input dimension mismatch\n");
+        return labels;
+    }
+    auto P = problems();
+    auto blocks = (X.m + kBlockRows - 1) / kBlockRows;
+    parallel::parallelFor(0, blocks, 1, [&](std::size_t lo, std::size_t hi) {
+        Vec<double> block(static_cast<std::size_t>(kBlockRows) * dim), scores(kBlockRows * P);
+        for (auto b = lo; b < hi; ++b) {
+            auto first = b * kBlockRows, rows = std::min<std::size_t>(kBlockRows, X.m - first);
+            for (std::size_t r = 0; r < rows; ++r) {
+                const auto &x = X.data[first + r];
+                std::copy(x.cbegin(), x.cend(), block.begin() + r * dim);
+            }
+            decision(block.data(), rows, scores.data());
+            for (std::size_t r = 0; r < rows; ++r) labels[first + r] = label(&scores[r * P]);
+        }
+    });
+    return labels;
+}
+
+template <typename DataType, typename LabelType>
+double SVM<DataType, LabelType>::validate(const Data<DataType> &X_test,
+                                          const Data<LabelType> &y_test) {
+    STAT_PROFILE_SCOPE(__func__);
+
+    double correct = 0.0;
+    auto m = X_test.m;
+    auto predicted = predictBatch(X_test);
+    for (auto i = 0; i < m; ++i) {
+        if (predicted[i] == y_test.data[i][0]) ++correct;
+    }
+    double acc = correct / m;
+    printf("accuracy: %f\n\n", acc);
+    return acc;
+}
+
+template <typename DataType, typename LabelType>
+void SVM<DataType, LabelType>::describe() const {
+    if (!isModelShow) return;
+    const char *names[] = {"linear", "poly", "rbf"};
+    printf("SVM (%s kernel, gamma %f): %zu classes, %u support vectors\n", names[kernel.type],
+           kernel.gamma, classes.size(), svCount);
+    for (uint32_t p = 0; p < problems(); ++p) printf("\tb[%u] = %f\n", p, bias[p]);
+    printf("\n");
+}
+
+template <typename DataType, typename LabelType>
+uint32_t SVM<DataType, LabelType>::inputDim() const {
+    return dim;
+}
+
+template <typename DataType, typename LabelType>
+memory::Usage SVM<DataType, LabelType>::memoryUsage() const {
+    memory::Usage u;
+    u.add("support vectors", memory::heapBytes(svs));
+    u.add("support vector norms", memory::heapBytes(svNorms));
+    u.add("coefficients", memory::heapBytes(coef) + memory::heapBytes(bias));
+    u.add("classes", memory::heapBytes(classes));
+    return u;
+}
+
+template <typename DataType, typename LabelType>
+bool SVM<DataType, LabelType>::save(const char *filename) const {
+    if (classes.empty()) {
+        printf("ERROR: model is not trained yet\n");
+        return false;
+    }
+    serialize::Writer writer(filename);
+    writer.writeHeader(MODEL_SVM, serialize::typeTag<DataType>(), serialize::typeTag<LabelType>());
+    writer.write(FileHeader{kernel, static_cast<uint32_t>(classes.size()), dim, svCount,
+                            problems()});
+    writer.writeArray(classes.data(), classes.size());
+    writer.writeArray(svs.data(), svs.size());
+    writer.writeArray(svNorms.data(), svNorms.size());
+    writer.writeArray(coef.data(), coef.size());
+    writer.writeArray(bias.data(), bias.size());
+    return writer.good();
+}
+
+template <typename DataType, typename LabelType>
+bool SVM<DataType, LabelType>::load(const char *filename) {
+    serialize::MappedFile file(filename);
+    serialize::Reader reader(file);
+    if (!reader.readHeader(MODEL_SVM, serialize::typeTag<DataType>(),
+                           serialize::typeTag<LabelType>())) {
+        return false;
+    }
+    FileHeader header;
+    bool ok = reader.read(header) && header.classes >= 2 && header.svs > 0 &&
+              header.problems == (header.classes == 2 ? 1 : header.classes) &&
+              header.kernel.type <= svm::RBF;
+    const LabelType *labels = nullptr;
+    const double *vectors = nullptr, *norms = nullptr, *coefs = nullptr, *biases = nullptr;
+    if (ok) {
+        labels = reader.view<LabelType>(header.classes);
+        vectors = reader.view<double>(static_cast<std::size_t>(header.svs) * header.dim);
+        norms = reader.view<double>(header.svs);
+        coefs = reader.view<double>(static_cast<std::size_t>(header.problems) * header.svs);
+        biases = reader.view<double>(header.problems);
+    }
+    if (!labels || !vectors || !norms || !coefs || !biases) {
+        printf("ERROR: corrupted svm model file (%s)\n", filename);
+        return false;
+    }
+    kernel = header.kernel;
+    dim = header.dim;
+    svCount = header.svs;
+    classes.assign(labels, labels + header.classes);
+    svs.assign(vectors, vectors + static_cast<std::size_t>(header.svs) * header.dim);
+    svNorms.assign(norms, norms + header.svs);
+    coef.assign(coefs, coefs + static_cast<std::size_t>(header.problems) * header.svs);
+    bias.assign(biases, biases + header.problems);
+    describe();
+    return true;
+}
+
+}  // namespace stat
+
+#endif  // __SVM_H__
@@ -0,0 +1,256 @@
+#ifndef __SERIALIZE_H__
+#define __SERIALIZE_H__
+
+#include "Types.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include <utility>
+
+// NOTE: <fcntl.h> and <sys/stat.h> declare `struct stat`, which clashes with namespace stat
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace stat {
+namespace serialize {
+
+/**
+ * Binary model format
+ *
+ *      +----------------+  offset 0
+ *      |  FileHeader    |  magic, format version, model type, data/label type tags
+ *      +----------------+
+ *      |  model header  |  fixed size POD, model specific (k, p, dims, ...)
+ *      +----------------+  64-byte aligned
+ *      |  section 0     |  raw array (weights, points, kd-tree nodes, ...)
+ *      +----------------+  64-byte aligned
+ *      |  ...           |
+ *
+ * All values are stored in host byte order. Every array section starts on a cache line boundary,
+ * so once the file is mmapped (page aligned) each section can be used in place as a typed array
+ * without any deserialization.
+ */
+
+constexpr char kMagic[8] = {'S', 'T', 'A', 'T', 'M', 'D', 'L', '\0'};
+constexpr uint32_t kVersion = 1;
+constexpr std::size_t kAlignment = 64;
+
+// type tag of a scalar type, saved models can only be loaded back with the same template types
+template <typename T>
+constexpr uint32_t typeTag() {
+    uint32_t kind = std::is_floating_point_v<T> ? 1 : (std::is_signed_v<T> ? 2 : 3);
+    return (kind << 8) | static_cast<uint32_t>(sizeof(T));
+}
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t model;       // stat::ModelType
+    uint32_t dataType;    // typeTag<DataType>()
+    uint32_t labelType;   // typeTag<LabelType>()
+};
+
+class Writer {
+public:
+    explicit Writer(const char *filename)
+        : fout(filename, std::fstream::binary | std::fstream::out | std::fstream::trunc),
+          offset(0) {
+        if (!fout.is_open()) { printf("ERROR: failed to open (%s) for writing\n", filename); }
+    }
+
+    bool good() const { return fout.is_open() && fout.good(); }
+
+    void writeBytes(const void *src, std::size_t size) {
+        fout.write(static_cast<const char *>(src), size);
+        offset += size;
+    }
+
+    template <typename T>
+    void write(const T &v) {
+        static_assert(std::is_trivially_copyable_v<T>, "only POD values can be serialized");
+        writeBytes(&v, sizeof v);
+    }
+
+    // an aligned raw array section, the element count must be recorded in a header by caller
+    template <typename T>
+    void writeArray(const T *src, std::size_t count) {
+        static_assert(std::is_trivially_copyable_v<T>, "only POD values can be serialized");
+        align();
+        if (count > 0) writeBytes(src, count * sizeof(T));
+    }
+
+    // length-prefixed aligned array section
+    template <typename T>
+    void writeVec(const Vec<T> &v) {
+        write<uint64_t>(v.size());
+        writeArray(v.data(), v.size());
+    }
+
+    void writeHeader(uint32_t model, uint32_t dataType, uint32_t labelType) {
+        FileHeader header;
+        std::memcpy(header.magic, kMagic, sizeof kMagic);
+        header.version = kVersion;
+        header.model = model;
+        header.dataType = dataType;
+        header.labelType = labelType;
+        write(header);
+    }
+
+    void align(std::size_t alignment = kAlignment) {
+        static const char zeros[kAlignment] = {0};
+        auto pad = (alignment - offset % alignment) % alignment;
+        if (pad > 0) writeBytes(zeros, pad);
+    }
+
+private:
+    std::fstream fout;
+    std::size_t offset;
+};
+
+/**
+ * Read-only private mapping of a whole file. Move-only, the mapping is released on destruction,
+ * so any model that keeps pointers into it must keep the MappedFile alive as well.
+ */
+class MappedFile {
+public:
+    MappedFile() : base(nullptr), length(0) {}
+
+    explicit MappedFile(const char *filename) : base(nullptr), length(0) {
+        FILE *fp = std::fopen(filename, "rb");
+        if (!fp) {
+            printf("ERROR: failed to open (%s) for reading\n", filename);
+            return;
+        }
+        auto fd = ::fileno(fp);
+        auto size = ::lseek(fd, 0, SEEK_END);
+        if (size > 0) {
+            void *addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                base = static_cast<const uint8_t *>(addr);
+                length = static_cast<std::size_t>(size);
+            } else {
+                printf("ERROR: failed to mmap (%s)\n", filename);
+            }
+        }
+        std::fclose(fp);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&other) noexcept : base(other.base), length(other.length) {
+        other.base = nullptr;
+        other.length = 0;
+    }
+
+    MappedFile &operator=(MappedFile &&other) noexcept {
+        if (this != &other) {
+            release();
+            std::swap(base, other.base);
+            std::swap(length, other.length);
+        }
+        return *this;
+    }
+
+    ~MappedFile() { release(); }
+
+    bool valid() const { return base != nullptr; }
+    const uint8_t *data() const { return base; }
+    std::size_t size() const { return length; }
+
+private:
+    const uint8_t *base;
+    std::size_t length;
+
+    void release() {
+        if (base) ::munmap(const_cast<uint8_t *>(base), length);
+        base = nullptr;
+        length = 0;
+    }
+};
+
+/**
+ * Sequential reader over a mapped file. `view` returns pointers into the mapping (zero copy),
+ * `read`/`readVec` copy values out. Any out-of-bound access turns the reader into failed state.
+ */
+class Reader {
+public:
+    explicit Reader(const MappedFile &file) : base(file.data()), length(file.size()), offset(0) {}
+
+    bool ok() const { return base != nullptr; }
+
+    template <typename T>
+    bool read(T &v) {
+        static_assert(std::is_trivially_copyable_v<T>, "only POD values can be deserialized");
+        if (!reserve(sizeof v)) return false;
+        std::memcpy(&v, base + offset, sizeof v);
+        offset += sizeof v;
+        return true;
+    }
+
+    template <typename T>
+    const T *view(std::size_t count) {
+        align();
+        if (count == 0 || !reserve(count * sizeof(T))) return nullptr;
+        auto ptr = reinterpret_cast<const T *>(base + offset);
+        offset += count * sizeof(T);
+        return ptr;
+    }
+
+    template <typename T>
+    bool readVec(Vec<T> &v) {
+        uint64_t count = 0;
+        if (!read(count)) return false;
+        auto ptr = view<T>(count);
+        if (count > 0 && !ptr) return false;
+        v.assign(ptr, ptr + count);
+        return true;
+    }
+
+    bool readHeader(uint32_t model, uint32_t dataType, uint32_t labelType) {
+        FileHeader header;
+        if (!read(header) || std::memcmp(header.magic, kMagic, sizeof kMagic) != 0) {
+            printf("ERROR: not a stat model file\n");
+            return false;
+        }
+        if (header.version != kVersion) {
+            printf("ERROR: unsupported model file version %u (expect %u)\n", header.version,
+                   kVersion);
+            return false;
+        }
+        if (header.model != model) {
+            printf("ERROR: model type mismatch (file %u, expect %u)\n", header.model, model);
+            return false;
+        }
+        if (header.dataType != dataType || header.labelType != labelType) {
+            printf("ERROR: data/label type mismatch (file 0x%x/0x%x, expect 0x%x/0x%x)\n",
+                   header.dataType, header.labelType, dataType, labelType);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    const uint8_t *base;
+    std::size_t length;
+    std::size_t offset;
+
+    void align() { offset = (offset + kAlignment - 1) / kAlignment * kAlignment; }
+
+    bool reserve(std::size_t size) {
+        if (!base || offset > length || length - offset < size) {
+            if (base) printf("ERROR: model file truncated\n");
+            base = nullptr;
+            return false;
+        }
+        return true;
+    }
+};
+
+}  // namespace serialize
+}  // namespace stat
+
+#endif  // __SERIALIZE_H__
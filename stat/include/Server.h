@@ -0,0 +1,297 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include "Profile.h"
+#include "Stat.h"
+#include "Types.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace stat {
+
+struct ServerParam {
+    uint32_t maxBatch = 32;    // rows dispatched together at most
+    uint32_t maxWaitUs = 200;  // the first row of a batch waits this long at most for others
+    uint32_t sloUs = 0;        // latency target, shortens the wait by the time a batch takes, 0 off
+    uint32_t dim = 0;          // values in a row, 0 is the model's inputDim() or the first row's
+};
+
+/**
+ * Multi-producer single-consumer queue of intrusive nodes (D. Vyukov's). push() is one atomic
+ * exchange and one store, wait-free, from any thread. pop() is for one consumer thread only, it may
+ * return nothing for an instant while a push is half done, the pusher wakes the consumer after.
+ * Sequentially consistent throughout, a consumer going to sleep relies on it (Server::popOrWait).
+ */
+class MpscQueue {
+public:
+    struct Node {
+        std::atomic<Node *> next{nullptr};
+    };
+
+    MpscQueue() : head(&stub), tail(&stub) {}
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    void push(Node *node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        auto *prev = head.exchange(node);
+        prev->next.store(node);
+    }
+
+    Node *pop() {
+        auto *t = tail;
+        auto *next = t->next.load();
+        if (t == &stub) {
+            if (!next) return nullptr;
+            tail = t = next;
+            next = next->next.load();
+        }
+        if (next) {
+            tail = next;
+            return t;
+        }
+        if (t != head.load()) return nullptr;  // a push in between
+        push(&stub);
+        next = t->next.load();
+        if (!next) return nullptr;
+        tail = next;
+        return t;
+    }
+
+private:
+    std::atomic<Node *> head;  // last pushed, producers
+    Node *tail;                // next to pop, consumer
+    Node stub;
+};
+
+/**
+ * In-process inference front-end with micro-batching
+ *
+ * Any number of threads submit() single rows and get a future of the label. Requests go to a
+ * lock-free MPSC queue, one dispatcher thread drains it into batches of at most `maxBatch` rows and
+ * runs the batched predict of the model on each (AnyModel runs predictBatch() where the model has
+ * one), then completes the futures. A batch is closed when it is full or when its oldest row has
+ * waited `maxWaitUs`; a row that arrives while the dispatcher is busy waits in the queue and the
+ * next batch takes it at once if its deadline already passed, so under load batches fill up by
+ * themselves and at low load a lone row pays the wait at most.
+ *
+ * With `sloUs` set the wait is cut to what the target leaves after the time a batch takes (a
+ * moving average of the measured dispatch times), never longer than `maxWaitUs`: a slow model
+ * gives up batching before it gives up the target.
+ *
+ * Every row of a batch must have the same width, a row of another width than `dim` is refused by
+ * submit() with a future that already holds a std::invalid_argument, it never reaches a batch.
+ *
+ * The model is only called from the dispatcher thread, it must not be trained while a server runs
+ * on it. The destructor serves the requests still queued before it returns.
+ */
+template <typename DataType, typename LabelType>
+class Server {
+public:
+    using BatchFn = std::function<Vec<LabelType>(const Data<DataType> &)>;
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+        uint64_t requests = 0;
+        uint64_t batches = 0;
+        double serviceUs = 0.0;  // moving average of the time the model takes on a batch
+    };
+
+    // `predict` labels all rows of its argument, in order
+    explicit Server(BatchFn predict, const ServerParam &_param = {})
+        : param(_param), batchFn(std::move(predict)), width(param.dim) {
+        param.maxBatch = std::max(param.maxBatch, 1u);
+        dispatcher = std::thread([this] { run(); });
+    }
+
+    explicit Server(AnyModel<DataType, LabelType> &model, const ServerParam &_param = {})
+        : Server([&model](const Data<DataType> &X) { return model.predict(X); },
+                 withDim(_param, model.inputDim())) {}
+
+    // a model without batched path, rows of a batch are predicted one by one
+    explicit Server(Model<DataType, LabelType> &model, const ServerParam &_param = {})
+        : Server(
+              [&model](const Data<DataType> &X) {
+                  Vec<LabelType> labels(X.m);
+                  for (uint32_t i = 0; i < X.m; ++i) labels[i] = model.predict(X.data[i]);
+                  return labels;
+              },
+              withDim(_param, model.inputDim())) {}
+
+    ~Server() {
+        stopping.store(true, std::memory_order_seq_cst);
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            wakeup.notify_one();
+        }
+        dispatcher.join();
+    }
+
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
+    std::future<LabelType> submit(Vec<DataType> row) {
+        // the first row fixes the width if neither the param nor the model did
+        uint32_t expected = 0;
+        auto size = static_cast<uint32_t>(row.size());
+        if (!width.compare_exchange_strong(expected, size) && expected != size) {
+            std::promise<LabelType> refused;
+            refused.set_exception(std::make_exception_ptr(std::invalid_argument(
+                "row of " + std::to_string(size) + " values, expected " +
+                std::to_string(expected))));
+            return refused.get_future();
+        }
+        auto *request = new Request();
+        request->row = std::move(row);
+        request->arrival = Clock::now();
+        auto future = request->promise.get_future();
+        queue.push(request);
+        if (sleeping.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lk(lock);
+            wakeup.notify_one();
+        }
+        return future;
+    }
+
+    Stats stats() const {
+        Stats s;
+        s.requests = served.load(std::memory_order_relaxed);
+        s.batches = batches.load(std::memory_order_relaxed);
+        s.serviceUs = serviceNs.load(std::memory_order_relaxed) / 1e3;
+        return s;
+    }
+
+    const ServerParam &config() const { return param; }
+
+private:
+    struct Request : MpscQueue::Node {
+        Vec<DataType> row;
+        std::promise<LabelType> promise;
+        Clock::time_point arrival;
+    };
+
+    ServerParam param;
+    BatchFn batchFn;
+    std::atomic<uint32_t> width;  // of every row, 0 until known
+    MpscQueue queue;
+    std::mutex lock;  // only to sleep on, the queue itself takes none
+    std::condition_variable wakeup;
+    std::atomic<bool> sleeping{false};
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> served{0};
+    std::atomic<uint64_t> batches{0};
+    std::atomic<uint64_t> serviceNs{0};  // written by the dispatcher only
+    std::thread dispatcher;
+
+    static ServerParam withDim(ServerParam param, uint32_t dim) {
+        if (param.dim == 0) param.dim = dim;
+        return param;
+    }
+
+    Request *pop() { return static_cast<Request *>(queue.pop()); }
+
+    /**
+     * next request, sleeping until one comes or `deadline` passes. the flag is raised before the
+     * queue is checked again and a producer reads it after its push, one of the two sees the other
+     */
+    Request *popOrWait(const Clock::time_point *deadline) {
+        if (auto *request = pop()) return request;
+        std::unique_lock<std::mutex> lk(lock);
+        sleeping.store(true, std::memory_order_seq_cst);
+        auto *request = pop();
+        if (!request && !stopping.load(std::memory_order_seq_cst)) {
+            if (deadline) {
+                wakeup.wait_until(lk, *deadline);
+            } else {
+                wakeup.wait(lk);
+            }
+            request = pop();
+        }
+        sleeping.store(false, std::memory_order_relaxed);
+        return request;
+    }
+
+    Clock::duration window() const {
+        auto wait = std::chrono::microseconds(param.maxWaitUs);
+        if (param.sloUs == 0) return wait;
+        auto left = std::chrono::nanoseconds(int64_t(param.sloUs) * 1000 -
+                                             int64_t(serviceNs.load(std::memory_order_relaxed)));
+        return std::clamp<Clock::duration>(left, Clock::duration::zero(), wait);
+    }
+
+    void run() {
+        std::vector<Request *> batch;
+        batch.reserve(param.maxBatch);
+        while (true) {
+            auto *first = popOrWait(nullptr);
+            if (!first) {
+                if (stopping.load(std::memory_order_seq_cst)) break;
+                continue;
+            }
+            batch.push_back(first);
+            auto deadline = first->arrival + window();
+            while (batch.size() < param.maxBatch) {
+                if (auto *request = pop()) {
+                    batch.push_back(request);
+                } else if (Clock::now() >= deadline || stopping.load(std::memory_order_relaxed)) {
+                    break;
+                } else if (auto *request = popOrWait(&deadline)) {
+                    batch.push_back(request);
+                }
+            }
+            dispatch(batch);
+            batch.clear();
+        }
+    }
+
+    void dispatch(const std::vector<Request *> &batch) {
+        STAT_PROFILE_SCOPE("server/dispatch");
+        Data<DataType> X{Mat<DataType>(), uint32_t(batch.size()), 0};
+        X.data.reserve(batch.size());
+        for (auto *request : batch) X.data.emplace_back(std::move(request->row));
+        X.n = X.data.front().size();
+        Vec<LabelType> labels;
+        std::exception_ptr error;
+        auto start = Clock::now();
+        try {
+            labels = batchFn(X);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        // the model's time only, waking the callers below is not part of it.
+        // exponential moving average over about the last 8 batches
+        auto ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start)
+                               .count());
+        auto avg = serviceNs.load(std::memory_order_relaxed);
+        serviceNs.store(avg ? avg - avg / 8 + ns / 8 : ns, std::memory_order_relaxed);
+        served.fetch_add(batch.size(), std::memory_order_relaxed);
+        batches.fetch_add(1, std::memory_order_relaxed);
+
+        for (uint32_t i = 0; i < batch.size(); ++i) {
+            if (error) {
+                batch[i]->promise.set_exception(error);
+            } else {
+                batch[i]->promise.set_value(i < labels.size() ? labels[i] : LabelType());
+            }
+            delete batch[i];
+        }
+    }
+};
+
+}  // namespace stat
+
+#endif  // __SERVER_H__
@@ -1,35 +1,32 @@
 #ifndef __STAT_H__
 #define __STAT_H__
 
+#include "AdaBoost.h"
+#include "CRF.h"
+#include "DecisionTree.h"
+#include "DynamicKNN.h"
+#include "EM.h"
+#include "HMM.h"
 #include "KNN.h"
+#include "LogisticRegression.h"
 #include "Model.h"
 #include "NaiveBayes.h"
 #include "Perceptron.h"
+#include "SVM.h"
+#include "Transform.h"
 #include "Types.h"
 #include "Utils.h"
 
 #include <memory>
+#include <optional>
+#include <type_traits>
+#include <variant>
 
 namespace stat {
 
-enum ModelType : uint32_t {
-    MODEL_UNKNOWN,
-    MODEL_PERCEPTRON,           // Perceptron model
-    MODEL_KNN,                  // k-Nearest Neighbor model
-    MODEL_NAIVE_BAYES,          // Naive Bayes model
-    MODEL_DECISION_TREE,        // Decision tree model
-    MODEL_LOGISTIC_REGRESSION,  // Logistic regression model
-    MODEL_SVM,                  // Support Vector Machine model
-    MODEL_ADA_BOOST,            // AdaBoost model
-    MODEL_EM,                   // Expectation-Maximization
-    MODEL_HMM,                  // Hidden Markov Model
-    MODEL_CRF,                  // Condition Random Field
-    MODEL_END,
-};
-
 template <typename DataType, typename LabelType>
 std::unique_ptr<Model<DataType, LabelType>> CreateModel(ModelType type = ModelType::MODEL_UNKNOWN,
-                                                        ModelParam param = {{}}) {
+                                                        ModelParam param = {}) {
     std::unique_ptr<Model<DataType, LabelType>> model = nullptr;
     switch (type) {
         case MODEL_PERCEPTRON: {
@@ -47,18 +44,176 @@ std::unique_ptr<Model<DataType, LabelType>> CreateModel(ModelType type = ModelTy
             model = std::make_unique<NaiveBayes<DataType, LabelType>>(param);
             break;
         }
-        case MODEL_DECISION_TREE:
-        case MODEL_LOGISTIC_REGRESSION:
-        case MODEL_SVM:
-        case MODEL_ADA_BOOST:
-        case MODEL_EM:
-        case MODEL_HMM:
-        case MODEL_CRF:
+        case MODEL_DECISION_TREE: {
+            printf("INFO: creating Decision Tree model\n");
+            model = std::make_unique<DecisionTree<DataType, LabelType>>(param);
+            break;
+        }
+        case MODEL_LOGISTIC_REGRESSION: {
+            printf("INFO: creating Logistic Regression model\n");
+            model = std::make_unique<LogisticRegression<DataType, LabelType>>(param);
+            break;
+        }
+        case MODEL_SVM: {
+            printf("INFO: creating SVM model\n");
+            model = std::make_unique<SVM<DataType, LabelType>>(param);
+            break;
+        }
+        case MODEL_ADA_BOOST: {
+            printf("INFO: creating AdaBoost model\n");
+            model = std::make_unique<AdaBoost<DataType, LabelType>>(param);
+            break;
+        }
+        case MODEL_EM: {
+            printf("INFO: creating EM model\n");
+            model = std::make_unique<EM<DataType, LabelType>>(param);
+            break;
+        }
+        case MODEL_HMM: {
+            printf("ERROR: HMM is a sequence model, use stat::HMM directly.\n");
+            break;
+        }
+        case MODEL_CRF: {
+            printf("ERROR: CRF is a sequence model, use stat::CRF directly.\n");
+            break;
+        }
+        case MODEL_DYNAMIC_KNN: {
+            printf("ERROR: DynamicKNN is updated in place, use stat::DynamicKNN directly.\n");
+            break;
+        }
         default: printf("ERROR: unknown/unsupported model type.\n");
     }
     return model;
 }
 
+// typed params of every model, an alternative selects the model of an AnyModel
+using ModelConfig = std::variant<PerceptronParam, KnnParam, NaiveBayesParam, DecisionTreeParam,
+                                 LogisticRegressionParam, SvmParam, AdaBoostParam, EmParam>;
+
+// typed params of a model from string params, nothing for a model without typed params
+inline std::optional<ModelConfig> ParseModelConfig(ModelType type, const ModelParam &param = {}) {
+    switch (type) {
+        case MODEL_PERCEPTRON: return PerceptronParam::parse(param);
+        case MODEL_KNN: return KnnParam::parse(param);
+        case MODEL_NAIVE_BAYES: return NaiveBayesParam::parse(param);
+        case MODEL_DECISION_TREE: return DecisionTreeParam::parse(param);
+        case MODEL_LOGISTIC_REGRESSION: return LogisticRegressionParam::parse(param);
+        case MODEL_SVM: return SvmParam::parse(param);
+        case MODEL_ADA_BOOST: return AdaBoostParam::parse(param);
+        case MODEL_EM: return EmParam::parse(param);
+        default: printf("ERROR: unknown/unsupported model type.\n");
+    }
+    return std::nullopt;
+}
+
+/**
+ * Statically dispatched model handle
+ *
+ * Holds the model itself in a std::variant instead of behind a Model pointer. Every call is one
+ * switch on the alternative and then a direct call of the concrete model, whose members are all
+ * final, so the compiler binds and can inline them. A batch `predict()` dispatches once for all the
+ * rows: models with a batched kernel (`predictBatch()`) run it, the others loop over their inlined
+ * per-row `predict()`. This matters where a prediction is cheap, on small models a virtual call per
+ * row is a large part of the cost. `CreateModel()` stays the string-keyed, virtual entry point.
+ */
+template <typename DataType, typename LabelType>
+class AnyModel {
+public:
+    using Variant = std::variant<Perceptron<DataType, LabelType>, KNN<DataType, LabelType>,
+                                 NaiveBayes<DataType, LabelType>, DecisionTree<DataType, LabelType>,
+                                 LogisticRegression<DataType, LabelType>, SVM<DataType, LabelType>,
+                                 AdaBoost<DataType, LabelType>, EM<DataType, LabelType>>;
+
+    explicit AnyModel(const ModelConfig &config) {
+        std::visit([this](const auto &param) { emplace(param); }, config);
+    }
+
+    // models are built in place, some are neither copyable nor movable
+    AnyModel(const AnyModel &) = delete;
+    AnyModel &operator=(const AnyModel &) = delete;
+
+    // the ModelType of the held model
+    ModelType type() const {
+        static constexpr ModelType kTypes[] = {
+            MODEL_PERCEPTRON, MODEL_KNN, MODEL_NAIVE_BAYES, MODEL_DECISION_TREE,
+            MODEL_LOGISTIC_REGRESSION, MODEL_SVM, MODEL_ADA_BOOST, MODEL_EM,
+        };
+        return kTypes[model.index()];
+    }
+
+    bool train(const Data<DataType> &X_train, const Data<LabelType> &y_train) {
+        return std::visit([&](auto &m) { return m.train(X_train, y_train); }, model);
+    }
+
+    LabelType predict(const Vec<DataType> &X) {
+        return std::visit([&](auto &m) { return m.predict(X); }, model);
+    }
+
+    // labels of rows [0, X.m) of X
+    Vec<LabelType> predict(const Data<DataType> &X) {
+        return std::visit(
+            [&](auto &m) {
+                if constexpr (hasPredictBatch<std::decay_t<decltype(m)>>::value) {
+                    return m.predictBatch(X);
+                } else {
+                    Vec<LabelType> labels(X.m);
+                    for (uint32_t i = 0; i < X.m; ++i) labels[i] = m.predict(X.data[i]);
+                    return labels;
+                }
+            },
+            model);
+    }
+
+    double validate(const Data<DataType> &X_test, const Data<LabelType> &y_test) {
+        return std::visit([&](auto &m) { return m.validate(X_test, y_test); }, model);
+    }
+
+    void describe() const {
+        std::visit([](const auto &m) { m.describe(); }, model);
+    }
+
+    memory::Usage memoryUsage() const {
+        return std::visit([](const auto &m) { return m.memoryUsage(); }, model);
+    }
+
+    uint32_t inputDim() const {
+        return std::visit([](const auto &m) { return m.inputDim(); }, model);
+    }
+
+    bool save(const char *filename) const {
+        return std::visit([&](const auto &m) { return m.save(filename); }, model);
+    }
+
+    bool load(const char *filename) {
+        return std::visit([&](auto &m) { return m.load(filename); }, model);
+    }
+
+    // the concrete model, for calls outside the common interface
+    template <typename Visitor>
+    decltype(auto) visit(Visitor &&visitor) {
+        return std::visit(std::forward<Visitor>(visitor), model);
+    }
+
+private:
+    template <typename M, typename = void>
+    struct hasPredictBatch : std::false_type {};
+    template <typename M>
+    using predictBatchOf = decltype(std::declval<const M &>().predictBatch(Data<DataType>{}));
+    template <typename M>
+    struct hasPredictBatch<M, std::void_t<predictBatchOf<M>>> : std::true_type {};
+
+    Variant model;
+
+    void emplace(const PerceptronParam &p) { model.template emplace<0>(p); }
+    void emplace(const KnnParam &p) { model.template emplace<1>(p); }
+    void emplace(const NaiveBayesParam &p) { model.template emplace<2>(p); }
+    void emplace(const DecisionTreeParam &p) { model.template emplace<3>(p); }
+    void emplace(const LogisticRegressionParam &p) { model.template emplace<4>(p); }
+    void emplace(const SvmParam &p) { model.template emplace<5>(p); }
+    void emplace(const AdaBoostParam &p) { model.template emplace<6>(p); }
+    void emplace(const EmParam &p) { model.template emplace<7>(p); }
+};
+
 }  // namespace stat
 
 #endif  // __STAT_H__
\ No newline at end of file
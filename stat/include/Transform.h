@@ -0,0 +1,359 @@
+#ifndef __TRANSFORM_H__
+#define __TRANSFORM_H__
+
+#include "Math.h"
+#include "Model.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace stat {
+namespace transform {
+
+enum StepType : uint32_t {
+    MIN_MAX,      // x' = lo + (x - min) (hi - lo) / (max - min) per column
+    STANDARDIZE,  // x' = (x - mu) / sigma per column
+    BINARIZE,     // x' = x > threshold ? 1 : 0
+    PROJECT,      // x' = A (x - mean), A is out x in
+};
+
+/**
+ * Preprocessing pipeline of per-row steps, fitted on a training set and applied to any row with
+ * the same scaling afterwards.
+ *
+ * MIN_MAX and STANDARDIZE are fitted from the column summaries of one pass over the data (Math.h
+ * columnSummaries()), a later scaling step maps those summaries through the affine steps before
+ * it instead of reading the data again. Only a scaling step after BINARIZE or PROJECT needs another
+ * pass, over the rows transformed by the steps before it.
+ *
+ * Fitted steps are compiled to a short program where runs of affine steps fold into a single
+ * x' = a x + b per column. A row then goes through every step in one visit, and the loaders in
+ * Utils.h take the pipeline as their `transform` so each chunk of decoded rows is transformed
+ * while it is still in cache, without a second full pass or copy of the data set.
+ */
+class Pipeline {
+public:
+    Pipeline &minMax(double lo = 0.0, double hi = 1.0) {
+        Step step(MIN_MAX);
+        step.lo = lo;
+        step.hi = hi;
+        return add(std::move(step));
+    }
+
+    Pipeline &standardize() { return add(Step(STANDARDIZE)); }
+
+    Pipeline &binarize(double threshold) {
+        Step step(BINARIZE);
+        step.threshold = threshold;
+        return add(std::move(step));
+    }
+
+    // a fitted linear projection: components is out x in, row by row, mean is in
+    Pipeline &project(const Vec<double> &mean, const Vec<double> &components, uint32_t out) {
+        Step step(PROJECT);
+        step.in = static_cast<uint32_t>(mean.size());
+        step.out = out;
+        step.a = components;
+        step.b = mean;
+        return add(std::move(step));
+    }
+
+    std::size_t size() const { return steps.size(); }
+    bool fitted() const { return isFitted; }
+    uint32_t inputDim() const { return in; }
+    uint32_t outputDim() const { return out; }
+
+    template <typename T>
+    bool fit(const Data<T> &X) {
+        STAT_PROFILE_SCOPE(__func__);
+
+        if (X.m == 0 || X.n == 0) {
+            printf("ERROR: invalid training set\n");
+            return false;
+        }
+        isFitted = false;
+        in = X.n;
+        uint32_t dim = X.n;
+        std::vector<Summary> stats;
+        bool current = false;  // stats describe the output of the fitted steps so far
+        for (std::size_t s = 0; s < steps.size(); ++s) {
+            auto &step = steps[s];
+            if (step.type == MIN_MAX || step.type == STANDARDIZE) {
+                if (!current) {
+                    stats = s == 0 ? columnSummaries(X) : prefixSummaries(X, s);
+                    current = true;
+                }
+                step.in = step.out = dim;
+                step.a.assign(dim, 0.0);
+                step.b.assign(dim, 0.0);
+                for (uint32_t j = 0; j < dim; ++j) {
+                    const auto &c = stats[j];
+                    double range = c.max - c.min, sigma = c.stdev();
+                    // constant columns map to lo (min-max) or 0 (z-score)
+                    if (step.type == MIN_MAX) {
+                        step.a[j] = range > 0 ? (step.hi - step.lo) / range : 0.0;
+                        step.b[j] = step.lo - c.min * step.a[j];
+                    } else {
+                        step.a[j] = sigma > 0 ? 1.0 / sigma : 0.0;
+                        step.b[j] = -c.mean * step.a[j];
+                    }
+                    // summary of the scaled column
+                    double a = step.a[j], b = step.b[j];
+                    Summary next{c.count, a * c.mean + b, a * a * c.m2, a * c.min + b, a * c.max + b};
+                    if (a < 0) std::swap(next.min, next.max);
+                    stats[j] = next;
+                }
+            } else if (step.type == BINARIZE) {
+                step.in = step.out = dim;
+                current = false;
+            } else {
+                if (step.in != dim || step.a.size() != static_cast<std::size_t>(step.out) * dim) {
+                    printf("ERROR: projection of %u columns after %u columns\n", step.in, dim);
+                    return false;
+                }
+                dim = step.out;
+                current = false;
+            }
+        }
+        out = dim;
+        compile();
+        isFitted = true;
+        return true;
+    }
+
+    // transforms X in place, rows in parallel. false, X untouched, if a row is not inputDim() wide
+    template <typename T>
+    bool transform(Data<T> &X) const {
+        STAT_PROFILE_SCOPE(__func__);
+
+        if (!isFitted) {
+            printf("ERROR: transform is not fitted yet\n");
+            return false;
+        }
+        if (X.m == 0) return true;
+        if (X.data.size() != X.m) {
+            printf("ERROR: data set of %u rows holds %zu rows\n", X.m, X.data.size());
+            return false;
+        }
+        if (X.n != in) {
+            printf("ERROR: transform of %u columns applied to rows of %u columns\n", in, X.n);
+            return false;
+        }
+        if (!(*this)(X.data.data(), X.data.size())) return false;
+        X.n = out;
+        return true;
+    }
+
+    template <typename T>
+    bool fitTransform(Data<T> &X) {
+        return fit(X) && transform(X);
+    }
+
+    // transforms one row of inputDim() values into outputDim() values, out may alias in
+    template <typename T>
+    void apply(const T *x, T *y) const {
+        thread_local Vec<double> buffer, scratch;
+        buffer.assign(x, x + in);
+        for (const auto &op : program) {
+            auto n = op.in;
+            auto v = buffer.data();
+            switch (op.type) {
+                case MIN_MAX:
+                case STANDARDIZE: {
+                    for (uint32_t j = 0; j < n; ++j) v[j] = v[j] * op.a[j] + op.b[j];
+                    break;
+                }
+                case BINARIZE: {
+                    for (uint32_t j = 0; j < n; ++j) v[j] = v[j] > op.threshold ? 1.0 : 0.0;
+                    break;
+                }
+                case PROJECT: {
+                    // A (x - mean) = A x - A mean, the second term folded into b at compile time
+                    scratch.resize(op.out);
+                    for (uint32_t k = 0; k < op.out; ++k) {
+                        scratch[k] = dot(op.a.data() + static_cast<std::size_t>(k) * n, v, n) +
+                                     op.b[k];
+                    }
+                    std::swap(buffer, scratch);
+                    break;
+                }
+            }
+        }
+        for (uint32_t j = 0; j < out; ++j) y[j] = static_cast<T>(buffer[j]);
+    }
+
+    /**
+     * transforms `count` rows in place, resized when the output width differs. the chunk hook of
+     * the loaders, a chunk is still in cache from decoding. false, rows untouched, if a row is not
+     * inputDim() wide
+     */
+    template <typename T>
+    bool operator()(Vec<T> *rows, std::size_t count) const {
+        auto misfit = std::find_if(rows, rows + count,
+                                   [this](const Vec<T> &row) { return row.size() != in; });
+        if (misfit != rows + count) {
+            printf("ERROR: transform of %u columns applied to rows of %zu columns\n", in,
+                   misfit->size());
+            return false;
+        }
+        parallel::parallelFor(0, count, 16, [&](std::size_t lo, std::size_t hi) {
+            for (auto i = lo; i < hi; ++i) {
+                auto &row = rows[i];
+                if (out > in) row.resize(out);
+                apply(row.data(), row.data());
+                row.resize(out);
+            }
+        });
+        return true;
+    }
+
+    bool save(const char *filename) const {
+        if (!isFitted) {
+            printf("ERROR: transform is not fitted yet\n");
+            return false;
+        }
+        serialize::Writer writer(filename);
+        writer.writeHeader(MODEL_TRANSFORM, serialize::typeTag<double>(),
+                           serialize::typeTag<double>());
+        writer.write(FileHeader{static_cast<uint32_t>(steps.size()), in, out, 0});
+        for (const auto &step : steps) {
+            writer.write(StepHeader{step.type, step.in, step.out, 0, step.threshold});
+            writer.writeVec(step.a);
+            writer.writeVec(step.b);
+        }
+        return writer.good();
+    }
+
+    bool load(const char *filename) {
+        serialize::MappedFile file(filename);
+        serialize::Reader reader(file);
+        if (!reader.readHeader(MODEL_TRANSFORM, serialize::typeTag<double>(),
+                               serialize::typeTag<double>())) {
+            return false;
+        }
+        FileHeader header;
+        bool ok = reader.read(header);
+        std::vector<Step> loaded(ok ? header.steps : 0);
+        uint32_t dim = header.in;
+        for (auto &step : loaded) {
+            StepHeader sh;
+            // only a projection changes the width
+            ok = ok && reader.read(sh) && sh.type <= PROJECT && sh.in == dim &&
+                 (sh.type == PROJECT || sh.out == sh.in) && reader.readVec(step.a) &&
+                 reader.readVec(step.b);
+            if (!ok) break;
+            step.type = static_cast<StepType>(sh.type);
+            step.in = sh.in;
+            step.out = sh.out;
+            step.threshold = sh.threshold;
+            std::size_t aSize = step.type == PROJECT ? std::size_t(step.out) * step.in
+                                : step.type == BINARIZE ? 0
+                                                        : step.in;
+            ok = step.a.size() == aSize && step.b.size() == (step.type == BINARIZE ? 0 : step.in);
+            dim = step.out;
+        }
+        if (!ok || dim != header.out) {
+            printf("ERROR: corrupted transform file (%s)\n", filename);
+            return false;
+        }
+        steps = std::move(loaded);
+        in = header.in;
+        out = header.out;
+        compile();
+        isFitted = true;
+        return true;
+    }
+
+private:
+    // fixed size part of the saved pipeline, the steps follow
+    struct FileHeader {
+        uint32_t steps;
+        uint32_t in;
+        uint32_t out;
+        uint32_t reserved;
+    };
+
+    struct StepHeader {
+        uint32_t type;
+        uint32_t in;
+        uint32_t out;
+        uint32_t reserved;
+        double threshold;
+    };
+
+    struct Step {
+        Step() = default;
+        explicit Step(StepType _type) : type(_type) {}
+
+        StepType type = MIN_MAX;
+        uint32_t in = 0;
+        uint32_t out = 0;
+        double lo = 0.0, hi = 1.0;  // MIN_MAX target range
+        double threshold = 0.0;     // BINARIZE
+        Vec<double> a;              // scale per column, or the projection matrix
+        Vec<double> b;              // shift per column, or the mean before projection
+    };
+
+    std::vector<Step> steps;
+    std::vector<Step> program;  // fitted steps with affine runs folded
+    uint32_t in = 0;
+    uint32_t out = 0;
+    bool isFitted = false;
+
+    Pipeline &add(Step step) {
+        steps.emplace_back(std::move(step));
+        isFitted = false;
+        return *this;
+    }
+
+    void compile() {
+        program.clear();
+        for (const auto &step : steps) {
+            bool affine = step.type == MIN_MAX || step.type == STANDARDIZE;
+            if (affine && !program.empty() && program.back().type != BINARIZE &&
+                program.back().type != PROJECT) {
+                // (a1 x + b1) a2 + b2
+                auto &last = program.back();
+                for (uint32_t j = 0; j < step.in; ++j) {
+                    last.a[j] *= step.a[j];
+                    last.b[j] = last.b[j] * step.a[j] + step.b[j];
+                }
+                continue;
+            }
+            program.emplace_back(step);
+            if (step.type == PROJECT) {
+                auto &op = program.back();
+                Vec<double> bias(op.out);
+                for (uint32_t k = 0; k < op.out; ++k) {
+                    bias[k] = -dot(op.a.data() + static_cast<std::size_t>(k) * op.in, op.b.data(),
+                                   op.in);
+                }
+                op.b = std::move(bias);
+            }
+        }
+    }
+
+    // column summaries of X transformed by the (fitted) first `count` steps
+    template <typename T>
+    std::vector<Summary> prefixSummaries(const Data<T> &X, std::size_t count) {
+        Pipeline prefix;
+        prefix.steps.assign(steps.begin(), steps.begin() + count);
+        prefix.in = X.n;
+        prefix.out = prefix.steps.back().out;
+        prefix.compile();
+        prefix.isFitted = true;
+        Data<double> Y{Mat<double>(X.m), X.m, X.n};
+        for (uint32_t i = 0; i < X.m; ++i) Y.data[i].assign(X.data[i].cbegin(), X.data[i].cend());
+        prefix.transform(Y);
+        return columnSummaries(Y);
+    }
+};
+
+}  // namespace transform
+}  // namespace stat
+
+#endif  // __TRANSFORM_H__
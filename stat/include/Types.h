@@ -2,23 +2,74 @@
 #define __TYPES_H__
 
 #include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <utility>
 #include <vector>
 
 namespace stat {
 
-// 1-D vector type
+// 1-D vector type. a std::pmr vector: it allocates from the default resource unless given one
+// (memory::Arena, memory::hugePages() in Memory.h). a copy goes to the default resource, moving
+// between two resources copies the elements
 template <typename T>
-using Vec = std::vector<T>;
+using Vec = std::pmr::vector<T>;
 
-// 2-D matrix type
+// 2-D matrix type, rows emplaced into a matrix allocate from the resource of the matrix
 template <typename T>
-using Mat = std::vector<Vec<T>>;
+using Mat = Vec<Vec<T>>;
+
+// column-major copy of a matrix, column j is the contiguous range [col(j), col(j) + m)
+template <typename T>
+struct ColMajor {
+    Vec<T> data;
+    uint32_t m = 0;  // rows
+    uint32_t n = 0;  // cols
+
+    const T *col(uint32_t j) const { return data.data() + static_cast<std::size_t>(j) * m; }
+};
 
 template <typename T = float>
 struct Data {
     Mat<T> data;
-    uint32_t m;
-    uint32_t n;
+    uint32_t m = 0;
+    uint32_t n = 0;
+    // resource `data` was allocated from (a loader arena), kept alive as long as the data set
+    std::shared_ptr<std::pmr::memory_resource> memory = nullptr;
+
+    // {data, m, n[, memory]}, as the brace-initialized aggregate it was. the rows are released
+    // before `memory` goes
+    Data(Mat<T> rows = {}, uint32_t rows_num = 0, uint32_t cols_num = 0,
+         std::shared_ptr<std::pmr::memory_resource> resource = nullptr)
+        : data(std::move(rows)), m(rows_num), n(cols_num), memory(std::move(resource)) {}
+    Data(const Data &) = default;
+    Data(Data &&) = default;
+
+    Data &operator=(const Data &other) {
+        if (this != &other) *this = Data(other);
+        return *this;
+    }
+
+    // as any pmr container, this data set keeps its resource: the rows of `other` are taken over
+    // when both share one, moved into this resource otherwise
+    Data &operator=(Data &&other) {
+        if (this == &other) return *this;
+        bool shared = data.get_allocator() == other.data.get_allocator();
+        data = std::move(other.data);
+        m = other.m;
+        n = other.n;
+        if (shared && other.memory) memory = std::move(other.memory);
+        return *this;
+    }
+
+    ~Data() { release(); }
+
+private:
+    void release() {
+        if (!memory) return;
+        data.clear();
+        data.shrink_to_fit();
+    }
 };
 
 }  // namespace stat
@@ -3,13 +3,15 @@
 
 #include "Types.h"
 
-#include <chrono>
-#include <cinttypes>
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
-#include <ratio>
+#include <memory>
+#include <memory_resource>
+#include <random>
 #include <sstream>
 #include <string>
 #include <tuple>
@@ -17,6 +19,21 @@
 #include <arpa/inet.h>
 
 namespace stat {
+
+// rows decoded by a loader before its transform runs on them, ~200KB of MNIST floats
+constexpr uint32_t kLoadChunkRows = 64;
+
+/**
+ * transform hook of the loaders: `transform(rows, count)` rewrites count freshly decoded rows in
+ * place (it may change their width), false fails the load. transform::Pipeline (Transform.h) is one
+ */
+struct NoTransform {
+    template <typename T>
+    bool operator()(Vec<T> *, std::size_t) const {
+        return true;
+    }
+};
+
 namespace mnist {
 
 // mnist dataset utils
@@ -41,12 +58,18 @@ uint32_t ImageHeight = 0;
 constexpr uint32_t kMagicImage = 0x00000803;
 constexpr uint32_t kMagicLabel = 0x00000801;
 
-template <typename DataType = float>
-Data<DataType> loadData(const char *filename) {
+/**
+ * rows are allocated from `memory` when given (memory::makeArena(), Memory.h): a monotonic arena
+ * turns the one allocation per row into a few large ones, the data set keeps the arena alive.
+ * a copy of the data set is back on the default resource, move it into a new one to keep the arena
+ */
+template <typename DataType = float, typename Transform = NoTransform>
+Data<DataType> loadData(const char *filename, const Transform &transform = {},
+                        std::shared_ptr<std::pmr::memory_resource> memory = nullptr) {
     std::fstream fin(filename, std::fstream::binary | std::fstream::in);
     if (fin.is_open()) {
         uint32_t magic_number = 0, item_num = 0, image_rows = 1, image_cols = 1;
-        Mat<DataType> data;
+        Mat<DataType> data(memory ? memory.get() : std::pmr::get_default_resource());
         fin.read((char *)&magic_number, sizeof magic_number);
         fin.read((char *)&item_num, sizeof item_num);
         magic_number = ::ntohl(magic_number);
@@ -62,38 +85,49 @@ Data<DataType> loadData(const char *filename) {
         }
         auto vector_size = image_rows * image_cols;
 
-        for (auto it = 0; it < item_num; ++it) {
-            Vec<DataType> v;
-            for (auto i = 0; i < vector_size; ++i) {
-                uint8_t e = 0;
-                fin.read((char *)&e, sizeof e);
-                v.emplace_back(static_cast<DataType>(e));
+        // items are read kLoadChunkRows at a time and transformed while the chunk is in cache
+        data.reserve(item_num);
+        std::vector<uint8_t> bytes;
+        for (uint32_t first = 0; first < item_num; first += kLoadChunkRows) {
+            auto count = std::min(kLoadChunkRows, item_num - first);
+            bytes.resize(static_cast<std::size_t>(count) * vector_size);
+            fin.read((char *)bytes.data(), bytes.size());
+            if (!fin) {
+                printf("ERROR: truncated data file (%s)\n", filename);
+                return {{}, 0, 0};
             }
-            data.emplace_back(std::move(v));
-            v.clear();
+            for (uint32_t i = 0; i < count; ++i) {
+                auto row = bytes.data() + static_cast<std::size_t>(i) * vector_size;
+                data.emplace_back(row, row + vector_size);
+            }
+            if (!transform(data.data() + first, count)) return {{}, 0, 0};
         }
         fin.close();
         // printf("INFO: load (%s) successfully\n", filename);
-        return {data, item_num, vector_size};
+        uint32_t n = data.empty() ? vector_size : static_cast<uint32_t>(data[0].size());
+        return {std::move(data), item_num, n, std::move(memory)};
     } else {
         printf("ERROR: failed to load data from (%s)\n", filename);
         return {{}, 0, 0};
     }
 }
 
-template <typename DataType = float>
-std::tuple<Data<DataType>, Data<DataType>> loadTrainSet() {
-    auto train_image = loadData<DataType>(kMnistTrainImages);
-    auto train_label = loadData<DataType>(kMnistTrainLables);
+// images go through `transform`, labels are kept as is. images and labels share `memory`
+template <typename DataType = float, typename Transform = NoTransform>
+std::tuple<Data<DataType>, Data<DataType>> loadTrainSet(
+    const Transform &transform = {}, std::shared_ptr<std::pmr::memory_resource> memory = nullptr) {
+    auto train_image = loadData<DataType>(kMnistTrainImages, transform, memory);
+    auto train_label = loadData<DataType>(kMnistTrainLables, NoTransform{}, memory);
     // if use C++17, just return {train_image, train_label}
-    return std::make_tuple(train_image, train_label);
+    return std::make_tuple(std::move(train_image), std::move(train_label));
 }
 
-template <typename DataType = float>
-std::tuple<Data<DataType>, Data<DataType>> loadTestSet() {
-    auto test_image = loadData<DataType>(kMnistTestImages);
-    auto test_label = loadData<DataType>(kMnistTestLables);
-    return std::make_tuple(test_image, test_label);
+template <typename DataType = float, typename Transform = NoTransform>
+std::tuple<Data<DataType>, Data<DataType>> loadTestSet(
+    const Transform &transform = {}, std::shared_ptr<std::pmr::memory_resource> memory = nullptr) {
+    auto test_image = loadData<DataType>(kMnistTestImages, transform, memory);
+    auto test_label = loadData<DataType>(kMnistTestLables, NoTransform{}, memory);
+    return std::make_tuple(std::move(test_image), std::move(test_label));
 }
 
 }  // namespace mnist
@@ -104,15 +138,17 @@ constexpr const char *kIrisTrainY = "data/iris/y_train";
 constexpr const char *kIrisTestX = "data/iris/X_test";
 constexpr const char *kIrisTestY = "data/iris/y_test";
 
-template <typename DataType = float>
-Data<DataType> loadData(const char *filename) {
+// rows are allocated from `memory` when given, like mnist::loadData()
+template <typename DataType = float, typename Transform = NoTransform>
+Data<DataType> loadData(const char *filename, const Transform &transform = {},
+                        std::shared_ptr<std::pmr::memory_resource> memory = nullptr) {
     std::fstream fin(filename, std::fstream::binary | std::fstream::in);
     if (fin.is_open()) {
-        Mat<DataType> data;
-        uint32_t rows = 0, cols = 0;
+        Mat<DataType> data(memory ? memory.get() : std::pmr::get_default_resource());
+        uint32_t rows = 0, cols = 0, pending = 0;
         std::string line;
         while (std::getline(fin, line)) {
-            Vec<DataType> v;
+            Vec<DataType> v(data.get_allocator());
             ++rows;
             cols = 0;
             std::stringstream ss(line);
@@ -124,83 +160,111 @@ Data<DataType> loadData(const char *filename) {
             }
             data.emplace_back(std::move(v));
             v.clear();
+            if (++pending == kLoadChunkRows) {
+                if (!transform(data.data() + data.size() - pending, pending)) return {{}, 0, 0};
+                pending = 0;
+            }
         }
-        return {data, rows, cols};
+        if (!transform(data.data() + data.size() - pending, pending)) return {{}, 0, 0};
+        if (!data.empty()) cols = static_cast<uint32_t>(data[0].size());
+        return {std::move(data), rows, cols, std::move(memory)};
     } else {
         printf("ERROR: failed to load data from (%s)\n", filename);
         return {{}, 0, 0};
     }
 }
 
-template <typename DataType = float>
-std::tuple<Data<DataType>, Data<DataType>> loadTrainSet() {
-    auto train_data = loadData<DataType>(kIrisTrainX);
-    auto train_label = loadData<DataType>(kIrisTrainY);
-    return std::make_tuple(train_data, train_label);
+template <typename DataType = float, typename Transform = NoTransform>
+std::tuple<Data<DataType>, Data<DataType>> loadTrainSet(
+    const Transform &transform = {}, std::shared_ptr<std::pmr::memory_resource> memory = nullptr) {
+    auto train_data = loadData<DataType>(kIrisTrainX, transform, memory);
+    auto train_label = loadData<DataType>(kIrisTrainY, NoTransform{}, memory);
+    return std::make_tuple(std::move(train_data), std::move(train_label));
 }
 
-template <typename DataType = float>
-std::tuple<Data<DataType>, Data<DataType>> loadTestSet() {
-    auto test_data = loadData<DataType>(kIrisTestX);
-    auto test_label = loadData<DataType>(kIrisTestY);
-    return std::make_tuple(test_data, test_label);
+template <typename DataType = float, typename Transform = NoTransform>
+std::tuple<Data<DataType>, Data<DataType>> loadTestSet(
+    const Transform &transform = {}, std::shared_ptr<std::pmr::memory_resource> memory = nullptr) {
+    auto test_data = loadData<DataType>(kIrisTestX, transform, memory);
+    auto test_label = loadData<DataType>(kIrisTestY, NoTransform{}, memory);
+    return std::make_tuple(std::move(test_data), std::move(test_label));
 }
 }  // namespace iris
 
-// time utils
+namespace synthetic {
 
-using TP = std::chrono::high_resolution_clock::time_point;
+// synthetic datasets, they make benchmarks and tests runnable without any dataset file. labels
+// follow the bundled datasets: -1/+1 for 2 classes (like iris), 0..classes-1 otherwise (like mnist)
 
-// Ref: https://stackoverflow.com/questions/42138599/how-to-format-stdchrono-durations
-template <typename... Durations, typename DurationIn>
-std::tuple<Durations...> break_down_durations(DurationIn d) {
-    std::tuple<Durations...> retval;
-    using discard = int[];
-    (void)discard{
-        0, (void(((std::get<Durations>(retval) = std::chrono::duration_cast<Durations>(d)),
-                  (d -= std::chrono::duration_cast<DurationIn>(std::get<Durations>(retval))))),
-            0)...};
-    return retval;
+template <typename LabelType>
+LabelType classLabel(uint32_t c, uint32_t classes) {
+    if (classes == 2) return static_cast<LabelType>(c == 0 ? -1 : 1);
+    return static_cast<LabelType>(c);
 }
 
-class Clock {
-public:
-    explicit Clock(const char *msg = "") : message(msg) {
-        printf("INFO: Entering function (%s)...\n\n", message.c_str());
-        start_point = std::chrono::high_resolution_clock::now();
+/**
+ * m samples of n features drawn from `classes` isotropic gaussian blobs (unit variance), blob
+ * centers are uniform in [-spread, spread]^n
+ */
+template <typename DataType = float>
+std::tuple<Data<DataType>, Data<DataType>> makeBlobs(uint32_t m, uint32_t n, uint32_t classes = 2,
+                                                     uint32_t seed = 0, double spread = 4.0) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> uniform(-spread, spread);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    classes = std::max<uint32_t>(classes, 1);
+    Mat<double> centers(classes, Vec<double>(n));
+    for (auto &c : centers) {
+        for (auto &v : c) v = uniform(gen);
     }
+    Mat<DataType> X, y;
+    X.reserve(m);
+    y.reserve(m);
+    for (uint32_t i = 0; i < m; ++i) {
+        auto c = gen() % classes;
+        Vec<DataType> v(n);
+        for (uint32_t j = 0; j < n; ++j) v[j] = static_cast<DataType>(centers[c][j] + normal(gen));
+        X.emplace_back(std::move(v));
+        y.push_back({classLabel<DataType>(c, classes)});
+    }
+    return std::make_tuple(Data<DataType>{X, m, n}, Data<DataType>{y, m, 1});
+}
 
-    ~Clock() {
-        end_point = std::chrono::high_resolution_clock::now();
-        auto duration = end_point - start_point;
-        auto [hour, min, sec, mil] =
-            break_down_durations<std::chrono::hours, std::chrono::minutes, std::chrono::seconds,
-                                 std::chrono::milliseconds>(duration);
-
-        bool all_zero = true;
-
-        auto append_time = [&all_zero](const auto &duration, const char *suffix) {
-            auto cnt = static_cast<uint64_t>(duration.count());
-            if (cnt != 0) {
-                all_zero = false;
-                printf("%" PRIu64 "%s ", cnt, suffix);
-            }
-        };
-
-        printf("INFO: Exiting function (%s)...\n", message.c_str());
-        append_time(hour, "h");
-        append_time(min, "m");
-        append_time(sec, "s");
-        append_time(mil, "ms");
-        if (all_zero) { printf("0ms "); }
-        printf("elapsed\n\n");
+/**
+ * m linearly separable samples of n features in [-1, 1]^n, labeled -1/+1 by a random hyperplane
+ * through the origin. samples closer than `margin` to the plane are rejected, so perceptron
+ * training is guaranteed to converge.
+ */
+template <typename DataType = float>
+std::tuple<Data<DataType>, Data<DataType>> makeSeparable(uint32_t m, uint32_t n, uint32_t seed = 0,
+                                                         double margin = 0.1) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    Vec<double> w(n);
+    double norm = 0.0;
+    for (auto &v : w) {
+        v = uniform(gen);
+        norm += v * v;
     }
+    norm = std::sqrt(norm);
+    Mat<DataType> X, y;
+    X.reserve(m);
+    y.reserve(m);
+    while (X.size() < m) {
+        Vec<DataType> v(n);
+        double d = 0.0;
+        for (uint32_t j = 0; j < n; ++j) {
+            v[j] = static_cast<DataType>(uniform(gen));
+            d += w[j] * v[j];
+        }
+        if (std::abs(d) / norm < margin) continue;
+        X.emplace_back(std::move(v));
+        y.push_back({static_cast<DataType>(d > 0 ? 1 : -1)});
+    }
+    return std::make_tuple(Data<DataType>{X, m, n}, Data<DataType>{y, m, 1});
+}
 
-private:
-    std::string message;
-    TP start_point;
-    TP end_point;
-};
+}  // namespace synthetic
 
 }  // namespace stat
 
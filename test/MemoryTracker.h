@@ -0,0 +1,118 @@
+#ifndef __MEMORY_TRACKER_H__
+#define __MEMORY_TRACKER_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+/**
+ * Tracking global allocator of the test programs. It replaces operator new and delete, so every
+ * heap allocation of the program is counted: the bytes live now and the peak since the last
+ * resetPeak(). Include it in exactly one translation unit of a program (every test is one). Huge
+ * page mappings of stat::memory::hugePages() bypass operator new and are not seen, its mapped()
+ * reports them.
+ *
+ *  tracker::resetPeak();
+ *  auto before = tracker::current();
+ *  model.train(X, y);
+ *  auto retained = tracker::current() - before;   // compare with model.memoryUsage().total()
+ *  auto peak = tracker::peak() - before;          // high-water mark of the training
+ */
+
+namespace tracker {
+namespace detail {
+
+inline std::atomic<std::size_t> live{0};
+inline std::atomic<std::size_t> high{0};
+inline std::atomic<uint64_t> count{0};
+
+// the size and the header length are stored right before the returned block
+constexpr std::size_t kHeader = alignof(std::max_align_t);
+
+inline void *allocate(std::size_t size, std::size_t align, bool nothrow = false) {
+    std::size_t pad = std::max(kHeader, align);
+    void *base = align > kHeader
+                     ? std::aligned_alloc(align, (pad + size + align - 1) / align * align)
+                     : std::malloc(pad + size);
+    if (!base) {
+        if (nothrow) return nullptr;
+        throw std::bad_alloc();
+    }
+    auto *p = static_cast<char *>(base) + pad;
+    reinterpret_cast<std::size_t *>(p)[-1] = pad;
+    reinterpret_cast<std::size_t *>(p)[-2] = size;
+    auto now = live.fetch_add(size, std::memory_order_relaxed) + size;
+    auto top = high.load(std::memory_order_relaxed);
+    while (now > top && !high.compare_exchange_weak(top, now, std::memory_order_relaxed)) {}
+    count.fetch_add(1, std::memory_order_relaxed);
+    return p;
+}
+
+inline void release(void *ptr) {
+    if (!ptr) return;
+    auto *p = static_cast<char *>(ptr);
+    auto pad = reinterpret_cast<std::size_t *>(p)[-1];
+    live.fetch_sub(reinterpret_cast<std::size_t *>(p)[-2], std::memory_order_relaxed);
+    std::free(p - pad);
+}
+
+}  // namespace detail
+
+// heap bytes allocated and not yet freed
+inline std::size_t current() { return detail::live.load(std::memory_order_relaxed); }
+
+// highest current() since the start or the last resetPeak()
+inline std::size_t peak() { return detail::high.load(std::memory_order_relaxed); }
+
+inline void resetPeak() { detail::high.store(current(), std::memory_order_relaxed); }
+
+inline uint64_t allocations() { return detail::count.load(std::memory_order_relaxed); }
+
+}  // namespace tracker
+
+void *operator new(std::size_t size) { return tracker::detail::allocate(size, 0); }
+void *operator new[](std::size_t size) { return tracker::detail::allocate(size, 0); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    return tracker::detail::allocate(size, 0, true);
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    return tracker::detail::allocate(size, 0, true);
+}
+void *operator new(std::size_t size, std::align_val_t align) {
+    return tracker::detail::allocate(size, static_cast<std::size_t>(align));
+}
+void *operator new[](std::size_t size, std::align_val_t align) {
+    return tracker::detail::allocate(size, static_cast<std::size_t>(align));
+}
+void *operator new(std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+    return tracker::detail::allocate(size, static_cast<std::size_t>(align), true);
+}
+void *operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+    return tracker::detail::allocate(size, static_cast<std::size_t>(align), true);
+}
+
+void operator delete(void *p) noexcept { tracker::detail::release(p); }
+void operator delete[](void *p) noexcept { tracker::detail::release(p); }
+void operator delete(void *p, std::size_t) noexcept { tracker::detail::release(p); }
+void operator delete[](void *p, std::size_t) noexcept { tracker::detail::release(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { tracker::detail::release(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { tracker::detail::release(p); }
+void operator delete(void *p, std::align_val_t) noexcept { tracker::detail::release(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { tracker::detail::release(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+    tracker::detail::release(p);
+}
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+    tracker::detail::release(p);
+}
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+    tracker::detail::release(p);
+}
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+    tracker::detail::release(p);
+}
+
+#endif  // __MEMORY_TRACKER_H__
@@ -1,5 +1,12 @@
+#include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
 
+#include "Memory.h"
+#include "MemoryTracker.h"
+#include "Transform.h"
 #include "Types.h"
 #include "Utils.h"
 
@@ -63,5 +70,149 @@ int main() {
         disp(testY, "test y");
     }
 
+    // TRANSFORM
+    {
+        printf("TRANSFORM\n");
+        auto close = [](double a, double b) { return std::abs(a - b) <= 1e-5 * (1.0 + std::abs(b)); };
+        auto same = [&](const stat::Data<float> &a, const stat::Data<float> &b) {
+            bool ok = a.m == b.m && a.n == b.n;
+            for (uint32_t i = 0; ok && i < a.m; ++i) {
+                for (uint32_t j = 0; ok && j < a.n; ++j) ok = close(a.data[i][j], b.data[i][j]);
+            }
+            return ok;
+        };
+
+        auto trainX = stat::iris::loadData<float>(stat::iris::kIrisTrainX);
+        if (trainX.m > 0) {
+            // z-scored columns, with a min-max step before it folded into one affine step
+            stat::transform::Pipeline pipeline;
+            pipeline.minMax(-1.0, 1.0).standardize();
+            bool ok = pipeline.fit(trainX);
+            auto scaled = trainX;
+            ok = ok && pipeline.transform(scaled);
+            auto stats = stat::columnSummaries(scaled);
+            for (const auto &c : stats) ok = ok && close(c.mean, 0.0) && close(c.stdev(), 1.0);
+            printf("min-max then standardize: %s\n", ok ? "passed" : "FAILED");
+
+            // fused into the loader, a saved pipeline scales the test set the same after loading
+            auto testX = stat::iris::loadData<float>(stat::iris::kIrisTestX);
+            pipeline.transform(testX);
+            stat::transform::Pipeline loaded;
+            ok = pipeline.save("out/transform.model") && loaded.load("out/transform.model") &&
+                 same(stat::iris::loadData<float>(stat::iris::kIrisTestX, loaded), testX);
+            printf("fused load and save/load round trip: %s\n", ok ? "passed" : "FAILED");
+
+            // binarize then a projection onto the petal coordinates, and a scaling step after the
+            // binarization fitted on binarized rows
+            stat::transform::Pipeline project;
+            uint32_t n = trainX.n;
+            stat::Vec<double> mean(n, 0.5), components(2 * n, 0.0);
+            components[2] = components[n + 3] = 1.0;
+            project.binarize(1.5).project(mean, components, 2).minMax();
+            auto projected = trainX;
+            ok = project.fitTransform(projected) && projected.n == 2 && project.outputDim() == 2;
+            for (uint32_t i = 0; ok && i < trainX.m; ++i) {
+                for (uint32_t k = 0; ok && k < 2; ++k) {
+                    ok = projected.data[i][k] == (trainX.data[i][k + 2] > 1.5f ? 1.0f : 0.0f);
+                }
+            }
+            printf("binarize, project and min-max: %s\n", ok ? "passed" : "FAILED");
+
+            // a data set of another width is refused whole, untouched
+            auto narrow = trainX;
+            for (auto &row : narrow.data) row.pop_back();
+            --narrow.n;
+            auto kept = narrow;
+            ok = !pipeline.transform(narrow) && narrow.n == kept.n && narrow.data == kept.data;
+            auto ragged = trainX;
+            ragged.data[1].pop_back();
+            ok = ok && !pipeline.transform(ragged) && ragged.data[0] == trainX.data[0];
+            // so is a chunk of the loader hook
+            ok = ok && !pipeline(ragged.data.data(), ragged.data.size()) &&
+                 ragged.data[0] == trainX.data[0];
+            printf("width mismatch refused: %s\n", ok ? "passed" : "FAILED");
+
+            // a saved min-max step that claims to widen its rows is refused at load
+            stat::transform::Pipeline single;
+            single.minMax();
+            ok = single.fit(trainX) && single.save("out/transform.model");
+            std::string bytes;
+            {
+                std::ifstream in("out/transform.model", std::ios::binary);
+                bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            }
+            // file header {steps, in, out, 0}, then the step {type, in, out, 0, threshold}
+            std::size_t header = sizeof(stat::serialize::FileHeader);
+            const uint32_t wider = 2 * trainX.n;
+            ok = ok && bytes.size() > header + 16 + 12;
+            if (ok) std::memcpy(&bytes[header + 8], &wider, 4);
+            if (ok) std::memcpy(&bytes[header + 16 + 8], &wider, 4);
+            std::ofstream("out/transform.model", std::ios::binary).write(bytes.data(), bytes.size());
+            stat::transform::Pipeline widened;
+            ok = ok && !widened.load("out/transform.model");
+            std::remove("out/transform.model");
+            printf("corrupted step width refused: %s\n", ok ? "passed" : "FAILED");
+        }
+    }
+
+    // MEMORY
+    {
+        printf("MEMORY\n");
+        // rows in an arena, same values as the default loader, a few upstream allocations
+        stat::memory::Counter upstream;
+        auto arena = std::make_shared<stat::memory::Arena>(1 << 12, &upstream);
+        auto pooled = stat::iris::loadData<float>(stat::iris::kIrisTrainX, stat::NoTransform{}, arena);
+        auto plain = stat::iris::loadData<float>(stat::iris::kIrisTrainX);
+        bool ok = pooled.m == plain.m && pooled.m > 0 && pooled.data == plain.data &&
+                  pooled.data.get_allocator().resource() == arena.get() &&
+                  pooled.data[0].get_allocator().resource() == arena.get() &&
+                  upstream.allocations() < 16;
+        printf("arena loader, %u rows in %llu allocations: %s\n", pooled.m,
+               static_cast<unsigned long long>(upstream.allocations()), ok ? "passed" : "FAILED");
+
+        // moved into a data set on another arena, the rows land in that arena and the source
+        // arena may go
+        {
+            auto target = std::make_shared<stat::memory::Arena>(1 << 12);
+            stat::Data<float> moved{stat::Mat<float>(target.get()), 0, 0, target};
+            {
+                auto source = stat::iris::loadData<float>(stat::iris::kIrisTrainX, stat::NoTransform{},
+                                                          std::make_shared<stat::memory::Arena>(1 << 12));
+                moved = std::move(source);
+            }
+            ok = moved.m == plain.m && moved.n == plain.n && moved.data == plain.data &&
+                 moved.memory == target && moved.data.get_allocator().resource() == target.get() &&
+                 moved.data[0].get_allocator().resource() == target.get();
+            // on the same arena the rows are taken over
+            auto *row = pooled.data[0].data();
+            stat::Data<float> same{stat::Mat<float>(arena.get()), 0, 0, arena};
+            same = std::move(pooled);
+            ok = ok && same.data[0].data() == row && same.data == plain.data;
+        }
+        printf("move between arenas: %s\n", ok ? "passed" : "FAILED");
+
+        // a large buffer mapped on huge pages, 2 MB aligned, unmapped when freed
+        auto *huge = stat::memory::hugePages();
+        auto before = huge->mapped();
+        {
+            stat::Vec<float> big(std::size_t(3) << 20, 1.0f, huge);
+            auto addr = reinterpret_cast<uintptr_t>(big.data());
+            ok = addr % stat::memory::kHugePageSize == 0 && huge->mapped() >= before + 12 * (1 << 20);
+            stat::Vec<float> small(16, 1.0f, huge);
+            ok = ok && big.back() == 1.0f && small.back() == 1.0f;
+        }
+        ok = ok && huge->mapped() == before;
+        printf("huge page resource: %s\n", ok ? "passed" : "FAILED");
+
+        // usage of a data set by component, the same bytes as the allocator gave its copy
+        auto live = tracker::current();
+        auto copy = plain;
+        auto retained = tracker::current() - live;
+        auto usage = stat::memory::usage(copy);
+        ok = usage.total() == retained && usage["rows"] == copy.m * copy.n * sizeof(float);
+        printf("data set usage %zu bytes, allocated %zu: %s\n", usage.total(), retained,
+               ok ? "passed" : "FAILED");
+    }
+
     EXIT;
 }
\ No newline at end of file
@@ -1,6 +1,9 @@
+#include <cmath>
 #include <cstdio>
+#include <random>
 
 #include "Math.h"
+#include "Reduction.h"
 #include "Types.h"
 
 #define TestName "Math"
@@ -30,5 +33,161 @@ int main() {
     dispMat({v});
     printf("mu = %f, sigma = %f, gaussian probability of 5 = %f\n", mu, sigma, gaussian);
 
+    // blocked transposition, large enough to cover several tiles and the parallel path
+    {
+        uint32_t m = 300, n = 517;
+        stat::Mat<int> A(m, stat::Vec<int>(n));
+        for (auto i = 0; i < m; ++i) {
+            for (auto j = 0; j < n; ++j) A[i][j] = i * n + j;
+        }
+        auto T = stat::transpose(A);
+        auto C = stat::columnMajor(A);
+        bool ok = T.size() == n && C.m == m && C.n == n;
+        for (auto i = 0; ok && i < m; ++i) {
+            for (auto j = 0; j < n; ++j) ok = ok && T[j][i] == A[i][j] && C.col(j)[i] == A[i][j];
+        }
+        auto S = stat::allocMat<int>(n, n, 0);
+        for (auto i = 0; i < n; ++i) {
+            for (auto j = 0; j < n; ++j) S[i][j] = i * n + j;
+        }
+        auto expected = stat::transpose(S);
+        stat::transposeInPlace(S);
+        ok = ok && S == expected;
+        printf("transpose %ux%u and in-place %ux%u: %s\n", m, n, n, n, ok ? "passed" : "FAILED");
+    }
+
+    // fused summary against a naive two pass reference, on data with a large offset where a plain
+    // float sum of squares loses all precision
+    {
+        uint32_t n = 300000;
+        stat::Vec<float> x(n);
+        for (auto i = 0; i < n; ++i) x[i] = 1e6f + (i % 7) * 0.5f;
+        double ref = 0.0, var = 0.0;
+        for (auto e : x) ref += e;
+        ref /= n;
+        for (auto e : x) var += (e - ref) * (e - ref) / n;
+        auto s = stat::summary(x);
+        bool ok = s.count == n && std::abs(s.mean - ref) < 1e-6 &&
+                  std::abs(s.variance() - var) < 1e-6 * var && s.min == 1e6f &&
+                  s.max == 1e6f + 3.0f;
+        stat::Data<float> D{stat::Mat<float>(n / 100, stat::Vec<float>(100)), n / 100, 100};
+        for (auto i = 0; i < D.m; ++i) {
+            for (auto j = 0; j < D.n; ++j) D.data[i][j] = x[i * D.n + j];
+        }
+        auto cols = stat::columnSummaries(D);
+        for (auto j = 0; ok && j < D.n; ++j) {
+            auto c = stat::summary(stat::getCol(D.data, j));
+            ok = cols[j].count == c.count && std::abs(cols[j].mean - c.mean) < 1e-6 &&
+                 std::abs(cols[j].m2 - c.m2) < 1e-6 * (1.0 + c.m2) && cols[j].min == c.min &&
+                 cols[j].max == c.max;
+        }
+        printf("summary of %u elements and %u columns: %s\n", n, D.n, ok ? "passed" : "FAILED");
+    }
+
+    // early-abandoning distance: the full sum without a bound, a sum beyond the bound once it stops
+    {
+        std::mt19937 gen(3);
+        std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+        bool ok = true;
+        for (uint32_t p = 1; p <= 3; ++p) {
+            for (std::size_t n : {1, 15, 16, 17, 100}) {
+                stat::Vec<double> a(n), b(n);
+                for (std::size_t j = 0; j < n; ++j) a[j] = uniform(gen), b[j] = uniform(gen);
+                double full = std::pow(stat::Lp(a.data(), b.data(), n, p), double(p));
+                std::size_t touched = 0;
+                double sum = stat::LpPowBounded(a.data(), b.data(), n, p, stat::Inf<double>, touched);
+                ok = ok && touched == n && std::abs(sum - full) <= 1e-9 * (1.0 + full);
+                double bound = full / 2;
+                sum = stat::LpPowBounded(a.data(), b.data(), n, p, bound, touched);
+                ok = ok && sum > bound && touched <= n;
+            }
+        }
+        printf("early-abandoning Lp: %s\n", ok ? "passed" : "FAILED");
+    }
+
+    // randomized pca against the eigen decomposition of the covariance matrix, on data with a
+    // decaying spectrum; the sparse projection keeps distances within a few eps
+    {
+        uint32_t m = 2000, n = 40, dim = 5;
+        std::mt19937 gen(3);
+        std::normal_distribution<double> normal(0.0, 1.0);
+        stat::Data<double> X{stat::Mat<double>(m, stat::Vec<double>(n)), m, n};
+        for (auto &row : X.data) {
+            for (uint32_t j = 0; j < n; ++j) row[j] = normal(gen) * std::pow(0.7, j) + j;
+        }
+        stat::Vec<double> mu(n, 0.0), cov(n * n, 0.0), values(n), vectors(n * n);
+        for (const auto &row : X.data) stat::axpy(1.0 / m, row.data(), mu.data(), n);
+        for (const auto &row : X.data) {
+            for (uint32_t a = 0; a < n; ++a) {
+                for (uint32_t b = 0; b < n; ++b) {
+                    cov[a * n + b] += (row[a] - mu[a]) * (row[b] - mu[b]) / m;
+                }
+            }
+        }
+        stat::symmetricEigen(cov.data(), n, values.data(), vectors.data());
+        bool ok = true;
+        for (uint32_t i = 0; i + 1 < n; ++i) ok = ok && values[i] >= values[i + 1];
+
+        stat::reduction::Projection pca;
+        ok = ok && pca.fitPca(X, dim);
+        const auto &variance = pca.explainedVariance();
+        for (uint32_t i = 0; ok && i < dim; ++i) {
+            ok = std::abs(variance[i] - values[i]) < 1e-6 * values[0];
+        }
+        // components match the eigenvectors up to sign, the projected data is centered
+        stat::Vec<double> y(dim);
+        pca.apply(mu.data(), y.data());
+        for (uint32_t i = 0; ok && i < dim; ++i) {
+            stat::Vec<double> row(n);
+            for (uint32_t j = 0; j < n; ++j) row[j] = mu[j] + vectors[i * n + j];
+            stat::Vec<double> z(dim);
+            pca.apply(row.data(), z.data());
+            ok = std::abs(y[i]) < 1e-9 && std::abs(std::abs(z[i]) - 1.0) < 1e-6;
+        }
+        printf("randomized pca of %ux%u to %u dim against the covariance eigenvectors: %s\n", m, n,
+               dim, ok ? "passed" : "FAILED");
+
+        stat::reduction::Projection jl;
+        uint32_t wide = 784, reduced = 256;
+        ok = jl.fitSparse(wide, reduced, 1);
+        stat::Vec<double> a(wide), b(wide), pa(reduced), pb(reduced);
+        double worst = 0.0;
+        for (int t = 0; t < 50; ++t) {
+            for (uint32_t j = 0; j < wide; ++j) {
+                a[j] = normal(gen);
+                b[j] = normal(gen);
+            }
+            jl.apply(a.data(), pa.data());
+            jl.apply(b.data(), pb.data());
+            worst = std::max(worst, std::abs(stat::Lp(pa, pb) / stat::Lp(a, b) - 1.0));
+        }
+        ok = ok && worst < 0.3;
+        printf("sparse random projection %u to %u dim, worst distance distortion %f: %s\n", wide,
+               reduced, worst, ok ? "passed" : "FAILED");
+
+        // a saved sparse projection whose column offsets do not start at 0 and increase is refused
+        struct {
+            uint32_t kind, in, out, reserved;
+            double scale;
+        } header{stat::reduction::SPARSE_JL, 3, 2, 0, 1.0};
+        ok = true;
+        using Starts = stat::Vec<uint32_t>;
+        for (const auto &starts : {Starts{0, 2, 1, 3}, Starts{1, 1, 2, 3}}) {
+            {
+                stat::serialize::Writer writer("out/projection.model");
+                writer.write(header);
+                for (int v = 0; v < 3; ++v) writer.writeVec(stat::Vec<double>());  // PCA sections
+                writer.writeVec(starts);
+                writer.writeVec(stat::Vec<uint32_t>{0, 1, 0});
+            }
+            stat::serialize::MappedFile file("out/projection.model");
+            stat::serialize::Reader reader(file);
+            stat::reduction::Projection corrupted;
+            ok = ok && !corrupted.read(reader);
+        }
+        std::remove("out/projection.model");
+        printf("corrupted sparse projection refused: %s\n", ok ? "passed" : "FAILED");
+    }
+
     EXIT;
 }
\ No newline at end of file
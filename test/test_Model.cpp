@@ -1,6 +1,15 @@
+#include "MemoryTracker.h"
+#include "ModelSelection.h"
+#include "Server.h"
 #include "Stat.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
 #include <thread>
 
 #define TEST_IRIS   // comment out to disable test on iris dataset
@@ -28,6 +37,8 @@ constexpr T Wrap_v = Wrap<T>::value;
 int main() {
     ENTER;
 
+    stat::profile::setEnabled(true);
+
 #ifdef TEST_IRIS
     {  // iris
         printf("*** Test on iris dataset ***\n\n");
@@ -50,8 +61,24 @@ int main() {
             CHARS(50, '=');
             auto model = stat::CreateModel<decltype(DataType), decltype(LabelType)>(type, param);
             if (model) {
+                tracker::resetPeak();
+                auto live = tracker::current();
                 model->train(trainX, trainY);
-                model->validate(testX, testY);
+                printf("INFO: model %.1f KB, training peak %.1f KB\n",
+                       model->memoryUsage().total() / 1024.0, (tracker::peak() - live) / 1024.0);
+                auto acc = model->validate(testX, testY);
+
+                // round trip through the binary model file, accuracy must be unchanged
+                const char *filename = "out/iris.model";
+                auto loaded =
+                    stat::CreateModel<decltype(DataType), decltype(LabelType)>(type, param);
+                if (model->save(filename) && loaded->load(filename)) {
+                    auto loadedAcc = loaded->validate(testX, testY);
+                    printf("INFO: save/load round trip %s\n",
+                           acc == loadedAcc ? "passed" : "FAILED");
+                } else {
+                    printf("ERROR: save/load round trip failed\n");
+                }
             } else {
                 printf("ERROR: create model failed\n");
             }
@@ -69,10 +96,542 @@ int main() {
                    {{"k", "5"}, {"model_type", "knn"}});  // simple knn
         TEST_MODEL(stat::ModelType::MODEL_KNN, Wrap_v<double>, Wrap_v<double>,
                    {{"k", "5"}, {"model_type", "kdtree"}});  // kdtree
+        TEST_MODEL(stat::ModelType::MODEL_KNN, Wrap_v<double>, Wrap_v<double>,
+                   {{"k", "5"}, {"reduction", "pca"}, {"reduced_dim", "2"}});  // pca
+        TEST_MODEL(stat::ModelType::MODEL_KNN, Wrap_v<double>, Wrap_v<double>,
+                   {{"k", "5"},
+                    {"model_type", "kdtree"},
+                    {"reduction", "jl"},
+                    {"reduced_dim", "3"}});  // sparse random projection
+        TEST_MODEL(stat::ModelType::MODEL_KNN, Wrap_v<double>, Wrap_v<double>,
+                   {{"k", "5"}, {"model_type", "pq"}, {"pq_m", "2"}});  // product quantization
+        TEST_MODEL(stat::ModelType::MODEL_KNN, Wrap_v<double>, Wrap_v<double>,
+                   {{"k", "5"}, {"model_type", "pq"}, {"pq_m", "1"}, {"rerank", "20"}});  // rerank
 
         // test naive bayes
         TEST_MODEL(stat::ModelType::MODEL_NAIVE_BAYES, Wrap_v<double>, Wrap_v<double>,
                    {{"model_show", "true"}});  // simple knn
+        // bit-packed bernoulli
+        TEST_MODEL(stat::ModelType::MODEL_NAIVE_BAYES, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "bernoulli"}, {"threshold", "2.5"}, {"model_show", "true"}});
+
+        // test decision tree
+        TEST_MODEL(stat::ModelType::MODEL_DECISION_TREE, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "id3"}, {"model_show", "true"}});
+        TEST_MODEL(stat::ModelType::MODEL_DECISION_TREE, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "c4.5"}, {"model_show", "true"}});
+        TEST_MODEL(stat::ModelType::MODEL_DECISION_TREE, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "cart"}, {"model_show", "true"}});
+
+        // test logistic regression
+        TEST_MODEL(stat::ModelType::MODEL_LOGISTIC_REGRESSION, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "sgd"}, {"model_show", "true"}});
+        TEST_MODEL(stat::ModelType::MODEL_LOGISTIC_REGRESSION, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "lbfgs"}, {"model_show", "true"}});
+
+        // test svm
+        TEST_MODEL(stat::ModelType::MODEL_SVM, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "linear"}, {"model_show", "true"}});
+        TEST_MODEL(stat::ModelType::MODEL_SVM, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "poly"}, {"model_show", "true"}});
+        TEST_MODEL(stat::ModelType::MODEL_SVM, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "rbf"}, {"C", "10"}, {"model_show", "true"}});
+
+        // test adaboost
+        TEST_MODEL(stat::ModelType::MODEL_ADA_BOOST, Wrap_v<double>, Wrap_v<double>,
+                   {{"rounds", "50"}, {"model_show", "true"}});
+
+        // test em, gaussian mixture per class
+        TEST_MODEL(stat::ModelType::MODEL_EM, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "diagonal"}, {"components", "2"}, {"model_show", "true"}});
+        TEST_MODEL(stat::ModelType::MODEL_EM, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "full"}, {"components", "2"}, {"model_show", "true"}});
+        TEST_MODEL(stat::ModelType::MODEL_EM, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "diagonal"}, {"components", "2"}, {"batch_size", "16"}});
+
+        // statically dispatched handle from typed params, same predictions as the virtual path
+        auto TEST_STATIC = [&](stat::ModelType type, stat::ModelParam param) {
+            CHARS(50, '=');
+            auto config = stat::ParseModelConfig(type, param);
+            auto model = stat::CreateModel<double, double>(type, param);
+            if (config && model) {
+                stat::AnyModel<double, double> handle(*config);
+                handle.train(trainX, trainY);
+                model->train(trainX, trainY);
+                auto labels = handle.predict(testX);
+                bool same = handle.type() == type && labels.size() == testX.m;
+                for (uint32_t i = 0; same && i < testX.m; ++i) {
+                    same = labels[i] == model->predict(testX.data[i]);
+                }
+                printf("INFO: static dispatch %s\n", same ? "passed" : "FAILED");
+            } else {
+                printf("ERROR: create model failed\n");
+            }
+            CHARS(50, '=');
+        };
+        TEST_STATIC(stat::ModelType::MODEL_KNN, {{"k", "5"}, {"model_type", "kdtree"}});
+        TEST_STATIC(stat::ModelType::MODEL_NAIVE_BAYES, {});
+        TEST_STATIC(stat::ModelType::MODEL_DECISION_TREE, {{"model_type", "c4.5"}});
+        TEST_STATIC(stat::ModelType::MODEL_ADA_BOOST, {{"rounds", "20"}});
+
+        // a bad value keeps the default, a misspelled key is reported
+        auto knn = stat::KnnParam::parse({{"k", "-1"}, {"p", "1"}, {"modle_type", "kdtree"}});
+        printf("INFO: typed params %s\n",
+               knn.k == 3 && knn.p == 1 && knn.type == stat::KnnParam::SIMPLE_KNN ? "passed"
+                                                                                  : "FAILED");
+
+        // model selection: one pass over k and p against retraining, sweeps of other models
+        {
+            CHARS(50, '=');
+            stat::selection::KnnSweepParam sweep;
+            sweep.kMax = 9;
+            sweep.ps = {1, 2};
+            stat::selection::report(stat::selection::knnSweep(trainX, trainY, sweep));
+            // overlapping blobs, where the accuracy depends on k
+            auto blobs = stat::synthetic::makeBlobs<double>(400, 8, 4, 7, 1.0);
+            const auto &bX = std::get<0>(blobs);
+            const auto &bY = std::get<1>(blobs);
+            auto scores = stat::selection::knnSweep(bX, bY, sweep);
+            bool same = scores.size() == 18;
+            for (uint32_t k : {1u, 4u, 9u}) {
+                stat::KnnParam param;
+                param.k = k;
+                auto retrained = stat::selection::crossValidate(bX, bY, param);
+                printf("INFO: k = %u, one pass %f, retrained %f\n", k, scores[9 + k - 1].accuracy,
+                       retrained.accuracy);
+                same = same && std::abs(retrained.accuracy - scores[9 + k - 1].accuracy) < 1e-12;
+            }
+            printf("INFO: one pass k-NN sweep %s\n", same ? "passed" : "FAILED");
+
+            // fewer rows than folds, two pairs 1-NN always gets right: the empty fold is left out
+            // of both means
+            stat::Mat<double> pairs{{0.0, 0.0}, {0.1, 0.0}, {5.0, 5.0}, {5.1, 5.0}};
+            stat::Data<double> fewX{pairs, 4, 2};
+            stat::Data<double> fewY{stat::Mat<double>{{0.0}, {0.0}, {1.0}, {1.0}}, 4, 1};
+            stat::selection::KnnSweepParam one;
+            one.kMax = 1;
+            stat::KnnParam nearest;
+            nearest.k = 1;
+            auto swept = stat::selection::knnSweep(fewX, fewY, one);
+            auto few = stat::selection::crossValidate(fewX, fewY, nearest);
+            // and a model that fails to train is not scored
+            stat::KnnParam untrainable;
+            untrainable.type = stat::KnnParam::PQ;
+            untrainable.p = 1;
+            auto failed = stat::selection::crossValidate(bX, bY, untrainable);
+            bool ok = few.accuracy == 1.0 && swept[0].accuracy == 1.0 && failed.accuracy == 0.0;
+            printf("INFO: cross-validation of %f over 4 rows, %f in one pass, failed %f %s\n",
+                   few.accuracy, swept[0].accuracy, failed.accuracy, ok ? "passed" : "FAILED");
+
+            stat::NaiveBayesParam bernoulli;
+            bernoulli.type = stat::NaiveBayesParam::BERNOULLI;
+            bernoulli.threshold = 2.0;
+            stat::PerceptronParam dual;
+            dual.form = stat::PerceptronParam::DUAL;
+            auto others = stat::selection::sweep(
+                trainX, trainY,
+                {{"naive bayes gaussian", stat::NaiveBayesParam{}},
+                 {"naive bayes bernoulli", bernoulli},
+                 {"perceptron original", stat::PerceptronParam{}},
+                 {"perceptron dual", dual}});
+            stat::selection::report(others);
+            printf("INFO: best %s\n", stat::selection::best(others).name.c_str());
+            CHARS(50, '=');
+        }
+
+        // sharded simple k-NN: same predictions as one scan, after a save/load round trip too
+        {
+            CHARS(50, '=');
+            auto blobs = stat::synthetic::makeBlobs<double>(900, 16, 4, 3, 1.0);
+            const auto &bX = std::get<0>(blobs);
+            const auto &bY = std::get<1>(blobs);
+            stat::KnnParam param;
+            param.k = 7;
+            stat::KNN<double, double> single(param);
+            param.sharded = true;
+            param.shards = 3;
+            stat::KNN<double, double> sharded(param), loaded(param);
+            single.train(bX, bY);
+            sharded.train(bX, bY);
+            const char *filename = "out/sharded.model";
+            bool same = sharded.save(filename) && loaded.load(filename);
+            std::remove(filename);
+            auto queries = stat::synthetic::makeBlobs<double>(200, 16, 4, 3, 1.0);
+            for (const auto &q : std::get<0>(queries).data) {
+                auto label = single.predict(q);
+                same = same && sharded.predict(q) == label && loaded.predict(q) == label;
+            }
+            auto cpus = stat::numa::parseList("0-2,5,7-8");
+            same = same && cpus == std::vector<uint32_t>{0, 1, 2, 5, 7, 8};
+            printf("INFO: sharded k-NN on %zu NUMA node(s) %s\n", stat::numa::nodes().size(),
+                   same ? "passed" : "FAILED");
+            CHARS(50, '=');
+        }
+
+        // dynamic k-NN: inserts and removes against a KNN retrained on the remaining rows
+        {
+            CHARS(50, '=');
+            auto blobs = stat::synthetic::makeBlobs<double>(700, 6, 4, 11, 1.0);
+            const auto &bX = std::get<0>(blobs);
+            const auto &bY = std::get<1>(blobs);
+            stat::DynamicKnnParam dynParam;
+            dynParam.k = 5;
+            dynParam.bufferSize = 16;
+            stat::DynamicKNN<double, double> index(dynParam);
+            stat::Data<double> keptX{stat::Mat<double>(), 0, bX.n}, keptY{stat::Mat<double>(), 0, 1};
+            for (uint32_t i = 0; i < 600; ++i) index.insert(bX.data[i], bY.data[i][0]);
+            for (uint32_t i = 0; i < 600; ++i) {
+                if (i % 3 == 0 || (i >= 200 && i < 300)) {
+                    index.remove(i);
+                } else {
+                    keptX.data.emplace_back(bX.data[i]);
+                    keptY.data.emplace_back(bY.data[i]);
+                }
+            }
+            keptX.m = keptY.m = keptX.data.size();
+            stat::KnnParam knnParam;
+            knnParam.k = 5;
+            stat::KNN<double, double> knn(knnParam);
+            knn.train(keptX, keptY);
+            bool same = index.size() == keptX.m && !index.remove(0);
+            for (uint32_t i = 600; same && i < 700; ++i) {
+                same = index.predict(bX.data[i]) == knn.predict(bX.data[i]);
+            }
+            printf("INFO: dynamic k-NN %zu points in %zu trees, against retrained %s\n",
+                   index.size(), index.trees(), same ? "passed" : "FAILED");
+
+            const char *filename = "out/dynamic.model";
+            stat::DynamicKNN<double, double> loaded;
+            bool saved = index.save(filename) && loaded.load(filename);
+            std::remove(filename);
+            same = saved && loaded.size() == index.size();
+            for (uint32_t i = 600; same && i < 700; ++i) {
+                same = loaded.nearest(bX.data[i], 5) == index.nearest(bX.data[i], 5);
+            }
+            printf("INFO: dynamic k-NN save and load %s\n", same ? "passed" : "FAILED");
+
+            // queries while another thread inserts, merges on the background thread
+            dynParam.backgroundMerge = true;
+            stat::DynamicKNN<double, double> live(dynParam);
+            live.train(keptX, keptY);
+            std::thread writer([&] {
+                for (int round = 0; round < 20; ++round) {
+                    for (uint32_t i = 0; i < 600; ++i) live.insert(bX.data[i], bY.data[i][0]);
+                }
+            });
+            uint64_t queries = 0;
+            bool found = true;
+            for (uint32_t round = 0; round < 2000; ++round, ++queries) {
+                auto hits = live.nearest(keptX.data[round % keptX.m], 1);
+                found = found && hits.size() == 1 && hits[0].second == 0.0;
+            }
+            writer.join();
+            live.waitForMerges();
+            found = found && live.size() == keptX.m + 20 * 600;
+            printf("INFO: dynamic k-NN %" PRIu64 " concurrent queries, %zu trees, %s\n", queries,
+                   live.trees(), found ? "passed" : "FAILED");
+
+            // compactions while inserts seal the buffer: every id is in the index exactly once
+            dynParam.backgroundMerge = false;
+            dynParam.bufferSize = 8;
+            stat::DynamicKNN<double, double> sealed(dynParam);
+            sealed.train(keptX, keptY);  // a compaction takes long enough to be overlapped
+            std::atomic<bool> inserting{true};
+            std::thread inserter([&] {
+                for (uint32_t i = 0; i < 600; ++i) sealed.insert(bX.data[i], bY.data[i][0]);
+                inserting.store(false);
+            });
+            uint32_t compactions = 0;
+            for (; inserting.load() || compactions == 0; ++compactions) sealed.compact();
+            inserter.join();
+            sealed.compact();
+            auto total = keptX.m + 600;
+            auto all = sealed.nearest(bX.data[0], 2 * total);
+            std::vector<stat::DynamicKNN<double, double>::Id> ids;
+            for (const auto &hit : all) ids.push_back(hit.first);
+            std::sort(ids.begin(), ids.end());
+            bool once = sealed.size() == total && ids.size() == total &&
+                        std::adjacent_find(ids.begin(), ids.end()) == ids.end();
+            for (auto id : ids) once = once && sealed.remove(id);
+            once = once && sealed.size() == 0 && sealed.nearest(bX.data[0], 2 * total).empty();
+            printf("INFO: dynamic k-NN inserts against %u compactions %s\n", compactions,
+                   once ? "passed" : "FAILED");
+            CHARS(50, '=');
+        }
+
+        // micro-batching server: concurrent single rows get the labels of a direct batch predict
+        {
+            CHARS(50, '=');
+            auto blobs = stat::synthetic::makeBlobs<double>(1200, 8, 4, 5, 1.0);
+            const auto &bX = std::get<0>(blobs);
+            const auto &bY = std::get<1>(blobs);
+            stat::AnyModel<double, double> tree(stat::DecisionTreeParam{});
+            tree.train(bX, bY);
+            auto expected = tree.predict(bX);
+            stat::ServerParam serverParam;
+            serverParam.maxBatch = 16;
+            serverParam.maxWaitUs = 2000;
+            bool same = true;
+            uint64_t batches = 0;
+            {
+                stat::Server<double, double> server(tree, serverParam);
+                std::vector<std::thread> clients;
+                std::vector<char> ok(4, 1);
+                for (uint32_t c = 0; c < ok.size(); ++c) {
+                    clients.emplace_back([&, c] {
+                        // a window of requests in flight per client, so batches can form
+                        std::vector<std::future<double>> pending;
+                        for (uint32_t i = c; i < bX.m; i += ok.size()) {
+                            pending.emplace_back(server.submit(bX.data[i]));
+                        }
+                        for (uint32_t i = c, j = 0; i < bX.m; i += ok.size(), ++j) {
+                            ok[c] = ok[c] && pending[j].get() == expected[i];
+                        }
+                    });
+                }
+                for (auto &client : clients) client.join();
+                for (auto o : ok) same = same && o;
+                auto stats = server.stats();
+                same = same && stats.requests == bX.m;
+                batches = stats.batches;
+            }
+            same = same && batches < bX.m;
+
+            // a virtual model, rows of a batch go through the per-row fallback
+            auto knn = stat::CreateModel<double, double>(stat::ModelType::MODEL_KNN, {});
+            knn->train(bX, bY);
+            {
+                stat::Server<double, double> server(*knn, serverParam);
+                auto label = server.submit(bX.data[7]);
+                same = same && label.get() == knn->predict(bX.data[7]);
+
+                // a row of another width is refused alone, the rows around it are served
+                auto before = server.submit(bX.data[1]);
+                auto cut = bX.data[2];
+                cut.pop_back();
+                auto shorter = server.submit(cut);
+                auto after = server.submit(bX.data[3]);
+                bool refused = false;
+                try {
+                    shorter.get();
+                } catch (const std::invalid_argument &) {
+                    refused = true;
+                }
+                same = same && refused && before.get() == knn->predict(bX.data[1]) &&
+                       after.get() == knn->predict(bX.data[3]);
+            }
+            printf("INFO: server %u requests in %" PRIu64 " batches %s\n", bX.m, batches,
+                   same ? "passed" : "FAILED");
+            CHARS(50, '=');
+        }
+
+        // product quantization ranks by L2, another p is refused unless the points are reranked
+        {
+            CHARS(50, '=');
+            stat::KNN<double, double> l1({{"model_type", "pq"}, {"p", "1"}});
+            stat::KNN<double, double> reranked({{"model_type", "pq"}, {"p", "1"}, {"rerank", "10"}});
+            bool ok = !l1.train(trainX, trainY) && reranked.train(trainX, trainY);
+            printf("INFO: pq k-NN with p = 1 %s\n", ok ? "passed" : "FAILED");
+            CHARS(50, '=');
+        }
+
+        // an rbf svm retrained on wider rows derives its gamma from the new width, C must be > 0
+        {
+            CHARS(50, '=');
+            auto blobs = stat::synthetic::makeBlobs<double>(400, 8, 4, 7, 1.0);
+            const auto &wideX = std::get<0>(blobs);
+            const auto &wideY = std::get<1>(blobs);
+            stat::SVM<double, double> retrained(stat::ModelParam{{"model_type", "rbf"}});
+            stat::SVM<double, double> fresh(stat::ModelParam{{"model_type", "rbf"}});
+            bool ok = retrained.train(trainX, trainY) && retrained.train(wideX, wideY) &&
+                      fresh.train(wideX, wideY) &&
+                      retrained.predictBatch(wideX) == fresh.predictBatch(wideX);
+            stat::SvmParam unbounded;
+            unbounded.C = 0.0;
+            stat::SVM<double, double> zero(unbounded);
+            ok = ok && !zero.train(trainX, trainY);
+            printf("INFO: svm retrained on another width, C = 0 refused %s\n",
+                   ok ? "passed" : "FAILED");
+            CHARS(50, '=');
+        }
+
+        // a kd-tree file whose child index points past the nodes, or with k or p 0, is refused at
+        // load, not searched
+        {
+            CHARS(50, '=');
+            stat::KNN<double, double> tree(stat::ModelParam{{"model_type", "kdtree"}});
+            const char *filename = "out/corrupted.model";
+            bool ok = tree.train(trainX, trainY) && tree.save(filename);
+            std::vector<char> bytes;
+            {
+                std::ifstream in(filename, std::ios::binary);
+                bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            }
+            // the first kNullNode child of the node section becomes an out of range index
+            const uint32_t null = 0xFFFFFFFFu, past = 0x7FFFFFFFu;
+            bool patched = false;
+            for (std::size_t at = 0; !patched && at + 4 <= bytes.size(); at += 4) {
+                if (std::memcmp(bytes.data() + at, &null, 4) == 0) {
+                    std::memcpy(bytes.data() + at, &past, 4);
+                    patched = true;
+                }
+            }
+            std::ofstream(filename, std::ios::binary).write(bytes.data(), bytes.size());
+            stat::KNN<double, double> loaded;
+            ok = ok && patched && !loaded.load(filename);
+            // so is a model header {k, p, ...} with k = 0 or p = 0
+            std::size_t header = sizeof(stat::serialize::FileHeader);
+            for (std::size_t field : {header, header + 4}) {
+                ok = ok && tree.save(filename);
+                std::fstream file(filename, std::ios::binary | std::ios::in | std::ios::out);
+                file.seekp(static_cast<std::streamoff>(field));
+                const uint32_t zero = 0;
+                file.write(reinterpret_cast<const char *>(&zero), 4);
+                file.close();
+                ok = ok && !loaded.load(filename);
+            }
+            std::remove(filename);
+            printf("INFO: corrupted kd-tree file refused %s\n", ok ? "passed" : "FAILED");
+            CHARS(50, '=');
+        }
+
+        // a decision tree file whose root points back to itself is refused, predict would loop
+        {
+            CHARS(50, '=');
+            stat::DecisionTree<double, double> tree;
+            const char *filename = "out/corrupted.model";
+            bool ok = tree.train(trainX, trainY) && tree.save(filename);
+            std::vector<char> bytes;
+            {
+                std::ifstream in(filename, std::ios::binary);
+                bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            }
+            // model header {criterion, dim, classes, nodes}, the node section ends the file
+            uint32_t nodes = 0;
+            std::size_t header = sizeof(stat::serialize::FileHeader);
+            ok = ok && bytes.size() >= header + 16;
+            if (ok) std::memcpy(&nodes, bytes.data() + header + 12, 4);
+            // node {threshold, feature, right}, the root's right child becomes the root
+            std::size_t root = bytes.size() - std::size_t(nodes) * 16;
+            const uint32_t self = 0;
+            ok = ok && nodes > 1 && root > header;
+            if (ok) std::memcpy(bytes.data() + root + 12, &self, 4);
+            std::ofstream(filename, std::ios::binary).write(bytes.data(), bytes.size());
+            stat::DecisionTree<double, double> loaded;
+            ok = ok && !loaded.load(filename);
+            std::remove(filename);
+            printf("INFO: corrupted decision tree file refused %s\n", ok ? "passed" : "FAILED");
+            CHARS(50, '=');
+        }
+
+        // EM with a covariance no regularization makes positive definite fails, not NaN later
+        {
+            CHARS(50, '=');
+            auto blobs = stat::synthetic::makeBlobs<double>(200, 3, 2, 5, 1.0);
+            auto bX = std::get<0>(blobs);
+            const auto &bY = std::get<1>(blobs);
+            bX.data[5][1] = stat::NaN<double>;
+            stat::EM<double, double> em({{"model_type", "full"}, {"components", "2"}});
+            bool ok = !em.train(bX, bY);
+            printf("INFO: em with an unfactorizable covariance %s\n", ok ? "passed" : "FAILED");
+            CHARS(50, '=');
+        }
+
+        // an em file with a negative variance is refused, the loading model is left as it was
+        {
+            CHARS(50, '=');
+            auto blobs = stat::synthetic::makeBlobs<double>(200, 3, 2, 5, 1.0);
+            const auto &bX = std::get<0>(blobs);
+            const auto &bY = std::get<1>(blobs);
+            stat::EM<double, double> diagonal({{"model_type", "diagonal"}, {"components", "2"}});
+            stat::EM<double, double> full({{"model_type", "full"}, {"components", "2"}});
+            const char *filename = "out/corrupted.model";
+            bool ok = diagonal.train(bX, bY) && full.train(bX, bY) && diagonal.save(filename);
+            std::vector<char> bytes;
+            {
+                std::ifstream in(filename, std::ios::binary);
+                bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            }
+            // the variances of the last class end the file
+            const double negative = -1.0;
+            ok = ok && bytes.size() > sizeof negative;
+            if (ok) std::memcpy(bytes.data() + bytes.size() - sizeof negative, &negative, 8);
+            std::ofstream(filename, std::ios::binary).write(bytes.data(), bytes.size());
+            ok = ok && !full.load(filename);
+            // still a full covariance model, saved and loaded as one
+            stat::EM<double, double> restored;
+            ok = ok && full.save(filename) && restored.load(filename) &&
+                 restored.predictBatch(bX) == full.predictBatch(bX);
+            std::remove(filename);
+            printf("INFO: corrupted em file refused %s\n", ok ? "passed" : "FAILED");
+            CHARS(50, '=');
+        }
+
+        // memory accounting: reported usage against what the allocator kept, byte budgets
+        {
+            CHARS(50, '=');
+            auto blobs = stat::synthetic::makeBlobs<double>(2000, 16, 4, 9, 1.0);
+            const auto &bX = std::get<0>(blobs);
+            const auto &bY = std::get<1>(blobs);
+            bool ok = true;
+            for (auto type : {"knn", "kdtree", "pq"}) {
+                stat::KNN<double, double> knn(stat::ModelParam{{"model_type", type}});
+                auto live = tracker::current();
+                knn.train(bX, bY);
+                auto retained = tracker::current() - live;
+                auto usage = knn.memoryUsage();
+                if (std::string(type) == "kdtree") usage.print("kd-tree k-NN");
+                // the allocator also sees what the model keeps in its object's small members
+                ok = ok && usage.total() <= retained && retained - usage.total() < 1024;
+            }
+            stat::AnyModel<double, double> bayes(stat::NaiveBayesParam{});
+            bayes.train(bX, bY);
+            ok = ok && bayes.memoryUsage()["gaussian parameters"] > 4 * 16 * 2 * sizeof(double);
+
+            stat::KNN<double, double> capped(stat::ModelParam{{"memory_budget", "0.1"}});
+            ok = ok && !capped.train(bX, bY) && capped.memoryUsage().total() == 0;
+            stat::DynamicKnnParam dynParam;
+            dynParam.memoryMB = 0.1;
+            stat::DynamicKNN<double, double> index(dynParam);
+            uint32_t inserted = 0;
+            while (inserted < bX.m && index.insert(bX.data[inserted], bY.data[inserted][0]) !=
+                                          stat::DynamicKNN<double, double>::kNoId) {
+                ++inserted;
+            }
+            ok = ok && inserted > 0 && inserted < bX.m &&
+                 index.memoryUsage().total() <= 0.1 * (1 << 20);
+            printf("INFO: memory accounting, dynamic k-NN capped at %u points %s\n", inserted,
+                   ok ? "passed" : "FAILED");
+            CHARS(50, '=');
+        }
+
+        // dense label encoding: round trip, unseen labels, storage against the label column
+        {
+            CHARS(50, '=');
+            auto blobs = stat::synthetic::makeBlobs<double>(600, 2, 5, 11, 1.0);
+            auto bY = std::get<1>(blobs);
+            for (uint32_t i = 0; i < bY.m; ++i) bY.data[i][0] = 10.5 - 2 * bY.data[i][0];
+            stat::LabelEncoder<double> encoder;
+            auto y = encoder.fit(bY);
+            bool ok = encoder.size() == 5 && encoder.decode(y[0]) == bY.data[0][0];
+            for (uint32_t i = 0; i < bY.m; ++i) {
+                ok = ok && y[i] < encoder.size() && encoder.decode(y[i]) == bY.data[i][0] &&
+                     encoder.encode(bY.data[i][0]) == y[i];
+            }
+            ok = ok && encoder.encode(42.0) == stat::LabelEncoder<double>::kUnknown;
+            auto back = encoder.inverse(y);
+            ok = ok && back.m == bY.m && back.data == bY.data && encoder.transform(bY) == y;
+            auto unseen = bY;
+            unseen.data[3][0] = 42.0;
+            auto partly = encoder.inverse(encoder.transform(unseen));
+            ok = ok && std::isnan(partly.data[3][0]) && partly.data[4] == bY.data[4] &&
+                 std::isnan(encoder.decode(encoder.size()));
+            auto dense = stat::memory::heapBytes(y);
+            auto column = stat::memory::usage(bY).total();
+            printf("INFO: label encoding, %u labels in %zu bytes instead of %zu %s\n", bY.m, dense,
+                   column, ok ? "passed" : "FAILED");
+            CHARS(50, '=');
+        }
     }
 #endif  // TEST_IRIS
 
@@ -93,7 +652,11 @@ int main() {
             CHARS(50, '=');
             auto model = stat::CreateModel<decltype(DataType), decltype(LabelType)>(type, param);
             if (model) {
+                tracker::resetPeak();
+                auto live = tracker::current();
                 model->train(trainX, trainY);
+                printf("INFO: model %.1f KB, training peak %.1f KB\n",
+                       model->memoryUsage().total() / 1024.0, (tracker::peak() - live) / 1024.0);
                 model->validate(testX, testY);
             } else {
                 printf("ERROR: create model failed\n");
@@ -112,6 +675,13 @@ int main() {
         // TEST_MODEL(stat::ModelType::MODEL_KNN, Wrap_v<double>, Wrap_v<double>,
         //            {{"model_type", "kdtree"}});
 
+        // projected to 32 dim by pca, the kd-tree prunes again
+        TEST_MODEL(stat::ModelType::MODEL_KNN, Wrap_v<double>, Wrap_v<double>,
+                   {{"k", "5"},
+                    {"model_type", "kdtree"},
+                    {"reduction", "pca"},
+                    {"reduced_dim", "32"}});
+
         // test naive bayes
         // without binaryzation - accuracy is only 0.6097
         TEST_MODEL(stat::ModelType::MODEL_NAIVE_BAYES, Wrap_v<double>, Wrap_v<double>,
@@ -149,8 +719,35 @@ int main() {
                 model->validate(X_test_new, testY);
             }
         }
+        // the same binarization inside the bit-packed bernoulli model
+        TEST_MODEL(stat::ModelType::MODEL_NAIVE_BAYES, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "bernoulli"}, {"threshold", "127"}});
+
+        // test decision tree
+        TEST_MODEL(stat::ModelType::MODEL_DECISION_TREE, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "cart"}, {"model_show", "true"}});
+
+        // test logistic regression, raw pixel values suit the full batch solver better
+        TEST_MODEL(stat::ModelType::MODEL_LOGISTIC_REGRESSION, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "lbfgs"}, {"epochs", "100"}});
+
+        // test svm, gamma scaled to raw pixel values
+        TEST_MODEL(stat::ModelType::MODEL_SVM, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "rbf"}, {"gamma", "1e-7"}, {"C", "10"}});
+
+        // test adaboost
+        TEST_MODEL(stat::ModelType::MODEL_ADA_BOOST, Wrap_v<double>, Wrap_v<double>,
+                   {{"rounds", "200"}});
+
+        // test em, mini-batches of the stepwise solver
+        TEST_MODEL(stat::ModelType::MODEL_EM, Wrap_v<double>, Wrap_v<double>,
+                   {{"model_type", "diagonal"}, {"components", "4"}, {"batch_size", "1000"},
+                    {"regularization", "1"}});
     }
 #endif  // TEST_MNIST
 
+    stat::profile::writeJson("out/profile_Model.json");
+    stat::profile::writeChromeTrace("out/trace_Model.json");
+
     EXIT;
 }
\ No newline at end of file
@@ -0,0 +1,225 @@
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+#include "CRF.h"
+#include "HMM.h"
+#include "Math.h"
+#include "Types.h"
+
+#define TestName "Sequence"
+#define ENTER printf("\n=== Run test " TestName " ===\n\n");
+#define EXIT printf("\n=== Exit test " TestName " ===\n\n");
+
+int main() {
+    ENTER;
+
+    auto close = [](double a, double b) { return std::abs(a - b) <= 1e-9 * (1.0 + std::abs(b)); };
+
+    // forward-backward and viterbi against the enumeration of every state path of a short sequence
+    {
+        uint32_t N = 3, M = 4;
+        auto hmm = stat::HMM::random(N, M, 7);
+        stat::Sequence obs{0, 3, 1, 1, 2, 0, 3};
+        auto T = obs.size();
+        const auto &pi = hmm.initial();
+        const auto &A = hmm.transition();
+        const auto &E = hmm.emission();
+
+        double total = 0.0, best = 0.0;
+        stat::Sequence bestPath;
+        stat::Vec<double> marginal(T * N, 0.0);
+        stat::Sequence path(T, 0);
+        for (;;) {
+            double p = pi[path[0]] * E[obs[0] * N + path[0]];
+            for (std::size_t t = 1; t < T; ++t) {
+                p *= A[path[t - 1] * N + path[t]] * E[obs[t] * N + path[t]];
+            }
+            total += p;
+            for (std::size_t t = 0; t < T; ++t) marginal[t * N + path[t]] += p;
+            if (p > best) {
+                best = p;
+                bestPath = path;
+            }
+            std::size_t t = 0;
+            for (; t < T && ++path[t] == N; ++t) path[t] = 0;
+            if (t == T) break;
+        }
+
+        auto gamma = hmm.posteriors(obs);
+        bool ok = close(hmm.logLikelihood(obs), std::log(total)) && gamma.size() == T * N;
+        for (std::size_t i = 0; ok && i < T * N; ++i) ok = close(gamma[i], marginal[i] / total);
+        double logProb;
+        auto decoded = hmm.viterbi(obs, &logProb);
+        ok = ok && decoded == bestPath && close(logProb, std::log(best));
+        printf("forward-backward and viterbi against %u^%zu paths: %s\n", N, T,
+               ok ? "passed" : "FAILED");
+    }
+
+    // a symbol the model does not have is refused, not read out of bounds
+    {
+        auto hmm = stat::HMM::random(3, 4, 7);
+        stat::Sequence obs{0, 3, 4, 1};
+        double logProb = 0.0;
+        bool ok = std::isinf(hmm.logLikelihood(obs)) && hmm.posteriors(obs).empty() &&
+                  hmm.viterbi(obs, &logProb).empty() && std::isinf(logProb) &&
+                  hmm.viterbiBatch({obs})[0].empty();
+        printf("symbol out of range: %s\n", ok ? "passed" : "FAILED");
+    }
+
+    // scaling keeps the log-likelihood of a long sequence finite
+    {
+        auto hmm = stat::HMM::random(8, 16, 3);
+        auto data = stat::synthetic::makeSequences(hmm, 1, 200000, 1);
+        double ll = hmm.logLikelihood(std::get<0>(data)[0]);
+        bool ok = std::isfinite(ll) && ll < 0.0;
+        printf("log-likelihood of 200000 tokens = %f: %s\n", ll, ok ? "passed" : "FAILED");
+    }
+
+    // baum-welch reaches the likelihood of the generating model, batch viterbi matches viterbi and
+    // a saved model scores the same after loading
+    {
+        auto truth = stat::HMM::random(3, 6, 11);
+        auto data = stat::synthetic::makeSequences(truth, 200, 100, 2);
+        const auto &obs = std::get<0>(data);
+        double reference = 0.0;
+        for (const auto &seq : obs) reference += truth.logLikelihood(seq);
+        reference /= 200 * 100;
+
+        stat::HmmParam param;
+        param.states = 3;
+        param.maxIterations = 500;
+        param.tolerance = 1e-7;
+        stat::HMM hmm(param);
+        double ll = hmm.fit(obs);
+        bool ok = ll > reference - 0.01;
+        printf("baum-welch %u iterations, log-likelihood per token %f (generating model %f): %s\n",
+               hmm.iterations, ll, reference, ok ? "passed" : "FAILED");
+
+        auto paths = hmm.viterbiBatch(obs);
+        ok = paths.size() == obs.size();
+        for (std::size_t k = 0; ok && k < obs.size(); ++k) ok = paths[k] == hmm.viterbi(obs[k]);
+        printf("batch viterbi of %zu sequences: %s\n", obs.size(), ok ? "passed" : "FAILED");
+
+        stat::HMM loaded;
+        ok = hmm.save("out/sequence.model") && loaded.load("out/sequence.model");
+        for (std::size_t k = 0; ok && k < 10; ++k) {
+            ok = close(loaded.logLikelihood(obs[k]), hmm.logLikelihood(obs[k]));
+        }
+        printf("save/load round trip: %s\n", ok ? "passed" : "FAILED");
+    }
+
+    // crf log-likelihood, marginals and viterbi against the enumeration of every label path, and
+    // the gradient against finite differences
+    {
+        uint32_t L = 3, bits = 4;
+        std::size_t size = (1u << bits) * L + L * L + L;
+        std::mt19937 gen(5);
+        std::normal_distribution<double> normal(0.0, 1.0);
+        stat::Vec<double> w(size);
+        for (auto &v : w) v = normal(gen);
+        stat::CRF crf;
+        crf.assign(L, bits, w.data(), size);
+
+        stat::CrfSequence seq;
+        std::uniform_int_distribution<uint32_t> any;
+        for (uint32_t t = 0; t < 6; ++t) {
+            for (int k = 0; k < 3; ++k) seq.features.emplace_back(any(gen));
+            seq.endToken(t % L);
+        }
+        auto T = seq.size();
+        auto score = [&](const stat::Sequence &y) {
+            double s = w[(1u << bits) * L + L * L + y[0]];
+            for (std::size_t t = 0; t < T; ++t) {
+                for (auto k = seq.offsets[t]; k < seq.offsets[t + 1]; ++k) {
+                    s += w[(seq.features[k] & ((1u << bits) - 1)) * L + y[t]];
+                }
+                if (t > 0) s += w[(1u << bits) * L + y[t - 1] * L + y[t]];
+            }
+            return s;
+        };
+
+        double Z = 0.0, best = -stat::Inf<double>;
+        stat::Sequence bestPath;
+        stat::Vec<double> marginal(T * L, 0.0);
+        stat::Sequence path(T, 0);
+        for (;;) {
+            double s = score(path), p = std::exp(s);
+            Z += p;
+            for (std::size_t t = 0; t < T; ++t) marginal[t * L + path[t]] += p;
+            if (s > best) {
+                best = s;
+                bestPath = path;
+            }
+            std::size_t t = 0;
+            for (; t < T && ++path[t] == L; ++t) path[t] = 0;
+            if (t == T) break;
+        }
+
+        auto gamma = crf.marginals(seq);
+        bool ok = close(crf.logLikelihood(seq), score(seq.labels) - std::log(Z));
+        for (std::size_t i = 0; ok && i < T * L; ++i) ok = close(gamma[i], marginal[i] / Z);
+        double decodedScore;
+        auto decoded = crf.viterbi(seq, &decodedScore);
+        ok = ok && decoded == bestPath && close(decodedScore, best);
+
+        std::vector<stat::CrfSequence> data{seq};
+        stat::Vec<double> grad;
+        crf.objective(data, w, &grad);
+        for (std::size_t i = 0; ok && i < size; ++i) {
+            auto x = w;
+            x[i] += 1e-6;
+            double up = crf.objective(data, x, nullptr);
+            x[i] -= 2e-6;
+            double down = crf.objective(data, x, nullptr);
+            ok = std::abs((up - down) / 2e-6 - grad[i]) < 1e-5;
+        }
+        printf("crf forward-backward, viterbi and gradient against %u^%zu paths: %s\n", L, T,
+               ok ? "passed" : "FAILED");
+    }
+
+    // both crf solvers learn tags from neighbouring symbols, batch viterbi matches viterbi and a
+    // saved model decodes the same after loading
+    {
+        auto train = stat::synthetic::makeTaggedSequences(600, 30, 4, 12, 21);
+        std::vector<stat::CrfSequence> test(train.begin() + 500, train.end());
+        train.resize(500);
+        auto accuracy = [&](const stat::CRF &crf) {
+            std::size_t hits = 0, total = 0;
+            auto paths = crf.viterbiBatch(test);
+            for (std::size_t k = 0; k < test.size(); ++k) {
+                for (std::size_t t = 0; t < paths[k].size(); ++t) {
+                    hits += paths[k][t] == test[k].labels[t];
+                }
+                total += test[k].size();
+            }
+            return static_cast<double>(hits) / total;
+        };
+
+        stat::CrfParam param;
+        param.bits = 12;
+        stat::CRF lbfgs(param);
+        lbfgs.fit(train);
+        param.solver = stat::CrfParam::SGD;
+        stat::CRF sgd(param);
+        sgd.fit(train);
+        double a = accuracy(lbfgs), b = accuracy(sgd);
+        bool ok = a > 0.7 && b > 0.7 && std::abs(a - b) < 0.03;
+        printf("crf token accuracy l-bfgs %f, sgd %f: %s\n", a, b, ok ? "passed" : "FAILED");
+
+        auto paths = lbfgs.viterbiBatch(test);
+        ok = paths.size() == test.size();
+        for (std::size_t k = 0; ok && k < test.size(); ++k) ok = paths[k] == lbfgs.viterbi(test[k]);
+        printf("crf batch viterbi of %zu sequences: %s\n", test.size(), ok ? "passed" : "FAILED");
+
+        stat::CRF loaded;
+        ok = lbfgs.save("out/sequence.model") && loaded.load("out/sequence.model");
+        for (std::size_t k = 0; ok && k < test.size(); ++k) {
+            ok = loaded.viterbi(test[k]) == paths[k] &&
+                 close(loaded.logLikelihood(test[k]), lbfgs.logLikelihood(test[k]));
+        }
+        printf("crf save/load round trip: %s\n", ok ? "passed" : "FAILED");
+    }
+
+    EXIT;
+}